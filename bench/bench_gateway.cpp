@@ -0,0 +1,66 @@
+#include <benchmark/benchmark.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <sys/socket.h>
+#include <unistd.h>
+
+extern "C" {
+#include "util.h"
+#include "gateway.h"
+}
+
+// One flush of the fleet gateway: 1000 trucks have moved since the last
+// publish and the delta block goes to N loopback subscribers (socketpairs).
+// Draining the subscriber ends is not timed.
+
+namespace {
+
+void BM_GatewayPublish(benchmark::State &state) {
+    const int subs = (int)state.range(0), trucks = 1000;
+    raise_fd_limit((size_t)subs * 2 + 64);
+    Gateway *g = gw_create((size_t)trucks, 0);
+    std::vector<int> peers;
+    for (int i = 0; i < subs; ++i) {
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0 || gw_subscribe(g, sv[0]) < 0) {
+            state.SkipWithError("socketpair");
+            break;
+        }
+        peers.push_back(sv[1]);
+    }
+
+    static char sink[1 << 16];
+    double lat = 31.9;
+    for (auto _ : state) {
+        lat += 1e-5;
+        for (int i = 0; i < trucks; ++i) {
+            TruckInfo t{};
+            snprintf(t.id, sizeof(t.id), "T%d", i);
+            t.lat = lat;
+            t.lon = 35.9;
+            t.tcp_port = 7000 + i;
+            gw_heartbeat(g, &t);
+        }
+        benchmark::DoNotOptimize(gw_publish(g));
+
+        state.PauseTiming();
+        for (int fd : peers)
+            while (recv(fd, sink, sizeof(sink), MSG_DONTWAIT) > 0) {}
+        gw_service(g);
+        state.ResumeTiming();
+    }
+    GwStats st;
+    gw_stats(g, &st);
+    state.counters["MB_out"] = benchmark::Counter((double)st.bytes_sent / 1e6);
+    state.counters["resyncs"] = (double)st.resyncs;
+    state.SetItemsProcessed(state.iterations() * subs);
+
+    gw_destroy(g);
+    for (int fd : peers) close(fd);
+}
+
+}  // namespace
+
+BENCHMARK(BM_GatewayPublish)->Arg(1)->Arg(100)->Arg(1000)->Unit(benchmark::kMicrosecond);
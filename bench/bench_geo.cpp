@@ -0,0 +1,93 @@
+#include <benchmark/benchmark.h>
+
+#include <stdint.h>
+#include <random>
+#include <vector>
+
+extern "C" {
+#include "geo.h"
+#include "util.h"
+}
+
+// Distances from one user position to a fleet stored as lat/lon arrays:
+// haversine_km() per pair vs the batch kernels, and a radius query with and
+// without the equirectangular prefilter.
+
+namespace {
+
+const double USER_LAT = 31.956, USER_LON = 35.945;
+
+struct Fleet {
+    std::vector<double> lat, lon, km;
+    explicit Fleet(size_t n) : lat(n), lon(n), km(n) {
+        std::mt19937 rng(11);
+        std::uniform_real_distribution<double> dlat(31.7, 32.2), dlon(35.7, 36.2);
+        for (size_t i = 0; i < n; ++i) { lat[i] = dlat(rng); lon[i] = dlon(rng); }
+    }
+};
+
+void BM_HaversinePerPair(benchmark::State &state) {
+    Fleet f((size_t)state.range(0));
+    for (auto _ : state) {
+        for (size_t i = 0; i < f.lat.size(); ++i) f.km[i] = haversine_km(USER_LAT, USER_LON, f.lat[i], f.lon[i]);
+        benchmark::DoNotOptimize(f.km.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+void BM_HaversineBatchScalar(benchmark::State &state) {
+    Fleet f((size_t)state.range(0));
+    GeoOrigin o;
+    geo_origin_init(&o, USER_LAT, USER_LON);
+    for (auto _ : state) {
+        geo_haversine_batch_scalar(&o, f.lat.data(), f.lon.data(), f.lat.size(), f.km.data());
+        benchmark::DoNotOptimize(f.km.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+void BM_HaversineBatch(benchmark::State &state) {
+    Fleet f((size_t)state.range(0));
+    GeoOrigin o;
+    geo_origin_init(&o, USER_LAT, USER_LON);
+    for (auto _ : state) {
+        geo_haversine_batch(&o, f.lat.data(), f.lon.data(), f.lat.size(), f.km.data());
+        benchmark::DoNotOptimize(f.km.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    state.SetLabel(geo_kernel_name());
+}
+
+// 2 km radius: the operator's "nearby" check over the whole fleet
+void BM_RadiusExactOnly(benchmark::State &state) {
+    Fleet f((size_t)state.range(0));
+    std::vector<uint32_t> idx(f.lat.size());
+    for (auto _ : state) {
+        size_t k = 0;
+        for (size_t i = 0; i < f.lat.size(); ++i) {
+            if (haversine_km(USER_LAT, USER_LON, f.lat[i], f.lon[i]) <= 2.0) idx[k++] = (uint32_t)i;
+        }
+        benchmark::DoNotOptimize(k);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+void BM_RadiusPrefiltered(benchmark::State &state) {
+    Fleet f((size_t)state.range(0));
+    std::vector<uint32_t> idx(f.lat.size());
+    GeoOrigin o;
+    geo_origin_init(&o, USER_LAT, USER_LON);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(geo_within_radius(&o, f.lat.data(), f.lon.data(), f.lat.size(),
+                                                   2.0, idx.data(), NULL));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+} // namespace
+
+BENCHMARK(BM_HaversinePerPair)->Arg(1024)->Arg(65536);
+BENCHMARK(BM_HaversineBatchScalar)->Arg(1024)->Arg(65536);
+BENCHMARK(BM_HaversineBatch)->Arg(1024)->Arg(65536);
+BENCHMARK(BM_RadiusExactOnly)->Arg(65536);
+BENCHMARK(BM_RadiusPrefiltered)->Arg(65536);
@@ -0,0 +1,60 @@
+#include <benchmark/benchmark.h>
+
+#include <math.h>
+#include <stdlib.h>
+
+extern "C" {
+#include "gps.h"
+}
+
+// One random-walk step per iteration. The legacy step drew from libc
+// rand(), whose shared state is locked, so threads stepping their own
+// positions still contended; each GpsCtx owns its PRNG.
+
+namespace {
+
+double legacy_urand() { return (double)rand() / (double)RAND_MAX; }
+
+void legacy_step(double *lat, double *lon) {
+    double mlat = (legacy_urand() - 0.5) * 2.0 * 4.0;
+    double mlon = (legacy_urand() - 0.5) * 2.0 * 4.0;
+    *lat += mlat / 111320.0;
+    *lon += mlon / (111320.0 * cos(*lat * M_PI / 180.0));
+}
+
+void BM_StepLegacyRand(benchmark::State &state) {
+    double lat = 31.956, lon = 35.945;
+    for (auto _ : state) {
+        legacy_step(&lat, &lon);
+        benchmark::DoNotOptimize(lat);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_StepGpsCtx(benchmark::State &state) {
+    GpsCtx *g = gps_create(31.956, 35.945, 4.0, (uint64_t)state.thread_index() + 1);
+    for (auto _ : state) gps_advance(g, 0.3);
+    state.SetItemsProcessed(state.iterations());
+    gps_destroy(g);
+}
+
+// Readers of a position that another thread keeps moving
+GpsCtx *shared_gps;
+
+void BM_PositionSnapshot(benchmark::State &state) {
+    if (state.thread_index() == 0) shared_gps = gps_create(31.956, 35.945, 4.0, 1);
+    double lat, lon;
+    for (auto _ : state) {
+        if (state.thread_index() == 0) gps_advance(shared_gps, 0.3);
+        else gps_position(shared_gps, &lat, &lon);
+        benchmark::DoNotOptimize(lat);
+    }
+    state.SetItemsProcessed(state.iterations());
+    if (state.thread_index() == 0) gps_destroy(shared_gps);
+}
+
+}  // namespace
+
+BENCHMARK(BM_StepLegacyRand)->Threads(1)->Threads(4);
+BENCHMARK(BM_StepGpsCtx)->Threads(1)->Threads(4);
+BENCHMARK(BM_PositionSnapshot)->Threads(2)->Threads(4);
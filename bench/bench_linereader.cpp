@@ -0,0 +1,79 @@
+#include <benchmark/benchmark.h>
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+extern "C" {
+#include "common.h"
+#include "protocol.h"
+#include "util.h"
+}
+
+// PING lines read from a socket: byte-at-a-time recv_line_timeout(), which
+// waits and reads once per byte, vs the buffered LineReader, which also
+// reports the recv/poll calls it made per line.
+
+namespace {
+
+struct SocketPair {
+    int fds[2];
+    SocketPair() { socketpair(AF_UNIX, SOCK_STREAM, 0, fds); }
+    ~SocketPair() { close(fds[0]); close(fds[1]); }
+};
+
+// Builds `count` back-to-back PING lines, the way a pipelining client sends them
+std::string ping_lines(int count) {
+    PingMsg p{};
+    strcpy(p.truck_id, "TRK01");
+    strcpy(p.user_id, "USR1");
+    strcpy(p.addr, "12 Main St, Irbid");
+    strcpy(p.note, "2 cylinders please");
+
+    char line[MAX_LINE];
+    int n = format_ping(line, sizeof(line), &p);
+    std::string out;
+    for (int i = 0; i < count; ++i) out.append(line, (size_t)n);
+    return out;
+}
+
+void BM_RecvLineTimeout(benchmark::State &state) {
+    SocketPair sp;
+    const int batch = (int)state.range(0);
+    std::string data = ping_lines(batch);
+    char buf[MAX_LINE];
+
+    for (auto _ : state) {
+        send(sp.fds[0], data.data(), data.size(), 0);
+        for (int i = 0; i < batch; ++i) benchmark::DoNotOptimize(recv_line_timeout(sp.fds[1], buf, sizeof(buf), 1000));
+    }
+    state.SetItemsProcessed((int64_t)state.iterations() * batch);
+}
+
+void BM_LineReader(benchmark::State &state) {
+    SocketPair sp;
+    const int batch = (int)state.range(0);
+    std::string data = ping_lines(batch);
+    char buf[4 * MAX_LINE];
+    LineReader rd;
+    linereader_init(&rd, sp.fds[1], buf, sizeof(buf));
+
+    for (auto _ : state) {
+        send(sp.fds[0], data.data(), data.size(), 0);
+        for (int i = 0; i < batch; ++i) {
+            const char *line;
+            size_t len;
+            linereader_next(&rd, &line, &len, 1000);
+            benchmark::DoNotOptimize(line);
+        }
+    }
+    double msgs = (double)state.iterations() * batch;
+    state.SetItemsProcessed((int64_t)msgs);
+    state.counters["syscalls_per_msg"] = (double)rd.nsyscalls / msgs;
+}
+
+} // namespace
+
+// 1 = one PING per connection turn, 16 = pipelined burst
+BENCHMARK(BM_RecvLineTimeout)->Arg(1)->Arg(16);
+BENCHMARK(BM_LineReader)->Arg(1)->Arg(16);
@@ -0,0 +1,109 @@
+#include <benchmark/benchmark.h>
+
+#include <glob.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+
+extern "C" {
+#include "common.h"
+#include "logger.h"
+#include "journal.h"
+}
+
+// Cost of logger_log_ping() as seen by PING handlers: the synchronous
+// logger (a one-record journal block per call) vs the async ring. Multiple
+// threads stand in for the truck's server workers. BM_JournalAppend is the
+// writer side: appending pings to the journal with and without block
+// compression, and the bytes each record takes on disk.
+
+namespace {
+
+const char *LOG_PATH = "/tmp/jarat_bench_log";
+
+void remove_segments(const char *prefix) {
+    glob_t g;
+    if (glob((std::string(prefix) + "-*.jrnl").c_str(), 0, nullptr, &g) == 0) {
+        for (size_t i = 0; i < g.gl_pathc; ++i) unlink(g.gl_pathv[i]);
+    }
+    globfree(&g);
+}
+
+PingMsg bench_ping() {
+    PingMsg p{};
+    strcpy(p.truck_id, "TRK01");
+    strcpy(p.user_id, "USR1");
+    strcpy(p.note, "2 cylinders please");
+    return p;
+}
+
+void BM_LogPingSync(benchmark::State &state) {
+    if (state.thread_index() == 0) logger_open(LOG_PATH);
+    PingMsg p = bench_ping();
+    for (auto _ : state) logger_log_ping(1700000000, &p, 31.956, 35.945);
+    state.SetItemsProcessed(state.iterations());
+    if (state.thread_index() == 0) {
+        logger_close();
+        remove_segments(LOG_PATH);
+    }
+}
+
+void BM_LogPingAsync(benchmark::State &state) {
+    if (state.thread_index() == 0) logger_open_async(LOG_PATH, 0, 200, LOG_FLUSH_INTERVAL);
+    PingMsg p = bench_ping();
+    for (auto _ : state) logger_log_ping(1700000000, &p, 31.956, 35.945);
+    state.SetItemsProcessed(state.iterations());
+    if (state.thread_index() == 0) {
+        // Producers outrunning the writer is expected here; report how often
+        state.counters["dropped"] = (double)logger_dropped();
+        logger_close();
+        remove_segments(LOG_PATH);
+    }
+}
+
+void BM_JournalAppend(benchmark::State &state) {
+    JournalOpts o{};
+    o.compress = (int)state.range(0);
+    Journal *j = journal_open(LOG_PATH, &o);
+    if (!j) {
+        state.SkipWithError("journal_open");
+        return;
+    }
+    JournalRec r{};
+    r.type = JREC_PING;
+    r.lon = 35.945;
+    strcpy(r.note, "2 cylinders please");
+    int64_t n = 0;
+    for (auto _ : state) {
+        r.ts = 1700000000 + n / 100;    // about 100 pings a second
+        r.lat = 31.956 + (double)(n % 977) * 1e-5;
+        snprintf(r.truck_id, sizeof(r.truck_id), "TRK%02d", (int)(n % 50));
+        snprintf(r.user_id, sizeof(r.user_id), "USR%d", (int)(n % 5000));
+        journal_append(j, &r);
+        n++;
+    }
+    journal_close(j);
+
+    glob_t g;
+    off_t bytes = 0;
+    if (glob((std::string(LOG_PATH) + "-*.jrnl").c_str(), 0, nullptr, &g) == 0) {
+        for (size_t i = 0; i < g.gl_pathc; ++i) {
+            FILE *f = fopen(g.gl_pathv[i], "rb");
+            if (!f) continue;
+            fseeko(f, 0, SEEK_END);
+            bytes += ftello(f);
+            fclose(f);
+        }
+    }
+    globfree(&g);
+    remove_segments(LOG_PATH);
+    state.counters["bytes/record"] = (double)bytes / (double)n;
+    state.SetItemsProcessed(n);
+}
+
+} // namespace
+
+BENCHMARK(BM_LogPingSync)->Threads(1)->Threads(4)->UseRealTime();
+BENCHMARK(BM_LogPingAsync)->Threads(1)->Threads(4)->UseRealTime();
+BENCHMARK(BM_JournalAppend)->Arg(0)->Arg(1);
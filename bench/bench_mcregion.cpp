@@ -0,0 +1,98 @@
+#include <benchmark/benchmark.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <cmath>
+#include <random>
+#include <vector>
+#include <unistd.h>
+
+extern "C" {
+#include "common.h"
+#include "net.h"
+#include "protocol.h"
+#include "registry.h"
+#include "mcrecv.h"
+#include "mcregion.h"
+#include "util.h"
+}
+
+// Receive side of one heartbeat round over loopback multicast: 2000 trucks
+// scattered over 10 km each send one heartbeat, and a client interested in
+// 2 km around the center drains its socket into a registry. Arg is the tile
+// size in km (0 = everyone on MC_GROUP). Sending is not timed.
+
+namespace {
+
+const int kTrucks = 2000;
+const uint16_t kPort = 15998;
+const double kLat = 31.956, kLon = 35.945;
+
+void BM_McRecvArea(benchmark::State &state) {
+    double tile_km = (double)state.range(0);
+    int tx = -1, rx = -1;
+    struct sockaddr_in dst;
+    if (udp_mc_sender(MC_GROUP, kPort, &tx, &dst) < 0 || udp_mc_bind(kPort, &rx) < 0) {
+        state.SkipWithError("socket");
+        return;
+    }
+    udp_set_rcvbuf(rx, 16 << 20);
+    mcbatch_watch_drops(rx);
+    set_nonblocking(rx);
+    McRegionSub sub;
+    mcregion_sub_init(&sub, rx, tile_km);
+    int groups = mcregion_follow(&sub, kLat, kLon, 2.0);
+    if (groups < 0) {
+        state.SkipWithError("join");
+        return;
+    }
+
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<double> u(0.0, 1.0);
+    std::vector<std::vector<char>> msgs(kTrucks);
+    std::vector<struct sockaddr_in> to(kTrucks, dst);
+    for (int i = 0; i < kTrucks; ++i) {
+        double r = 10.0 * std::sqrt(u(rng)), a = 2.0 * M_PI * u(rng);
+        double lat = kLat + r * std::sin(a) / 111.32;
+        double lon = kLon + r * std::cos(a) / (111.32 * std::cos(kLat * M_PI / 180.0));
+        char id[MAX_ID_LEN];
+        snprintf(id, sizeof(id), "SIM%05d", i);
+        msgs[i].resize(MAX_LINE);
+        msgs[i].resize((size_t)format_hb(msgs[i].data(), MAX_LINE, id, lat, lon, 7000 + i, 0));
+        to[i].sin_addr = mcregion_group(tile_km, lat, lon);
+    }
+
+    McBatch *mb = mcbatch_create(64);
+    Registry *reg = registry_create(kTrucks);
+    std::vector<TruckInfo> parsed(HB_BATCH_MAX_RECORDS);
+    uint64_t got = 0;
+    for (auto _ : state) {
+        state.PauseTiming();
+        for (int i = 0; i < kTrucks; ++i)
+            sendto(tx, msgs[i].data(), msgs[i].size(), 0, (struct sockaddr *)&to[i], sizeof(to[i]));
+        state.ResumeTiming();
+
+        int n;
+        while ((n = mcbatch_recv(mb, rx)) > 0) {
+            for (int i = 0; i < n; ++i) {
+                size_t len;
+                const char *d = mcbatch_data(mb, i, &len, NULL);
+                int k = proto_parse_hb_datagram(d, len, parsed.data(), parsed.size());
+                for (int j = 0; j < k; ++j) registry_upsert(reg, &parsed[j]);
+                got += (uint64_t)(k > 0 ? k : 0);
+            }
+        }
+    }
+    state.counters["groups"] = groups;
+    state.counters["rx_per_round"] = (double)got / (double)state.iterations();
+    state.counters["kernel_drops"] = (double)mcbatch_stats(mb)->drops;
+
+    registry_destroy(reg);
+    mcbatch_destroy(mb);
+    close(tx);
+    close(rx);
+}
+
+}  // namespace
+
+BENCHMARK(BM_McRecvArea)->Arg(0)->Arg(2)->Arg(5)->Unit(benchmark::kMicrosecond);
@@ -0,0 +1,41 @@
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <stdint.h>
+
+extern "C" {
+#include "metrics.h"
+}
+
+// Counting one event from several PING workers: a single shared atomic
+// counter (every increment fights over one cache line) vs the per-thread
+// shards behind metrics_inc(). Observe adds a histogram bucket update.
+
+namespace {
+
+std::atomic<uint64_t> shared_counter{0};
+
+void BM_SharedAtomicInc(benchmark::State &state) {
+    for (auto _ : state) shared_counter.fetch_add(1, std::memory_order_relaxed);
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_MetricsInc(benchmark::State &state) {
+    for (auto _ : state) metrics_inc(MC_PINGS);
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_MetricsObserve(benchmark::State &state) {
+    uint64_t ns = 400;
+    for (auto _ : state) {
+        metrics_observe_ns(MH_PARSE, ns);
+        ns = ns * 7 % 100003;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+}  // namespace
+
+BENCHMARK(BM_SharedAtomicInc)->Threads(1)->Threads(4);
+BENCHMARK(BM_MetricsInc)->Threads(1)->Threads(4);
+BENCHMARK(BM_MetricsObserve)->Threads(1)->Threads(4);
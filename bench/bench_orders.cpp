@@ -0,0 +1,63 @@
+#include <benchmark/benchmark.h>
+
+#include <stdio.h>
+#include <random>
+
+extern "C" {
+#include "common.h"
+#include "orders.h"
+}
+
+// What a PING costs the truck's order queue with N orders already pending:
+// place a new order (insert + ETA quote) and later remove it again, so the
+// queue size stays at N.
+
+namespace {
+
+void BM_OrderPlaceComplete(benchmark::State &state) {
+    const int pending = (int)state.range(0);
+    OrderQueue *q = orders_create(30.0, 5.0, (size_t)pending + 16);
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<double> dlat(31.7, 32.2), dlon(35.7, 36.2);
+    char user[MAX_ID_LEN];
+    OrderQuote oq;
+    for (int i = 0; i < pending; ++i) {
+        snprintf(user, sizeof(user), "P%d", i);
+        orders_place(q, user, dlat(rng), dlon(rng), 31.95, 35.94, 0, &oq);
+    }
+
+    unsigned n = 0;
+    for (auto _ : state) {
+        snprintf(user, sizeof(user), "N%u", n++);
+        orders_place(q, user, dlat(rng), dlon(rng), 31.95, 35.94, 0, &oq);
+        benchmark::DoNotOptimize(oq.eta_min);
+        // Remove it again (a cancel at the end of the route)
+        orders_complete(q, oq.job);
+    }
+    state.SetItemsProcessed(state.iterations());
+    orders_destroy(q);
+}
+
+void BM_OrderQuote(benchmark::State &state) {
+    const int pending = (int)state.range(0);
+    OrderQueue *q = orders_create(30.0, 5.0, (size_t)pending);
+    char user[MAX_ID_LEN];
+    OrderQuote oq;
+    for (int i = 0; i < pending; ++i) {
+        snprintf(user, sizeof(user), "P%d", i);
+        orders_place(q, user, 31.9 + i * 1e-5, 35.9, 31.95, 35.94, 0, &oq);
+    }
+    uint32_t job = 1;
+    for (auto _ : state) {
+        orders_quote(q, job, 31.95, 35.94, &oq);
+        benchmark::DoNotOptimize(oq.eta_min);
+        job = job % (uint32_t)pending + 1;
+    }
+    state.SetItemsProcessed(state.iterations());
+    orders_destroy(q);
+}
+
+} // namespace
+
+BENCHMARK(BM_OrderPlaceComplete)->Arg(10)->Arg(100)->Arg(1000)->Arg(10000);
+BENCHMARK(BM_OrderQuote)->Arg(10)->Arg(100)->Arg(1000)->Arg(10000);
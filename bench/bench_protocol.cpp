@@ -0,0 +1,79 @@
+#include <benchmark/benchmark.h>
+
+#include <string.h>
+
+extern "C" {
+#include "common.h"
+#include "protocol.h"
+#include "protocol_legacy.h"
+}
+
+// Messages/sec for each message type: single-pass tokenizer (proto_parse_*)
+// vs the previous strncmp/sscanf parsers.
+
+namespace {
+
+const char HB_LINE[] = "HB truck_id=TRK01 lat=31.956123 lon=35.945678 ts=1760000000 tcp=6012\n";
+const char PING_LINE[] = "PING truck_id=TRK01 user_id=USR1 addr=\"12 Main St, Irbid\" note=\"2 cylinders\" ka=1\n";
+const char ACK_LINE[] = "ACK truck_id=TRK01 eta_min=7 queued=3\n";
+
+void BM_ParseHb(benchmark::State &state) {
+    TruckInfo t;
+    time_t ts;
+    for (auto _ : state) benchmark::DoNotOptimize(proto_parse_hb(HB_LINE, sizeof(HB_LINE) - 1, &t, &ts));
+    state.SetItemsProcessed(state.iterations());
+    state.counters["bytes_per_msg"] = sizeof(HB_LINE) - 1;
+}
+
+void BM_ParseHbLegacy(benchmark::State &state) {
+    TruckInfo t;
+    time_t ts;
+    for (auto _ : state) benchmark::DoNotOptimize(legacy_parse_hb(HB_LINE, &t, &ts));
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_ParseHbBinary(benchmark::State &state) {
+    uint8_t buf[HB_BIN_MAX_LEN];
+    int n = format_hb_bin(buf, sizeof(buf), "TRK01", 31.956123, 35.945678, 6012, 1760000000, 1);
+    TruckInfo t;
+    time_t ts;
+    for (auto _ : state) benchmark::DoNotOptimize(proto_parse_hb_any(buf, (size_t)n, &t, &ts));
+    state.SetItemsProcessed(state.iterations());
+    state.counters["bytes_per_msg"] = n;
+}
+
+void BM_ParsePing(benchmark::State &state) {
+    PingMsg p;
+    for (auto _ : state) benchmark::DoNotOptimize(proto_parse_ping(PING_LINE, sizeof(PING_LINE) - 1, &p));
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_ParsePingLegacy(benchmark::State &state) {
+    PingMsg p;
+    for (auto _ : state) benchmark::DoNotOptimize(legacy_parse_ping(PING_LINE, &p));
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_ParseAck(benchmark::State &state) {
+    char id[MAX_ID_LEN];
+    int eta, q;
+    for (auto _ : state) benchmark::DoNotOptimize(proto_parse_ack(ACK_LINE, sizeof(ACK_LINE) - 1, id, &eta, &q));
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_ParseAckLegacy(benchmark::State &state) {
+    char id[MAX_ID_LEN];
+    int eta, q;
+    for (auto _ : state) benchmark::DoNotOptimize(legacy_parse_ack(ACK_LINE, id, &eta, &q));
+    state.SetItemsProcessed(state.iterations());
+}
+
+} // namespace
+
+BENCHMARK(BM_ParseHb);
+BENCHMARK(BM_ParseHbLegacy);
+BENCHMARK(BM_ParseHbBinary);
+BENCHMARK(BM_ParsePing);
+BENCHMARK(BM_ParsePingLegacy);
+BENCHMARK(BM_ParseAck);
+BENCHMARK(BM_ParseAckLegacy);
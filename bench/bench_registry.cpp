@@ -0,0 +1,216 @@
+#include <benchmark/benchmark.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <random>
+#include <vector>
+
+extern "C" {
+#include "common.h"
+#include "registry.h"
+#include "util.h"
+}
+
+// Heartbeat upsert cost with N trucks already known: the client's old
+// linear strncmp scan vs the hash-indexed registry.
+
+namespace {
+
+std::vector<TruckInfo> make_fleet(size_t n) {
+    std::vector<TruckInfo> v(n);
+    for (size_t i = 0; i < n; ++i) {
+        memset(&v[i], 0, sizeof(TruckInfo));
+        snprintf(v[i].id, sizeof(v[i].id), "TRK%06u", (unsigned)(i % 1000000));
+        v[i].lat = 31.9 + (double)i * 1e-6;
+        v[i].lon = 35.9;
+        v[i].tcp_port = 6000;
+        v[i].last_seen = 1000;
+    }
+    return v;
+}
+
+// The upsert that client.c used before the registry
+void linear_upsert(std::vector<TruckInfo> &trucks, const TruckInfo *ti) {
+    for (auto &t : trucks) {
+        if (strncmp(t.id, ti->id, MAX_ID_LEN) == 0) { t = *ti; return; }
+    }
+    trucks.push_back(*ti);
+}
+
+void BM_UpsertLinear(benchmark::State &state) {
+    std::vector<TruckInfo> fleet = make_fleet((size_t)state.range(0));
+    std::vector<TruckInfo> trucks;
+    for (auto &t : fleet) linear_upsert(trucks, &t);
+
+    size_t i = 0;
+    for (auto _ : state) {
+        linear_upsert(trucks, &fleet[i]);
+        i = (i + 7919) % fleet.size();  // spread over the whole fleet
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_UpsertRegistry(benchmark::State &state) {
+    std::vector<TruckInfo> fleet = make_fleet((size_t)state.range(0));
+    Registry *reg = registry_create(0);
+    for (auto &t : fleet) registry_upsert(reg, &t);
+
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(registry_upsert(reg, &fleet[i]));
+        i = (i + 7919) % fleet.size();  // spread over the whole fleet
+    }
+    state.SetItemsProcessed(state.iterations());
+    registry_destroy(reg);
+}
+
+// One second of a fleet at 1 Hz followed by the client's periodic prune
+void BM_RegistryHeartbeatRound(benchmark::State &state) {
+    std::vector<TruckInfo> fleet = make_fleet((size_t)state.range(0));
+    Registry *reg = registry_create(0);
+    time_t now = 1000;
+
+    for (auto _ : state) {
+        for (auto &t : fleet) {
+            t.last_seen = now;
+            registry_upsert(reg, &t);
+        }
+        benchmark::DoNotOptimize(registry_expire(reg, now, DROP_AGE_SEC));
+        now++;
+    }
+    state.SetItemsProcessed(state.iterations() * (int64_t)fleet.size());
+    registry_destroy(reg);
+}
+
+// Time trucks_mu is held for the client's once-a-second prune of a large
+// fleet where 1% of the trucks stopped reporting: the old compaction of the
+// whole array vs the registry's expiry wheel. The heartbeats in between are
+// not timed.
+void BM_PruneArrayScan(benchmark::State &state) {
+    std::vector<TruckInfo> fleet = make_fleet((size_t)state.range(0));
+    std::vector<TruckInfo> trucks;
+    time_t now = 1000;
+    size_t quiet = 0;   // first truck of the 1% block that goes quiet this round
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        trucks.clear();
+        for (size_t i = 0; i < fleet.size(); ++i) {
+            fleet[i].last_seen = i - quiet < fleet.size() / 100 ? now - DROP_AGE_SEC - 1 : now;
+            trucks.push_back(fleet[i]);
+        }
+        state.ResumeTiming();
+
+        // prune_stale() before the registry
+        size_t w = 0;
+        for (size_t r = 0; r < trucks.size(); ++r) {
+            if (now - trucks[r].last_seen <= DROP_AGE_SEC) {
+                if (w != r) trucks[w] = trucks[r];
+                ++w;
+            }
+        }
+        trucks.resize(w);
+        benchmark::DoNotOptimize(trucks.data());
+
+        quiet = (quiet + fleet.size() / 100) % fleet.size();
+        now++;
+    }
+}
+
+void BM_PruneWheel(benchmark::State &state) {
+    std::vector<TruckInfo> fleet = make_fleet((size_t)state.range(0));
+    Registry *reg = registry_create(fleet.size());
+    time_t now = 1000;
+    size_t quiet = 0;
+    size_t expired = 0;
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        for (size_t i = 0; i < fleet.size(); ++i) {
+            fleet[i].last_seen = i - quiet < fleet.size() / 100 ? now - DROP_AGE_SEC - 1 : now;
+            registry_upsert(reg, &fleet[i]);
+        }
+        state.ResumeTiming();
+
+        expired += registry_expire(reg, now, DROP_AGE_SEC);
+
+        quiet = (quiet + fleet.size() / 100) % fleet.size();
+        now++;
+    }
+    state.counters["expired/round"] = (double)expired / (double)state.iterations();
+    registry_destroy(reg);
+}
+
+// A refresh of the client's list: every truck's distance plus a full qsort
+// (the old list_loop) vs a grid search for the 10 nearest. Trucks are spread
+// over a 0.5 x 0.5 degree box, roughly a metro area.
+struct Row {
+    double dist;
+    TruckInfo t;
+};
+
+int cmp_row(const void *a, const void *b) {
+    double da = ((const Row *)a)->dist, db = ((const Row *)b)->dist;
+    return (da > db) - (da < db);
+}
+
+Registry *make_city(size_t n) {
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<double> dlat(31.7, 32.2), dlon(35.7, 36.2);
+    std::vector<TruckInfo> fleet = make_fleet(n);
+    Registry *reg = registry_create(n);
+    for (auto &t : fleet) {
+        t.lat = dlat(rng);
+        t.lon = dlon(rng);
+        registry_upsert(reg, &t);
+    }
+    return reg;
+}
+
+void BM_ListFullSort(benchmark::State &state) {
+    Registry *reg = make_city((size_t)state.range(0));
+    std::vector<Row> rows(registry_count(reg));
+    for (auto _ : state) {
+        size_t k = 0;
+        for (size_t s = 0; s < registry_slots(reg); ++s) {
+            const TruckInfo *t = registry_get(reg, (int)s);
+            if (!t) continue;
+            rows[k].t = *t;
+            rows[k].dist = haversine_km(31.956, 35.945, t->lat, t->lon);
+            k++;
+        }
+        qsort(rows.data(), k, sizeof(Row), cmp_row);
+        benchmark::DoNotOptimize(rows.data());
+    }
+    registry_destroy(reg);
+}
+
+void BM_ListNearestK(benchmark::State &state) {
+    Registry *reg = make_city((size_t)state.range(0));
+    RegHit hits[10];
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(registry_nearest_k(reg, 31.956, 35.945, 10, hits));
+    }
+    registry_destroy(reg);
+}
+
+void BM_WithinRadius(benchmark::State &state) {
+    Registry *reg = make_city((size_t)state.range(0));
+    RegHit hits[64];
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(registry_within_radius(reg, 31.956, 35.945, 0.5, hits, 64));
+    }
+    registry_destroy(reg);
+}
+
+} // namespace
+
+BENCHMARK(BM_UpsertLinear)->Arg(1000)->Arg(10000)->Arg(100000);
+BENCHMARK(BM_UpsertRegistry)->Arg(1000)->Arg(10000)->Arg(100000);
+BENCHMARK(BM_RegistryHeartbeatRound)->Arg(1000)->Arg(10000)->Arg(100000);
+BENCHMARK(BM_PruneArrayScan)->Arg(10000)->Arg(100000)->Arg(1000000)->Iterations(30)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_PruneWheel)->Arg(10000)->Arg(100000)->Arg(1000000)->Iterations(30)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_ListFullSort)->Arg(1000)->Arg(10000)->Arg(100000);
+BENCHMARK(BM_ListNearestK)->Arg(1000)->Arg(10000)->Arg(100000);
+BENCHMARK(BM_WithinRadius)->Arg(1000)->Arg(10000)->Arg(100000);
@@ -0,0 +1,7 @@
+#pragma once
+#include <time.h>
+#include "common.h"
+
+int legacy_parse_hb(const char *line, TruckInfo *out, time_t *ts);
+int legacy_parse_ping(const char *line, PingMsg *out);
+int legacy_parse_ack(const char *line, char *id, int *eta_min, int *queued);
@@ -3,6 +3,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 #include <pthread.h>
 #include <unistd.h>
 #include <arpa/inet.h>
@@ -14,71 +15,85 @@
 #include "net.h"
 #include "protocol.h"
 #include "util.h"
+#include "pingclient.h"
+#include "registry.h"
+#include "mcrecv.h"
+#include "geo.h"
+#include "truckcache.h"
+#include "scheduler.h"
+#include "mcregion.h"
 
 static double u_lat = 31.956;
 static double u_lon = 35.945;
 static double near_km = 0.5;
+static int top_k = 0;       // list only the K nearest trucks, 0 = all
+static int drop_age = DROP_AGE_SEC;  // seconds without a heartbeat before a truck is dropped
 
 static char want_truck[MAX_ID_LEN] = "";
 static char user_id[MAX_ID_LEN] = "USR1";
 static char addr[128] = "";
 static char note[64] = "";
+static int ping_count = 1;  // PINGs to send in ping mode
+static int ping_depth = 1;  // PINGs in flight at once on the connection
+static int best_k = 0;      // --best: ping the K nearest trucks at once, keep the lowest ETA
+static int accept_eta = -1; // --best: stop at the first ETA at or below this (minutes)
+static int deadline_ms = 2000;
 
 static int mc_fd = -1;
+static int mc_rcvbuf = 0;   // SO_RCVBUF request in bytes, 0 = system default
+static int mc_show_stats = 0;
+static double mc_tile_km = 0;       // --mc-tile-km: join only the map tiles around the user; 0 = MC_GROUP
+static double mc_radius_km = 5.0;   // --mc-radius-km: area of interest around u_lat/u_lon
+static McRegionSub mc_region;       // list thread only, after setup
+#define MC_BATCH 64         // datagrams per recvmmsg call
+static struct in_addr gw_ip;  // --gateway: fleet comes from a fleet_gateway instead of multicast
+static int gw_port = 0;
+#define GW_RECONNECT_MS 1000
 static pthread_mutex_t trucks_mu = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t want_seen = PTHREAD_COND_INITIALIZER;  // want_truck's heartbeat arrived
 
-static TruckInfo *trucks = NULL;
-static size_t trucks_count = 0;
-static size_t trucks_cap = 0;
+static TruckCache *tcache = NULL;   // last-known trucks shared with later runs
+static int use_cache = 1;
+static char cache_path[256] = "";
+static int cache_max_age = 300;     // seconds a cached truck is trusted without a heartbeat
+#define CACHE_RECORDS 4096
+#define CACHE_CONNECT_MS 500
+#define HB_WAIT_MS (2 * HB_INTERVAL_MS)  // ping mode: wait this long for an unknown truck
+
+static Registry *trucks = NULL;  // guarded by trucks_mu
+static McStats mc_stats;         // copy of the receiver's counters, guarded by trucks_mu
+static uint64_t mc_bad = 0;      // datagrams that were not heartbeats, guarded by trucks_mu
+static double reckon_km = 0;     // farthest any heartbeat so far can be extrapolated, guarded by trucks_mu
 
 static long now_s(void) { return now_sec(); }
 
-static void upsert_truck(const TruckInfo *ti) {
-    pthread_mutex_lock(&trucks_mu);
+static long mono_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
 
-    // look for existing
-    for (size_t i = 0; i < trucks_count; ++i) {
-        if (strncmp(trucks[i].id, ti->id, MAX_ID_LEN) == 0) {
-            trucks[i] = *ti;
-            pthread_mutex_unlock(&trucks_mu);
-            return;
-        }
-    }
+// Nearby alerts and offline notices printed per refresh; the rest are summarized
+#define MAX_ALERTS 16
 
-    // grow array if needed
-    if (trucks_count == trucks_cap) {
-        size_t new_cap = (trucks_cap == 0) ? 4 : trucks_cap * 2;
-        TruckInfo *tmp = realloc(trucks, new_cap * sizeof(TruckInfo));
-        if (!tmp) {
-            fprintf(stderr, "Error: Reallocation failed in upsert_truck.\n");
-            pthread_mutex_unlock(&trucks_mu);
-            return;
-        }
-        trucks = tmp;
-        trucks_cap = new_cap;
-    }
+// Trucks dropped since the last list refresh, guarded by trucks_mu
+static char dropped_id[MAX_ALERTS][MAX_ID_LEN];
+static size_t n_dropped = 0;
 
-    trucks[trucks_count++] = *ti;
-    pthread_mutex_unlock(&trucks_mu);
+static void on_drop(void *ctx, int slot, const TruckInfo *ti) {
+    (void)ctx;
+    (void)slot;
+    if (n_dropped < MAX_ALERTS) memcpy(dropped_id[n_dropped], ti->id, MAX_ID_LEN);
+    n_dropped++;
 }
 
 static void prune_stale(void) {
-    long now = now_s();
-    size_t w = 0;
-    for (size_t r = 0; r < trucks_count; ++r) {
-        if ((now - trucks[r].last_seen) <= DROP_AGE_SEC) {
-            if (w != r) {
-                trucks[w] = trucks[r];
-            }
-            ++w;
-        }
-    }
-    trucks_count = w;
+    registry_expire_fn(trucks, now_s(), drop_age, on_drop, NULL);
 }
 
 struct Row {
     double dist;
-    TruckInfo *t;
+    TruckInfo t;  // copied so the lock can be dropped before printing
 };
 
 static int cmp_row(const void *a, const void *b) {
@@ -91,153 +106,526 @@ static int cmp_row(const void *a, const void *b) {
 
 static void *th_mc(void *arg) {
     (void)arg;
-    char buf[MAX_LINE];
+    McBatch *mb = mcbatch_create(MC_BATCH);
+    if (!mb) {
+        perror("mcbatch_create");
+        return NULL;
+    }
+    // Room for every truck of a full recvmmsg batch of batched heartbeats
+    size_t cap = (size_t)MC_BATCH * HB_BATCH_MAX_RECORDS;
+    TruckInfo *parsed = malloc(cap * sizeof(*parsed));
+    if (!parsed) {
+        perror("malloc");
+        mcbatch_destroy(mb);
+        return NULL;
+    }
 
     while (1) {
-        struct sockaddr_in src;
-        socklen_t sl = sizeof(src);
-        ssize_t n = recvfrom(mc_fd, buf, sizeof(buf) - 1, 0,
-                             (struct sockaddr *)&src, &sl);
-        if (n <= 0) {
+        int n = mcbatch_recv(mb, mc_fd);
+        if (n < 0) {
+            perror("recvmmsg");
             usleep(20 * 1000);
             continue;
         }
-        buf[n] = '\0';
-
-        TruckInfo ti;
-        memset(&ti, 0, sizeof(ti));
-        time_t ts = 0;
-        if (parse_hb(buf, &ti, &ts)) {
-            ti.last_seen = now_s();
-            ti.last_ip = src.sin_addr;
-            upsert_truck(&ti);
+
+        // Parse the whole batch before taking the lock
+        struct timespec ts_now;
+        clock_gettime(CLOCK_REALTIME, &ts_now);
+        double seen_at = (double)ts_now.tv_sec + ts_now.tv_nsec / 1e9;
+        long now = (long)ts_now.tv_sec;
+        size_t k = 0;
+        int bad = 0;
+        for (int i = 0; i < n; ++i) {
+            size_t len;
+            struct sockaddr_in src;
+            const char *buf = mcbatch_data(mb, i, &len, &src);
+            // Text, binary and batched heartbeats can be mixed on the same group
+            int got = proto_parse_hb_datagram(buf, len, &parsed[k], cap - k);
+            if (got <= 0) {
+                bad++;
+                continue;
+            }
+            for (size_t j = k; j < k + (size_t)got; ++j) {
+                parsed[j].last_seen = now;
+                parsed[j].seen_at = seen_at;
+                parsed[j].last_ip = src.sin_addr;
+            }
+            k += (size_t)got;
         }
-    }
-    return NULL;
-}
 
-static void list_loop(void) {
-    while (1) {
         pthread_mutex_lock(&trucks_mu);
-        prune_stale();
-
-        size_t n = trucks_count;
-        struct Row *rows = NULL;
-        
-        if (n > 0) {
-            rows = (struct Row *)malloc(n * sizeof(struct Row));
-            if (!rows) {
-                // BUG FIX: Handle malloc failure
-                pthread_mutex_unlock(&trucks_mu);
-                perror("malloc failed in list_loop");
-                sleep(1);
-                continue;
+        for (size_t i = 0; i < k; ++i) {
+            if (registry_upsert(trucks, &parsed[i]) < 0) {
+                fprintf(stderr, "Error: allocation failed in upsert_truck.\n");
+                break;
+            }
+            if (want_truck[0] && !strcmp(parsed[i].id, want_truck)) pthread_cond_broadcast(&want_seen);
+            if (parsed[i].keepalive_s > 0) {
+                double r = hypot(parsed[i].vn, parsed[i].ve) * parsed[i].keepalive_s / 1000.0;
+                if (r > reckon_km) reckon_km = r;
             }
         }
+        mc_stats = *mcbatch_stats(mb);
+        mc_bad += (uint64_t)bad;
+        pthread_mutex_unlock(&trucks_mu);
 
-        for (size_t i = 0; i < n; ++i) {
-            rows[i].t = &trucks[i];
-            // Assuming haversine_km is defined and works
-            rows[i].dist = haversine_km(u_lat, u_lon,
-                                         trucks[i].lat, trucks[i].lon);
+        if (tcache) {
+            for (size_t i = 0; i < k; ++i) truckcache_put(tcache, &parsed[i]);
         }
+    }
+    free(parsed);
+    return NULL;
+}
 
-        pthread_mutex_unlock(&trucks_mu);
+// Applies one gateway stream line to the registry. Caller holds trucks_mu.
+static void gw_apply(const GwMsg *m, long now) {
+    TruckInfo t;
+    int slot;
+    Registry *fresh;
+    switch (m->op) {
+    case GW_SNAP:
+        fresh = registry_create(m->count ? m->count : 256);
+        if (!fresh) break;
+        registry_destroy(trucks);
+        trucks = fresh;
+        break;
+    case GW_ADD:
+        t = m->t;
+        t.last_seen = now;
+        registry_upsert(trucks, &t);
+        if (tcache) truckcache_put(tcache, &t);
+        if (want_truck[0] && !strcmp(t.id, want_truck)) pthread_cond_broadcast(&want_seen);
+        break;
+    case GW_MOV:
+        slot = registry_find(trucks, m->t.id);
+        if (slot < 0) break;
+        t = *registry_get(trucks, slot);
+        t.lat = m->t.lat;
+        t.lon = m->t.lon;
+        t.last_seen = now;
+        registry_upsert(trucks, &t);
+        if (tcache) truckcache_put(tcache, &t);
+        break;
+    case GW_DEL:
+        slot = registry_find(trucks, m->t.id);
+        if (slot < 0) break;
+        on_drop(NULL, slot, registry_get(trucks, slot));
+        registry_remove(trucks, m->t.id);
+        break;
+    }
+}
 
-        if (n > 0) {
-            qsort(rows, n, sizeof(struct Row), cmp_row);
+/**
+ * @brief Gateway mode: keeps the registry in step with a fleet_gateway
+ * stream, reconnecting when it drops. The gateway expires trucks itself, so
+ * last_seen here is the time of the last change that arrived.
+ */
+static void *th_gw(void *arg) {
+    (void)arg;
+    static char buf[64 * 1024];
+    while (1) {
+        int fd = tcp_connect_timeout_addr(gw_ip, (uint16_t)gw_port, 2000);
+        if (fd < 0) {
+            perror("gateway connect");
+            usleep(GW_RECONNECT_MS * 1000);
+            continue;
         }
+        LineReader lr;
+        linereader_init(&lr, fd, buf, sizeof(buf));
+        const char *line;
+        size_t len;
+        ssize_t k;
+        while ((k = linereader_next(&lr, &line, &len, 60 * 1000)) >= 0) {
+            GwMsg m;
+            if (k == 0 || proto_parse_gw(line, len, &m) != PROTO_OK) continue;
+            pthread_mutex_lock(&trucks_mu);
+            gw_apply(&m, now_s());
+            pthread_mutex_unlock(&trucks_mu);
+        }
+        close(fd);
+        fprintf(stderr, "gateway connection lost, reconnecting\n");
+        usleep(GW_RECONNECT_MS * 1000);
+    }
+    return NULL;
+}
+
+// Fills rows with every truck, unsorted. Caller holds trucks_mu.
+static size_t collect_all(struct Row *rows, size_t max) {
+    size_t k = 0;
+    for (size_t s = 0, ns = registry_slots(trucks); s < ns && k < max; ++s) {
+        const TruckInfo *t = registry_get(trucks, (int)s);
+        if (!t) continue;
+        rows[k++].t = *t;
+    }
+    return k;
+}
+
+// Distances for rows in one batch kernel call. Runs without the lock.
+static void measure_rows(struct Row *rows, size_t n) {
+    double *buf = malloc(3 * n * sizeof(double));
+    if (!buf) {
+        for (size_t i = 0; i < n; ++i) rows[i].dist = haversine_km(u_lat, u_lon, rows[i].t.lat, rows[i].t.lon);
+        return;
+    }
+    double *lat = buf, *lon = buf + n, *km = buf + 2 * n;
+    for (size_t i = 0; i < n; ++i) {
+        lat[i] = rows[i].t.lat;
+        lon[i] = rows[i].t.lon;
+    }
+    GeoOrigin o;
+    geo_origin_init(&o, u_lat, u_lon);
+    geo_haversine_batch(&o, lat, lon, n, km);
+    for (size_t i = 0; i < n; ++i) rows[i].dist = km[i];
+    free(buf);
+}
 
-        printf("\ntruck_id        distance_km last_seen_s tcp_port ip\n");
-        long now = now_s();
-        for (size_t i = 0; i < n; ++i) {
-            TruckInfo *t = rows[i].t;
-            char ipbuf[INET_ADDRSTRLEN];
-            snprintf(ipbuf, sizeof(ipbuf), "%s", inet_ntoa(t->last_ip));
-            printf("%-14s %10.3f %11ld %8d %s\n",
-                   t->id,
-                   rows[i].dist,
-                   now - t->last_seen,
-                   t->tcp_port,
-                   ipbuf);
-            if (rows[i].dist < near_km) {
-                printf("\a>> %s is nearby!\n", t->id);
+/**
+ * @brief Moves rows from adaptive trucks to where they should be now by
+ * dead reckoning from the moment their last heartbeat arrived; the
+ * extrapolation stops at the truck's keepalive, after which a fresh
+ * heartbeat is due anyway. Returns how many rows moved. Runs without the lock.
+ */
+static size_t dead_reckon_rows(struct Row *rows, size_t n) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    double now = (double)ts.tv_sec + ts.tv_nsec / 1e9;
+    size_t moved = 0;
+    for (size_t i = 0; i < n; ++i) {
+        TruckInfo *t = &rows[i].t;
+        if (t->keepalive_s <= 0 || (t->vn == 0 && t->ve == 0)) continue;
+        double dt = now - (t->seen_at > 0 ? t->seen_at : (double)t->last_seen);
+        if (dt > t->keepalive_s) dt = t->keepalive_s;
+        if (dt <= 0) continue;
+        geo_dead_reckon(t->lat, t->lon, t->vn, t->ve, dt, &t->lat, &t->lon);
+        moved++;
+    }
+    return moved;
+}
+
+// Copies the trucks behind hits into freshly allocated rows. Caller holds trucks_mu.
+static struct Row *rows_from_hits(const RegHit *hits, size_t n) {
+    struct Row *rows = malloc((n ? n : 1) * sizeof(struct Row));
+    if (!rows) return NULL;
+    for (size_t i = 0; i < n; ++i) {
+        rows[i].t = *registry_get(trucks, hits[i].slot);
+        rows[i].dist = hits[i].km;
+    }
+    return rows;
+}
+
+/**
+ * @brief Dead reckons rows and puts them in distance order. Rows that come
+ * in sorted by their reported positions are only measured again if one of
+ * them moved. Runs without the lock.
+ */
+static void reckon_and_sort(struct Row *rows, size_t n, int sorted) {
+    if (n > 0 && (dead_reckon_rows(rows, n) > 0 || !sorted)) {
+        measure_rows(rows, n);
+        qsort(rows, n, sizeof(struct Row), cmp_row);
+    }
+}
+
+// One list refresh; scheduled every second by list_loop()
+static void list_refresh(void *arg) {
+    (void)arg;
+    // Follow the user's area; a no-op unless it crossed into other tiles
+    if (mc_tile_km > 0 && !gw_port && mcregion_follow(&mc_region, u_lat, u_lon, mc_radius_km) < 0)
+        perror("multicast groups");
+    pthread_mutex_lock(&trucks_mu);
+    if (!gw_port) prune_stale();
+
+    // The grid searches below rank trucks by their last reported positions.
+    // Widening them by reckon_km keeps every truck that could make the cut
+    // once extrapolated; the final selection is on the reckoned rows.
+    size_t cap = registry_count(trucks);
+    RegHit *hits = malloc((cap ? cap : 1) * sizeof(RegHit));
+    struct Row *rows = NULL, *near = NULL;
+    size_t n = 0, n_near = 0;
+    int sorted = 0;
+    if (hits) {
+        if (top_k > 0) {
+            // The reckoned K-th nearest is at most reckon_km beyond the reported
+            // one, and a truck gets at most reckon_km closer by reckoning
+            n = registry_nearest_k(trucks, u_lat, u_lon, (size_t)top_k < cap ? (size_t)top_k : cap, hits);
+            if (n > 0 && reckon_km > 0) {
+                n = registry_within_radius(trucks, u_lat, u_lon, hits[n - 1].km + 2 * reckon_km, hits, cap);
+                if (n > cap) n = cap;
             }
+            rows = rows_from_hits(hits, n);
+            sorted = 1;
+        } else {
+            rows = malloc((cap ? cap : 1) * sizeof(struct Row));
+            if (rows) n = collect_all(rows, cap);
+        }
+        n_near = registry_within_radius(trucks, u_lat, u_lon, near_km + reckon_km, hits, cap);
+        if (n_near > cap) n_near = cap;
+        near = rows_from_hits(hits, n_near);
+    }
+    free(hits);
+    if (!rows || !near) {
+        // BUG FIX: Handle malloc failure
+        pthread_mutex_unlock(&trucks_mu);
+        perror("malloc failed in list_refresh");
+        free(rows);
+        free(near);
+        return;
+    }
+
+    // Only the trucks that went away since the last refresh, not a rescan
+    char gone_id[MAX_ALERTS][MAX_ID_LEN];
+    size_t n_gone = n_dropped;
+    memcpy(gone_id, dropped_id, (n_gone < MAX_ALERTS ? n_gone : MAX_ALERTS) * MAX_ID_LEN);
+    n_dropped = 0;
+
+    McStats st = mc_stats;
+    uint64_t bad = mc_bad;
+    pthread_mutex_unlock(&trucks_mu);
+
+    reckon_and_sort(rows, n, sorted);
+    if (top_k > 0 && n > (size_t)top_k) n = (size_t)top_k;
+    reckon_and_sort(near, n_near, 1);
+    while (n_near > 0 && near[n_near - 1].dist > near_km) n_near--;
+
+    printf("\ntruck_id        distance_km last_seen_s tcp_port ip\n");
+    long now = now_s();
+    for (size_t i = 0; i < n; ++i) {
+        const TruckInfo *t = &rows[i].t;
+        char ipbuf[INET_ADDRSTRLEN];
+        snprintf(ipbuf, sizeof(ipbuf), "%s", inet_ntoa(t->last_ip));
+        printf("%-14s %10.3f %11ld %8d %s\n",
+               t->id,
+               rows[i].dist,
+               now - t->last_seen,
+               t->tcp_port,
+               ipbuf);
+    }
+    for (size_t i = 0; i < n_near && i < MAX_ALERTS; ++i) {
+        printf("\a>> %s is nearby!\n", near[i].t.id);
+    }
+    if (n_near > MAX_ALERTS) {
+        printf(">> and %zu more nearby\n", n_near - MAX_ALERTS);
+    }
+    for (size_t i = 0; i < n_gone && i < MAX_ALERTS; ++i) {
+        printf("<< %s went offline\n", gone_id[i]);
+    }
+    if (n_gone > MAX_ALERTS) {
+        printf("<< and %zu more went offline\n", n_gone - MAX_ALERTS);
+    }
+    if (mc_show_stats) {
+        printf("heartbeats: %llu datagrams in %llu batches, %llu dropped by kernel, %llu invalid\n",
+               (unsigned long long)st.datagrams, (unsigned long long)st.batches,
+               (unsigned long long)st.drops, (unsigned long long)bad);
+    }
+    fflush(stdout);
+    free(rows); // Free the allocated memory
+    free(near);
+}
+
+// Refreshes on absolute one-second deadlines, so the period does not drift by the refresh time
+static void list_loop(void) {
+    Sched *s = sched_create(0);
+    if (!s || sched_add(s, "list", 0, 1000, 0, list_refresh, NULL) < 0) {
+        perror("scheduler");
+        sched_destroy(s);
+        return;
+    }
+    sched_run(s);
+    sched_destroy(s);
+}
+
+// The PING this customer sends to truck_id
+static void fill_ping(PingMsg *p, const char *truck_id) {
+    memset(p, 0, sizeof(*p));
+    snprintf(p->truck_id, sizeof(p->truck_id), "%s", truck_id);
+    snprintf(p->user_id, sizeof(p->user_id), "%s", user_id);
+    snprintf(p->addr, sizeof(p->addr), "%s", addr);
+    snprintf(p->note, sizeof(p->note), "%s", note);
+
+    // Lets the truck route to us and quote a distance-based ETA
+    p->has_loc = 1;
+    p->lat = u_lat;
+    p->lon = u_lon;
+}
+
+/**
+ * @brief Sends the PING(s) to chosen and prints the ACKs. Returns 0 when
+ * every PING was answered, 1 on a missing or bad ACK, and -1 when the truck
+ * could not be reached at all (nothing printed). connect_ms bounds the TCP
+ * connect; ACKs get the usual 2 s.
+ */
+static int ping_truck(const TruckInfo *chosen, int connect_ms) {
+    PingMsg p;
+    fill_ping(&p, want_truck);
+
+    // Several pings share one kept-alive connection
+    p.keepalive = ping_count > 1;
+
+    PingMsg *msgs = malloc((size_t)ping_count * sizeof(PingMsg));
+    PingResult *res = calloc((size_t)ping_count, sizeof(PingResult));
+    ConnPool *pool = connpool_create(0);
+    if (!msgs || !res || !pool) {
+        perror("ping setup");
+        free(msgs); free(res); connpool_destroy(pool);
+        return 1;
+    }
+    for (int i = 0; i < ping_count; ++i) msgs[i] = p;
+
+    // Connect first under connect_ms; the pooled socket is then reused
+    int reused, got = -1;
+    int fd = connpool_acquire(pool, chosen->id, chosen->last_ip, (uint16_t)chosen->tcp_port,
+                              connect_ms, &reused);
+    if (fd >= 0) {
+        connpool_release(pool, chosen->id, chosen->last_ip, (uint16_t)chosen->tcp_port, fd, 1);
+        got = ping_via_pool(pool, chosen, msgs, (size_t)ping_count, ping_depth, res, 2000);
+    }
+    // Someone else now answers on that address (a stale cache entry)
+    if (got > 0 && res[0].ok && strcmp(res[0].truck_id, want_truck) != 0) got = 0;
+    if (got <= 0) {
+        connpool_destroy(pool);
+        free(msgs);
+        free(res);
+        return -1;
+    }
+
+    int rc = got == ping_count ? 0 : 1;
+    for (int i = 0; i < got; ++i) {
+        if (res[i].ok) {
+            printf("ACK from %s: eta=%d min queued=%d job=%u\n", res[i].truck_id, res[i].eta_min,
+                   res[i].queued, res[i].job);
+        } else {
+            printf("bad ACK\n");
+            rc = 1;
         }
-        fflush(stdout);
-        free(rows); // Free the allocated memory
-        sleep(1);
     }
+
+    connpool_destroy(pool);
+    free(msgs);
+    free(res);
+    return rc;
 }
 
-static int do_ping(void) {
-    // find truck by ID
-    TruckInfo chosen;
-    int found = 0;
+// Waits up to timeout_ms for a heartbeat from want_truck
+static int wait_for_truck(TruckInfo *out, int timeout_ms) {
+    struct timespec dl;
+    clock_gettime(CLOCK_REALTIME, &dl);
+    dl.tv_sec += timeout_ms / 1000;
+    dl.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+    if (dl.tv_nsec >= 1000000000L) {
+        dl.tv_sec++;
+        dl.tv_nsec -= 1000000000L;
+    }
 
     pthread_mutex_lock(&trucks_mu);
-    for (size_t i = 0; i < trucks_count; ++i) {
-        if (strncmp(trucks[i].id, want_truck, MAX_ID_LEN) == 0) {
-            chosen = trucks[i];
-            found = 1;
-            break;
-        }
+    int slot;
+    while ((slot = registry_find(trucks, want_truck)) < 0) {
+        if (pthread_cond_timedwait(&want_seen, &trucks_mu, &dl) != 0) break;
     }
+    if (slot >= 0) *out = *registry_get(trucks, slot);
     pthread_mutex_unlock(&trucks_mu);
+    return slot >= 0 ? 0 : -1;
+}
+
+/**
+ * @brief Ping mode. A truck found in the cache is pinged straight away;
+ * only when it is not cached, cached too long ago, or does not answer do we
+ * wait for its heartbeat, and then only until it arrives.
+ */
+static int do_ping(void) {
+    TruckInfo chosen;
+    if (tcache && truckcache_get(tcache, want_truck, &chosen) == 0 &&
+        now_s() - chosen.last_seen <= cache_max_age) {
+        int rc = ping_truck(&chosen, CACHE_CONNECT_MS);
+        if (rc >= 0) return rc;
+        fprintf(stderr, "cached address of %s did not answer, waiting for its heartbeat\n", want_truck);
+    }
 
-    if (!found) {
+    if (wait_for_truck(&chosen, HB_WAIT_MS) < 0) {
         fprintf(stderr,
                 "truck %s not seen yet. Run client in list mode first.\n",
                 want_truck);
         return 1;
     }
-
-    // Assuming tcp_connect_timeout_addr is defined and works
-    int s = tcp_connect_timeout_addr(chosen.last_ip,
-                                     chosen.tcp_port,
-                                     2000);
-    if (s < 0) {
+    int rc = ping_truck(&chosen, 2000);
+    if (rc < 0) {
         perror("connect");
         return 1;
     }
+    return rc;
+}
 
-    PingMsg p;
-    memset(&p, 0, sizeof(p));
-    
-    // Safety: ensure null termination after strncpy
-    strncpy(p.truck_id, want_truck, MAX_ID_LEN);
-    p.truck_id[MAX_ID_LEN - 1] = '\0';
-    
-    strncpy(p.user_id, user_id, MAX_ID_LEN);
-    p.user_id[MAX_ID_LEN - 1] = '\0';
-    
-    strncpy(p.addr, addr, sizeof(p.addr));
-    p.addr[sizeof(p.addr) - 1] = '\0'; // Added explicit null termination
-    
-    strncpy(p.note, note, sizeof(p.note));
-    p.note[sizeof(p.note) - 1] = '\0'; // Added explicit null termination
-
-    char line[MAX_LINE];
-    // Assuming format_ping and send_all_timeout are defined and work
-    format_ping(line, sizeof(line), &p);
-    send_all_timeout(s, line, strlen(line), 2000);
-
-    char resp[MAX_LINE];
-    // Assuming recv_line_timeout is defined and works
-    ssize_t n = recv_line_timeout(s, resp, sizeof(resp), 2000);
-    if (n > 0) {
-        char id[16];
-        int eta, q;
-        // Assuming parse_ack is defined and works
-        if (parse_ack(resp, id, &eta, &q)) {
-            printf("ACK from %s: eta=%d min queued=%d\n", id, eta, q);
-        } else {
-            printf("bad ACK: %s\n", resp);
-        }
+// Known trucks from the cache stand in until their heartbeats arrive
+static void preload_from_cache(void) {
+    TruckInfo *list = tcache ? malloc(CACHE_RECORDS * sizeof(*list)) : NULL;
+    if (!list) return;
+    size_t n = truckcache_list(tcache, now_s() - cache_max_age, list, CACHE_RECORDS);
+    pthread_mutex_lock(&trucks_mu);
+    for (size_t i = 0; i < n; ++i) registry_upsert(trucks, &list[i]);
+    pthread_mutex_unlock(&trucks_mu);
+    free(list);
+}
+
+/**
+ * @brief --best mode: PINGs the best_k trucks nearest to the user at once and
+ * keeps the lowest ETA; orders placed with the other trucks are cancelled.
+ */
+static int do_best(void) {
+    // Without enough cached trucks, give every live truck one heartbeat to show up
+    long start = mono_ms();
+    for (;;) {
+        pthread_mutex_lock(&trucks_mu);
+        size_t n = registry_count(trucks);
+        pthread_mutex_unlock(&trucks_mu);
+        if (n >= (size_t)best_k || mono_ms() - start >= HB_WAIT_MS) break;
+        usleep(50 * 1000);
     }
 
-    close(s);
-    return 0;
+    RegHit *hits = malloc((size_t)best_k * sizeof(*hits));
+    TruckInfo *cand = malloc((size_t)best_k * sizeof(*cand));
+    if (!hits || !cand) {
+        perror("best setup");
+        free(hits);
+        free(cand);
+        return 1;
+    }
+    pthread_mutex_lock(&trucks_mu);
+    size_t n = registry_nearest_k(trucks, u_lat, u_lon, (size_t)best_k, hits);
+    for (size_t i = 0; i < n; ++i) cand[i] = *registry_get(trucks, hits[i].slot);
+    pthread_mutex_unlock(&trucks_mu);
+    free(hits);
+    if (n == 0) {
+        fprintf(stderr, "no trucks seen yet. Run client in list mode first.\n");
+        free(cand);
+        return 1;
+    }
+
+    PingMsg tmpl;
+    fill_ping(&tmpl, "");
+    long t0 = mono_ms();
+    FanOut *f = fanout_start(cand, n, &tmpl);
+    if (!f) {
+        perror("fanout_start");
+        free(cand);
+        return 1;
+    }
+    int best = fanout_run(f, accept_eta, deadline_ms);
+    long took = mono_ms() - t0;
+
+    size_t answered = 0;
+    for (size_t i = 0; i < n; ++i) answered += fanout_result(f, i)->ok;
+    int rc = 1;
+    if (best >= 0) {
+        const PingResult *r = fanout_result(f, (size_t)best);
+        printf("ACK from %s: eta=%d min queued=%d job=%u (best of %zu answers from %zu trucks, %ld ms)\n",
+               r->truck_id, r->eta_min, r->queued, r->job, answered, n, took);
+        rc = 0;
+    } else {
+        printf("no truck answered within %d ms (%zu asked)\n", deadline_ms, n);
+    }
+    int cancelled = fanout_cancel_rest(f, best, deadline_ms);
+    if (cancelled > 0) printf("cancelled %d order(s) with the other trucks\n", cancelled);
+    fanout_destroy(f);
+    free(cand);
+    return rc;
 }
 
 int main(int argc, char **argv) {
@@ -250,6 +638,12 @@ int main(int argc, char **argv) {
             u_lon = atof(argv[++i]);
         } else if (!strcmp(argv[i], "--near") && i + 1 < argc) {
             near_km = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--top") && i + 1 < argc) {
+            top_k = atoi(argv[++i]);
+            if (top_k < 0) top_k = 0;
+        } else if (!strcmp(argv[i], "--drop-age") && i + 1 < argc) {
+            drop_age = atoi(argv[++i]);
+            if (drop_age < 1) drop_age = 1;
         } else if (!strcmp(argv[i], "--truck") && i + 1 < argc) {
             strncpy(want_truck, argv[++i], MAX_ID_LEN - 1);
             want_truck[MAX_ID_LEN - 1] = '\0'; // Safety null termination
@@ -260,29 +654,111 @@ int main(int argc, char **argv) {
         } else if (!strcmp(argv[i], "--note") && i + 1 < argc) {
             strncpy(note, argv[++i], sizeof(note) - 1);
             note[sizeof(note) - 1] = '\0'; // Safety null termination
+        } else if (!strcmp(argv[i], "--count") && i + 1 < argc) {
+            ping_count = atoi(argv[++i]);
+            if (ping_count < 1) ping_count = 1;
+        } else if (!strcmp(argv[i], "--pipeline") && i + 1 < argc) {
+            ping_depth = atoi(argv[++i]);
+            if (ping_depth < 1) ping_depth = 1;
+        } else if (!strcmp(argv[i], "--rcvbuf") && i + 1 < argc) {
+            mc_rcvbuf = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--gateway") && i + 1 < argc) {
+            // host:port, host an IPv4 address
+            char host[64];
+            const char *hp = argv[++i], *colon = strrchr(hp, ':');
+            size_t hl = colon ? (size_t)(colon - hp) : 0;
+            if (!colon || hl >= sizeof(host)) {
+                fprintf(stderr, "--gateway wants host:port\n");
+                return 1;
+            }
+            memcpy(host, hp, hl);
+            host[hl] = '\0';
+            gw_port = atoi(colon + 1);
+            if (inet_pton(AF_INET, host, &gw_ip) != 1 || gw_port <= 0 || gw_port > 65535) {
+                fprintf(stderr, "--gateway wants host:port\n");
+                return 1;
+            }
+        } else if (!strcmp(argv[i], "--best") && i + 1 < argc) {
+            best_k = atoi(argv[++i]);
+            if (best_k < 1) best_k = 1;
+        } else if (!strcmp(argv[i], "--accept-eta") && i + 1 < argc) {
+            accept_eta = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--deadline-ms") && i + 1 < argc) {
+            deadline_ms = atoi(argv[++i]);
+            if (deadline_ms < 1) deadline_ms = 1;
+        } else if (!strcmp(argv[i], "--cache") && i + 1 < argc) {
+            snprintf(cache_path, sizeof(cache_path), "%s", argv[++i]);
+        } else if (!strcmp(argv[i], "--no-cache")) {
+            use_cache = 0;
+        } else if (!strcmp(argv[i], "--cache-age") && i + 1 < argc) {
+            cache_max_age = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--mc-tile-km") && i + 1 < argc) {
+            mc_tile_km = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--mc-radius-km") && i + 1 < argc) {
+            mc_radius_km = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--mc-stats")) {
+            mc_show_stats = 1;
         } else if (!strcmp(argv[i], "--user") && i + 1 < argc) {
             strncpy(user_id, argv[++i], MAX_ID_LEN - 1);
             user_id[MAX_ID_LEN - 1] = '\0'; // Safety null termination
         }
     }
 
-    // Assuming udp_mc_receiver is defined and works
-    if (udp_mc_receiver(MC_GROUP, MC_PORT, &mc_fd) < 0) {
-        perror("udp_mc_receiver");
+    trucks = registry_create(256);
+    if (!trucks) {
+        perror("registry_create");
         return 1;
     }
 
+    if (use_cache) {
+        if (!cache_path[0]) truckcache_default_path(cache_path, sizeof(cache_path));
+        tcache = truckcache_open(cache_path, CACHE_RECORDS);
+        if (!tcache) perror(cache_path);
+    }
+
     pthread_t tm;
+    if (gw_port) {
+        if (pthread_create(&tm, NULL, th_gw, NULL) != 0) {
+            perror("pthread_create failed for gateway reader");
+            return 1;
+        }
+    } else if (mc_tile_km > 0) {
+        // Only the tiles around the user; list_refresh() keeps them current
+        if (udp_mc_bind(MC_PORT, &mc_fd) < 0) {
+            perror("udp_mc_bind");
+            return 1;
+        }
+        mcregion_sub_init(&mc_region, mc_fd, mc_tile_km);
+        int n = mcregion_follow(&mc_region, u_lat, u_lon, mc_radius_km);
+        if (n < 0) {
+            fprintf(stderr, "cannot join the groups for %.1f km around the user with %.1f km tiles "
+                    "(at most %d; try a larger --mc-tile-km)\n", mc_radius_km, mc_tile_km, MC_REGION_MAX_JOIN);
+            return 1;
+        }
+        fprintf(stderr, "listening to %d map tile group(s) within %.1f km\n", n, mc_radius_km);
+    } else if (udp_mc_receiver(MC_GROUP, MC_PORT, &mc_fd) < 0) {
+        perror("udp_mc_receiver");
+        return 1;
+    }
+    if (!gw_port && mc_rcvbuf > 0) {
+        int got = udp_set_rcvbuf(mc_fd, mc_rcvbuf);
+        if (got < 0) perror("SO_RCVBUF");
+        else if (got < mc_rcvbuf) fprintf(stderr, "rcvbuf capped at %d bytes (see net.core.rmem_max)\n", got);
+    }
+    if (!gw_port && mcbatch_watch_drops(mc_fd) < 0) perror("SO_RXQ_OVFL");
+
     // BUG FIX: Check return value of pthread_create
-    if (pthread_create(&tm, NULL, th_mc, NULL) != 0) {
+    if (!gw_port && pthread_create(&tm, NULL, th_mc, NULL) != 0) {
         perror("pthread_create failed for multicast receiver");
         close(mc_fd);
         return 1;
     }
 
+    if (best_k > 0) {
+        preload_from_cache();
+        return do_best();
+    }
     if (ping_mode) {
-        // give some time to receive at least one heartbeat
-        sleep(1);
         int res = do_ping();
         // Since we are exiting, we don't need to join tm, but we should free resources
         // For a simple exit, it's fine, but in a clean shutdown, join/cancel the thread.
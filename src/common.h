@@ -22,6 +22,10 @@ double lat, lon;
 int tcp_port;
 time_t last_seen;
 struct in_addr last_ip; 
+uint32_t seq; // binary heartbeat sequence number (0 for text heartbeats)
+float vn, ve; // adaptive heartbeats: velocity in m/s north / east (0 otherwise)
+int keepalive_s; // adaptive heartbeats: longest gap between them in seconds, 0 = every HB_INTERVAL_MS
+double seen_at; // receive time, CLOCK_REALTIME seconds with the fraction (0 = only last_seen is known)
 } TruckInfo;
 
 
@@ -30,4 +34,7 @@ char truck_id[MAX_ID_LEN];
 char user_id[MAX_ID_LEN];
 char addr[128];
 char note[64];
+int keepalive; // ka=1: keep the connection open for further PINGs
+int has_loc;   // lat/lon below were sent (lat= and lon= keys)
+double lat, lon; // customer location
 } PingMsg;
\ No newline at end of file
@@ -0,0 +1,230 @@
+#define _GNU_SOURCE               // accept4
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "common.h"
+#include "net.h"
+#include "protocol.h"
+#include "util.h"
+#include "mcrecv.h"
+#include "gateway.h"
+#include "mcregion.h"
+
+/*
+ * Fleet gateway: joins the heartbeat group once and serves the fleet to any
+ * number of viewers over TCP.
+ *
+ * Each viewer connects to --port and receives a SNAP of the current fleet
+ * followed by a stream of ADD / MOV / DEL lines (protocol.h). Changes are
+ * gathered for --flush-ms and sent as one block, so a truck that reports
+ * several times between flushes costs one line. A viewer that cannot keep up
+ * (more than --sub-buf bytes unsent) loses its queued deltas and is sent a
+ * fresh SNAP once it drains; see gateway.h.
+ *
+ * With --mc-tile-km only the map tile groups within --radius-km of
+ * --center-lat/--center-lon are joined (mcregion.h).
+ *
+ * Everything runs on one thread and one epoll loop.
+ */
+
+#define GW_PORT 5100
+#define GW_MC_BATCH 64
+#define GW_STATS_SEC 5
+#define GW_EVENTS 64
+
+// Tags for the main epoll loop
+enum { EV_MC = 1, EV_LISTEN, EV_SUBS };
+
+static volatile int running = 1;
+
+static int port = GW_PORT;
+static int flush_ms = 100;
+static int mc_rcvbuf = 0;
+static size_t sub_buf = 0;
+static int drop_age = DROP_AGE_SEC;  // seconds without a heartbeat before a DEL
+static int max_subs = 4096;
+static double mc_tile_km = 0;      // --mc-tile-km: join the map tiles of the served area; 0 = MC_GROUP
+static double center_lat = 31.956, center_lon = 35.945, radius_km = 10.0;
+
+static void on_sig(int s) {
+    (void)s;
+    running = 0;
+}
+
+static long mono_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint64_t hb_bad = 0;
+
+// Drains everything queued on the non-blocking multicast socket
+static void take_heartbeats(Gateway *g, McBatch *mb, int mc_fd) {
+    static TruckInfo ti[HB_BATCH_MAX_RECORDS];
+    int n;
+    while ((n = mcbatch_recv(mb, mc_fd)) > 0) {
+        long now = now_sec();
+        for (int i = 0; i < n; ++i) {
+            size_t len;
+            struct sockaddr_in src;
+            const char *buf = mcbatch_data(mb, i, &len, &src);
+            int got = proto_parse_hb_datagram(buf, len, ti, HB_BATCH_MAX_RECORDS);
+            if (got <= 0) {
+                hb_bad++;
+                continue;
+            }
+            for (int j = 0; j < got; ++j) {
+                ti[j].last_seen = now;
+                ti[j].last_ip = src.sin_addr;
+                gw_heartbeat(g, &ti[j]);
+            }
+        }
+        if (n < GW_MC_BATCH) break;
+    }
+    if (n < 0) perror("recvmmsg");
+}
+
+static void take_subscribers(Gateway *g, int listen_fd) {
+    for (;;) {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) perror("accept");
+            return;
+        }
+        GwStats st;
+        gw_stats(g, &st);
+        if (st.subscribers >= (size_t)max_subs || gw_subscribe(g, fd) < 0) close(fd);
+    }
+}
+
+int main(int argc, char **argv) {
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--port") && i + 1 < argc) port = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--flush-ms") && i + 1 < argc) flush_ms = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--rcvbuf") && i + 1 < argc) mc_rcvbuf = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--sub-buf") && i + 1 < argc) sub_buf = strtoul(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "--max-subs") && i + 1 < argc) max_subs = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--drop-age") && i + 1 < argc) drop_age = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--mc-tile-km") && i + 1 < argc) mc_tile_km = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--center-lat") && i + 1 < argc) center_lat = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--center-lon") && i + 1 < argc) center_lon = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--radius-km") && i + 1 < argc) radius_km = atof(argv[++i]);
+    }
+    if (flush_ms < 1) flush_ms = 1;
+    if (drop_age < 1) drop_age = 1;
+    if (max_subs < 1) max_subs = 1;
+
+    if (raise_fd_limit((size_t)max_subs + 64) < 0)
+        fprintf(stderr, "open file limit is below %d; fewer subscribers fit (see ulimit -n)\n", max_subs + 64);
+
+    signal(SIGINT, on_sig);
+    signal(SIGTERM, on_sig);
+    signal(SIGPIPE, SIG_IGN);
+
+    int mc_fd = -1, listen_fd = -1;
+    McRegionSub region;
+    if (mc_tile_km > 0) {
+        // The tiles of the area this gateway serves
+        if (udp_mc_bind(MC_PORT, &mc_fd) < 0) {
+            perror("udp_mc_bind");
+            return 1;
+        }
+        mcregion_sub_init(&region, mc_fd, mc_tile_km);
+        if (mcregion_follow(&region, center_lat, center_lon, radius_km) < 0) {
+            fprintf(stderr, "cannot join the groups for %.1f km with %.1f km tiles (at most %d)\n",
+                    radius_km, mc_tile_km, MC_REGION_MAX_JOIN);
+            return 1;
+        }
+    } else if (udp_mc_receiver(MC_GROUP, MC_PORT, &mc_fd) < 0) {
+        perror("udp_mc_receiver");
+        return 1;
+    }
+    if (mc_rcvbuf > 0) {
+        int got = udp_set_rcvbuf(mc_fd, mc_rcvbuf);
+        if (got < 0) perror("SO_RCVBUF");
+        else if (got < mc_rcvbuf) fprintf(stderr, "rcvbuf capped at %d bytes (see net.core.rmem_max)\n", got);
+    }
+    if (mcbatch_watch_drops(mc_fd) < 0) perror("SO_RXQ_OVFL");
+    set_nonblocking(mc_fd);
+    if (tcp_listen((uint16_t)port, 1024, &listen_fd) < 0) {
+        perror("tcp_listen");
+        return 1;
+    }
+    set_nonblocking(listen_fd);
+
+    McBatch *mb = mcbatch_create(GW_MC_BATCH);
+    Gateway *g = gw_create(1024, sub_buf);
+    int ep = epoll_create1(EPOLL_CLOEXEC);
+    if (!mb || !g || ep < 0) {
+        perror("gateway setup");
+        return 1;
+    }
+    struct epoll_event ev = { .events = EPOLLIN };
+    ev.data.u32 = EV_MC;
+    epoll_ctl(ep, EPOLL_CTL_ADD, mc_fd, &ev);
+    ev.data.u32 = EV_LISTEN;
+    epoll_ctl(ep, EPOLL_CTL_ADD, listen_fd, &ev);
+    ev.data.u32 = EV_SUBS;
+    epoll_ctl(ep, EPOLL_CTL_ADD, gw_epoll_fd(g), &ev);
+
+    fprintf(stderr, "fleet_gateway: mc=%s:%d, subscribers on port %d, flush every %d ms\n",
+            MC_GROUP, MC_PORT, port, flush_ms);
+
+    long next_flush = mono_ms() + flush_ms;
+    long next_stats = mono_ms() + GW_STATS_SEC * 1000;
+    uint64_t last_bytes = 0;
+    while (running) {
+        long wait = next_flush - mono_ms();
+        struct epoll_event evs[GW_EVENTS];
+        int n = epoll_wait(ep, evs, GW_EVENTS, wait > 0 ? (int)wait : 0);
+        if (n < 0 && errno != EINTR) {
+            perror("epoll_wait");
+            break;
+        }
+        for (int i = 0; i < n; ++i) {
+            switch (evs[i].data.u32) {
+            case EV_MC:     take_heartbeats(g, mb, mc_fd); break;
+            case EV_LISTEN: take_subscribers(g, listen_fd); break;
+            case EV_SUBS:   gw_service(g); break;
+            }
+        }
+
+        long now = mono_ms();
+        if (now >= next_flush) {
+            gw_expire(g, now_sec(), drop_age);
+            gw_publish(g);
+            next_flush = now + flush_ms;
+        }
+        if (now >= next_stats) {
+            GwStats st;
+            gw_stats(g, &st);
+            const McStats *ms = mcbatch_stats(mb);
+            fprintf(stderr, "gateway: %zu trucks, %zu subscribers, %.1f MB/s out, "
+                    "%llu resyncs, %llu disconnects, %llu heartbeats (%llu dropped by kernel, %llu invalid)\n",
+                    st.trucks, st.subscribers, (double)(st.bytes_sent - last_bytes) / GW_STATS_SEC / 1e6,
+                    (unsigned long long)st.resyncs, (unsigned long long)st.disconnects,
+                    (unsigned long long)ms->datagrams, (unsigned long long)ms->drops,
+                    (unsigned long long)hb_bad);
+            last_bytes = st.bytes_sent;
+            next_stats = now + GW_STATS_SEC * 1000;
+        }
+    }
+
+    gw_destroy(g);
+    mcbatch_destroy(mb);
+    close(ep);
+    close(listen_fd);
+    close(mc_fd);
+    return 0;
+}
@@ -0,0 +1,447 @@
+#define _GNU_SOURCE               // clock_nanosleep, M_PI
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <math.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "common.h"
+#include "net.h"
+#include "protocol.h"
+#include "util.h"
+#include "server.h"
+#include "prng.h"
+#include "mcregion.h"
+
+/*
+ * Capacity-test simulator: --trucks N virtual trucks in one process.
+ *
+ * Positions live in structure-of-arrays form and are stepped together in a
+ * tight loop. A single scheduler thread spreads the heartbeats evenly over
+ * HB_INTERVAL_MS (truck i sends at offset i * interval / N), so the
+ * multicast group sees a steady stream instead of one burst per second.
+ * Every truck has its own TCP port (--base-port + i); all ports are served
+ * by one epoll server (--workers event loops, default 1), with the port's
+ * listener context telling the PING handler which truck was asked.
+ *
+ * With --hb-format batch the trucks of a slot are packed into batched
+ * heartbeat datagrams (about 40 trucks each) and the slot's datagrams go
+ * out in one sendmmsg call. Batch mode uses fewer, fuller slots
+ * (SIM_BATCH_SLOT trucks each), so receivers see a few large datagrams per
+ * slot instead of one per truck.
+ *
+ * With --mc-tile-km each truck sends to the group of its map tile
+ * (mcregion.h), and batches are filled per group.
+ *
+ * Simulated trucks do not keep order queues: the ACK quotes the drive from
+ * the truck to the customer plus one service time.
+ *
+ * With --hb-mode adaptive a truck still gets its slot every interval but
+ * only sends when it has walked more than --hb-threshold-m from the last
+ * position it sent or --hb-keepalive-s has passed, as truck.c does. The
+ * walk is GPS noise around a parked truck, so the advertised velocity is 0.
+ */
+
+#define SIM_STEP_MS 300        // position update period, as in truck.c
+#define SIM_SLOTS_MAX 1000     // heartbeat scheduler ticks per interval
+#define SIM_BATCH_SLOT 128     // batch mode: trucks per slot to aim for
+#define SIM_BATCH_DGRAMS 16    // batch mode: datagrams per sendmmsg call
+#define SIM_WALK_M 3.0         // max random-walk step in meters
+#define SIM_STATS_SEC 5
+
+static volatile int running = 1;
+
+static int n_trucks = 1000;
+static int base_port = 7000;
+static int n_workers = 1;
+static int hb_binary = 0;
+static int hb_batch = 0;          // --hb-format batch
+static double center_lat = 31.956, center_lon = 35.945;
+static double spread_km = 10.0;
+static uint64_t seed = 1;
+static double speed_kmh = 30.0, service_min = 5.0;
+static int hb_adaptive = 0;
+static double hb_threshold_m = 25.0;
+static int hb_keepalive_s = 10;
+static double mc_tile_km = 0;     // --mc-tile-km: each truck sends to its map tile's group
+
+// Fleet state, one entry per truck (structure of arrays)
+static char (*f_id)[MAX_ID_LEN];
+static double *f_lat, *f_lon;           // scheduler thread only
+static _Atomic uint32_t *f_pos_seq;      // per truck seqlock: odd while a step is publishing
+static _Atomic double *f_pub_lat, *f_pub_lon;  // positions published for the PING workers
+static double *f_cos_lat;          // refreshed every step for the lon scale
+static Prng *f_rng;
+static uint32_t *f_seq;
+static int *f_listen_fd;
+static double *f_sent_lat, *f_sent_lon;  // adaptive mode: position in the last heartbeat
+static long *f_sent_at;                 // adaptive mode: interval it was sent in, LONG_MIN = never
+
+static int mc_fd = -1;
+static struct sockaddr_in mc_addr;
+
+static unsigned long stat_hb = 0, stat_hb_err = 0, stat_late = 0;  // scheduler thread only
+static unsigned long stat_dgrams = 0;                             // scheduler thread only
+static HbBatch sim_batch[SIM_BATCH_DGRAMS];                       // batch mode: datagrams being filled
+static struct sockaddr_in sim_batch_to[SIM_BATCH_DGRAMS];         // ... and their groups
+static int sim_nbatch = 0;                                        // ... of which this many are in use
+static unsigned long stat_pings = 0;                              // atomic
+
+static void on_sig(int s) {
+    (void)s;
+    running = 0;
+}
+
+static long mono_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+// --- Fleet ---
+
+static int fleet_alloc(size_t n) {
+    f_id = calloc(n, sizeof(*f_id));
+    f_lat = malloc(n * sizeof(*f_lat));
+    f_lon = malloc(n * sizeof(*f_lon));
+    f_pos_seq = calloc(n, sizeof(*f_pos_seq));
+    f_pub_lat = calloc(n, sizeof(*f_pub_lat));
+    f_pub_lon = calloc(n, sizeof(*f_pub_lon));
+    f_cos_lat = malloc(n * sizeof(*f_cos_lat));
+    f_rng = malloc(n * sizeof(*f_rng));
+    f_seq = calloc(n, sizeof(*f_seq));
+    f_listen_fd = malloc(n * sizeof(*f_listen_fd));
+    f_sent_lat = malloc(n * sizeof(*f_sent_lat));
+    f_sent_lon = malloc(n * sizeof(*f_sent_lon));
+    f_sent_at = malloc(n * sizeof(*f_sent_at));
+    if (!f_id || !f_lat || !f_lon || !f_pos_seq || !f_pub_lat || !f_pub_lon || !f_cos_lat || !f_rng || !f_seq ||
+        !f_listen_fd || !f_sent_lat || !f_sent_lon || !f_sent_at) return -1;
+
+    // Scatter the trucks uniformly over a disc around the center
+    double km_per_deg = 111.32;
+    for (size_t i = 0; i < n; ++i) {
+        prng_seed(&f_rng[i], seed, i);
+        double r = spread_km * sqrt(prng_double(&f_rng[i]));
+        double a = 2.0 * M_PI * prng_double(&f_rng[i]);
+        f_lat[i] = center_lat + r * sin(a) / km_per_deg;
+        f_lon[i] = center_lon + r * cos(a) / (km_per_deg * cos(center_lat * M_PI / 180.0));
+        f_cos_lat[i] = cos(f_lat[i] * M_PI / 180.0);
+        atomic_init(&f_pub_lat[i], f_lat[i]);
+        atomic_init(&f_pub_lon[i], f_lon[i]);
+        f_listen_fd[i] = -1;
+        f_sent_at[i] = LONG_MIN;
+        snprintf(f_id[i], MAX_ID_LEN, "SIM%05zu", i);
+    }
+    return 0;
+}
+
+// Publishes truck i's position for handle_ping, as gps.c does for GpsCtx
+static void fleet_publish(size_t i) {
+    uint32_t s = atomic_load_explicit(&f_pos_seq[i], memory_order_relaxed);
+    atomic_store_explicit(&f_pos_seq[i], s + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&f_pub_lat[i], f_lat[i], memory_order_relaxed);
+    atomic_store_explicit(&f_pub_lon[i], f_lon[i], memory_order_relaxed);
+    atomic_store_explicit(&f_pos_seq[i], s + 2, memory_order_release);
+}
+
+// Reads truck i's last published position; safe from any thread
+static void fleet_position(size_t i, double *lat, double *lon) {
+    for (;;) {
+        uint32_t s0 = atomic_load_explicit(&f_pos_seq[i], memory_order_acquire);
+        double la = atomic_load_explicit(&f_pub_lat[i], memory_order_relaxed);
+        double lo = atomic_load_explicit(&f_pub_lon[i], memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+        uint32_t s1 = atomic_load_explicit(&f_pos_seq[i], memory_order_relaxed);
+        if (s0 == s1 && !(s0 & 1)) {
+            *lat = la;
+            *lon = lo;
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Random-walks every truck by up to SIM_WALK_M in each axis. Each
+ * truck draws from its own PRNG, so a run is reproducible for a given seed.
+ */
+static void fleet_step(size_t n) {
+    const double m_to_deg = 1.0 / 111320.0;
+    for (size_t i = 0; i < n; ++i) {
+        double dy = (prng_double(&f_rng[i]) - 0.5) * 2.0 * SIM_WALK_M;
+        double dx = (prng_double(&f_rng[i]) - 0.5) * 2.0 * SIM_WALK_M;
+        f_lat[i] += dy * m_to_deg;
+        f_lon[i] += dx * m_to_deg / f_cos_lat[i];
+        fleet_publish(i);
+    }
+    // The longitude scale barely moves between steps; refresh it in a separate
+    // pass so the loop above stays free of libm calls
+    for (size_t i = 0; i < n; ++i) f_cos_lat[i] = cos(f_lat[i] * M_PI / 180.0);
+}
+
+// Sends the datagrams filled so far with one sendmmsg call
+static void flush_batch(void) {
+    if (sim_nbatch == 0) return;
+    const void *bufs[SIM_BATCH_DGRAMS];
+    size_t lens[SIM_BATCH_DGRAMS];
+    for (int i = 0; i < sim_nbatch; ++i) {
+        bufs[i] = sim_batch[i].buf;
+        lens[i] = sim_batch[i].len;
+    }
+    int sent = udp_send_batch(mc_fd, sim_batch_to, bufs, lens, sim_nbatch);
+    if (sent < 0) sent = 0;
+    for (int i = 0; i < sim_nbatch; ++i) {
+        if (i < sent) stat_hb += (unsigned long)sim_batch[i].count;
+        else stat_hb_err += (unsigned long)sim_batch[i].count;
+        hb_batch_reset(&sim_batch[i]);
+    }
+    stat_dgrams += (unsigned long)sent;
+    sim_nbatch = 0;
+}
+
+// Group truck i sends to
+static struct sockaddr_in hb_dest(size_t i) {
+    struct sockaddr_in to = mc_addr;
+    if (mc_tile_km > 0) to.sin_addr = mcregion_group(mc_tile_km, f_lat[i], f_lon[i]);
+    return to;
+}
+
+// Batch mode: adds truck i to a datagram for its group, starting a new one
+// (and sending the lot when all are in use) if none has room
+static void batch_hb(size_t i, const HbMotion *m) {
+    struct sockaddr_in to = hb_dest(i);
+    uint32_t seq = ++f_seq[i];
+    for (int b = sim_nbatch - 1; b >= 0; --b) {
+        if (sim_batch_to[b].sin_addr.s_addr == to.sin_addr.s_addr &&
+            hb_batch_add(&sim_batch[b], f_id[i], f_lat[i], f_lon[i], base_port + (int)i, time(NULL), seq, m) == 0)
+            return;
+    }
+    if (sim_nbatch == SIM_BATCH_DGRAMS) flush_batch();
+    int b = sim_nbatch++;
+    sim_batch_to[b] = to;
+    if (hb_batch_add(&sim_batch[b], f_id[i], f_lat[i], f_lon[i], base_port + (int)i, time(NULL), seq, m) < 0)
+        stat_hb_err++;
+}
+
+static void send_hb(size_t i) {
+    char buf[MAX_LINE];
+    HbMotion m = { .vn = 0, .ve = 0, .keepalive_s = hb_keepalive_s };
+    const HbMotion *mp = hb_adaptive ? &m : NULL;
+    if (hb_batch) {
+        batch_hb(i, mp);
+        return;
+    }
+    int len;
+    if (hb_binary)
+        len = format_hb_bin_motion((uint8_t *)buf, sizeof(buf), f_id[i], f_lat[i], f_lon[i],
+                                   base_port + (int)i, time(NULL), ++f_seq[i], mp);
+    else
+        len = format_hb_motion(buf, sizeof(buf), f_id[i], f_lat[i], f_lon[i], base_port + (int)i,
+                               time(NULL), mp);
+    struct sockaddr_in to = hb_dest(i);
+    if (len > 0 && sendto(mc_fd, buf, (size_t)len, 0, (struct sockaddr *)&to, sizeof(to)) == len) {
+        stat_hb++;
+        stat_dgrams++;
+    } else {
+        stat_hb_err++;
+    }
+}
+
+// Adaptive mode: sends truck i's heartbeat only if receivers need it.
+// The whole fleet announces itself in the first interval; truck i's first
+// keepalive then comes i % ka intervals early so that they do not all
+// repeat in the same one.
+static void maybe_send_hb(size_t i, long interval) {
+    long ka = (long)hb_keepalive_s * 1000 / HB_INTERVAL_MS;
+    if (ka < 1) ka = 1;
+    int first = f_sent_at[i] == LONG_MIN;
+    if (!first && interval - f_sent_at[i] < ka &&
+        haversine_km(f_lat[i], f_lon[i], f_sent_lat[i], f_sent_lon[i]) * 1000.0 <= hb_threshold_m)
+        return;
+    send_hb(i);
+    f_sent_lat[i] = f_lat[i];
+    f_sent_lon[i] = f_lon[i];
+    f_sent_at[i] = first ? interval - (long)(i % (size_t)ka) : interval;
+}
+
+// --- Scheduler Thread ---
+
+/**
+ * @brief Drives positions and heartbeats from absolute deadlines. Each
+ * interval is cut into slots; at slot k the trucks [k*N/S, (k+1)*N/S) send.
+ * A slot that starts late is counted but still sent, so no truck skips a
+ * heartbeat.
+ */
+static void *th_sched(void *arg) {
+    (void)arg;
+    size_t n = (size_t)n_trucks;
+    size_t slots = n < SIM_SLOTS_MAX ? n : SIM_SLOTS_MAX;
+    if (hb_batch) {
+        size_t want = (n + SIM_BATCH_SLOT - 1) / SIM_BATCH_SLOT;
+        if (want < slots) slots = want;
+    }
+    for (int i = 0; i < SIM_BATCH_DGRAMS; ++i) hb_batch_reset(&sim_batch[i]);
+    long slot_ns = (long)HB_INTERVAL_MS * 1000000L / (long)slots;
+
+    long start = mono_ns();
+    long next_step = start, next_stats = start + SIM_STATS_SEC * 1000000000L;
+    unsigned long last_hb = 0, last_dgrams = 0, last_pings = 0;
+
+    for (unsigned long tick = 0; running; ++tick) {
+        long deadline = start + (long)tick * slot_ns;
+        struct timespec ts = { deadline / 1000000000L, deadline % 1000000000L };
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0 && running) {}
+        long now = mono_ns();
+        if (now - deadline > slot_ns) stat_late++;
+
+        if (now >= next_step) {
+            fleet_step(n);
+            next_step += SIM_STEP_MS * 1000000L;
+        }
+
+        size_t k = tick % slots;
+        for (size_t i = k * n / slots; i < (k + 1) * n / slots; ++i) {
+            if (hb_adaptive) maybe_send_hb(i, (long)(tick / slots));
+            else send_hb(i);
+        }
+        flush_batch();
+
+        if (now >= next_stats) {
+            unsigned long pings = __atomic_load_n(&stat_pings, __ATOMIC_RELAXED);
+            fprintf(stderr, "sim: %zu trucks, %.0f hb/s in %.0f datagrams/s (%lu send errors, %lu late slots), %.0f pings/s\n",
+                    n, (double)(stat_hb - last_hb) / SIM_STATS_SEC,
+                    (double)(stat_dgrams - last_dgrams) / SIM_STATS_SEC, stat_hb_err, stat_late,
+                    (double)(pings - last_pings) / SIM_STATS_SEC);
+            last_hb = stat_hb;
+            last_dgrams = stat_dgrams;
+            last_pings = pings;
+            next_stats += SIM_STATS_SEC * 1000000000L;
+        }
+    }
+    return NULL;
+}
+
+// --- PING Handler (shared by all trucks; ctx is the truck index) ---
+
+static int handle_ping(void *ctx, const char *line, char *out, size_t out_n, int *keepalive) {
+    size_t i = (size_t)(uintptr_t)ctx;
+    PingMsg p;
+    int err = proto_parse_ping(line, strlen(line), &p);
+    if (err == PROTO_ERR_TYPE) {
+        // Nothing is queued here, so there is never anything to cancel
+        CancelMsg m;
+        if (proto_parse_cancel(line, strlen(line), &m) != PROTO_OK) return -1;
+        *keepalive = m.keepalive;
+        return format_ack(out, out_n, f_id[i], 0, 0);
+    }
+    if (err != PROTO_OK) return -1;
+    *keepalive = p.keepalive;
+
+    double km = 0.0;
+    if (p.has_loc) {
+        double lat, lon;
+        fleet_position(i, &lat, &lon);
+        km = haversine_km(lat, lon, p.lat, p.lon);
+    }
+    int eta = (int)ceil(km / speed_kmh * 60.0 + service_min);
+    __atomic_add_fetch(&stat_pings, 1, __ATOMIC_RELAXED);
+    return format_ack(out, out_n, f_id[i], eta, 1);
+}
+
+// --- Setup ---
+
+int main(int argc, char **argv) {
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--trucks") && i + 1 < argc) n_trucks = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--base-port") && i + 1 < argc) base_port = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--workers") && i + 1 < argc) n_workers = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--center-lat") && i + 1 < argc) center_lat = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--center-lon") && i + 1 < argc) center_lon = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--spread-km") && i + 1 < argc) spread_km = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--seed") && i + 1 < argc) seed = strtoull(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "--speed-kmh") && i + 1 < argc) speed_kmh = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--service-min") && i + 1 < argc) service_min = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--hb-format") && i + 1 < argc) {
+            const char *f = argv[++i];
+            if (!strcmp(f, "binary")) hb_binary = 1, hb_batch = 0;
+            else if (!strcmp(f, "batch")) hb_binary = hb_batch = 1;
+            else if (!strcmp(f, "text")) hb_binary = hb_batch = 0;
+            else { fprintf(stderr, "unknown --hb-format '%s' (use text|binary|batch)\n", f); return 1; }
+        }
+        else if (!strcmp(argv[i], "--hb-mode") && i + 1 < argc) {
+            const char *m = argv[++i];
+            if (!strcmp(m, "adaptive")) hb_adaptive = 1;
+            else if (!strcmp(m, "fixed")) hb_adaptive = 0;
+            else { fprintf(stderr, "unknown --hb-mode '%s' (use fixed|adaptive)\n", m); return 1; }
+        }
+        else if (!strcmp(argv[i], "--hb-threshold-m") && i + 1 < argc) hb_threshold_m = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--hb-keepalive-s") && i + 1 < argc) hb_keepalive_s = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--mc-tile-km") && i + 1 < argc) mc_tile_km = atof(argv[++i]);
+    }
+    if (n_trucks < 1 || base_port < 1 || base_port + n_trucks - 1 > 65535) {
+        fprintf(stderr, "--trucks %d from --base-port %d does not fit in the port range\n", n_trucks, base_port);
+        return 1;
+    }
+    if (speed_kmh <= 0) speed_kmh = 30.0;
+    if (hb_keepalive_s < 1) hb_keepalive_s = 1;
+
+    size_t n = (size_t)n_trucks;
+    // One descriptor per truck port, plus sockets for clients being served
+    if (raise_fd_limit(n + 1024) < 0) {
+        fprintf(stderr, "cannot raise the open file limit to %zu (see ulimit -n)\n", n + 1024);
+        return 1;
+    }
+    if (fleet_alloc(n) < 0) {
+        perror("fleet_alloc");
+        return 1;
+    }
+
+    signal(SIGINT, on_sig);
+    signal(SIGTERM, on_sig);
+    signal(SIGPIPE, SIG_IGN);
+
+    if (udp_mc_sender(MC_GROUP, MC_PORT, &mc_fd, &mc_addr) < 0) {
+        perror("udp_mc_sender");
+        return 1;
+    }
+
+    Server *srv = server_create(SERVER_EPOLL, n_workers, handle_ping);
+    if (!srv) {
+        perror("server_create");
+        return 1;
+    }
+    for (size_t i = 0; i < n; ++i) {
+        if (tcp_listen((uint16_t)(base_port + (int)i), 128, &f_listen_fd[i]) < 0 ||
+            server_add_listener(srv, f_listen_fd[i], (void *)(uintptr_t)i) < 0) {
+            fprintf(stderr, "cannot listen on port %d: ", base_port + (int)i);
+            perror("");
+            return 1;
+        }
+    }
+
+    pthread_t ts;
+    if (pthread_create(&ts, NULL, th_sched, NULL) != 0) {
+        perror("pthread_create");
+        return 1;
+    }
+    fprintf(stderr, "fleet_sim: %zu trucks on ports %d-%d, mc=%s:%d, %d event loop(s)\n",
+            n, base_port, base_port + n_trucks - 1, MC_GROUP, MC_PORT, n_workers);
+
+    server_run(srv, &running);
+    running = 0;
+    pthread_join(ts, NULL);
+
+    server_destroy(srv);
+    for (size_t i = 0; i < n; ++i) close(f_listen_fd[i]);
+    close(mc_fd);
+    return 0;
+}
@@ -0,0 +1,423 @@
+#define _GNU_SOURCE               // MSG_NOSIGNAL, EPOLLRDHUP
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "common.h"
+#include "util.h"
+#include "protocol.h"
+#include "registry.h"
+#include "gateway.h"
+
+#define GW_SUB_MAX_BYTES (1u << 20)
+#define GW_IOV_MAX 64             // blocks handed to one sendmsg call
+#define GW_EPOLL_EVENTS 64
+
+/*
+ * One block of complete lines, shared by every subscriber it is queued on.
+ * Freed when the last subscriber has sent (or dropped) it.
+ */
+typedef struct {
+    size_t refs;
+    size_t len;
+    char data[];
+} Block;
+
+typedef struct {
+    int fd;
+    size_t idx;               // position in Gateway.subs
+    Block **q;                // ring of queued blocks
+    size_t qhead, qlen, qcap;
+    size_t off;               // bytes of q[qhead] already sent
+    size_t backlog;           // unsent bytes over the whole queue
+    int resync;               // deltas were dropped: send a SNAP once drained
+    int want_out;             // EPOLLOUT is armed
+} Sub;
+
+typedef struct {
+    TruckInfo sent;           // what subscribers were last told
+    unsigned char known;      // subscribers have an ADD for this truck
+    unsigned char dirty;      // on the dirty list
+} SlotState;
+
+typedef struct {
+    char *buf;
+    size_t len, cap;
+} Text;
+
+struct Gateway {
+    Registry *reg;
+    SlotState *slot;
+    size_t nslot;
+    int *dirty;
+    size_t ndirty, dirty_cap;
+
+    Text delta;               // DEL lines from expiry, then this publish's lines
+    Block *snap;              // SNAP of the known state, NULL once stale
+
+    Sub **subs;
+    size_t nsubs, subs_cap;
+    size_t sub_max;
+    int epfd;
+
+    GwStats st;
+};
+
+// --- Blocks ---
+
+static Block *block_new(const char *data, size_t len) {
+    Block *b = malloc(sizeof(*b) + len);
+    if (!b) return NULL;
+    b->refs = 1;
+    b->len = len;
+    memcpy(b->data, data, len);
+    return b;
+}
+
+static void block_unref(Block *b) {
+    if (b && --b->refs == 0) free(b);
+}
+
+static int text_reserve(Text *t, size_t more) {
+    if (t->len + more <= t->cap) return 0;
+    size_t cap = t->cap ? t->cap : 4096;
+    while (cap < t->len + more) cap *= 2;
+    char *p = realloc(t->buf, cap);
+    if (!p) return -1;
+    t->buf = p;
+    t->cap = cap;
+    return 0;
+}
+
+// Appends one formatted line (at most MAX_MSG_LEN bytes)
+static int text_line(Text *t, int len, const char *line) {
+    if (len <= 0 || len >= MAX_MSG_LEN || text_reserve(t, (size_t)len) < 0) return -1;
+    memcpy(t->buf + t->len, line, (size_t)len);
+    t->len += (size_t)len;
+    return 0;
+}
+
+// --- Construction ---
+
+Gateway *gw_create(size_t cap_hint, size_t sub_max_bytes) {
+    Gateway *g = calloc(1, sizeof(*g));
+    if (!g) return NULL;
+    g->sub_max = sub_max_bytes ? sub_max_bytes : GW_SUB_MAX_BYTES;
+    g->reg = registry_create(cap_hint);
+    g->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (!g->reg || g->epfd < 0) {
+        gw_destroy(g);
+        return NULL;
+    }
+    return g;
+}
+
+static void sub_close(Gateway *g, Sub *s);
+
+void gw_destroy(Gateway *g) {
+    if (!g) return;
+    while (g->nsubs > 0) sub_close(g, g->subs[g->nsubs - 1]);
+    block_unref(g->snap);
+    if (g->epfd >= 0) close(g->epfd);
+    registry_destroy(g->reg);
+    free(g->slot);
+    free(g->dirty);
+    free(g->delta.buf);
+    free(g->subs);
+    free(g);
+}
+
+// --- Fleet State ---
+
+static int slot_reserve(Gateway *g, size_t n) {
+    if (n <= g->nslot) return 0;
+    size_t cap = g->nslot ? g->nslot : 256;
+    while (cap < n) cap *= 2;
+    SlotState *p = realloc(g->slot, cap * sizeof(*p));
+    if (!p) return -1;
+    memset(p + g->nslot, 0, (cap - g->nslot) * sizeof(*p));
+    g->slot = p;
+    g->nslot = cap;
+    return 0;
+}
+
+// The known set changed: the cached SNAP no longer matches it
+static void snap_invalidate(Gateway *g) {
+    block_unref(g->snap);
+    g->snap = NULL;
+}
+
+int gw_heartbeat(Gateway *g, const TruckInfo *ti) {
+    int s = registry_upsert(g->reg, ti);
+    if (s < 0 || slot_reserve(g, registry_slots(g->reg)) < 0) return -1;
+    SlotState *ss = &g->slot[s];
+    if (ss->dirty) return 0;
+    if (g->ndirty == g->dirty_cap) {
+        size_t cap = g->dirty_cap ? 2 * g->dirty_cap : 256;
+        int *p = realloc(g->dirty, cap * sizeof(*p));
+        if (!p) return -1;
+        g->dirty = p;
+        g->dirty_cap = cap;
+    }
+    g->dirty[g->ndirty++] = s;
+    ss->dirty = 1;
+    return 0;
+}
+
+static void on_expire(void *ctx, int slot, const TruckInfo *ti) {
+    Gateway *g = ctx;
+    SlotState *ss = &g->slot[slot];
+    if (ss->known) {
+        char line[MAX_MSG_LEN];
+        text_line(&g->delta, format_gw_del(line, sizeof(line), ti->id), line);
+        snap_invalidate(g);
+    }
+    // A stale entry may stay on the dirty list; publish skips it
+    ss->known = 0;
+    ss->dirty = 0;
+}
+
+size_t gw_expire(Gateway *g, time_t now, int max_age) {
+    return registry_expire_fn(g->reg, now, max_age, on_expire, g);
+}
+
+// --- Subscribers ---
+
+static void sub_watch(Gateway *g, Sub *s, int want_out) {
+    if (s->want_out == want_out) return;
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLRDHUP | (want_out ? EPOLLOUT : 0) };
+    ev.data.ptr = s;
+    epoll_ctl(g->epfd, EPOLL_CTL_MOD, s->fd, &ev);
+    s->want_out = want_out;
+}
+
+static void sub_drop_queue(Sub *s, int keep_head) {
+    size_t keep = keep_head && s->qlen > 0 ? 1 : 0;
+    for (size_t i = keep; i < s->qlen; ++i) {
+        Block *b = s->q[(s->qhead + i) % s->qcap];
+        s->backlog -= b->len - (i == 0 ? s->off : 0);
+        block_unref(b);
+    }
+    s->qlen = keep;
+    if (!keep) s->off = 0;
+}
+
+static void sub_close(Gateway *g, Sub *s) {
+    epoll_ctl(g->epfd, EPOLL_CTL_DEL, s->fd, NULL);
+    close(s->fd);
+    sub_drop_queue(s, 0);
+    free(s->q);
+    Sub *last = g->subs[--g->nsubs];
+    g->subs[s->idx] = last;
+    last->idx = s->idx;
+    free(s);
+}
+
+static int sub_push(Sub *s, Block *b) {
+    if (s->qlen == s->qcap) {
+        size_t cap = s->qcap ? 2 * s->qcap : 8;
+        Block **q = malloc(cap * sizeof(*q));
+        if (!q) return -1;
+        for (size_t i = 0; i < s->qlen; ++i) q[i] = s->q[(s->qhead + i) % s->qcap];
+        free(s->q);
+        s->q = q;
+        s->qhead = 0;
+        s->qcap = cap;
+    }
+    s->q[(s->qhead + s->qlen) % s->qcap] = b;
+    s->qlen++;
+    s->backlog += b->len;
+    b->refs++;
+    return 0;
+}
+
+/**
+ * @brief Queues a delta block, or, when that would push the subscriber past
+ * its backlog limit, drops everything not yet started and marks it for a
+ * resync.
+ */
+static void sub_offer(Gateway *g, Sub *s, Block *b) {
+    if (s->resync) return;
+    if (s->backlog + b->len > g->sub_max || sub_push(s, b) < 0) {
+        sub_drop_queue(s, s->off > 0);
+        s->resync = 1;
+        g->st.resyncs++;
+    }
+}
+
+static Block *snap_block(Gateway *g) {
+    if (g->snap) return g->snap;
+    Text t = { 0 };
+    char line[MAX_MSG_LEN];
+    size_t n = 0;
+    for (size_t i = 0, ns = registry_slots(g->reg); i < ns && i < g->nslot; ++i)
+        if (g->slot[i].known) n++;
+    int rc = text_line(&t, format_gw_snap(line, sizeof(line), n), line);
+    for (size_t i = 0, ns = registry_slots(g->reg); rc == 0 && i < ns && i < g->nslot; ++i) {
+        if (!g->slot[i].known) continue;
+        rc = text_line(&t, format_gw_add(line, sizeof(line), &g->slot[i].sent), line);
+    }
+    if (rc == 0) g->snap = block_new(t.buf, t.len);
+    free(t.buf);
+    return g->snap;
+}
+
+/**
+ * @brief Writes as much of the queue as the socket takes, handing out a SNAP
+ * once a subscriber marked for resync has drained. Returns -1 when the
+ * subscriber must be closed.
+ */
+static int sub_flush(Gateway *g, Sub *s) {
+    for (;;) {
+        if (s->qlen == 0 && s->resync) {
+            Block *snap = snap_block(g);
+            if (!snap || sub_push(s, snap) < 0) return -1;
+            s->resync = 0;
+        }
+        if (s->qlen == 0) break;
+
+        struct iovec iov[GW_IOV_MAX];
+        size_t niov = s->qlen < GW_IOV_MAX ? s->qlen : GW_IOV_MAX;
+        for (size_t i = 0; i < niov; ++i) {
+            Block *b = s->q[(s->qhead + i) % s->qcap];
+            size_t skip = i == 0 ? s->off : 0;
+            iov[i].iov_base = b->data + skip;
+            iov[i].iov_len = b->len - skip;
+        }
+        struct msghdr mh = { .msg_iov = iov, .msg_iovlen = niov };
+        ssize_t k = sendmsg(s->fd, &mh, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (k < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return -1;
+        }
+        g->st.bytes_sent += (uint64_t)k;
+        size_t left = (size_t)k;
+        while (left > 0) {
+            Block *b = s->q[s->qhead];
+            size_t rest = b->len - s->off;
+            if (left < rest) {
+                s->off += left;
+                s->backlog -= left;
+                break;
+            }
+            left -= rest;
+            s->backlog -= rest;
+            s->off = 0;
+            s->qhead = (s->qhead + 1) % s->qcap;
+            s->qlen--;
+            block_unref(b);
+        }
+    }
+    sub_watch(g, s, s->qlen > 0 || s->resync);
+    return 0;
+}
+
+int gw_subscribe(Gateway *g, int fd) {
+    if (g->nsubs == g->subs_cap) {
+        size_t cap = g->subs_cap ? 2 * g->subs_cap : 64;
+        Sub **p = realloc(g->subs, cap * sizeof(*p));
+        if (!p) return -1;
+        g->subs = p;
+        g->subs_cap = cap;
+    }
+    Sub *s = calloc(1, sizeof(*s));
+    if (!s) return -1;
+    s->fd = fd;
+    s->resync = 1;
+    set_nonblocking(fd);
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLRDHUP };
+    ev.data.ptr = s;
+    if (epoll_ctl(g->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        free(s);
+        return -1;
+    }
+    s->idx = g->nsubs;
+    g->subs[g->nsubs++] = s;
+    if (sub_flush(g, s) < 0) {
+        sub_close(g, s);
+        g->st.disconnects++;
+    }
+    return 0;
+}
+
+int gw_epoll_fd(const Gateway *g) { return g->epfd; }
+
+void gw_service(Gateway *g) {
+    struct epoll_event evs[GW_EPOLL_EVENTS];
+    int n = epoll_wait(g->epfd, evs, GW_EPOLL_EVENTS, 0);
+    for (int i = 0; i < n; ++i) {
+        Sub *s = evs[i].data.ptr;
+        int dead = (evs[i].events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) != 0;
+        if (!dead && (evs[i].events & EPOLLIN)) {
+            // Subscribers have nothing to say; read only to notice a close
+            char junk[256];
+            ssize_t k = recv(s->fd, junk, sizeof(junk), MSG_DONTWAIT);
+            if (k == 0 || (k < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) dead = 1;
+        }
+        if (!dead && (evs[i].events & EPOLLOUT)) dead = sub_flush(g, s) < 0;
+        if (dead) {
+            sub_close(g, s);
+            g->st.disconnects++;
+        }
+    }
+}
+
+// --- Publishing ---
+
+size_t gw_publish(Gateway *g) {
+    char line[MAX_MSG_LEN];
+    for (size_t i = 0; i < g->ndirty; ++i) {
+        int s = g->dirty[i];
+        SlotState *ss = &g->slot[s];
+        if (!ss->dirty) continue;
+        ss->dirty = 0;
+        const TruckInfo *ti = registry_get(g->reg, s);
+        if (!ti) continue;
+        int len;
+        if (!ss->known || ss->sent.tcp_port != ti->tcp_port ||
+            ss->sent.last_ip.s_addr != ti->last_ip.s_addr) {
+            len = format_gw_add(line, sizeof(line), ti);
+        } else if (ss->sent.lat != ti->lat || ss->sent.lon != ti->lon) {
+            len = format_gw_mov(line, sizeof(line), ti);
+        } else {
+            continue;   // heartbeat without news
+        }
+        if (text_line(&g->delta, len, line) < 0) continue;
+        ss->sent = *ti;
+        ss->known = 1;
+    }
+    g->ndirty = 0;
+
+    size_t len = g->delta.len;
+    if (len == 0) return 0;
+    snap_invalidate(g);
+    Block *b = block_new(g->delta.buf, len);
+    g->delta.len = 0;
+    if (!b) return 0;
+    g->st.published++;
+
+    // Backwards, so closing a subscriber (swap with the last) skips no one
+    for (size_t i = g->nsubs; i-- > 0;) {
+        Sub *s = g->subs[i];
+        sub_offer(g, s, b);
+        if (sub_flush(g, s) < 0) {
+            sub_close(g, s);
+            g->st.disconnects++;
+        }
+    }
+    block_unref(b);
+    return len;
+}
+
+void gw_stats(const Gateway *g, GwStats *out) {
+    *out = g->st;
+    out->trucks = registry_count(g->reg);
+    out->subscribers = g->nsubs;
+}
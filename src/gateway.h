@@ -0,0 +1,57 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include "common.h"
+
+/*
+ * Fan-out core of the fleet gateway.
+ *
+ * The gateway owns the authoritative truck registry: heartbeats go in with
+ * gw_heartbeat(), stale trucks go out with gw_expire(). gw_publish() turns
+ * everything that changed since the last call into one block of delta lines
+ * (see the gateway stream in protocol.h: DEL first, then ADD / MOV), and the
+ * same reference-counted block is queued on every subscriber. A truck that
+ * moved five times between publishes costs one MOV line.
+ *
+ * Subscriber sockets are non-blocking. When a subscriber's unsent backlog
+ * would pass sub_max_bytes its queued deltas are thrown away (a block that
+ * is already half sent is finished first, so lines are never cut) and, once
+ * the socket drains, it gets a fresh SNAP of the current fleet instead. Slow
+ * viewers therefore see fewer, coalesced updates and never slow down the
+ * others. The snapshot block is built once per change and shared too.
+ *
+ * Not thread-safe: one thread drives the whole gateway. gw_epoll_fd() is an
+ * epoll descriptor covering every subscriber; when it polls readable, call
+ * gw_service().
+ */
+
+typedef struct Gateway Gateway;
+
+typedef struct {
+    size_t trucks;
+    size_t subscribers;
+    uint64_t published;     // delta blocks built
+    uint64_t bytes_sent;
+    uint64_t resyncs;       // subscribers that fell behind and were resent a SNAP
+    uint64_t disconnects;   // subscribers closed by the peer or on a send error
+} GwStats;
+
+// sub_max_bytes = unsent bytes a subscriber may have queued (0 = 1 MiB)
+Gateway *gw_create(size_t cap_hint, size_t sub_max_bytes);
+void gw_destroy(Gateway *g);
+
+// Records one heartbeat (ti->last_seen and ti->last_ip already set)
+int gw_heartbeat(Gateway *g, const TruckInfo *ti);
+// Drops trucks not heard from within max_age seconds; returns how many
+size_t gw_expire(Gateway *g, time_t now, int max_age);
+// Sends the pending deltas to every subscriber; returns the block size in bytes
+size_t gw_publish(Gateway *g);
+
+// Takes ownership of a connected socket and starts it with a SNAP
+int gw_subscribe(Gateway *g, int fd);
+int gw_epoll_fd(const Gateway *g);
+// Handles subscriber socket events without blocking
+void gw_service(Gateway *g);
+
+void gw_stats(const Gateway *g, GwStats *out);
@@ -0,0 +1,211 @@
+#define _DEFAULT_SOURCE  // M_PI
+
+#include <math.h>
+#include <string.h>
+
+#include "geo.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define GEO_HAVE_AVX2 1
+#include <immintrin.h>
+#endif
+
+#define D2R (M_PI / 180.0)
+
+// Points per chunk in geo_within_radius (stack buffers)
+#define GEO_CHUNK 256
+
+void geo_origin_init(GeoOrigin *o, double lat_deg, double lon_deg) {
+    o->lat = lat_deg * D2R;
+    o->lon = lon_deg * D2R;
+    o->cos_lat = cos(o->lat);
+    o->sin_lat = sin(o->lat);
+    o->lat_deg = lat_deg;
+}
+
+// Longitude difference folded into [-pi, pi]
+static double wrap_pi(double x) {
+    if (x > M_PI) x -= 2 * M_PI;
+    else if (x < -M_PI) x += 2 * M_PI;
+    return x;
+}
+
+// --- Scalar Kernel ---
+
+void geo_haversine_batch_scalar(const GeoOrigin *o, const double *lat, const double *lon,
+                                size_t n, double *km) {
+    for (size_t i = 0; i < n; ++i) {
+        double la = lat[i] * D2R;
+        double s1 = sin((la - o->lat) * 0.5);
+        double s2 = sin(wrap_pi(lon[i] * D2R - o->lon) * 0.5);
+        double a = s1 * s1 + o->cos_lat * cos(la) * s2 * s2;
+        if (a > 1.0) a = 1.0;
+        km[i] = 2.0 * GEO_EARTH_KM * asin(sqrt(a));
+    }
+}
+
+// --- AVX2 Kernel ---
+
+#ifdef GEO_HAVE_AVX2
+
+#define GEO_AVX2 __attribute__((target("avx2,fma")))
+
+// Taylor series of sin on [-pi/2, pi/2]; the first omitted term is < 3e-16
+static const double SIN_C[] = {
+    -0.16666666666666666, 0.008333333333333333, -0.0001984126984126984,
+    2.7557319223985893e-06, -2.505210838544172e-08, 1.6059043836821613e-10,
+    -7.647163731819816e-13, 2.8114572543455206e-15, -8.22063524662433e-18,
+};
+
+// Taylor series of asin on [0, 0.5]; the tail after x^45 is < 3e-17
+static const double ASIN_C[] = {
+    0.16666666666666666, 0.075, 0.044642857142857144, 0.030381944444444444,
+    0.022372159090909092, 0.017352764423076924, 0.01396484375, 0.011551800896139705,
+    0.009761609529194078, 0.008390335809616815, 0.0073125258735988454, 0.006447210311889649,
+    0.005740037670841924, 0.005153309682319905, 0.004660143486915096, 0.004240907093679363,
+    0.003880964558837669, 0.0035692053938259347, 0.003297059503473485, 0.0030578216492580306,
+    0.002846178401108942, 0.00265787063820729,
+};
+
+// x + x * z * P(z) with z = x^2, Horner from the highest coefficient
+GEO_AVX2 static __m256d odd_poly(__m256d x, const double *c, int nc) {
+    __m256d z = _mm256_mul_pd(x, x);
+    __m256d p = _mm256_set1_pd(c[nc - 1]);
+    for (int k = nc - 2; k >= 0; --k) p = _mm256_fmadd_pd(p, z, _mm256_set1_pd(c[k]));
+    return _mm256_fmadd_pd(_mm256_mul_pd(x, z), p, x);
+}
+
+GEO_AVX2 static void haversine_avx2(const GeoOrigin *o, const double *lat, const double *lon,
+                                    size_t n, double *km) {
+    const int nsin = (int)(sizeof(SIN_C) / sizeof(SIN_C[0]));
+    const int nasin = (int)(sizeof(ASIN_C) / sizeof(ASIN_C[0]));
+    const __m256d d2r = _mm256_set1_pd(D2R);
+    const __m256d half = _mm256_set1_pd(0.5);
+    const __m256d one = _mm256_set1_pd(1.0);
+    const __m256d half_pi = _mm256_set1_pd(M_PI / 2);
+    const __m256d two_pi = _mm256_set1_pd(2 * M_PI);
+    const __m256d inv_two_pi = _mm256_set1_pd(1.0 / (2 * M_PI));
+    const __m256d sign = _mm256_set1_pd(-0.0);
+    const __m256d lat1 = _mm256_set1_pd(o->lat);
+    const __m256d lon1 = _mm256_set1_pd(o->lon);
+    const __m256d cos1 = _mm256_set1_pd(o->cos_lat);
+    const __m256d diam = _mm256_set1_pd(2.0 * GEO_EARTH_KM);
+
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d la = _mm256_mul_pd(_mm256_loadu_pd(lat + i), d2r);
+        __m256d dlon = _mm256_fmsub_pd(_mm256_loadu_pd(lon + i), d2r, lon1);
+        dlon = _mm256_fnmadd_pd(two_pi,
+                                _mm256_round_pd(_mm256_mul_pd(dlon, inv_two_pi),
+                                                _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC),
+                                dlon);
+
+        __m256d s1 = odd_poly(_mm256_mul_pd(_mm256_sub_pd(la, lat1), half), SIN_C, nsin);
+        __m256d s2 = odd_poly(_mm256_mul_pd(dlon, half), SIN_C, nsin);
+        // cos(lat) = sin(pi/2 - |lat|), keeping the argument in range
+        __m256d c2 = odd_poly(_mm256_sub_pd(half_pi, _mm256_andnot_pd(sign, la)), SIN_C, nsin);
+
+        __m256d a = _mm256_fmadd_pd(_mm256_mul_pd(cos1, c2), _mm256_mul_pd(s2, s2),
+                                    _mm256_mul_pd(s1, s1));
+        a = _mm256_min_pd(_mm256_max_pd(a, _mm256_setzero_pd()), one);
+        __m256d h = _mm256_sqrt_pd(a);
+
+        // asin(h) = pi/2 - 2 asin(sqrt((1 - h) / 2)) above 0.5
+        __m256d big = _mm256_cmp_pd(h, half, _CMP_GT_OQ);
+        __m256d x = _mm256_blendv_pd(h, _mm256_sqrt_pd(_mm256_mul_pd(_mm256_sub_pd(one, h), half)), big);
+        __m256d p = odd_poly(x, ASIN_C, nasin);
+        __m256d r = _mm256_blendv_pd(p, _mm256_fnmadd_pd(_mm256_set1_pd(2.0), p, half_pi), big);
+
+        _mm256_storeu_pd(km + i, _mm256_mul_pd(diam, r));
+    }
+    geo_haversine_batch_scalar(o, lat + i, lon + i, n - i, km + i);
+}
+
+static int have_avx2(void) {
+    static int cached = -1;
+    if (cached < 0) cached = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    return cached;
+}
+
+#endif // GEO_HAVE_AVX2
+
+// --- Dispatch ---
+
+void geo_haversine_batch(const GeoOrigin *o, const double *lat, const double *lon,
+                         size_t n, double *km) {
+#ifdef GEO_HAVE_AVX2
+    if (have_avx2()) {
+        haversine_avx2(o, lat, lon, n, km);
+        return;
+    }
+#endif
+    geo_haversine_batch_scalar(o, lat, lon, n, km);
+}
+
+const char *geo_kernel_name(void) {
+#ifdef GEO_HAVE_AVX2
+    if (have_avx2()) return "avx2";
+#endif
+    return "scalar";
+}
+
+// --- Equirectangular Prefilter ---
+
+/**
+ * @brief Flat-earth distance using the cosine of the mean latitude,
+ * expanded to second order around the origin so no cos() is needed per
+ * point. See GEO_EQUIRECT_ERR for the error bound.
+ */
+double geo_equirect_km(const GeoOrigin *o, double lat_deg, double lon_deg) {
+    double dlat = lat_deg * D2R - o->lat;
+    double m = dlat * 0.5;
+    double cos_mid = o->cos_lat - o->sin_lat * m - o->cos_lat * m * m * 0.5;
+    double x = wrap_pi(lon_deg * D2R - o->lon) * cos_mid;
+    return GEO_EARTH_KM * sqrt(x * x + dlat * dlat);
+}
+
+void geo_dead_reckon(double lat_deg, double lon_deg, double vn, double ve, double dt_s,
+                     double *lat_out, double *lon_out) {
+    double dlat = vn * dt_s / (GEO_EARTH_KM * 1000.0);
+    double c = cos(lat_deg * D2R);
+    double dlon = c > 1e-6 ? ve * dt_s / (GEO_EARTH_KM * 1000.0 * c) : 0.0;
+    *lat_out = lat_deg + dlat / D2R;
+    *lon_out = lon_deg + dlon / D2R;
+    if (*lon_out > 180.0) *lon_out -= 360.0;
+    else if (*lon_out < -180.0) *lon_out += 360.0;
+}
+
+/**
+ * @brief Radius query over SoA buffers. When the error bound applies,
+ * points whose equirectangular distance is clearly outside the radius are
+ * dropped first and only the survivors go through the batch haversine.
+ */
+size_t geo_within_radius(const GeoOrigin *o, const double *lat, const double *lon,
+                         size_t n, double km, uint32_t *idx, double *dist) {
+    int prefilter = km <= GEO_EQUIRECT_MAX_KM && fabs(o->lat_deg) <= 70.0;
+    double reject_km = km * (1.0 + GEO_EQUIRECT_ERR);
+
+    size_t found = 0;
+    double clat[GEO_CHUNK], clon[GEO_CHUNK], ckm[GEO_CHUNK];
+    uint32_t cidx[GEO_CHUNK];
+
+    for (size_t base = 0; base < n; base += GEO_CHUNK) {
+        size_t end = base + GEO_CHUNK < n ? base + GEO_CHUNK : n;
+        size_t m = 0;
+        for (size_t i = base; i < end; ++i) {
+            if (prefilter && geo_equirect_km(o, lat[i], lon[i]) > reject_km) continue;
+            clat[m] = lat[i];
+            clon[m] = lon[i];
+            cidx[m] = (uint32_t)i;
+            m++;
+        }
+        geo_haversine_batch(o, clat, clon, m, ckm);
+        for (size_t j = 0; j < m; ++j) {
+            if (ckm[j] > km) continue;
+            idx[found] = cidx[j];
+            if (dist) dist[found] = ckm[j];
+            found++;
+        }
+    }
+    return found;
+}
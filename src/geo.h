@@ -0,0 +1,53 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Batch distance kernels over structure-of-arrays lat/lon buffers (degrees).
+ *
+ * A GeoOrigin holds the per-origin terms (radians, cos/sin of the latitude)
+ * so they are computed once per query instead of once per truck.
+ * geo_haversine_batch() uses an AVX2/FMA kernel with polynomial sin/asin
+ * when the CPU supports it (agrees with haversine_km() to ~1e-12 relative)
+ * and a libm loop otherwise.
+ *
+ * geo_equirect_km() is a flat-earth approximation costing a few multiplies.
+ * For points within GEO_EQUIRECT_MAX_KM of an origin with |lat| <= 70 deg its
+ * relative error against haversine is below GEO_EQUIRECT_ERR, which is what
+ * lets geo_within_radius() reject far points without the exact formula.
+ */
+
+#define GEO_EARTH_KM 6371.0
+#define GEO_EQUIRECT_MAX_KM 500.0
+#define GEO_EQUIRECT_ERR 0.005
+
+typedef struct {
+    double lat, lon;          // radians
+    double cos_lat, sin_lat;
+    double lat_deg;
+} GeoOrigin;
+
+void geo_origin_init(GeoOrigin *o, double lat_deg, double lon_deg);
+
+// km[i] = haversine distance from o to (lat[i], lon[i])
+void geo_haversine_batch(const GeoOrigin *o, const double *lat, const double *lon,
+                         size_t n, double *km);
+// Same result using libm only; the fallback and the accuracy reference
+void geo_haversine_batch_scalar(const GeoOrigin *o, const double *lat, const double *lon,
+                                size_t n, double *km);
+
+double geo_equirect_km(const GeoOrigin *o, double lat_deg, double lon_deg);
+
+// Position after moving dt_s seconds at vn/ve m/s (north/east) from
+// (lat_deg, lon_deg); flat-earth, for the few hundred metres between
+// adaptive heartbeats
+void geo_dead_reckon(double lat_deg, double lon_deg, double vn, double ve, double dt_s,
+                     double *lat_out, double *lon_out);
+
+// Indices (and distances, if dist is not NULL) of points within km of o, in
+// input order. idx and dist must have room for n entries. Returns the count.
+size_t geo_within_radius(const GeoOrigin *o, const double *lat, const double *lon,
+                         size_t n, double km, uint32_t *idx, double *dist);
+
+// "avx2" or "scalar": the kernel geo_haversine_batch() runs on this CPU
+const char *geo_kernel_name(void);
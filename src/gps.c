@@ -1,39 +1,243 @@
+#define _DEFAULT_SOURCE  // M_PI
+
+#include <stdio.h>
 #include <stdlib.h>
-#include <math.h> // Includes sin, cos, M_PI (often via _GNU_SOURCE)
+#include <string.h>
+#include <math.h>
 #include <time.h>
+#include <stdatomic.h>
 #include "gps.h"
+#include "prng.h"
+#include "util.h"
 
 
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
 #endif
 
+#define M_PER_DEG 111320.0 // approximation of meters per degree latitude
+
+struct GpsCtx {
+    // Published position: seq is odd while an update is in progress
+    _Atomic uint32_t seq;
+    _Atomic double pub_lat, pub_lon;
+
+    // Mover thread only
+    double lat, lon;
+    double step_m;
+    Prng rng;
+    GpsMode mode;
+    GpsPoint *pts;
+    size_t npts, next;   // route target / next replay point
+    double speed_kmh;
+};
+
+
+// --- Position Snapshot (seqlock) ---
+
+static void publish(GpsCtx *g) {
+    uint32_t s = atomic_load_explicit(&g->seq, memory_order_relaxed);
+    atomic_store_explicit(&g->seq, s + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&g->pub_lat, g->lat, memory_order_relaxed);
+    atomic_store_explicit(&g->pub_lon, g->lon, memory_order_relaxed);
+    atomic_store_explicit(&g->seq, s + 2, memory_order_release);
+}
+
+void gps_position(const GpsCtx *g, double *lat, double *lon) {
+    for (;;) {
+        uint32_t s0 = atomic_load_explicit(&g->seq, memory_order_acquire);
+        double la = atomic_load_explicit(&g->pub_lat, memory_order_relaxed);
+        double lo = atomic_load_explicit(&g->pub_lon, memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+        uint32_t s1 = atomic_load_explicit(&g->seq, memory_order_relaxed);
+        if (s0 == s1 && !(s0 & 1)) {
+            *lat = la;
+            *lon = lo;
+            return;
+        }
+    }
+}
+
+
+// --- Context ---
+
+GpsCtx *gps_create(double lat0, double lon0, double max_step_m, uint64_t seed) {
+    GpsCtx *g = calloc(1, sizeof(*g));
+    if (!g) return NULL;
+    g->lat = lat0;
+    g->lon = lon0;
+    g->step_m = max_step_m > 0 ? max_step_m : 3.0;
+    prng_seed(&g->rng, seed, 0);
+    g->mode = GPS_WALK;
+    atomic_init(&g->seq, 0);
+    atomic_init(&g->pub_lat, lat0);
+    atomic_init(&g->pub_lon, lon0);
+    return g;
+}
+
+void gps_destroy(GpsCtx *g) {
+    if (!g) return;
+    free(g->pts);
+    free(g);
+}
+
+static int take_points(GpsCtx *g, const GpsPoint *pts, size_t n) {
+    if (n == 0) return -1;
+    GpsPoint *copy = malloc(n * sizeof(*copy));
+    if (!copy) return -1;
+    memcpy(copy, pts, n * sizeof(*copy));
+    free(g->pts);
+    g->pts = copy;
+    g->npts = n;
+    g->next = 0;
+    return 0;
+}
+
+int gps_set_route(GpsCtx *g, const GpsPoint *pts, size_t n, double speed_kmh) {
+    if (speed_kmh <= 0 || take_points(g, pts, n) < 0) return -1;
+    g->speed_kmh = speed_kmh;
+    g->mode = GPS_ROUTE;
+    return 0;
+}
+
+int gps_set_replay(GpsCtx *g, const GpsPoint *pts, size_t n) {
+    if (take_points(g, pts, n) < 0) return -1;
+    g->mode = GPS_REPLAY;
+    return 0;
+}
+
+void gps_set_walk(GpsCtx *g) {
+    g->mode = GPS_WALK;
+}
+
+GpsMode gps_mode(const GpsCtx *g) {
+    return g->mode;
+}
+
+void gps_set_position(GpsCtx *g, double lat, double lon) {
+    g->lat = lat;
+    g->lon = lon;
+    publish(g);
+}
+
+
+// --- Movement ---
+
+static void walk(Prng *r, double step_m, double *lat, double *lon) {
+    double meters_lat = (prng_double(r) - 0.5) * 2.0 * step_m;
+    double meters_lon = (prng_double(r) - 0.5) * 2.0 * step_m;
+
+    // Meters per degree of longitude shrink with the current latitude
+    *lat += meters_lat / M_PER_DEG;
+    *lon += meters_lon / (M_PER_DEG * cos((*lat) * M_PI / 180.0));
+}
+
+// Moves (g->lat, g->lon) up to km toward (lat, lon) without publishing
+static int move_toward(GpsCtx *g, double lat, double lon, double km) {
+    double d = haversine_km(g->lat, g->lon, lat, lon);
+    if (d <= km) {
+        g->lat = lat;
+        g->lon = lon;
+        return 1;
+    }
+    double f = km / d;
+    g->lat += (lat - g->lat) * f;
+    g->lon += (lon - g->lon) * f;
+    return 0;
+}
+
+int gps_drive_toward(GpsCtx *g, double lat, double lon, double km) {
+    int arrived = move_toward(g, lat, lon, km);
+    publish(g);
+    return arrived;
+}
 
-static double g_lat0, g_lon0, g_step_m = 3.0; // default ~3m/step
+/**
+ * @brief Route mode spends the whole step's distance: reaching a waypoint
+ * carries the remainder on toward the next one.
+ */
+static void route_step(GpsCtx *g, double dt_s) {
+    double km = g->speed_kmh * dt_s / 3600.0;
+    // Bounded so a route of identical points cannot spin forever
+    for (size_t hops = 0; km > 0 && hops <= g->npts; ++hops) {
+        const GpsPoint *p = &g->pts[g->next];
+        double d = haversine_km(g->lat, g->lon, p->lat, p->lon);
+        if (!move_toward(g, p->lat, p->lon, km)) break;
+        km -= d;
+        g->next = (g->next + 1) % g->npts;
+    }
+}
 
+void gps_advance(GpsCtx *g, double dt_s) {
+    switch (g->mode) {
+    case GPS_WALK:
+        walk(&g->rng, g->step_m, &g->lat, &g->lon);
+        break;
+    case GPS_ROUTE:
+        route_step(g, dt_s);
+        break;
+    case GPS_REPLAY:
+        g->lat = g->pts[g->next].lat;
+        g->lon = g->pts[g->next].lon;
+        g->next = (g->next + 1) % g->npts;
+        break;
+    }
+    publish(g);
+}
 
-static double urand(){ return (double)rand() / (double)RAND_MAX; }
 
+// --- Track Files ---
+
+int gps_load_points(const char *path, GpsPoint **out, size_t *n) {
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    GpsPoint *pts = NULL;
+    size_t cnt = 0, cap = 0;
+    char line[256];
+    int rc = 0;
+    while (fgets(line, sizeof(line), f)) {
+        char *s = line;
+        while (*s == ' ' || *s == '\t') s++;
+        if (*s == '#' || *s == '\n' || *s == '\r' || *s == '\0') continue;
+        double lat, lon;
+        if (sscanf(s, "%lf%*[ ,\t]%lf", &lat, &lon) != 2 ||
+            lat < -90 || lat > 90 || lon < -180 || lon > 180) {
+            rc = -1;
+            break;
+        }
+        if (cnt == cap) {
+            cap = cap ? cap * 2 : 64;
+            GpsPoint *np = realloc(pts, cap * sizeof(*np));
+            if (!np) { rc = -1; break; }
+            pts = np;
+        }
+        pts[cnt++] = (GpsPoint){ lat, lon };
+    }
+    fclose(f);
+    if (rc < 0 || cnt == 0) {
+        free(pts);
+        return -1;
+    }
+    *out = pts;
+    *n = cnt;
+    return 0;
+}
+
+
+// --- Legacy Global Walk ---
+
+static Prng g_rng;
+static double g_step_m = 3.0; // default ~3m/step
 
 void gps_init(double lat0, double lon0, double max_step_m){
-    g_lat0 = lat0; 
-    g_lon0 = lon0; 
+    (void)lat0;
+    (void)lon0;
     // Ensure g_step_m is at least 3.0 if a non-positive value is passed
-    g_step_m = max_step_m > 0 ? max_step_m : 3.0; 
-    srand((unsigned)time(NULL));
+    g_step_m = max_step_m > 0 ? max_step_m : 3.0;
+    prng_seed(&g_rng, (uint64_t)time(NULL), 0);
 }
 
-
 void gps_step(double *lat, double *lon){
-    double meters_lat = (urand() - 0.5) * 2.0 * g_step_m;
-    double meters_lon = (urand() - 0.5) * 2.0 * g_step_m;
-    
-    // Standard conversion factors for meters to degrees
-    double dlat = meters_lat / 111320.0; // approximation of meters per degree latitude
-    
-    // Approximation of meters per degree longitude, dependent on current latitude
-    double dlon = meters_lon / (111320.0 * cos((*lat) * M_PI / 180.0));
-    
-    *lat += dlat; 
-    *lon += dlon;
+    walk(&g_rng, g_step_m, lat, lon);
 }
@@ -1,3 +1,57 @@
 #pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Simulated GPS.
+ *
+ * A GpsCtx owns everything one receiver needs: its position, movement mode
+ * and a private PRNG, so any number of them can run side by side and the
+ * same seed replays the same track. One thread moves a context (the step,
+ * drive and set calls); any thread may call gps_position() at the same time.
+ * The position is published through a seqlock, so readers never block the
+ * mover and always get a lat/lon pair from the same update.
+ *
+ * Modes:
+ *   GPS_WALK   - random walk of up to max_step_m per axis per step
+ *   GPS_ROUTE  - drive along waypoints at a fixed speed, looping at the end
+ *   GPS_REPLAY - one recorded point per step, looping at the end
+ */
+
+typedef enum {
+    GPS_WALK = 0,
+    GPS_ROUTE,
+    GPS_REPLAY
+} GpsMode;
+
+typedef struct {
+    double lat, lon;
+} GpsPoint;
+
+typedef struct GpsCtx GpsCtx;
+
+GpsCtx *gps_create(double lat0, double lon0, double max_step_m, uint64_t seed);
+void gps_destroy(GpsCtx *g);
+
+// Switches to route mode (copies pts); starts toward pts[0] from the current position
+int gps_set_route(GpsCtx *g, const GpsPoint *pts, size_t n, double speed_kmh);
+// Switches to replay mode (copies pts); the next step jumps to pts[0]
+int gps_set_replay(GpsCtx *g, const GpsPoint *pts, size_t n);
+void gps_set_walk(GpsCtx *g);
+GpsMode gps_mode(const GpsCtx *g);
+
+// Advances by one step of dt_s seconds in the current mode
+void gps_advance(GpsCtx *g, double dt_s);
+// Moves up to km straight toward (lat, lon); returns 1 on arrival
+int gps_drive_toward(GpsCtx *g, double lat, double lon, double km);
+void gps_set_position(GpsCtx *g, double lat, double lon);
+// Consistent snapshot of the latest position; safe from any thread
+void gps_position(const GpsCtx *g, double *lat, double *lon);
+
+// Reads "lat,lon" (or "lat lon") per line; blank lines and '#' comments are skipped
+int gps_load_points(const char *path, GpsPoint **out, size_t *n);
+
+// Process-wide random walk kept for older callers. Not thread-safe; new code
+// should own a GpsCtx.
 void gps_init(double lat0, double lon0, double max_step_m);
-void gps_step(double *lat, double *lon);
\ No newline at end of file
+void gps_step(double *lat, double *lon);
@@ -0,0 +1,68 @@
+#include <string.h>
+
+#include "histo.h"
+
+#define SUB (1u << HISTO_SUB_BITS)        // buckets per power of two
+#define LINEAR (2u << HISTO_SUB_BITS)     // values with a bucket of their own
+
+static unsigned msb64(uint64_t v) {
+    return 63u - (unsigned)__builtin_clzll(v);
+}
+
+size_t histo_bucket(uint64_t v) {
+    if (v < LINEAR) return (size_t)v;
+    if (v >> HISTO_MAX_BITS) return HISTO_BUCKETS - 1;
+    unsigned m = msb64(v);                 // > HISTO_SUB_BITS
+    unsigned shift = m - HISTO_SUB_BITS;
+    return LINEAR + (size_t)(m - HISTO_SUB_BITS - 1) * SUB + (size_t)((v >> shift) - SUB);
+}
+
+uint64_t histo_bucket_high(size_t i) {
+    if (i < LINEAR) return i;
+    size_t k = i - LINEAR;
+    unsigned shift = (unsigned)(k / SUB) + 1;
+    uint64_t sub = SUB + k % SUB;
+    return ((sub + 1) << shift) - 1;
+}
+
+void histo_reset(Histo *h) {
+    memset(h, 0, sizeof(*h));
+    h->min = UINT64_MAX;
+}
+
+void histo_record(Histo *h, uint64_t v) {
+    h->counts[histo_bucket(v)]++;
+    h->total++;
+    h->sum += (double)v;
+    if (v < h->min) h->min = v;
+    if (v > h->max) h->max = v;
+}
+
+void histo_merge(Histo *dst, const Histo *src) {
+    for (size_t i = 0; i < HISTO_BUCKETS; ++i) dst->counts[i] += src->counts[i];
+    dst->total += src->total;
+    dst->sum += src->sum;
+    if (src->min < dst->min) dst->min = src->min;
+    if (src->max > dst->max) dst->max = src->max;
+}
+
+uint64_t histo_quantile(const Histo *h, double q) {
+    if (h->total == 0) return 0;
+    if (q <= 0) return h->min;
+    uint64_t rank = (uint64_t)(q * (double)h->total + 0.5);
+    if (rank < 1) rank = 1;
+    if (rank >= h->total) return h->max;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < HISTO_BUCKETS; ++i) {
+        seen += h->counts[i];
+        if (seen >= rank) {
+            uint64_t v = histo_bucket_high(i);
+            return v < h->max ? v : h->max;
+        }
+    }
+    return h->max;
+}
+
+double histo_mean(const Histo *h) {
+    return h->total ? h->sum / (double)h->total : 0.0;
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Log-linear latency histogram in the style of HdrHistogram.
+ *
+ * Values below 128 get one bucket each; above that every power of two is cut
+ * into 64 equal buckets, so any recorded value is reported within 1/64
+ * (1.6%) of its true size. Values up to 2^40 are tracked, which covers
+ * microseconds for about 12 days. A Histo is a plain fixed-size value: keep
+ * one per thread and merge them at the end. Not thread-safe.
+ */
+
+#define HISTO_SUB_BITS 6
+#define HISTO_MAX_BITS 40
+#define HISTO_BUCKETS ((2 << HISTO_SUB_BITS) + (HISTO_MAX_BITS - HISTO_SUB_BITS - 1) * (1 << HISTO_SUB_BITS))
+
+typedef struct {
+    uint64_t counts[HISTO_BUCKETS];
+    uint64_t total;
+    uint64_t min, max;   // exact
+    double sum;
+} Histo;
+
+void histo_reset(Histo *h);
+void histo_record(Histo *h, uint64_t v);
+void histo_merge(Histo *dst, const Histo *src);
+// Upper bound of the bucket holding the q-th (0..1) value, capped at the max
+uint64_t histo_quantile(const Histo *h, double q);
+double histo_mean(const Histo *h);
+
+// Bucket layout, for callers that keep their own (e.g. atomic) bucket arrays
+size_t histo_bucket(uint64_t v);
+// Largest value that lands in bucket i
+uint64_t histo_bucket_high(size_t i);
@@ -0,0 +1,521 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "journal.h"
+
+#define JRNL_MAGIC 0x4c4a474au    // "JGJL"
+#define JRNL_VERSION 1
+#define BLOCK_MAGIC 0x4b4c424au   // "JBLK"
+#define BLK_LZ 0x01               // block flags: stored bytes are LZ-compressed
+#define JRNL_BLOCK_RECORDS 1024
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version, header_len;
+    int64_t created;              // unix seconds
+} FileHeader;
+
+typedef struct {
+    uint32_t magic;
+    uint8_t type, flags;
+    uint16_t reserved;
+    uint32_t nrec;
+    uint32_t raw_len, stored_len;
+    uint32_t checksum;            // FNV-1a of the stored bytes
+    int64_t ts_min, ts_max;
+} BlockHeader;
+
+_Static_assert(sizeof(FileHeader) == 16, "file header layout");
+_Static_assert(sizeof(BlockHeader) == 40, "block header layout");
+
+#define HDR sizeof(BlockHeader)
+
+// --- Columns ---
+//
+// Each record type stores a fixed list of JournalRec fields. A block holds
+// column 0 for every record, then column 1, and so on, so equal neighbouring
+// values (timestamps, truck ids, zero padding) sit next to each other.
+
+enum { C_TS, C_LAT, C_LON, C_IP, C_ETA, C_QUEUED, C_TRUCK, C_USER, C_NOTE };
+
+static const struct { size_t off, width; } COLS[] = {
+    [C_TS]     = { offsetof(JournalRec, ts),       sizeof(int64_t) },
+    [C_LAT]    = { offsetof(JournalRec, lat),      sizeof(double) },
+    [C_LON]    = { offsetof(JournalRec, lon),      sizeof(double) },
+    [C_IP]     = { offsetof(JournalRec, ip),       sizeof(uint32_t) },
+    [C_ETA]    = { offsetof(JournalRec, eta_min),  sizeof(int32_t) },
+    [C_QUEUED] = { offsetof(JournalRec, queued),   sizeof(int32_t) },
+    [C_TRUCK]  = { offsetof(JournalRec, truck_id), MAX_ID_LEN },
+    [C_USER]   = { offsetof(JournalRec, user_id),  MAX_ID_LEN },
+    [C_NOTE]   = { offsetof(JournalRec, note),     sizeof(((JournalRec *)0)->note) },
+};
+
+// Columns per type in block order, -1 terminated
+static const int8_t TYPE_COLS[JREC_TYPES][8] = {
+    [JREC_PING] = { C_TS, C_LAT, C_LON, C_TRUCK, C_USER, C_NOTE, -1 },
+    [JREC_HB]   = { C_TS, C_LAT, C_LON, C_IP, C_TRUCK, -1 },
+    [JREC_ACK]  = { C_TS, C_ETA, C_QUEUED, C_TRUCK, -1 },
+};
+
+static size_t row_width(int type) {
+    size_t w = 0;
+    for (const int8_t *c = TYPE_COLS[type]; *c >= 0; ++c) w += COLS[*c].width;
+    return w;
+}
+
+static size_t encode_columns(const JournalRec *rows, size_t n, int type, uint8_t *out) {
+    uint8_t *p = out;
+    for (const int8_t *c = TYPE_COLS[type]; *c >= 0; ++c) {
+        size_t off = COLS[*c].off, w = COLS[*c].width;
+        for (size_t i = 0; i < n; ++i, p += w) memcpy(p, (const char *)&rows[i] + off, w);
+    }
+    return (size_t)(p - out);
+}
+
+static void decode_columns(const uint8_t *in, size_t n, int type, JournalRec *rows) {
+    memset(rows, 0, n * sizeof(*rows));
+    const uint8_t *p = in;
+    for (const int8_t *c = TYPE_COLS[type]; *c >= 0; ++c) {
+        size_t off = COLS[*c].off, w = COLS[*c].width;
+        for (size_t i = 0; i < n; ++i, p += w) memcpy((char *)&rows[i] + off, p, w);
+    }
+    for (size_t i = 0; i < n; ++i) {
+        rows[i].type = (uint8_t)type;
+        rows[i].truck_id[MAX_ID_LEN - 1] = '\0';
+        rows[i].user_id[MAX_ID_LEN - 1] = '\0';
+        rows[i].note[sizeof(rows[i].note) - 1] = '\0';
+    }
+}
+
+static uint32_t fnv1a(const uint8_t *p, size_t n) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < n; ++i) {
+        h ^= p[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+const char *journal_type_name(int type) {
+    switch (type) {
+    case JREC_PING: return "PING";
+    case JREC_HB:   return "HB";
+    case JREC_ACK:  return "ACK";
+    default:        return "?";
+    }
+}
+
+// --- LZ Block Codec ---
+//
+// A byte-oriented LZ77 in the style of LZ4: each sequence is a token (literal
+// count in the high nibble, match length - 4 in the low one, 15 = more length
+// bytes follow), the literals, then a 2-byte offset back into the output. The
+// last sequence has literals only. Fast enough to run on every block and
+// good at the repeats that columnar event data is full of.
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 12
+#define LZ_MAX_OFFSET 65535
+
+static uint32_t lz_hash(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static int lz_put_len(uint8_t *dst, size_t cap, size_t *op, size_t len) {
+    for (len -= 15; ; len -= 255) {
+        if (*op >= cap) return -1;
+        dst[(*op)++] = (uint8_t)(len < 255 ? len : 255);
+        if (len < 255) return 0;
+    }
+}
+
+static int lz_emit(uint8_t *dst, size_t cap, size_t *op, const uint8_t *lit, size_t nlit,
+                   size_t off, size_t mlen) {
+    size_t ml = mlen ? mlen - LZ_MIN_MATCH : 0;
+    if (*op >= cap) return -1;
+    dst[(*op)++] = (uint8_t)((nlit < 15 ? nlit : 15) << 4 | (ml < 15 ? ml : 15));
+    if (nlit >= 15 && lz_put_len(dst, cap, op, nlit) < 0) return -1;
+    if (nlit > cap - *op) return -1;
+    memcpy(dst + *op, lit, nlit);
+    *op += nlit;
+    if (!mlen) return 0;
+    if (cap - *op < 2) return -1;
+    dst[(*op)++] = (uint8_t)(off & 0xff);
+    dst[(*op)++] = (uint8_t)(off >> 8);
+    if (ml >= 15 && lz_put_len(dst, cap, op, ml) < 0) return -1;
+    return 0;
+}
+
+// Compressed size of src in dst, or 0 when it does not fit in cap bytes
+static size_t lz_compress(const uint8_t *src, size_t n, uint8_t *dst, size_t cap) {
+    uint32_t table[1u << LZ_HASH_BITS];   // position + 1 of the last 4 bytes with this hash
+    memset(table, 0, sizeof(table));
+    size_t ip = 0, anchor = 0, op = 0;
+
+    while (ip + LZ_MIN_MATCH <= n) {
+        uint32_t h = lz_hash(src + ip);
+        size_t cand = table[h];
+        table[h] = (uint32_t)ip + 1;
+        if (!cand || ip - (cand - 1) > LZ_MAX_OFFSET || memcmp(src + cand - 1, src + ip, LZ_MIN_MATCH)) {
+            ip++;
+            continue;
+        }
+        size_t m = cand - 1, len = LZ_MIN_MATCH;
+        while (ip + len < n && src[m + len] == src[ip + len]) len++;
+        if (lz_emit(dst, cap, &op, src + anchor, ip - anchor, ip - m, len) < 0) return 0;
+        ip += len;
+        anchor = ip;
+    }
+    if (lz_emit(dst, cap, &op, src + anchor, n - anchor, 0, 0) < 0) return 0;
+    return op;
+}
+
+static int lz_get_len(const uint8_t *src, size_t n, size_t *ip, size_t *len) {
+    for (;;) {
+        if (*ip >= n) return -1;
+        uint8_t b = src[(*ip)++];
+        *len += b;
+        if (b < 255) return 0;
+    }
+}
+
+// Expands exactly out_len bytes; -1 if src is not a valid stream for that size
+static int lz_decompress(const uint8_t *src, size_t n, uint8_t *dst, size_t out_len) {
+    size_t ip = 0, op = 0;
+    for (;;) {
+        if (ip >= n) return -1;
+        uint8_t tok = src[ip++];
+        size_t nlit = tok >> 4;
+        if (nlit == 15 && lz_get_len(src, n, &ip, &nlit) < 0) return -1;
+        if (nlit > n - ip || nlit > out_len - op) return -1;
+        memcpy(dst + op, src + ip, nlit);
+        ip += nlit;
+        op += nlit;
+        if (op == out_len) return ip == n ? 0 : -1;
+
+        if (n - ip < 2) return -1;
+        size_t off = src[ip] | (size_t)src[ip + 1] << 8;
+        ip += 2;
+        size_t mlen = tok & 15;
+        if (mlen == 15 && lz_get_len(src, n, &ip, &mlen) < 0) return -1;
+        mlen += LZ_MIN_MATCH;
+        if (off == 0 || off > op || mlen > out_len - op) return -1;
+        for (size_t i = 0; i < mlen; ++i, ++op) dst[op] = dst[op - off];   // may overlap
+    }
+}
+
+// --- Writer ---
+
+struct Journal {
+    char prefix[256];
+    char path[320];
+    JournalOpts o;
+    int fd;
+    uint64_t seg_bytes;
+    time_t seg_opened;
+    char seg_stamp[32];           // name stamp of the last segment, for NNN
+    unsigned seg_seq;
+    JournalRec *pend[JREC_TYPES]; // records waiting for their block
+    size_t npend[JREC_TYPES];
+    uint8_t *raw, *packed;        // header room + one block's columns / compressed copy
+};
+
+static int write_all(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t k = write(fd, p, len);
+        if (k < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += k;
+        len -= (size_t)k;
+    }
+    return 0;
+}
+
+// Opens the next segment; the current one is closed only once it exists
+static int segment_open(Journal *j) {
+    time_t now = time(NULL);
+    struct tm tm;
+    char stamp[32];
+    gmtime_r(&now, &tm);
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm);
+    if (strcmp(stamp, j->seg_stamp)) {
+        snprintf(j->seg_stamp, sizeof(j->seg_stamp), "%s", stamp);
+        j->seg_seq = 0;
+    }
+
+    int fd = -1;
+    char path[sizeof(j->path)];
+    while (fd < 0 && j->seg_seq < 1000) {
+        snprintf(path, sizeof(path), "%s-%s-%03u.jrnl", j->prefix, stamp, j->seg_seq++);
+        fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_APPEND | O_CLOEXEC, 0644);
+        if (fd < 0 && errno != EEXIST) return -1;
+    }
+    if (fd < 0) return -1;
+
+    FileHeader h = { JRNL_MAGIC, JRNL_VERSION, sizeof(FileHeader), (int64_t)now };
+    if (write_all(fd, &h, sizeof(h)) < 0) {
+        close(fd);
+        unlink(path);
+        return -1;
+    }
+    if (j->fd >= 0) close(j->fd);
+    j->fd = fd;
+    memcpy(j->path, path, sizeof(path));
+    j->seg_bytes = sizeof(h);
+    j->seg_opened = now;
+    return 0;
+}
+
+static int rotate_due(const Journal *j, size_t block_len) {
+    if (j->seg_bytes == sizeof(FileHeader)) return 0;   // never leave a segment empty
+    if (j->o.max_bytes && j->seg_bytes + block_len > j->o.max_bytes) return 1;
+    return j->o.max_secs && time(NULL) - j->seg_opened >= j->o.max_secs;
+}
+
+/**
+ * @brief Encodes the pending records of one type as a block and appends it,
+ * starting a new segment first when this one is full or old. The records are
+ * gone afterwards even if the write failed.
+ */
+static int write_block(Journal *j, int type) {
+    size_t n = j->npend[type];
+    if (n == 0) return 0;
+    j->npend[type] = 0;
+
+    const JournalRec *rows = j->pend[type];
+    size_t raw_len = encode_columns(rows, n, type, j->raw + HDR);
+    BlockHeader h = { .magic = BLOCK_MAGIC, .type = (uint8_t)type, .nrec = (uint32_t)n,
+                      .raw_len = (uint32_t)raw_len, .ts_min = rows[0].ts, .ts_max = rows[0].ts };
+    for (size_t i = 1; i < n; ++i) {
+        if (rows[i].ts < h.ts_min) h.ts_min = rows[i].ts;
+        if (rows[i].ts > h.ts_max) h.ts_max = rows[i].ts;
+    }
+
+    uint8_t *blk = j->raw;
+    size_t stored = raw_len;
+    if (j->o.compress) {
+        size_t c = lz_compress(j->raw + HDR, raw_len, j->packed + HDR, raw_len - 1);
+        if (c) {
+            blk = j->packed;
+            stored = c;
+            h.flags |= BLK_LZ;
+        }
+    }
+    h.stored_len = (uint32_t)stored;
+    h.checksum = fnv1a(blk + HDR, stored);
+    memcpy(blk, &h, HDR);
+
+    if (rotate_due(j, HDR + stored) && segment_open(j) < 0) return -1;
+    if (write_all(j->fd, blk, HDR + stored) < 0) return -1;
+    j->seg_bytes += HDR + stored;
+    return 0;
+}
+
+Journal *journal_open(const char *prefix, const JournalOpts *o) {
+    Journal *j = calloc(1, sizeof(*j));
+    if (!j) return NULL;
+    j->fd = -1;
+    if (o) j->o = *o;
+    if (!j->o.block_records) j->o.block_records = JRNL_BLOCK_RECORDS;
+    snprintf(j->prefix, sizeof(j->prefix), "%s", prefix);
+
+    size_t widest = 0;
+    for (int t = 0; t < JREC_TYPES; ++t) {
+        if (row_width(t) > widest) widest = row_width(t);
+        j->pend[t] = malloc(j->o.block_records * sizeof(JournalRec));
+    }
+    j->raw = malloc(HDR + j->o.block_records * widest);
+    j->packed = malloc(HDR + j->o.block_records * widest);
+    if (!j->pend[JREC_PING] || !j->pend[JREC_HB] || !j->pend[JREC_ACK] || !j->raw || !j->packed ||
+        segment_open(j) < 0) {
+        journal_close(j);
+        return NULL;
+    }
+    return j;
+}
+
+void journal_close(Journal *j) {
+    if (!j) return;
+    if (j->fd >= 0) {
+        journal_flush(j, 0);
+        close(j->fd);
+        if (j->seg_bytes == sizeof(FileHeader)) unlink(j->path);
+    }
+    for (int t = 0; t < JREC_TYPES; ++t) free(j->pend[t]);
+    free(j->raw);
+    free(j->packed);
+    free(j);
+}
+
+// Zeroes everything after the terminator so equal ids encode to equal bytes
+static void pad_str(char *s, size_t n) {
+    size_t len = strnlen(s, n - 1);
+    memset(s + len, 0, n - len);
+}
+
+int journal_append(Journal *j, const JournalRec *r) {
+    if (r->type >= JREC_TYPES) return -1;
+    int t = r->type;
+    JournalRec *row = &j->pend[t][j->npend[t]++];
+    *row = *r;
+    pad_str(row->truck_id, sizeof(row->truck_id));
+    pad_str(row->user_id, sizeof(row->user_id));
+    pad_str(row->note, sizeof(row->note));
+    return j->npend[t] == j->o.block_records ? write_block(j, t) : 0;
+}
+
+int journal_flush(Journal *j, int sync) {
+    int rc = 0;
+    for (int t = 0; t < JREC_TYPES; ++t) {
+        if (write_block(j, t) < 0) rc = -1;
+    }
+    if (sync && fdatasync(j->fd) < 0) rc = -1;
+    return rc;
+}
+
+const char *journal_path(const Journal *j) { return j->path; }
+
+// --- Reader ---
+
+struct JournalReader {
+    int fd;
+    const uint8_t *map;           // whole segment in mmap mode, else NULL
+    uint64_t size;
+    uint64_t next;                // offset of the next block header
+    BlockHeader cur;
+    uint64_t cur_off;
+    int have_cur;
+    uint8_t *buf, *raw;           // stored bytes (pread mode) / decompressed columns
+    size_t buf_cap, raw_cap;
+};
+
+static int read_at(JournalReader *r, void *out, size_t len, uint64_t off) {
+    if (r->map) {
+        memcpy(out, r->map + off, len);
+        return 0;
+    }
+    char *p = out;
+    while (len > 0) {
+        ssize_t k = pread(r->fd, p, len, (off_t)off);
+        if (k < 0 && errno == EINTR) continue;
+        if (k <= 0) return -1;
+        p += k;
+        off += (uint64_t)k;
+        len -= (size_t)k;
+    }
+    return 0;
+}
+
+static int grow(uint8_t **p, size_t *cap, size_t need) {
+    if (need <= *cap) return 0;
+    uint8_t *q = realloc(*p, need);
+    if (!q) return -1;
+    *p = q;
+    *cap = need;
+    return 0;
+}
+
+JournalReader *journal_reader_open(const char *path, int use_mmap) {
+    JournalReader *r = calloc(1, sizeof(*r));
+    if (!r) return NULL;
+    r->fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    FileHeader h;
+    if (r->fd < 0 || fstat(r->fd, &st) < 0) goto fail;
+    r->size = (uint64_t)st.st_size;
+    if (r->size < sizeof(h) || read_at(r, &h, sizeof(h), 0) < 0 || h.magic != JRNL_MAGIC ||
+        h.version != JRNL_VERSION || h.header_len < sizeof(h) || h.header_len > r->size) {
+        errno = EINVAL;
+        goto fail;
+    }
+    r->next = h.header_len;
+    if (use_mmap) {
+        void *m = mmap(NULL, r->size, PROT_READ, MAP_SHARED, r->fd, 0);
+        if (m == MAP_FAILED) goto fail;
+        posix_madvise(m, r->size, POSIX_MADV_SEQUENTIAL);
+        r->map = m;
+    }
+    return r;
+fail:
+    journal_reader_close(r);
+    return NULL;
+}
+
+void journal_reader_close(JournalReader *r) {
+    if (!r) return;
+    int saved = errno;
+    if (r->map) munmap((void *)r->map, r->size);
+    if (r->fd >= 0) close(r->fd);
+    free(r->buf);
+    free(r->raw);
+    free(r);
+    errno = saved;
+}
+
+int journal_next_block(JournalReader *r, JournalBlock *b) {
+    memset(b, 0, sizeof(*b));
+    b->offset = r->next;
+    r->have_cur = 0;
+    if (r->next == r->size) return 0;
+
+    BlockHeader h;
+    uint64_t left = r->size - r->next;
+    if (left < HDR || read_at(r, &h, HDR, r->next) < 0) return -1;
+    if (h.magic != BLOCK_MAGIC || h.type >= JREC_TYPES || h.nrec == 0 ||
+        h.stored_len > left - HDR || h.raw_len != h.nrec * row_width(h.type) ||
+        (!(h.flags & BLK_LZ) && h.stored_len != h.raw_len))
+        return -1;
+
+    b->type = h.type;
+    b->compressed = (h.flags & BLK_LZ) != 0;
+    b->nrec = h.nrec;
+    b->raw_len = h.raw_len;
+    b->stored_len = h.stored_len;
+    b->ts_min = h.ts_min;
+    b->ts_max = h.ts_max;
+    r->cur = h;
+    r->cur_off = r->next;
+    r->have_cur = 1;
+    r->next += HDR + h.stored_len;
+    return 1;
+}
+
+int journal_read_block(JournalReader *r, JournalRec *rows) {
+    if (!r->have_cur) return -1;
+    const BlockHeader *h = &r->cur;
+    const uint8_t *stored;
+    if (r->map) {
+        stored = r->map + r->cur_off + HDR;
+    } else {
+        if (grow(&r->buf, &r->buf_cap, h->stored_len) < 0 ||
+            read_at(r, r->buf, h->stored_len, r->cur_off + HDR) < 0)
+            return -1;
+        stored = r->buf;
+    }
+    if (fnv1a(stored, h->stored_len) != h->checksum) return -1;
+
+    const uint8_t *cols = stored;
+    if (h->flags & BLK_LZ) {
+        if (grow(&r->raw, &r->raw_cap, h->raw_len) < 0 ||
+            lz_decompress(stored, h->stored_len, r->raw, h->raw_len) < 0)
+            return -1;
+        cols = r->raw;
+    }
+    decode_columns(cols, h->nrec, h->type, rows);
+    return 0;
+}
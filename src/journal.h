@@ -0,0 +1,83 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "common.h"
+
+/*
+ * Append-only binary journal of truck events, written in segments.
+ *
+ * A segment is a small file header followed by blocks. Every block holds up
+ * to block_records events of one type, stored column by column at fixed
+ * widths (all timestamps, then all latitudes, ...), behind a header with the
+ * record count, the min/max timestamp and a checksum. A block may be
+ * LZ-compressed when that makes it smaller. Readers can skip whole blocks by
+ * type or time range without decoding them.
+ *
+ * Segments are named <prefix>-YYYYmmdd-HHMMSS-NNN.jrnl (UTC, when opened), so
+ * sorting the names sorts them by age. A new segment is started once the
+ * current one would pass max_bytes or is older than max_secs. Each block goes
+ * out in one write, so a crash leaves at most a torn block at the end of the
+ * last segment, which readers report and stop at. Values are stored in host
+ * byte order (little-endian on every platform the truck runs on).
+ */
+
+typedef enum { JREC_PING = 0, JREC_HB = 1, JREC_ACK = 2, JREC_TYPES = 3 } JournalType;
+
+// One event. Fields a type does not store read back as zero.
+typedef struct {
+    uint8_t type;                // JournalType
+    int64_t ts;                  // unix seconds
+    double lat, lon;             // PING/HB: truck position
+    uint32_t ip;                 // HB: sender, network byte order
+    int32_t eta_min, queued;     // ACK
+    char truck_id[MAX_ID_LEN];
+    char user_id[MAX_ID_LEN];    // PING
+    char note[64];               // PING
+} JournalRec;
+
+typedef struct {
+    size_t max_bytes;            // rotate before a segment passes this size, 0 = never
+    int max_secs;                // rotate segments opened this long ago, 0 = never
+    int compress;                // LZ-compress blocks that shrink
+    size_t block_records;        // records per block, 0 = 1024
+} JournalOpts;
+
+typedef struct Journal Journal;
+
+// Starts a new segment under prefix; o may be NULL for no rotation/compression
+Journal *journal_open(const char *prefix, const JournalOpts *o);
+// Writes pending blocks and closes the segment
+void journal_close(Journal *j);
+// Buffers r; full blocks are written as they fill up
+int journal_append(Journal *j, const JournalRec *r);
+// Writes every partly filled block; sync also fdatasyncs the segment
+int journal_flush(Journal *j, int sync);
+// Path of the segment being written
+const char *journal_path(const Journal *j);
+
+// --- Reader ---
+
+typedef struct {
+    uint8_t type;                // JournalType
+    uint8_t compressed;
+    uint32_t nrec;
+    uint32_t raw_len, stored_len;// column bytes before / after compression
+    int64_t ts_min, ts_max;
+    uint64_t offset;             // of the block header within the segment
+} JournalBlock;
+
+typedef struct JournalReader JournalReader;
+
+// use_mmap maps the whole segment; otherwise blocks are read with pread
+JournalReader *journal_reader_open(const char *path, int use_mmap);
+void journal_reader_close(JournalReader *r);
+/*
+ * Moves to the next block and describes it in *b. Returns 1, 0 at the end of
+ * the segment, or -1 for a torn or foreign block (b->offset says where). The
+ * block's records are only decoded if journal_read_block() is called.
+ */
+int journal_next_block(JournalReader *r, JournalBlock *b);
+// Decodes the current block into rows (b->nrec entries); -1 on a bad checksum
+int journal_read_block(JournalReader *r, JournalRec *rows);
+
+const char *journal_type_name(int type);
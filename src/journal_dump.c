@@ -0,0 +1,152 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "common.h"
+#include "journal.h"
+
+/*
+ * Converts truck journal segments (logs/pings-*.jrnl) to CSV on stdout.
+ *
+ *   journal_dump [--mmap] [--type ping|hb|ack] [--from TS] [--to TS] [--blocks] SEGMENT...
+ *
+ * Segments are read with pread by default, or mapped whole with --mmap.
+ * --type and --from/--to (unix seconds, inclusive) filter records; blocks
+ * whose type or min/max timestamp rule them out are skipped without being
+ * read. --blocks lists the block headers instead of the records. A torn or
+ * corrupt block ends its segment with a warning on stderr and exit status 1.
+ */
+
+static int want_type = -1;
+static int64_t ts_from = INT64_MIN, ts_to = INT64_MAX;
+
+// RFC 4180: quote fields holding a comma, quote or line break
+static void put_csv(const char *s) {
+    if (!strpbrk(s, ",\"\r\n")) {
+        fputs(s, stdout);
+        return;
+    }
+    putchar('"');
+    for (; *s; ++s) {
+        if (*s == '"') putchar('"');
+        putchar(*s);
+    }
+    putchar('"');
+}
+
+static void put_row(const JournalRec *r) {
+    char when[32];
+    time_t t = (time_t)r->ts;
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%SZ", &tm);
+
+    printf("%s,%lld,%s,", journal_type_name(r->type), (long long)r->ts, when);
+    put_csv(r->truck_id);
+    switch (r->type) {
+    case JREC_PING:
+        printf(",%.6f,%.6f,,", r->lat, r->lon);
+        put_csv(r->user_id);
+        putchar(',');
+        put_csv(r->note);
+        fputs(",,\n", stdout);
+        break;
+    case JREC_HB: {
+        char ip[INET_ADDRSTRLEN];
+        struct in_addr a = { .s_addr = r->ip };
+        inet_ntop(AF_INET, &a, ip, sizeof(ip));
+        printf(",%.6f,%.6f,%s,,,,\n", r->lat, r->lon, ip);
+        break;
+    }
+    case JREC_ACK:
+        printf(",,,,,,%d,%d\n", r->eta_min, r->queued);
+        break;
+    }
+}
+
+static int skip_block(const JournalBlock *b) {
+    return (want_type >= 0 && b->type != want_type) || b->ts_max < ts_from || b->ts_min > ts_to;
+}
+
+static int dump(const char *path, int use_mmap, int blocks_only) {
+    JournalReader *r = journal_reader_open(path, use_mmap);
+    if (!r) {
+        perror(path);
+        return -1;
+    }
+    JournalRec *rows = NULL;
+    size_t rows_cap = 0;
+    JournalBlock b;
+    int rc;
+    while ((rc = journal_next_block(r, &b)) > 0) {
+        if (blocks_only) {
+            printf("%s,%llu,%s,%u,%lld,%lld,%u,%u\n", path, (unsigned long long)b.offset,
+                   journal_type_name(b.type), b.nrec, (long long)b.ts_min, (long long)b.ts_max,
+                   b.raw_len, b.stored_len);
+            continue;
+        }
+        if (skip_block(&b)) continue;
+        if (b.nrec > rows_cap) {
+            free(rows);
+            rows = malloc(b.nrec * sizeof(*rows));
+            rows_cap = rows ? b.nrec : 0;
+            if (!rows) {
+                perror("malloc");
+                rc = -1;
+                break;
+            }
+        }
+        if (journal_read_block(r, rows) < 0) {
+            rc = -1;
+            break;
+        }
+        for (uint32_t i = 0; i < b.nrec; ++i) {
+            if (rows[i].ts >= ts_from && rows[i].ts <= ts_to) put_row(&rows[i]);
+        }
+    }
+    if (rc < 0) fprintf(stderr, "%s: torn or corrupt block at offset %llu\n", path, (unsigned long long)b.offset);
+    free(rows);
+    journal_reader_close(r);
+    return rc < 0 ? -1 : 0;
+}
+
+int main(int argc, char **argv) {
+    int use_mmap = 0, blocks_only = 0, first = argc;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--mmap")) use_mmap = 1;
+        else if (!strcmp(argv[i], "--blocks")) blocks_only = 1;
+        else if (!strcmp(argv[i], "--from") && i + 1 < argc) ts_from = strtoll(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "--to") && i + 1 < argc) ts_to = strtoll(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "--type") && i + 1 < argc) {
+            const char *t = argv[++i];
+            if (!strcmp(t, "ping")) want_type = JREC_PING;
+            else if (!strcmp(t, "hb")) want_type = JREC_HB;
+            else if (!strcmp(t, "ack")) want_type = JREC_ACK;
+            else {
+                fprintf(stderr, "unknown --type '%s' (use ping|hb|ack)\n", t);
+                return 1;
+            }
+        } else {
+            first = i;
+            break;
+        }
+    }
+    if (first == argc) {
+        fprintf(stderr, "usage: %s [--mmap] [--type ping|hb|ack] [--from TS] [--to TS] [--blocks] SEGMENT...\n",
+                argv[0]);
+        return 1;
+    }
+
+    if (blocks_only) puts("segment,offset,type,records,ts_min,ts_max,raw_bytes,stored_bytes");
+    else puts("type,ts,time_utc,truck_id,lat,lon,ip,user_id,note,eta_min,queued");
+    int status = 0;
+    for (int i = first; i < argc; ++i) {
+        if (dump(argv[i], use_mmap, blocks_only) < 0) status = 1;
+    }
+    return status;
+}
@@ -0,0 +1,394 @@
+#define _DEFAULT_SOURCE           // inet_aton
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "common.h"
+#include "net.h"
+#include "protocol.h"
+#include "util.h"
+#include "pingclient.h"
+#include "histo.h"
+
+/*
+ * Loopback load generator for the truck's PING port.
+ *
+ * Runs --conns client threads, spread round-robin over --targets trucks
+ * listening on consecutive ports from --port (a fleet_sim fleet works too).
+ *
+ * Closed loop (default): each thread repeats connect -> PING -> ACK -> close
+ * --requests times and records the latency of every exchange. With
+ * --keepalive each thread instead keeps one connection open and sends its
+ * PINGs over it, --pipeline D of them in flight at a time.
+ *
+ * Open loop (--rate R): the threads together send R PINGs/sec for
+ * --duration seconds on keep-alive connections, each PING at its scheduled
+ * time whether or not earlier ACKs have arrived. Latency is measured from
+ * the scheduled time, so a stalled truck shows up as latency instead of
+ * silently lowering the offered load.
+ *
+ * Prints throughput and a latency percentile table. Exits 2 when any PING
+ * failed (connect error, timeout or bad ACK) or p99 exceeds --max-p99-ms.
+ */
+
+#define OPEN_MAX_INFLIGHT 8192   // per connection
+
+static char target_host[64] = "127.0.0.1";
+static int target_port = 6012;
+static int n_targets = 1;
+static char target_truck[MAX_ID_LEN] = "TRK01";
+static int n_conns = 16;
+static int n_requests = 1000;
+static int keepalive = 0;
+static int depth = 1;
+static double rate = 0;          // open-loop pings/sec over all threads; 0 = closed loop
+static double duration_s = 5.0;
+static int timeout_ms = 2000;
+static double max_p99_ms = 0;    // 0 = no latency limit
+
+typedef struct {
+    int port;
+    Histo hist;
+    long sent;
+    long connect_err;
+    long timeouts;
+    long bad_acks;
+} ThreadStats;
+
+static long now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+static void make_ping(PingMsg *p) {
+    memset(p, 0, sizeof(*p));
+    snprintf(p->truck_id, sizeof(p->truck_id), "%s", target_truck);
+    snprintf(p->user_id, sizeof(p->user_id), "LOAD");
+    snprintf(p->addr, sizeof(p->addr), "loopback");
+    snprintf(p->note, sizeof(p->note), "loadgen");
+}
+
+// --- Closed Loop ---
+
+// 0 on a good ACK, -1 connect error, -2 timeout, -3 bad ACK
+static int one_ping(struct in_addr ip, int port, const char *line) {
+    int s = tcp_connect_timeout_addr(ip, (uint16_t)port, timeout_ms);
+    if (s < 0) return -1;
+
+    int rc = -2;
+    if (send_all_timeout(s, line, strlen(line), timeout_ms) == (ssize_t)strlen(line)) {
+        char rbuf[MAX_LINE], id[MAX_ID_LEN];
+        const char *resp;
+        size_t resp_len;
+        int eta, q;
+        LineReader rd;
+        linereader_init(&rd, s, rbuf, sizeof(rbuf));
+        if (linereader_next(&rd, &resp, &resp_len, timeout_ms) > 0)
+            rc = parse_ack(resp, id, &eta, &q) ? 0 : -3;
+    }
+    close(s);
+    return rc;
+}
+
+static void run_closed(ThreadStats *st, struct in_addr ip, PingMsg *p) {
+    if (keepalive) {
+        TruckInfo t;
+        memset(&t, 0, sizeof(t));
+        snprintf(t.id, sizeof(t.id), "%s", target_truck);
+        t.last_ip = ip;
+        t.tcp_port = st->port;
+        p->keepalive = 1;
+
+        ConnPool *pool = connpool_create(0);
+        PingMsg *msgs = malloc((size_t)depth * sizeof(PingMsg));
+        PingResult *res = malloc((size_t)depth * sizeof(PingResult));
+        if (!pool || !msgs || !res) { st->connect_err = n_requests; goto out; }
+        for (int i = 0; i < depth; ++i) msgs[i] = *p;
+
+        for (int i = 0; i < n_requests; i += depth) {
+            int batch = n_requests - i < depth ? n_requests - i : depth;
+            int got = ping_via_pool(pool, &t, msgs, (size_t)batch, depth, res, timeout_ms);
+            st->sent += batch;
+            for (int j = 0; j < got; ++j) {
+                if (res[j].ok) histo_record(&st->hist, (uint64_t)res[j].rtt_us);
+                else st->bad_acks++;
+            }
+            st->timeouts += batch - (got > 0 ? got : 0);
+        }
+out:
+        connpool_destroy(pool);
+        free(msgs);
+        free(res);
+        return;
+    }
+
+    char line[MAX_LINE];
+    format_ping(line, sizeof(line), p);
+
+    for (int i = 0; i < n_requests; ++i) {
+        long t0 = now_us();
+        int rc = one_ping(ip, st->port, line);
+        st->sent++;
+        if (rc == 0) histo_record(&st->hist, (uint64_t)(now_us() - t0));
+        else if (rc == -1) st->connect_err++;
+        else if (rc == -2) st->timeouts++;
+        else st->bad_acks++;
+    }
+}
+
+// --- Open Loop ---
+
+typedef struct {
+    int fd;
+    long *due;                   // scheduled send times of PINGs awaiting ACKs
+    size_t head, count;
+    char out[MAX_LINE * 8];      // bytes not yet accepted by the socket
+    size_t out_len;
+    char in[MAX_LINE * 4];
+    size_t in_len;
+} OpenConn;
+
+static void open_drop(OpenConn *c, ThreadStats *st) {
+    st->timeouts += (long)c->count;
+    c->head = c->count = 0;
+    c->out_len = c->in_len = 0;
+    if (c->fd >= 0) close(c->fd);
+    c->fd = -1;
+}
+
+static int open_flush(OpenConn *c) {
+    while (c->out_len > 0) {
+        ssize_t w = send(c->fd, c->out, c->out_len, MSG_NOSIGNAL);
+        if (w < 0) return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+        memmove(c->out, c->out + w, c->out_len - (size_t)w);
+        c->out_len -= (size_t)w;
+    }
+    return 0;
+}
+
+// Reads what has arrived and matches ACK lines to PINGs in order
+static int open_read(OpenConn *c, ThreadStats *st) {
+    for (;;) {
+        ssize_t r = recv(c->fd, c->in + c->in_len, sizeof(c->in) - c->in_len, 0);
+        if (r == 0) return -1;
+        if (r < 0) return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+        c->in_len += (size_t)r;
+        long now = now_us();
+
+        char *start = c->in, *end = c->in + c->in_len, *nl;
+        while ((nl = memchr(start, '\n', (size_t)(end - start))) != NULL) {
+            *nl = '\0';
+            if (c->count == 0) return -1;   // an ACK nobody asked for
+            long due = c->due[c->head];
+            c->head = (c->head + 1) % OPEN_MAX_INFLIGHT;
+            c->count--;
+            char id[MAX_ID_LEN];
+            int eta, q;
+            if (parse_ack(start, id, &eta, &q)) histo_record(&st->hist, (uint64_t)(now - due));
+            else st->bad_acks++;
+            start = nl + 1;
+        }
+        c->in_len = (size_t)(end - start);
+        memmove(c->in, start, c->in_len);
+        if (c->in_len == sizeof(c->in)) return -1;  // line too long
+    }
+}
+
+static void run_open(ThreadStats *st, struct in_addr ip, PingMsg *p, long start_us, long period_us, long total) {
+    char line[MAX_LINE];
+    p->keepalive = 1;
+    int line_len = format_ping(line, sizeof(line), p);
+
+    OpenConn c = { .fd = -1 };
+    c.due = malloc(OPEN_MAX_INFLIGHT * sizeof(long));
+    if (!c.due || line_len <= 0) { st->connect_err = total; free(c.due); return; }
+
+    long next = 0;   // index of the next PING to send
+    long end_us = start_us + total * period_us;
+    for (;;) {
+        long now = now_us();
+        if (next >= total && (c.count == 0 || now > end_us + timeout_ms * 1000L)) break;
+
+        if (c.fd < 0 && next < total) {
+            c.fd = tcp_connect_timeout_addr(ip, (uint16_t)st->port, timeout_ms);
+            if (c.fd < 0) {
+                // Everything that fell due while we could not connect is lost
+                long t = now_us();
+                long due_now = t >= start_us ? (t - start_us) / period_us + 1 : 0;
+                if (due_now > total) due_now = total;
+                if (due_now > next) {
+                    st->connect_err += due_now - next;
+                    st->sent += due_now - next;
+                    next = due_now;
+                }
+                usleep(1000);
+                continue;
+            }
+        }
+
+        // Send every PING whose time has come, even if we are behind
+        while (c.fd >= 0 && next < total && start_us + next * period_us <= now) {
+            if (c.count == OPEN_MAX_INFLIGHT || c.out_len + (size_t)line_len > sizeof(c.out)) break;
+            memcpy(c.out + c.out_len, line, (size_t)line_len);
+            c.out_len += (size_t)line_len;
+            c.due[(c.head + c.count) % OPEN_MAX_INFLIGHT] = start_us + next * period_us;
+            c.count++;
+            next++;
+            st->sent++;
+        }
+        if (c.fd >= 0 && open_flush(&c) < 0) { open_drop(&c, st); continue; }
+
+        // Oldest unanswered PING too old: give up on the connection
+        if (c.count > 0 && now - c.due[c.head] > timeout_ms * 1000L) { open_drop(&c, st); continue; }
+
+        long wait_us = next < total ? start_us + next * period_us - now : 1000;
+        if (wait_us < 0) wait_us = 0;
+        if (c.count > 0) {
+            long to_timeout = c.due[c.head] + timeout_ms * 1000L - now;
+            if (to_timeout < wait_us) wait_us = to_timeout > 0 ? to_timeout : 0;
+        }
+        if (c.fd < 0) {
+            if (wait_us > 0) usleep((useconds_t)wait_us);
+            continue;
+        }
+        struct pollfd pfd = { .fd = c.fd, .events = POLLIN | (c.out_len ? POLLOUT : 0) };
+        int pr = poll(&pfd, 1, (int)((wait_us + 999) / 1000));
+        if (pr > 0 && (pfd.revents & (POLLIN | POLLERR | POLLHUP)) && open_read(&c, st) < 0)
+            open_drop(&c, st);
+    }
+    open_drop(&c, st);   // counts whatever never got an answer
+    free(c.due);
+}
+
+// --- Threads ---
+
+static long open_start_us, open_period_us, open_total;
+
+static void *th_client(void *arg) {
+    ThreadStats *st = (ThreadStats *)arg;
+    struct in_addr ip;
+    inet_aton(target_host, &ip);
+
+    PingMsg p;
+    make_ping(&p);
+    if (rate > 0) run_open(st, ip, &p, open_start_us, open_period_us, open_total);
+    else run_closed(st, ip, &p);
+    return NULL;
+}
+
+static void print_report(const Histo *h, double secs, long sent, long conn_err, long timeouts, long bad) {
+    printf("conns=%d targets=%d ok=%llu errors=%ld elapsed=%.2fs\n", n_conns, n_targets,
+           (unsigned long long)h->total, conn_err + timeouts + bad, secs);
+    if (rate > 0) printf("offered=%.0f/s sent=%ld\n", rate, sent);
+    printf("pings/sec=%.0f\n", secs > 0 ? (double)h->total / secs : 0.0);
+    printf("connect_errors=%ld timeouts=%ld bad_acks=%ld\n", conn_err, timeouts, bad);
+    printf("latency_us p50=%llu p99=%llu p999=%llu max=%llu\n",
+           (unsigned long long)histo_quantile(h, 0.50), (unsigned long long)histo_quantile(h, 0.99),
+           (unsigned long long)histo_quantile(h, 0.999), (unsigned long long)h->max);
+
+    static const double qs[] = { 0.0, 0.5, 0.75, 0.9, 0.99, 0.999, 0.9999, 1.0 };
+    printf("%12s %10s %12s\n", "value_us", "percentile", "count");
+    uint64_t prev = 0;
+    for (size_t i = 0; i < sizeof(qs) / sizeof(qs[0]); ++i) {
+        uint64_t v = qs[i] >= 1.0 ? h->max : histo_quantile(h, qs[i]);
+        if (i > 0 && v == prev && qs[i] < 1.0) continue;
+        printf("%12llu %9.4f%% %12llu\n", (unsigned long long)v, qs[i] * 100.0,
+               (unsigned long long)(qs[i] * (double)h->total + 0.5));
+        prev = v;
+    }
+    printf("mean_us=%.1f\n", histo_mean(h));
+}
+
+int main(int argc, char **argv) {
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--host") && i + 1 < argc) {
+            snprintf(target_host, sizeof(target_host), "%s", argv[++i]);
+        } else if (!strcmp(argv[i], "--port") && i + 1 < argc) {
+            target_port = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--targets") && i + 1 < argc) {
+            n_targets = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--truck") && i + 1 < argc) {
+            snprintf(target_truck, sizeof(target_truck), "%s", argv[++i]);
+        } else if (!strcmp(argv[i], "--conns") && i + 1 < argc) {
+            n_conns = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--requests") && i + 1 < argc) {
+            n_requests = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--keepalive")) {
+            keepalive = 1;
+        } else if (!strcmp(argv[i], "--pipeline") && i + 1 < argc) {
+            depth = atoi(argv[++i]);
+            keepalive = 1;
+        } else if (!strcmp(argv[i], "--rate") && i + 1 < argc) {
+            rate = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--duration") && i + 1 < argc) {
+            duration_s = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--timeout-ms") && i + 1 < argc) {
+            timeout_ms = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--max-p99-ms") && i + 1 < argc) {
+            max_p99_ms = atof(argv[++i]);
+        }
+    }
+    if (n_conns <= 0 || n_requests <= 0 || depth <= 0 || n_targets <= 0 || rate < 0 ||
+        duration_s <= 0 || timeout_ms <= 0 || target_port + n_targets - 1 > 65535) {
+        fprintf(stderr, "usage: loadgen [--host IP] [--port P] [--targets T] [--truck ID] [--conns C]\n"
+                        "               [--requests N] [--keepalive] [--pipeline D]\n"
+                        "               [--rate R --duration S] [--timeout-ms MS] [--max-p99-ms MS]\n");
+        return 1;
+    }
+
+    pthread_t *tids = calloc((size_t)n_conns, sizeof(*tids));
+    ThreadStats *stats = calloc((size_t)n_conns, sizeof(*stats));
+    if (!tids || !stats) { perror("calloc"); return 1; }
+
+    if (rate > 0) {
+        // Each thread runs its share of the rate; start 10 ms out so all begin together
+        open_period_us = (long)(1e6 * n_conns / rate);
+        if (open_period_us < 1) open_period_us = 1;
+        open_total = (long)(duration_s * 1e6 / (double)open_period_us);
+        if (open_total < 1) open_total = 1;
+        open_start_us = now_us() + 10000;
+    }
+
+    long t0 = now_us();
+    for (int i = 0; i < n_conns; ++i) {
+        histo_reset(&stats[i].hist);
+        stats[i].port = target_port + i % n_targets;
+        pthread_create(&tids[i], NULL, th_client, &stats[i]);
+    }
+
+    Histo all;
+    histo_reset(&all);
+    long sent = 0, conn_err = 0, timeouts = 0, bad = 0;
+    for (int i = 0; i < n_conns; ++i) {
+        pthread_join(tids[i], NULL);
+        histo_merge(&all, &stats[i].hist);
+        sent += stats[i].sent;
+        conn_err += stats[i].connect_err;
+        timeouts += stats[i].timeouts;
+        bad += stats[i].bad_acks;
+    }
+    double secs = (double)(now_us() - (rate > 0 ? open_start_us : t0)) / 1e6;
+
+    print_report(&all, secs, sent, conn_err, timeouts, bad);
+
+    int fail = conn_err + timeouts + bad > 0;
+    double p99_ms = (double)histo_quantile(&all, 0.99) / 1000.0;
+    if (max_p99_ms > 0 && p99_ms > max_p99_ms) {
+        printf("FAIL: p99 %.2f ms exceeds --max-p99-ms %.2f\n", p99_ms, max_p99_ms);
+        fail = 1;
+    }
+
+    free(stats);
+    free(tids);
+    return fail ? 2 : 0;
+}
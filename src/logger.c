@@ -6,7 +6,9 @@
 #include <time.h>
 #include <pthread.h>
 #include <stdlib.h>
-#include <stdint.h> 
+#include <stdint.h>
+#include <stdatomic.h>
+#include <unistd.h>
 
 // Network headers for structs and functions used externally
 #include <sys/types.h>
@@ -17,121 +19,279 @@
 
 #include "common.h"
 #include "protocol.h"
+#include "journal.h"
 #include "logger.h"
 
+#define LOG_DEFAULT_RING 8192
+#define LOG_BATCH 256          // records written between flush decisions
+#define LOG_IDLE_US 1000       // writer sleep when the ring is empty
+
 // Internal State Definition (Fixes original struct in_addr error)
 struct TruckLogState {
     char id[MAX_ID_LEN];
     double lat;
     double lon;
     time_t last_hb_ts;
-    uint32_t last_ip; 
+    uint32_t last_ip;
 };
 
+// One event, copied by value so producers never share memory with the writer
+typedef JournalRec LogRecord;
+
 // Global state and mutex
 static struct TruckLogState log_state = {0};
 static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
-static FILE *log_file = NULL;
+static Journal *log_j = NULL;
+static JournalOpts log_opts = { 0 };
+
+// --- Async State ---
+//
+// Bounded MPSC ring (Vyukov): each cell's sequence number tells producers
+// whether it is free for position pos (seq == pos) and tells the writer
+// whether it holds the record for pos (seq == pos + 1).
+
+typedef struct {
+    _Atomic size_t seq;
+    LogRecord rec;
+} LogCell;
+
+static LogCell *ring = NULL;
+static size_t ring_mask;
+static _Atomic size_t enq_pos;
+static _Atomic size_t deq_pos;         // written by the writer thread only
+static _Atomic int async_on = 0;
+static _Atomic int writer_stop = 0;
+static _Atomic uint64_t dropped = 0;
+static pthread_t writer_th;
+static int writer_flush_ms;
+static LogDurability writer_durability;
+
+static void copy_id(char *dst, const char *src) {
+    snprintf(dst, MAX_ID_LEN, "%s", src);
+}
+
+// --- Async Ring ---
+
+static int ring_push(const LogRecord *r) {
+    size_t pos = atomic_load_explicit(&enq_pos, memory_order_relaxed);
+    LogCell *c;
+    for (;;) {
+        c = &ring[pos & ring_mask];
+        size_t seq = atomic_load_explicit(&c->seq, memory_order_acquire);
+        intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+        if (dif == 0) {
+            if (atomic_compare_exchange_weak_explicit(&enq_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
+                break;
+        } else if (dif < 0) {
+            return -1; // full
+        } else {
+            pos = atomic_load_explicit(&enq_pos, memory_order_relaxed);
+        }
+    }
+    c->rec = *r;
+    atomic_store_explicit(&c->seq, pos + 1, memory_order_release);
+    return 0;
+}
+
+static int ring_pop(LogRecord *out) {
+    size_t pos = atomic_load_explicit(&deq_pos, memory_order_relaxed);
+    LogCell *c = &ring[pos & ring_mask];
+    size_t seq = atomic_load_explicit(&c->seq, memory_order_acquire);
+    if (seq != pos + 1) return -1; // empty (or a producer is mid-write)
+    *out = c->rec;
+    atomic_store_explicit(&c->seq, pos + ring_mask + 1, memory_order_release);
+    atomic_store_explicit(&deq_pos, pos + 1, memory_order_relaxed);
+    return 0;
+}
+
+static long mono_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void *th_writer(void *arg) {
+    (void)arg;
+    long last_flush = mono_ms();
+    int dirty = 0;
+
+    for (;;) {
+        LogRecord r;
+        int n = 0;
+        while (n < LOG_BATCH && ring_pop(&r) == 0) {
+            journal_append(log_j, &r);
+            n++;
+        }
+
+        if (n > 0) {
+            dirty = 1;
+            if (writer_durability >= LOG_FLUSH_BATCH) {
+                journal_flush(log_j, writer_durability == LOG_FSYNC_BATCH);
+                dirty = 0;
+                last_flush = mono_ms();
+            }
+        }
+        if (dirty && mono_ms() - last_flush >= writer_flush_ms) {
+            journal_flush(log_j, 0);
+            dirty = 0;
+            last_flush = mono_ms();
+        }
+
+        if (n == 0) {
+            // Drain everything that was queued before logger_close()
+            if (atomic_load(&writer_stop)) break;
+            usleep(LOG_IDLE_US);
+        }
+    }
+    journal_flush(log_j, writer_durability == LOG_FSYNC_BATCH);
+    return NULL;
+}
 
-// Helper to get formatted time
-static void get_timestamp_string(char *buf, size_t n, time_t ts) {
-    struct tm *tm = localtime(&ts);
-    strftime(buf, n, "%Y-%m-%d %H:%M:%S", tm);
+// --- Open / Close ---
+
+void logger_set_journal(const JournalOpts *o) {
+    pthread_mutex_lock(&log_mutex);
+    log_opts = *o;
+    pthread_mutex_unlock(&log_mutex);
 }
 
-int logger_open(const char *path) {
+int logger_open(const char *prefix) {
     pthread_mutex_lock(&log_mutex);
-    if (log_file) fclose(log_file);
-    log_file = fopen(path, "a");
-    int success = (log_file != NULL);
+    journal_close(log_j);
+    log_j = journal_open(prefix, &log_opts);
+    int success = (log_j != NULL);
     if (!success) {
-        perror("Failed to open log file");
+        perror("Failed to open log journal");
     }
     pthread_mutex_unlock(&log_mutex);
     return success;
 }
 
+/**
+ * @brief Opens the log in async mode and starts the writer thread.
+ * @return 1 on success, 0 on failure (nothing is logged then).
+ */
+int logger_open_async(const char *prefix, size_t ring_records, int flush_ms, LogDurability durability) {
+    logger_close();
+    if (!logger_open(prefix)) return 0;
+
+    size_t cap = 1;
+    while (cap < (ring_records ? ring_records : LOG_DEFAULT_RING)) cap <<= 1;
+    ring = malloc(cap * sizeof(*ring));
+    if (!ring) {
+        logger_close();
+        return 0;
+    }
+    for (size_t i = 0; i < cap; ++i) atomic_init(&ring[i].seq, i);
+    ring_mask = cap - 1;
+    atomic_store(&enq_pos, 0);
+    atomic_store(&deq_pos, 0);
+    atomic_store(&dropped, 0);
+    atomic_store(&writer_stop, 0);
+    writer_flush_ms = flush_ms > 0 ? flush_ms : 200;
+    writer_durability = durability;
+
+    if (pthread_create(&writer_th, NULL, th_writer, NULL) != 0) {
+        free(ring);
+        ring = NULL;
+        logger_close();
+        return 0;
+    }
+    atomic_store(&async_on, 1);
+    return 1;
+}
 
+// Callers must have stopped logging from other threads before closing
 void logger_close(void) {
-    pthread_mutex_lock(&log_mutex);
-    if (log_file) {
-        fclose(log_file);
-        log_file = NULL;
+    if (atomic_exchange(&async_on, 0)) {
+        atomic_store(&writer_stop, 1);
+        pthread_join(writer_th, NULL);
+        free(ring);
+        ring = NULL;
     }
+    pthread_mutex_lock(&log_mutex);
+    journal_close(log_j);
+    log_j = NULL;
     pthread_mutex_unlock(&log_mutex);
 }
 
-// Implementation for logger_log_hb (assumed signature)
-void logger_log_hb(const char *truck_id, double lat, double lon, const struct in_addr ip_addr, time_t ts) {
+uint64_t logger_dropped(void) {
+    return atomic_load(&dropped);
+}
+
+size_t logger_backlog(void) {
+    if (!atomic_load_explicit(&async_on, memory_order_acquire)) return 0;
+    size_t enq = atomic_load_explicit(&enq_pos, memory_order_relaxed);
+    size_t deq = atomic_load_explicit(&deq_pos, memory_order_relaxed);
+    return enq > deq ? enq - deq : 0;
+}
+
+int logger_durability_parse(const char *s, LogDurability *out) {
+    if (!strcmp(s, "interval")) *out = LOG_FLUSH_INTERVAL;
+    else if (!strcmp(s, "batch")) *out = LOG_FLUSH_BATCH;
+    else if (!strcmp(s, "fsync")) *out = LOG_FSYNC_BATCH;
+    else return -1;
+    return 0;
+}
+
+// --- Logging Calls ---
+
+// Queues the record in async mode, otherwise writes it now as a block of one
+static void submit(const LogRecord *r) {
+    if (atomic_load_explicit(&async_on, memory_order_acquire)) {
+        if (ring_push(r) < 0) atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+        return;
+    }
     pthread_mutex_lock(&log_mutex);
-    
-    char time_str[30];
-    get_timestamp_string(time_str, sizeof(time_str), ts);
-    
-    struct in_addr temp_ip = ip_addr;
-    char *ip_str = inet_ntoa(temp_ip);
-
-    if (log_file) {
-        fprintf(log_file, "[%s] HB | ID: %s | Loc: %.6f, %.6f | IP: %s\n", 
-                time_str, truck_id, lat, lon, ip_str);
-        fflush(log_file);
+    if (log_j) {
+        journal_append(log_j, r);
+        journal_flush(log_j, 0);
     }
-    
+    pthread_mutex_unlock(&log_mutex);
+}
+
+void logger_log_hb(const char *truck_id, double lat, double lon, const struct in_addr ip_addr, time_t ts) {
+    LogRecord r = { .type = JREC_HB, .ts = ts, .lat = lat, .lon = lon, .ip = ip_addr.s_addr };
+    copy_id(r.truck_id, truck_id);
+    submit(&r);
+
     // Update internal state
+    pthread_mutex_lock(&log_mutex);
     if (strcmp(log_state.id, truck_id) == 0 || log_state.id[0] == 0) {
-        strncpy(log_state.id, truck_id, MAX_ID_LEN);
+        copy_id(log_state.id, truck_id);
         log_state.lat = lat;
         log_state.lon = lon;
         log_state.last_hb_ts = ts;
         log_state.last_ip = ip_addr.s_addr; // Store the raw integer
     }
-
     pthread_mutex_unlock(&log_mutex);
 }
 
-// MATCHES logger.h: void logger_log_ping(time_t ts, const PingMsg *p, double truck_lat, double truck_lon);
 void logger_log_ping(time_t ts, const PingMsg *p, double truck_lat, double truck_lon) {
-    pthread_mutex_lock(&log_mutex);
-    
-    char time_str[30];
-    get_timestamp_string(time_str, sizeof(time_str), ts);
-
-    if (log_file) {
-        fprintf(log_file, "[%s] PING | Truck: %s (%.6f, %.6f) | User: %s | Note: \"%s\"\n", 
-                time_str, p->truck_id, truck_lat, truck_lon, p->user_id, p->note);
-        fflush(log_file);
-    }
-
-    pthread_mutex_unlock(&log_mutex);
+    LogRecord r = { .type = JREC_PING, .ts = ts, .lat = truck_lat, .lon = truck_lon };
+    copy_id(r.truck_id, p->truck_id);
+    copy_id(r.user_id, p->user_id);
+    snprintf(r.note, sizeof(r.note), "%s", p->note);
+    submit(&r);
 }
 
-// Implementation for logger_log_ack (assumed signature)
 void logger_log_ack(const char *truck_id, int eta_min, int queued) {
-    pthread_mutex_lock(&log_mutex);
-    
-    time_t now = time(NULL);
-    char time_str[30];
-    get_timestamp_string(time_str, sizeof(time_str), now);
-
-    if (log_file) {
-        fprintf(log_file, "[%s] ACK | Truck: %s | ETA: %d min | Queued: %d\n", 
-                time_str, truck_id, eta_min, queued);
-        fflush(log_file);
-    }
-
-    pthread_mutex_unlock(&log_mutex);
+    LogRecord r = { .type = JREC_ACK, .ts = time(NULL), .eta_min = eta_min, .queued = queued };
+    copy_id(r.truck_id, truck_id);
+    submit(&r);
 }
 
 // Function to get the latest known state (e.g., for truck server to respond)
 void logger_get_latest_state(TruckInfo *info, struct in_addr *ip_addr) {
     pthread_mutex_lock(&log_mutex);
-    strncpy(info->id, log_state.id, MAX_ID_LEN);
+    copy_id(info->id, log_state.id);
     info->lat = log_state.lat;
     info->lon = log_state.lon;
-    info->tcp_port = 0; 
+    info->tcp_port = 0;
 
     // Reconstruct the struct in_addr from the stored uint32_t
-    ip_addr->s_addr = log_state.last_ip; 
-    
+    ip_addr->s_addr = log_state.last_ip;
+
     pthread_mutex_unlock(&log_mutex);
 }
@@ -1,8 +1,43 @@
 #pragma once
 #include "common.h"
+#include <stddef.h>
+#include <stdint.h>
 #include <time.h>
+#include <netinet/in.h>
+#include "journal.h"
 
+/*
+ * Event log for the truck, written as a binary journal (journal.h) under the
+ * given path prefix; journal_dump turns it into CSV.
+ *
+ * logger_open() gives the original synchronous logger: every call writes the
+ * event under a mutex as a block of its own. logger_open_async() instead
+ * copies each event into a fixed-size record on a lock-free ring and
+ * returns; a background thread appends records to the journal in batches and
+ * writes out full blocks. When the ring is full the event is dropped and
+ * counted (logger_dropped) rather than blocking the caller.
+ */
 
-int logger_open(const char *path);
+typedef enum {
+    LOG_FLUSH_INTERVAL = 0,   // write partial blocks at most every flush_ms
+    LOG_FLUSH_BATCH = 1,      // write partial blocks after every batch
+    LOG_FSYNC_BATCH = 2,      // same, then fdatasync
+} LogDurability;
+
+// Rotation and compression for journals opened from now on (default: neither)
+void logger_set_journal(const JournalOpts *o);
+int logger_open(const char *prefix);
+// ring_records is rounded up to a power of two (0 = 8192)
+int logger_open_async(const char *prefix, size_t ring_records, int flush_ms, LogDurability durability);
 void logger_close(void);
-void logger_log_ping(time_t ts, const PingMsg *p, double truck_lat, double truck_lon);
\ No newline at end of file
+
+void logger_log_ping(time_t ts, const PingMsg *p, double truck_lat, double truck_lon);
+void logger_log_hb(const char *truck_id, double lat, double lon, const struct in_addr ip_addr, time_t ts);
+void logger_log_ack(const char *truck_id, int eta_min, int queued);
+void logger_get_latest_state(TruckInfo *info, struct in_addr *ip_addr);
+
+// Async mode: records lost because the ring was full
+uint64_t logger_dropped(void);
+// Async mode: records queued but not yet written (approximate)
+size_t logger_backlog(void);
+int logger_durability_parse(const char *s, LogDurability *out);
@@ -0,0 +1,115 @@
+#define _GNU_SOURCE  // recvmmsg, MSG_WAITFORONE
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+
+#include "common.h"
+#include "mcrecv.h"
+
+#ifndef SO_RXQ_OVFL
+#define SO_RXQ_OVFL 40
+#endif
+
+// Room for one SO_RXQ_OVFL (uint32) control message per datagram
+#define MC_CTRL_LEN CMSG_SPACE(sizeof(uint32_t))
+
+struct McBatch {
+    size_t depth;
+    int n;                       // datagrams in the last batch
+    struct mmsghdr *msgs;
+    struct iovec *iov;
+    struct sockaddr_in *src;
+    char *data;                  // depth * MC_DGRAM_MAX
+    char *ctrl;                  // depth * MC_CTRL_LEN
+    uint32_t last_ovfl;          // kernel drop counter at the previous batch
+    McStats stats;
+};
+
+McBatch *mcbatch_create(size_t depth) {
+    if (depth == 0) depth = 1;
+    McBatch *b = calloc(1, sizeof(*b));
+    if (!b) return NULL;
+    b->depth = depth;
+    b->msgs = calloc(depth, sizeof(*b->msgs));
+    b->iov = calloc(depth, sizeof(*b->iov));
+    b->src = calloc(depth, sizeof(*b->src));
+    b->data = malloc(depth * MC_DGRAM_MAX);
+    b->ctrl = malloc(depth * MC_CTRL_LEN);
+    if (!b->msgs || !b->iov || !b->src || !b->data || !b->ctrl) {
+        mcbatch_destroy(b);
+        return NULL;
+    }
+    return b;
+}
+
+void mcbatch_destroy(McBatch *b) {
+    if (!b) return;
+    free(b->msgs);
+    free(b->iov);
+    free(b->src);
+    free(b->data);
+    free(b->ctrl);
+    free(b);
+}
+
+int mcbatch_watch_drops(int fd) {
+    int on = 1;
+    return setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on));
+}
+
+// The kernel's running drop count for the socket, if the message carries it
+static int read_ovfl(const struct msghdr *mh, uint32_t *out) {
+    for (struct cmsghdr *c = CMSG_FIRSTHDR(mh); c; c = CMSG_NXTHDR((struct msghdr *)mh, c)) {
+        if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SO_RXQ_OVFL) {
+            memcpy(out, CMSG_DATA(c), sizeof(*out));
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int mcbatch_recv(McBatch *b, int fd) {
+    // recvmmsg overwrites the lengths, so the headers are re-armed every call
+    for (size_t i = 0; i < b->depth; ++i) {
+        b->iov[i].iov_base = b->data + i * MC_DGRAM_MAX;
+        b->iov[i].iov_len = MC_DGRAM_MAX;
+        struct msghdr *mh = &b->msgs[i].msg_hdr;
+        mh->msg_name = &b->src[i];
+        mh->msg_namelen = sizeof(b->src[i]);
+        mh->msg_iov = &b->iov[i];
+        mh->msg_iovlen = 1;
+        mh->msg_control = b->ctrl + i * MC_CTRL_LEN;
+        mh->msg_controllen = MC_CTRL_LEN;
+        mh->msg_flags = 0;
+    }
+
+    int n = recvmmsg(fd, b->msgs, (unsigned)b->depth, MSG_WAITFORONE, NULL);
+    b->n = 0;
+    if (n < 0) return (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+
+    // The counter is cumulative; the newest datagram has the latest value
+    uint32_t ovfl;
+    for (int i = n - 1; i >= 0; --i) {
+        if (read_ovfl(&b->msgs[i].msg_hdr, &ovfl)) {
+            b->stats.drops += (uint32_t)(ovfl - b->last_ovfl);
+            b->last_ovfl = ovfl;
+            break;
+        }
+    }
+
+    b->n = n;
+    b->stats.datagrams += (uint64_t)n;
+    b->stats.batches++;
+    return n;
+}
+
+const char *mcbatch_data(const McBatch *b, int i, size_t *len, struct sockaddr_in *src) {
+    if (i < 0 || i >= b->n) return NULL;
+    if (len) *len = b->msgs[i].msg_len;
+    if (src) *src = b->src[i];
+    return b->data + (size_t)i * MC_DGRAM_MAX;
+}
+
+const McStats *mcbatch_stats(const McBatch *b) { return &b->stats; }
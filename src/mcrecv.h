@@ -0,0 +1,42 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <netinet/in.h>
+
+/*
+ * Batched datagram receive for the heartbeat listener.
+ *
+ * One recvmmsg() call fills a preallocated array of datagram buffers with
+ * everything the socket has queued (blocking until at least one arrives),
+ * so a burst of heartbeats costs one syscall instead of one per truck.
+ * The kernel's count of datagrams dropped on a full receive buffer is read
+ * from SO_RXQ_OVFL ancillary data.
+ */
+
+typedef struct {
+    uint64_t datagrams;  // received
+    uint64_t batches;    // recvmmsg calls that returned data
+    uint64_t drops;      // dropped by the kernel (socket buffer full)
+} McStats;
+
+typedef struct McBatch McBatch;
+
+// Largest datagram kept whole: a full batched heartbeat (HB_BATCH_MAX_LEN)
+#define MC_DGRAM_MAX 1536
+
+// depth = datagrams per recvmmsg call; each buffer holds up to MC_DGRAM_MAX bytes
+McBatch *mcbatch_create(size_t depth);
+void mcbatch_destroy(McBatch *b);
+
+// Enables SO_RXQ_OVFL on fd so mcbatch_recv can report kernel drops
+int mcbatch_watch_drops(int fd);
+
+// Blocks until at least one datagram is queued, then takes as many as fit.
+// Returns the number received (0 when interrupted, or when a non-blocking
+// fd has nothing queued) or -1 on error.
+int mcbatch_recv(McBatch *b, int fd);
+
+// Datagram i of the last batch
+const char *mcbatch_data(const McBatch *b, int i, size_t *len, struct sockaddr_in *src);
+
+const McStats *mcbatch_stats(const McBatch *b);
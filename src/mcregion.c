@@ -0,0 +1,114 @@
+#define _DEFAULT_SOURCE  // ip_mreq
+
+#include <math.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "common.h"
+#include "mcregion.h"
+
+#define KM_PER_DEG 111.32
+
+static int32_t tile_coord(double deg, double tile_deg) {
+    return (int32_t)floor(deg / tile_deg);
+}
+
+// Torus index of tile (x, y); neighbours within MC_REGION_SIDE never collide
+static uint32_t tile_index(int32_t x, int32_t y) {
+    uint32_t ux = (uint32_t)x & (MC_REGION_SIDE - 1);
+    uint32_t uy = (uint32_t)y & (MC_REGION_SIDE - 1);
+    return ux + MC_REGION_SIDE * uy;
+}
+
+static struct in_addr group_addr(uint32_t idx) {
+    struct in_addr a;
+    a.s_addr = htonl(MC_REGION_BASE + idx);
+    return a;
+}
+
+struct in_addr mcregion_group(double tile_km, double lat, double lon) {
+    if (tile_km <= 0) {
+        struct in_addr a;
+        inet_aton(MC_GROUP, &a);
+        return a;
+    }
+    double td = tile_km / KM_PER_DEG;
+    return group_addr(tile_index(tile_coord(lon, td), tile_coord(lat, td)));
+}
+
+/**
+ * @brief Tiles overlapping the lat/lon box around the circle, folded onto
+ * the torus. A box wider than the torus covers every column (or row), which
+ * is where the count saturates at MC_REGION_SIDE squared.
+ */
+int mcregion_cover(double tile_km, double lat, double lon, double radius_km,
+                   struct in_addr *out, int max) {
+    if (tile_km <= 0) {
+        if (max < 1) return -1;
+        out[0] = mcregion_group(0, lat, lon);
+        return 1;
+    }
+    double td = tile_km / KM_PER_DEG;
+    double dlat = radius_km / KM_PER_DEG;
+    double c = cos(lat * M_PI / 180.0);
+    double dlon = radius_km / (KM_PER_DEG * (c > 0.01 ? c : 0.01));
+
+    int64_t x0 = tile_coord(lon - dlon, td), x1 = tile_coord(lon + dlon, td);
+    int64_t y0 = tile_coord(lat - dlat, td), y1 = tile_coord(lat + dlat, td);
+    if (x1 - x0 >= MC_REGION_SIDE) x1 = x0 + MC_REGION_SIDE - 1;
+    if (y1 - y0 >= MC_REGION_SIDE) y1 = y0 + MC_REGION_SIDE - 1;
+
+    int n = 0;
+    for (int64_t y = y0; y <= y1; ++y) {
+        for (int64_t x = x0; x <= x1; ++x) {
+            if (n == max) return -1;
+            out[n++] = group_addr(tile_index((int32_t)x, (int32_t)y));
+        }
+    }
+    return n;
+}
+
+void mcregion_sub_init(McRegionSub *s, int fd, double tile_km) {
+    memset(s, 0, sizeof(*s));
+    s->fd = fd;
+    s->tile_km = tile_km;
+}
+
+static int has_group(const struct in_addr *set, int n, struct in_addr g) {
+    for (int i = 0; i < n; ++i)
+        if (set[i].s_addr == g.s_addr) return 1;
+    return 0;
+}
+
+static int membership(int fd, int opt, struct in_addr g) {
+    struct ip_mreq mreq;
+    mreq.imr_multiaddr = g;
+    mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+    return setsockopt(fd, IPPROTO_IP, opt, &mreq, sizeof(mreq));
+}
+
+/**
+ * @brief Leaves the groups that dropped out of the area before joining the
+ * new ones, so the membership count never goes over the kernel limit
+ * mid-move. A failed join keeps the groups joined so far.
+ */
+int mcregion_follow(McRegionSub *s, double lat, double lon, double radius_km) {
+    struct in_addr want[MC_REGION_MAX_JOIN];
+    int nw = mcregion_cover(s->tile_km, lat, lon, radius_km, want, MC_REGION_MAX_JOIN);
+    if (nw < 0) return -1;
+
+    int keep = 0;
+    for (int i = 0; i < s->n; ++i) {
+        if (has_group(want, nw, s->joined[i])) s->joined[keep++] = s->joined[i];
+        else membership(s->fd, IP_DROP_MEMBERSHIP, s->joined[i]);
+    }
+    s->n = keep;
+
+    for (int i = 0; i < nw; ++i) {
+        if (has_group(s->joined, s->n, want[i])) continue;
+        if (membership(s->fd, IP_ADD_MEMBERSHIP, want[i]) < 0) return -1;
+        s->joined[s->n++] = want[i];
+    }
+    return s->n;
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <stdint.h>
+#include <netinet/in.h>
+
+/*
+ * Region-sharded heartbeat multicast.
+ *
+ * The map is cut into square tiles tile_km on a side (measured in degrees
+ * of latitude; a tile spans the same number of degrees of longitude). Tile
+ * (x, y) publishes on group MC_REGION_BASE + (x mod 16) + 16 * (y mod 16),
+ * a group in 239.255.1.0/24, on the usual MC_PORT. Every sender and receiver
+ * derives the same group without coordination, and two tiles only share a
+ * group when they are 16 tiles apart.
+ *
+ * A truck sends each heartbeat to the group of the tile it is in, so it
+ * moves to the next group when it crosses a tile edge. A receiver joins the
+ * groups of the tiles overlapping the box around its area of interest and
+ * calls mcregion_follow() again when the area moves; only the groups that
+ * changed are joined or left. tile_km == 0 means the single MC_GROUP.
+ */
+
+#define MC_REGION_BASE 0xEFFF0100u   // 239.255.1.0
+#define MC_REGION_SIDE 16            // tiles per torus side; 256 groups
+#define MC_REGION_MAX_JOIN 20        // Linux default net.ipv4.igmp_max_memberships
+
+// Group for a heartbeat sent from (lat, lon)
+struct in_addr mcregion_group(double tile_km, double lat, double lon);
+
+// The distinct groups covering the circle of radius_km around (lat, lon).
+// Returns how many, or -1 when that is more than max (larger tiles needed).
+int mcregion_cover(double tile_km, double lat, double lon, double radius_km,
+                   struct in_addr *out, int max);
+
+typedef struct {
+    int fd;                  // bound with udp_mc_bind
+    double tile_km;
+    int n;
+    struct in_addr joined[MC_REGION_MAX_JOIN];
+} McRegionSub;
+
+void mcregion_sub_init(McRegionSub *s, int fd, double tile_km);
+
+// Moves the memberships to the area around (lat, lon); returns the number
+// of groups joined afterwards, or -1 (area too large, or a join failed)
+int mcregion_follow(McRegionSub *s, double lat, double lon, double radius_km);
@@ -0,0 +1,190 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "histo.h"
+#include "metrics.h"
+
+typedef struct {
+    _Atomic uint64_t counts[HISTO_BUCKETS];
+    _Atomic uint64_t sum_ns;
+    _Atomic uint64_t max_ns;
+} ShardHist;
+
+typedef struct Shard {
+    _Atomic uint64_t counters[MC_COUNT];
+    ShardHist hist[MH_COUNT];
+    _Atomic int in_use;
+    struct Shard *next;          // set once before the shard is published
+} Shard;
+
+static _Atomic(Shard *) shards = NULL;
+static _Thread_local Shard *tls_shard = NULL;
+static pthread_key_t shard_key;
+static pthread_once_t shard_once = PTHREAD_ONCE_INIT;
+
+static _Atomic int64_t gauges[MG_COUNT];
+
+static const struct { const char *name, *help; } counter_info[MC_COUNT] = {
+    [MC_ACCEPTS]        = { "jarat_accepts_total", "TCP connections accepted" },
+    [MC_PINGS]          = { "jarat_pings_total", "PING requests handled" },
+    [MC_PARSE_ERRORS]   = { "jarat_parse_errors_total", "Request lines that failed to parse" },
+    [MC_REPLIES]        = { "jarat_replies_total", "Replies queued for sending" },
+    [MC_SEND_ERRORS]    = { "jarat_send_errors_total", "Connections dropped on a send error" },
+    [MC_HB_SENT]        = { "jarat_heartbeats_sent_total", "Heartbeats sent" },
+    [MC_HB_SEND_ERRORS] = { "jarat_heartbeat_send_errors_total", "Heartbeats the kernel refused" },
+};
+
+static const struct { const char *name, *help; } hist_info[MH_COUNT] = {
+    [MH_ACCEPT] = { "jarat_accept_seconds", "Time in accept()" },
+    [MH_PARSE]  = { "jarat_parse_seconds", "Time to parse a PING line" },
+    [MH_LOG]    = { "jarat_log_seconds", "Time to log one PING" },
+    [MH_SEND]   = { "jarat_send_seconds", "Time to send queued replies" },
+};
+
+static const struct { const char *name, *help; } gauge_info[MG_COUNT] = {
+    [MG_ORDERS_QUEUED] = { "jarat_orders_queued", "Pending orders in the truck's queue" },
+    [MG_LOG_BACKLOG]   = { "jarat_log_backlog", "Records waiting in the async log ring" },
+    [MG_LOG_DROPPED]   = { "jarat_log_dropped", "Log records dropped because the ring was full" },
+    [MG_PINGS_PER_SEC] = { "jarat_pings_per_second", "PINGs handled during the last full second" },
+};
+
+// --- Shards ---
+
+static void shard_release(void *p) {
+    atomic_store_explicit(&((Shard *)p)->in_use, 0, memory_order_release);
+}
+
+static void make_key(void) {
+    pthread_key_create(&shard_key, shard_release);
+}
+
+static Shard *shard_slow(void) {
+    pthread_once(&shard_once, make_key);
+
+    // Reuse a shard left behind by a finished thread
+    Shard *s;
+    for (s = atomic_load_explicit(&shards, memory_order_acquire); s; s = s->next) {
+        int free_slot = 0;
+        if (atomic_compare_exchange_strong(&s->in_use, &free_slot, 1)) break;
+    }
+    if (!s) {
+        s = calloc(1, sizeof(*s));
+        if (!s) return NULL;
+        atomic_store_explicit(&s->in_use, 1, memory_order_relaxed);
+        Shard *head = atomic_load_explicit(&shards, memory_order_relaxed);
+        do {
+            s->next = head;
+        } while (!atomic_compare_exchange_weak_explicit(&shards, &head, s,
+                                                        memory_order_release, memory_order_relaxed));
+    }
+    pthread_setspecific(shard_key, s);
+    tls_shard = s;
+    return s;
+}
+
+static inline Shard *shard(void) {
+    Shard *s = tls_shard;
+    return s ? s : shard_slow();
+}
+
+// --- Recording ---
+
+void metrics_add(MetricCounter c, uint64_t n) {
+    Shard *s = shard();
+    if (s) atomic_fetch_add_explicit(&s->counters[c], n, memory_order_relaxed);
+}
+
+void metrics_inc(MetricCounter c) {
+    metrics_add(c, 1);
+}
+
+void metrics_observe_ns(MetricHist h, uint64_t ns) {
+    Shard *s = shard();
+    if (!s) return;
+    ShardHist *sh = &s->hist[h];
+    atomic_fetch_add_explicit(&sh->counts[histo_bucket(ns)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&sh->sum_ns, ns, memory_order_relaxed);
+    // Only this thread writes the shard, so load + store cannot lose a maximum
+    if (ns > atomic_load_explicit(&sh->max_ns, memory_order_relaxed))
+        atomic_store_explicit(&sh->max_ns, ns, memory_order_relaxed);
+}
+
+void metrics_gauge_set(MetricGauge g, int64_t v) {
+    atomic_store_explicit(&gauges[g], v, memory_order_relaxed);
+}
+
+// --- Reading ---
+
+uint64_t metrics_counter(MetricCounter c) {
+    uint64_t total = 0;
+    for (Shard *s = atomic_load_explicit(&shards, memory_order_acquire); s; s = s->next)
+        total += atomic_load_explicit(&s->counters[c], memory_order_relaxed);
+    return total;
+}
+
+static void hist_snapshot(MetricHist h, Histo *out) {
+    histo_reset(out);
+    out->min = 0;
+    for (Shard *s = atomic_load_explicit(&shards, memory_order_acquire); s; s = s->next) {
+        ShardHist *sh = &s->hist[h];
+        for (size_t i = 0; i < HISTO_BUCKETS; ++i) {
+            uint64_t n = atomic_load_explicit(&sh->counts[i], memory_order_relaxed);
+            out->counts[i] += n;
+            out->total += n;
+        }
+        out->sum += (double)atomic_load_explicit(&sh->sum_ns, memory_order_relaxed);
+        uint64_t mx = atomic_load_explicit(&sh->max_ns, memory_order_relaxed);
+        if (mx > out->max) out->max = mx;
+    }
+}
+
+typedef struct {
+    char *buf;
+    size_t n, len;
+} Out;
+
+static void emit(Out *o, const char *fmt, ...) {
+    if (o->len + 1 >= o->n) return;
+    va_list ap;
+    va_start(ap, fmt);
+    int k = vsnprintf(o->buf + o->len, o->n - o->len, fmt, ap);
+    va_end(ap);
+    if (k < 0) return;
+    o->len += (size_t)k < o->n - o->len ? (size_t)k : o->n - o->len - 1;
+}
+
+size_t metrics_render(char *buf, size_t n) {
+    if (n == 0) return 0;
+    Out o = { buf, n, 0 };
+    buf[0] = '\0';
+
+    for (int c = 0; c < MC_COUNT; ++c) {
+        emit(&o, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n",
+             counter_info[c].name, counter_info[c].help, counter_info[c].name,
+             counter_info[c].name, (unsigned long long)metrics_counter((MetricCounter)c));
+    }
+    for (int g = 0; g < MG_COUNT; ++g) {
+        emit(&o, "# HELP %s %s\n# TYPE %s gauge\n%s %lld\n",
+             gauge_info[g].name, gauge_info[g].help, gauge_info[g].name,
+             gauge_info[g].name, (long long)atomic_load_explicit(&gauges[g], memory_order_relaxed));
+    }
+
+    Histo *h = malloc(sizeof(*h));
+    if (!h) return o.len;
+    static const double qs[] = { 0.5, 0.9, 0.99, 0.999 };
+    for (int m = 0; m < MH_COUNT; ++m) {
+        const char *name = hist_info[m].name;
+        hist_snapshot((MetricHist)m, h);
+        emit(&o, "# HELP %s %s\n# TYPE %s summary\n", name, hist_info[m].help, name);
+        for (size_t i = 0; i < sizeof(qs) / sizeof(qs[0]); ++i)
+            emit(&o, "%s{quantile=\"%g\"} %.9f\n", name, qs[i], (double)histo_quantile(h, qs[i]) / 1e9);
+        emit(&o, "%s_sum %.9f\n%s_count %llu\n", name, h->sum / 1e9, name, (unsigned long long)h->total);
+    }
+    free(h);
+    return o.len;
+}
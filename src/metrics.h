@@ -0,0 +1,62 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Process-wide metrics for the truck.
+ *
+ * Counters and latency histograms are recorded into a per-thread shard:
+ * each thread only ever writes its own shard with relaxed atomic adds, so
+ * the hot path takes no lock and shares no cache line with other threads.
+ * A reader sums all shards when rendering. Shards are never freed; a thread
+ * that exits hands its shard on to the next new thread (totals carry over),
+ * so thread-per-connection servers do not grow the list without bound.
+ * Gauges are single values set by whoever owns the quantity.
+ *
+ * metrics_render() writes the Prometheus text exposition format.
+ */
+
+typedef enum {
+    MC_ACCEPTS = 0,       // connections accepted by the PING server
+    MC_PINGS,             // PING requests handled
+    MC_PARSE_ERRORS,      // request lines that failed to parse
+    MC_REPLIES,           // replies queued for sending
+    MC_SEND_ERRORS,       // connections dropped on a send error
+    MC_HB_SENT,
+    MC_HB_SEND_ERRORS,
+    MC_COUNT
+} MetricCounter;
+
+typedef enum {
+    MH_ACCEPT = 0,        // accept() call (empty on the uring backend)
+    MH_PARSE,             // PING line parse
+    MH_LOG,               // logging one PING
+    MH_SEND,              // sending queued replies
+    MH_COUNT
+} MetricHist;
+
+typedef enum {
+    MG_ORDERS_QUEUED = 0,
+    MG_LOG_BACKLOG,       // records waiting in the async log ring
+    MG_LOG_DROPPED,
+    MG_PINGS_PER_SEC,     // PINGs handled during the last full second
+    MG_COUNT
+} MetricGauge;
+
+void metrics_inc(MetricCounter c);
+void metrics_add(MetricCounter c, uint64_t n);
+// Records one duration in nanoseconds
+void metrics_observe_ns(MetricHist h, uint64_t ns);
+void metrics_gauge_set(MetricGauge g, int64_t v);
+
+// Sum over all threads
+uint64_t metrics_counter(MetricCounter c);
+// Renders every metric; returns the length written (truncated to n - 1)
+size_t metrics_render(char *buf, size_t n);
+
+static inline uint64_t metrics_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
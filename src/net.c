@@ -1,3 +1,4 @@
+#define _GNU_SOURCE               // sendmmsg
 #define _DEFAULT_SOURCE           // Required to expose functions like inet_aton and some structures
 #define _POSIX_C_SOURCE 200809L
 #include <sys/types.h>            // Required for basic types like socklen_t and some network structs (like ip_mreq)
@@ -7,11 +8,10 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
+#include <netinet/tcp.h>             // TCP_NODELAY
 #include <errno.h>
 
-// CRITICAL FIXES for non-blocking connect and select():
-#include <sys/select.h> 
-#include <sys/time.h>             // Defines struct timeval completely
+#include <poll.h>                 // connect timeout; select() breaks past FD_SETSIZE
 #include <fcntl.h>                // Defines constants needed for set_nonblocking
 
 #include "net.h"
@@ -27,38 +27,112 @@ inet_aton(group, &addr.sin_addr);
 }
 
 
-int udp_mc_receiver(const char *group, uint16_t port, int *sock_out){
+#ifndef IP_MULTICAST_ALL
+#define IP_MULTICAST_ALL 49
+#endif
+
+// Bound to the port but in no group yet. Only the groups this socket joins
+// are delivered to it, not every group some socket on the host joined.
+int udp_mc_bind(uint16_t port, int *sock_out){
 int s = socket(AF_INET, SOCK_DGRAM, 0); if (s<0) return -1;
 int reuse=1; setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+int all=0; setsockopt(s, IPPROTO_IP, IP_MULTICAST_ALL, &all, sizeof(all));
 struct sockaddr_in addr={0}; addr.sin_family=AF_INET; addr.sin_port=htons(port); addr.sin_addr.s_addr=htonl(INADDR_ANY);
 if (bind(s, (struct sockaddr*)&addr, sizeof(addr))<0){ close(s); return -1; }
+*sock_out=s; return 0;
+}
+
+
+int udp_mc_receiver(const char *group, uint16_t port, int *sock_out){
+int s; if (udp_mc_bind(port, &s)<0) return -1;
 struct ip_mreq mreq; mreq.imr_multiaddr.s_addr=inet_addr(group); mreq.imr_interface.s_addr=htonl(INADDR_ANY);
 if (setsockopt(s, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq))<0){ close(s); return -1; }
 *sock_out=s; return 0;
 }
 
 
-int tcp_listen(uint16_t port, int backlog, int *sock_out){
+static int tcp_listen_on(uint32_t ip, uint16_t port, int backlog, int *sock_out){
 int s=socket(AF_INET, SOCK_STREAM, 0); if (s<0) return -1;
 int reuse=1; setsockopt(s,SOL_SOCKET,SO_REUSEADDR,&reuse,sizeof(reuse));
-struct sockaddr_in addr={0}; addr.sin_family=AF_INET; addr.sin_port=htons(port); addr.sin_addr.s_addr=htonl(INADDR_ANY);
+struct sockaddr_in addr={0}; addr.sin_family=AF_INET; addr.sin_port=htons(port); addr.sin_addr.s_addr=htonl(ip);
 if (bind(s,(struct sockaddr*)&addr,sizeof(addr))<0){ close(s); return -1; }
 if (listen(s, backlog)<0){ close(s); return -1; }
 *sock_out=s; return 0;
 }
 
 
+int tcp_listen(uint16_t port, int backlog, int *sock_out){
+return tcp_listen_on(INADDR_ANY, port, backlog, sock_out);
+}
+
+
+// Loopback only: for local admin endpoints such as metrics
+int tcp_listen_local(uint16_t port, int backlog, int *sock_out){
+return tcp_listen_on(INADDR_LOOPBACK, port, backlog, sock_out);
+}
+
+
 int tcp_connect_timeout_addr(struct in_addr ip, uint16_t port, int timeout_ms){
 int s=socket(AF_INET, SOCK_STREAM, 0); if (s<0) return -1;
 set_nonblocking(s);
 struct sockaddr_in addr={0}; addr.sin_family=AF_INET; addr.sin_port=htons(port); addr.sin_addr=ip;
 int r=connect(s,(struct sockaddr*)&addr,sizeof(addr));
 if (r<0 && errno!=EINPROGRESS){ close(s); return -1; }
-fd_set wf; FD_ZERO(&wf); FD_SET(s,&wf);
-struct timeval tv = { .tv_sec = timeout_ms/1000, .tv_usec = (timeout_ms%1000)*1000 };
-r = select(s+1,NULL,&wf,NULL,&tv);
+struct pollfd pfd = { .fd = s, .events = POLLOUT };
+r = poll(&pfd, 1, timeout_ms);
 if (r<=0){ close(s); return -1; }
 int err=0; socklen_t len=sizeof(err); getsockopt(s,SOL_SOCKET,SO_ERROR,&err,&len);
 if (err){ close(s); return -1; }
+tcp_set_nodelay(s);
 return s;
-}
\ No newline at end of file
+}
+
+
+// PING/ACK lines are tiny request/response pairs: send them without Nagle delays
+int tcp_set_nodelay(int fd){
+int on=1; return setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+}
+
+
+// Asks for a bigger receive buffer so bursts of heartbeats are not dropped.
+// SO_RCVBUFFORCE bypasses rmem_max when we have CAP_NET_ADMIN. Returns the
+// size the kernel actually granted, or -1.
+int udp_set_rcvbuf(int fd, int bytes){
+if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &bytes, sizeof(bytes))<0 &&
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bytes, sizeof(bytes))<0) return -1;
+int got=0; socklen_t len=sizeof(got);
+if (getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &got, &len)<0) return -1;
+return got/2; // getsockopt reports the value doubled for bookkeeping overhead
+}
+
+
+// Datagrams per sendmmsg call in udp_send_batch
+#define UDP_MMSG_MAX 64
+
+/**
+ * @brief Sends n datagrams, datagram i to to[i], with as few sendmmsg
+ * calls as possible. A call that sends only part of its chunk is continued
+ * from the first unsent datagram. Returns how many went out, or -1 if the
+ * first failed.
+ */
+int udp_send_batch(int fd, const struct sockaddr_in *to, const void *const *bufs, const size_t *lens, int n){
+struct mmsghdr msgs[UDP_MMSG_MAX];
+struct iovec iov[UDP_MMSG_MAX];
+int sent=0;
+while (sent<n){
+    int k = n-sent < UDP_MMSG_MAX ? n-sent : UDP_MMSG_MAX;
+    memset(msgs, 0, (size_t)k*sizeof(msgs[0]));
+    for (int i=0; i<k; ++i){
+        iov[i].iov_base=(void *)bufs[sent+i]; iov[i].iov_len=lens[sent+i];
+        msgs[i].msg_hdr.msg_name=(void *)&to[sent+i]; msgs[i].msg_hdr.msg_namelen=sizeof(to[0]);
+        msgs[i].msg_hdr.msg_iov=&iov[i]; msgs[i].msg_hdr.msg_iovlen=1;
+    }
+    int r=sendmmsg(fd, msgs, (unsigned)k, 0);
+    if (r<0){
+        if (errno==EINTR) continue;
+        return sent>0 ? sent : -1;
+    }
+    sent+=r;
+}
+return sent;
+}
@@ -1,9 +1,16 @@
 #pragma once
+#include <stddef.h>
 #include <stdint.h>
 #include <netinet/in.h>
 
 
 int udp_mc_sender(const char *group, uint16_t port, int *sock_out, struct sockaddr_in *addr_out);
 int udp_mc_receiver(const char *group, uint16_t port, int *sock_out);
+int udp_mc_bind(uint16_t port, int *sock_out);
 int tcp_listen(uint16_t port, int backlog, int *sock_out);
-int tcp_connect_timeout_addr(struct in_addr ip, uint16_t port, int timeout_ms);
\ No newline at end of file
+int tcp_listen_local(uint16_t port, int backlog, int *sock_out);
+int tcp_connect_timeout_addr(struct in_addr ip, uint16_t port, int timeout_ms);
+int tcp_set_nodelay(int fd);
+int udp_set_rcvbuf(int fd, int bytes);
+// sendmmsg n datagrams, bufs[i] to to[i]; returns the number sent or -1
+int udp_send_batch(int fd, const struct sockaddr_in *to, const void *const *bufs, const size_t *lens, int n);
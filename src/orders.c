@@ -0,0 +1,324 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "protocol.h"
+#include "util.h"
+#include "orders.h"
+
+typedef struct Node {
+    Order o;
+    uint32_t prio;
+    double leg;              // km from the previous stop; 0 for the first stop
+    double sum;              // legs in this subtree
+    int size;                // nodes in this subtree
+    struct Node *l, *r;
+    struct Node *user_next;  // chain in the by-user index
+} Node;
+
+struct OrderQueue {
+    pthread_mutex_t mu;
+    Node *root;
+    uint32_t next_job;
+    uint32_t rng;
+    double speed_kmh, service_min;
+    size_t max_orders;
+
+    Node **by_user;          // pending order per user_id, chained
+    size_t user_mask;
+    size_t count;
+};
+
+// --- Treap ---
+
+static int size_of(const Node *n) { return n ? n->size : 0; }
+static double sum_of(const Node *n) { return n ? n->sum : 0.0; }
+
+static void pull(Node *n) {
+    n->size = 1 + size_of(n->l) + size_of(n->r);
+    n->sum = n->leg + sum_of(n->l) + sum_of(n->r);
+}
+
+static Node *merge(Node *a, Node *b) {
+    if (!a) return b;
+    if (!b) return a;
+    if (a->prio > b->prio) {
+        a->r = merge(a->r, b);
+        pull(a);
+        return a;
+    }
+    b->l = merge(a, b->l);
+    pull(b);
+    return b;
+}
+
+// Splits n into jobs < job and jobs >= job
+static void split(Node *n, uint32_t job, Node **lo, Node **hi) {
+    if (!n) { *lo = *hi = NULL; return; }
+    if (n->o.job < job) {
+        split(n->r, job, &n->r, hi);
+        pull(n);
+        *lo = n;
+    } else {
+        split(n->l, job, lo, &n->l);
+        pull(n);
+        *hi = n;
+    }
+}
+
+static Node *leftmost(Node *n) {
+    while (n && n->l) n = n->l;
+    return n;
+}
+
+static Node *rightmost(Node *n) {
+    while (n && n->r) n = n->r;
+    return n;
+}
+
+static void set_leftmost_leg(Node *n, double leg) {
+    if (!n) return;
+    if (n->l) set_leftmost_leg(n->l, leg);
+    else n->leg = leg;
+    pull(n);
+}
+
+static Node *find(Node *n, uint32_t job) {
+    while (n && n->o.job != job) n = job < n->o.job ? n->l : n->r;
+    return n;
+}
+
+// Number of orders with id <= job and the sum of their legs
+static void prefix(const Node *n, uint32_t job, int *rank, double *legs) {
+    *rank = 0;
+    *legs = 0.0;
+    while (n) {
+        if (job < n->o.job) {
+            n = n->l;
+        } else {
+            *rank += size_of(n->l) + 1;
+            *legs += sum_of(n->l) + n->leg;
+            n = n->r;
+        }
+    }
+}
+
+static double stop_km(const Node *a, const Node *b) {
+    return haversine_km(a->o.lat, a->o.lon, b->o.lat, b->o.lon);
+}
+
+// --- By-user Index ---
+
+static size_t user_bucket(const OrderQueue *q, const char *user_id) {
+    return proto_id_key(user_id) & q->user_mask;
+}
+
+static Node *user_find(const OrderQueue *q, const char *user_id) {
+    Node *n = q->by_user[user_bucket(q, user_id)];
+    while (n && strncmp(n->o.user_id, user_id, MAX_ID_LEN) != 0) n = n->user_next;
+    return n;
+}
+
+static void user_unlink(OrderQueue *q, Node *x) {
+    Node **pp = &q->by_user[user_bucket(q, x->o.user_id)];
+    while (*pp && *pp != x) pp = &(*pp)->user_next;
+    if (*pp) *pp = x->user_next;
+}
+
+static int user_link(OrderQueue *q, Node *x) {
+    if (q->count + 1 > q->user_mask + 1) {
+        size_t nb = (q->user_mask + 1) * 2;
+        Node **tab = calloc(nb, sizeof(*tab));
+        if (!tab) return -1;
+        for (size_t i = 0; i <= q->user_mask; ++i) {
+            Node *n = q->by_user[i];
+            while (n) {
+                Node *next = n->user_next;
+                size_t b = proto_id_key(n->o.user_id) & (nb - 1);
+                n->user_next = tab[b];
+                tab[b] = n;
+                n = next;
+            }
+        }
+        free(q->by_user);
+        q->by_user = tab;
+        q->user_mask = nb - 1;
+    }
+    size_t b = user_bucket(q, x->o.user_id);
+    x->user_next = q->by_user[b];
+    q->by_user[b] = x;
+    return 0;
+}
+
+// --- Queue ---
+
+OrderQueue *orders_create(double speed_kmh, double service_min, size_t max_orders) {
+    OrderQueue *q = calloc(1, sizeof(*q));
+    if (!q) return NULL;
+    q->by_user = calloc(64, sizeof(*q->by_user));
+    if (!q->by_user) { free(q); return NULL; }
+    q->user_mask = 63;
+    pthread_mutex_init(&q->mu, NULL);
+    q->next_job = 1;
+    q->rng = 2463534242u;
+    q->speed_kmh = speed_kmh > 0 ? speed_kmh : 30.0;
+    q->service_min = service_min >= 0 ? service_min : 0.0;
+    q->max_orders = max_orders ? max_orders : 4096;
+    return q;
+}
+
+static void free_tree(Node *n) {
+    if (!n) return;
+    free_tree(n->l);
+    free_tree(n->r);
+    free(n);
+}
+
+void orders_destroy(OrderQueue *q) {
+    if (!q) return;
+    free_tree(q->root);
+    free(q->by_user);
+    pthread_mutex_destroy(&q->mu);
+    free(q);
+}
+
+static uint32_t next_prio(OrderQueue *q) {
+    uint32_t x = q->rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return q->rng = x;
+}
+
+// ETA for a stop at position pos whose route legs (after the first stop) sum to legs
+static double eta_of(const OrderQueue *q, double to_head_km, double legs, int pos) {
+    return (to_head_km + legs) / q->speed_kmh * 60.0 + q->service_min * (pos - 1);
+}
+
+static void quote_locked(OrderQueue *q, const Node *x, double truck_lat, double truck_lon, OrderQuote *out) {
+    const Node *head = leftmost(q->root);
+    int rank;
+    double legs;
+    prefix(q->root, x->o.job, &rank, &legs);
+    out->job = x->o.job;
+    out->position = rank;
+    out->queued = (int)q->count;
+    out->eta_min = eta_of(q, haversine_km(truck_lat, truck_lon, head->o.lat, head->o.lon), legs, rank);
+}
+
+/**
+ * @brief Adds an order at the end of the route, or quotes the customer's
+ * existing one. When the queue is full, out describes where the order would
+ * have gone and out->job is 0.
+ * @return 0, or -1 on allocation failure.
+ */
+int orders_place(OrderQueue *q, const char *user_id, double lat, double lon,
+                 double truck_lat, double truck_lon, time_t now, OrderQuote *out) {
+    memset(out, 0, sizeof(*out));
+    pthread_mutex_lock(&q->mu);
+
+    Node *x = user_find(q, user_id);
+    if (x) {
+        quote_locked(q, x, truck_lat, truck_lon, out);
+        out->existing = 1;
+        pthread_mutex_unlock(&q->mu);
+        return 0;
+    }
+
+    Node *last = rightmost(q->root);
+    Node probe = { .o = { .lat = lat, .lon = lon } };
+    double leg = last ? stop_km(last, &probe) : 0.0;
+
+    if (q->count >= q->max_orders) {
+        const Node *head = leftmost(q->root);
+        out->position = (int)q->count + 1;
+        out->queued = (int)q->count;
+        out->eta_min = eta_of(q, haversine_km(truck_lat, truck_lon, head->o.lat, head->o.lon),
+                              q->root->sum + leg, out->position);
+        pthread_mutex_unlock(&q->mu);
+        return 0;
+    }
+
+    x = calloc(1, sizeof(*x));
+    if (!x) { pthread_mutex_unlock(&q->mu); return -1; }
+    x->o.job = q->next_job++;
+    snprintf(x->o.user_id, sizeof(x->o.user_id), "%s", user_id);
+    x->o.lat = lat;
+    x->o.lon = lon;
+    x->o.created = now;
+    x->prio = next_prio(q);
+    x->leg = leg;
+    pull(x);
+
+    if (user_link(q, x) < 0) { free(x); pthread_mutex_unlock(&q->mu); return -1; }
+    // New ids are the largest, so the order goes at the right end
+    q->root = merge(q->root, x);
+    q->count++;
+
+    quote_locked(q, x, truck_lat, truck_lon, out);
+    pthread_mutex_unlock(&q->mu);
+    return 0;
+}
+
+int orders_quote(OrderQueue *q, uint32_t job, double truck_lat, double truck_lon, OrderQuote *out) {
+    memset(out, 0, sizeof(*out));
+    pthread_mutex_lock(&q->mu);
+    const Node *x = find(q->root, job);
+    if (x) quote_locked(q, x, truck_lat, truck_lon, out);
+    pthread_mutex_unlock(&q->mu);
+    return x ? 0 : -1;
+}
+
+/**
+ * @brief Removes a job from anywhere in the route. The following stop's leg
+ * is re-measured from the removed job's predecessor. When user_id is given
+ * the job must belong to that customer. Caller holds q->mu.
+ */
+static int remove_locked(OrderQueue *q, uint32_t job, const char *user_id) {
+    Node *a, *b, *x, *c;
+    split(q->root, job, &a, &b);
+    split(b, job + 1, &x, &c);
+    if (!x || (user_id && strncmp(x->o.user_id, user_id, MAX_ID_LEN) != 0)) {
+        // Not pending (job + 1 wrapping to 0 also lands here): put everything back
+        q->root = merge(a, merge(x, c));
+        return -1;
+    }
+
+    Node *prev = rightmost(a), *next = leftmost(c);
+    if (next) set_leftmost_leg(c, prev ? stop_km(prev, next) : 0.0);
+    q->root = merge(a, c);
+    user_unlink(q, x);
+    q->count--;
+    free(x);
+    return 0;
+}
+
+int orders_complete(OrderQueue *q, uint32_t job) {
+    pthread_mutex_lock(&q->mu);
+    int r = remove_locked(q, job, NULL);
+    pthread_mutex_unlock(&q->mu);
+    return r;
+}
+
+int orders_cancel(OrderQueue *q, uint32_t job, const char *user_id) {
+    pthread_mutex_lock(&q->mu);
+    int r = remove_locked(q, job, user_id);
+    pthread_mutex_unlock(&q->mu);
+    return r;
+}
+
+int orders_head(OrderQueue *q, Order *out) {
+    pthread_mutex_lock(&q->mu);
+    const Node *h = leftmost(q->root);
+    if (h) *out = h->o;
+    pthread_mutex_unlock(&q->mu);
+    return h ? 0 : -1;
+}
+
+size_t orders_count(OrderQueue *q) {
+    pthread_mutex_lock(&q->mu);
+    size_t n = q->count;
+    pthread_mutex_unlock(&q->mu);
+    return n;
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include "common.h"
+
+/*
+ * The truck's pending orders, served first come first served.
+ *
+ * Orders live in a treap keyed by job id (ids only grow, so id order is
+ * route order). Each node stores the straight-line length of the leg from
+ * the previous stop, and subtrees keep the sum of their legs, so the route
+ * length up to any order, its position, insertion and removal are all
+ * O(log n). A customer has at most one pending order; pinging again returns
+ * the existing one. All calls are thread-safe.
+ *
+ * ETA = (distance from the truck to the first stop + legs up to this stop)
+ *       / speed + service time at every stop ahead.
+ */
+
+typedef struct {
+    uint32_t job;
+    char user_id[MAX_ID_LEN];
+    double lat, lon;
+    time_t created;
+} Order;
+
+typedef struct {
+    uint32_t job;      // 0 when the queue was full and nothing was added
+    int position;      // 1 = next stop
+    int queued;        // pending orders including this one
+    double eta_min;
+    int existing;      // the customer already had this order pending
+} OrderQuote;
+
+typedef struct OrderQueue OrderQueue;
+
+OrderQueue *orders_create(double speed_kmh, double service_min, size_t max_orders);
+void orders_destroy(OrderQueue *q);
+
+// Adds an order for user_id at (lat, lon), or finds their pending one.
+// The quote is computed from the truck's position (truck_lat, truck_lon).
+int orders_place(OrderQueue *q, const char *user_id, double lat, double lon,
+                 double truck_lat, double truck_lon, time_t now, OrderQuote *out);
+// Current quote for a pending job; -1 if it is not pending
+int orders_quote(OrderQueue *q, uint32_t job, double truck_lat, double truck_lon, OrderQuote *out);
+// Removes a pending job (delivered or cancelled); -1 if it is not pending
+int orders_complete(OrderQueue *q, uint32_t job);
+// Removes a pending job placed by user_id; -1 if it is not theirs or not pending
+int orders_cancel(OrderQueue *q, uint32_t job, const char *user_id);
+// The next stop; -1 if the queue is empty
+int orders_head(OrderQueue *q, Order *out);
+size_t orders_count(OrderQueue *q);
@@ -0,0 +1,483 @@
+#define _DEFAULT_SOURCE
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "net.h"
+#include "protocol.h"
+#include "util.h"
+#include "pingclient.h"
+
+#define POOL_MAX_IDLE 64
+
+typedef struct PoolConn {
+    char truck_id[MAX_ID_LEN];
+    struct in_addr ip;
+    uint16_t port;
+    int fd;
+    long last_used_ms;
+    struct PoolConn *next;
+} PoolConn;
+
+struct ConnPool {
+    pthread_mutex_t mu;
+    int idle_ms;
+    size_t nidle;
+    PoolConn *idle;   // most recently released first
+};
+
+static long mono_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static long mono_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+// --- Connection Pool ---
+
+ConnPool *connpool_create(int idle_ms) {
+    ConnPool *pool = calloc(1, sizeof(*pool));
+    if (!pool) return NULL;
+    pthread_mutex_init(&pool->mu, NULL);
+    pool->idle_ms = idle_ms > 0 ? idle_ms : 4000;
+    return pool;
+}
+
+void connpool_destroy(ConnPool *pool) {
+    if (!pool) return;
+    PoolConn *c = pool->idle;
+    while (c) {
+        PoolConn *next = c->next;
+        close(c->fd);
+        free(c);
+        c = next;
+    }
+    pthread_mutex_destroy(&pool->mu);
+    free(pool);
+}
+
+static int same_key(const PoolConn *c, const char *truck_id, struct in_addr ip, uint16_t port) {
+    return c->port == port && c->ip.s_addr == ip.s_addr &&
+           strncmp(c->truck_id, truck_id, MAX_ID_LEN) == 0;
+}
+
+/**
+ * @brief Checks whether an idle socket is still usable: the truck may have
+ * closed it (idle timeout) or sent something unexpected.
+ */
+static int still_open(int fd) {
+    char c;
+    ssize_t k = recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    return k < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+int connpool_acquire(ConnPool *pool, const char *truck_id, struct in_addr ip,
+                     uint16_t port, int timeout_ms, int *reused) {
+    long now = mono_ms();
+    int fd = -1;
+
+    pthread_mutex_lock(&pool->mu);
+    PoolConn **pp = &pool->idle;
+    while (*pp) {
+        PoolConn *c = *pp;
+        if (!same_key(c, truck_id, ip, port)) { pp = &c->next; continue; }
+
+        *pp = c->next;
+        pool->nidle--;
+        if (fd < 0 && now - c->last_used_ms < pool->idle_ms && still_open(c->fd)) {
+            fd = c->fd;
+        } else {
+            close(c->fd); // expired, dead, or a surplus duplicate
+        }
+        free(c);
+        if (fd >= 0) break;
+    }
+    pthread_mutex_unlock(&pool->mu);
+
+    if (reused) *reused = fd >= 0;
+    if (fd >= 0) return fd;
+    return tcp_connect_timeout_addr(ip, port, timeout_ms);
+}
+
+void connpool_release(ConnPool *pool, const char *truck_id, struct in_addr ip,
+                      uint16_t port, int fd, int reusable) {
+    if (fd < 0) return;
+    PoolConn *c = reusable ? malloc(sizeof(*c)) : NULL;
+    if (!c) { close(fd); return; }
+
+    snprintf(c->truck_id, sizeof(c->truck_id), "%s", truck_id);
+    c->ip = ip;
+    c->port = port;
+    c->fd = fd;
+    c->last_used_ms = mono_ms();
+
+    pthread_mutex_lock(&pool->mu);
+    c->next = pool->idle;
+    pool->idle = c;
+    PoolConn *victim = NULL;
+    if (++pool->nidle > POOL_MAX_IDLE) {
+        // Drop the least recently used connection (the tail)
+        PoolConn **pp = &pool->idle;
+        while ((*pp)->next) pp = &(*pp)->next;
+        victim = *pp;
+        *pp = NULL;
+        pool->nidle--;
+    }
+    pthread_mutex_unlock(&pool->mu);
+
+    if (victim) { close(victim->fd); free(victim); }
+}
+
+// --- Pipelined Exchange ---
+
+/**
+ * @brief Sends the PINGs in msgs over fd, keeping at most depth of them
+ * unanswered, and stores the ACKs in res in request order.
+ * @return Number of ACK lines read, or -1 if nothing could be sent.
+ */
+int ping_pipeline(int fd, const PingMsg *msgs, size_t n, int depth,
+                  PingResult *res, int timeout_ms) {
+    if (depth < 1) depth = 1;
+    size_t sent = 0, recvd = 0;
+    long *sent_at = malloc((n ? n : 1) * sizeof(long));
+    if (!sent_at) return -1;
+
+    // Only ACKs for PINGs we sent can arrive, so nothing is left buffered at the end
+    char rbuf[4 * MAX_LINE];
+    LineReader rd;
+    linereader_init(&rd, fd, rbuf, sizeof(rbuf));
+
+    while (recvd < n) {
+        // Fill the window with one send() for all the PINGs that fit
+        char out[8 * MAX_LINE];
+        size_t len = 0;
+        size_t first = sent;
+        while (sent < n && sent - recvd < (size_t)depth && sizeof(out) - len >= MAX_LINE) {
+            int k = format_ping(out + len, sizeof(out) - len, &msgs[sent]);
+            if (k <= 0 || (size_t)k >= sizeof(out) - len) break;
+            len += (size_t)k;
+            sent++;
+        }
+        if (len > 0) {
+            long t = mono_us();
+            for (size_t i = first; i < sent; ++i) sent_at[i] = t;
+            if (send_all_timeout(fd, out, len, timeout_ms) != (ssize_t)len) break;
+        }
+
+        const char *line;
+        size_t line_len;
+        if (linereader_next(&rd, &line, &line_len, timeout_ms) <= 0) break;
+
+        PingResult *r = &res[recvd];
+        memset(r, 0, sizeof(*r));
+        r->rtt_us = mono_us() - sent_at[recvd];
+        r->ok = proto_parse_ack_job(line, line_len, r->truck_id, &r->eta_min,
+                                    &r->queued, &r->job) == PROTO_OK;
+        recvd++;
+    }
+
+    free(sent_at);
+    if (recvd == 0 && n > 0 && sent == 0) return -1;
+    return (int)recvd;
+}
+
+int ping_via_pool(ConnPool *pool, const TruckInfo *t, const PingMsg *msgs, size_t n,
+                  int depth, PingResult *res, int timeout_ms) {
+    size_t done = 0;
+
+    for (int attempt = 0; attempt < 2 && done < n; ++attempt) {
+        int reused = 0;
+        int fd = connpool_acquire(pool, t->id, t->last_ip, (uint16_t)t->tcp_port,
+                                  timeout_ms, &reused);
+        if (fd < 0) break;
+
+        int got = ping_pipeline(fd, msgs + done, n - done, depth, res + done, timeout_ms);
+        if (got > 0) done += (size_t)got;
+
+        // Keep the connection only if every request on it was answered
+        int clean = got >= 0 && done == n && msgs[n - 1].keepalive;
+        connpool_release(pool, t->id, t->last_ip, (uint16_t)t->tcp_port, fd, clean);
+
+        // A fresh connection that failed will not do better on retry
+        if (!reused || got > 0) break;
+    }
+    return (int)done;
+}
+
+// --- Fan-out ---
+
+typedef enum {
+    FO_CONNECTING,   // non-blocking connect in progress
+    FO_SENDING,      // request partly written
+    FO_WAITING,      // request written, reading the reply
+    FO_DONE,         // ACK received; connection kept open for a CANCEL
+    FO_CLOSED,       // failed, finished, or abandoned
+} FoState;
+
+typedef struct {
+    TruckInfo t;
+    int fd;
+    FoState st;
+    int cancelling;            // the outstanding request is a CANCEL
+    char out[MAX_LINE];
+    size_t out_len, out_off;
+    char in[MAX_LINE];
+    size_t in_len;
+    long sent_us;
+    PingResult res;
+} FoPeer;
+
+struct FanOut {
+    FoPeer *p;
+    size_t n;
+    PingMsg tmpl;
+    int cancelled;
+};
+
+static void fo_close(FoPeer *p) {
+    if (p->fd >= 0) close(p->fd);
+    p->fd = -1;
+    p->st = FO_CLOSED;
+}
+
+static void fo_queue(FoPeer *p, int len) {
+    if (len <= 0 || (size_t)len >= sizeof(p->out)) {
+        fo_close(p);
+        return;
+    }
+    p->out_len = (size_t)len;
+    p->out_off = 0;
+    p->in_len = 0;
+    p->st = FO_SENDING;
+}
+
+FanOut *fanout_start(const TruckInfo *trucks, size_t n, const PingMsg *tmpl) {
+    FanOut *f = calloc(1, sizeof(*f));
+    if (!f) return NULL;
+    f->p = calloc(n ? n : 1, sizeof(*f->p));
+    if (!f->p) {
+        free(f);
+        return NULL;
+    }
+    f->n = n;
+    f->tmpl = *tmpl;
+    f->tmpl.keepalive = 1;     // the losers' connections carry the CANCEL
+
+    for (size_t i = 0; i < n; ++i) {
+        FoPeer *p = &f->p[i];
+        p->t = trucks[i];
+        p->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        p->st = FO_CONNECTING;
+        if (p->fd < 0) {
+            p->st = FO_CLOSED;
+            continue;
+        }
+        struct sockaddr_in a = { .sin_family = AF_INET, .sin_port = htons((uint16_t)p->t.tcp_port),
+                                 .sin_addr = p->t.last_ip };
+        if (connect(p->fd, (struct sockaddr *)&a, sizeof(a)) < 0 && errno != EINPROGRESS) fo_close(p);
+    }
+    return f;
+}
+
+void fanout_destroy(FanOut *f) {
+    if (!f) return;
+    for (size_t i = 0; i < f->n; ++i) fo_close(&f->p[i]);
+    free(f->p);
+    free(f);
+}
+
+const PingResult *fanout_result(const FanOut *f, size_t i) {
+    return &f->p[i].res;
+}
+
+static void fo_connected(FanOut *f, FoPeer *p) {
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(p->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err) {
+        fo_close(p);
+        return;
+    }
+    tcp_set_nodelay(p->fd);
+    PingMsg m = f->tmpl;
+    snprintf(m.truck_id, sizeof(m.truck_id), "%s", p->t.id);
+    fo_queue(p, format_ping(p->out, sizeof(p->out), &m));
+}
+
+static void fo_send(FoPeer *p) {
+    while (p->out_off < p->out_len) {
+        ssize_t k = send(p->fd, p->out + p->out_off, p->out_len - p->out_off, MSG_NOSIGNAL);
+        if (k < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) fo_close(p);
+            return;
+        }
+        p->out_off += (size_t)k;
+    }
+    p->sent_us = mono_us();
+    p->st = FO_WAITING;
+}
+
+// Reads the reply line; returns 1 once a whole line has been handled
+static int fo_recv(FanOut *f, FoPeer *p) {
+    ssize_t k = recv(p->fd, p->in + p->in_len, sizeof(p->in) - 1 - p->in_len, 0);
+    if (k < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return 0;
+    if (k <= 0) {
+        fo_close(p);
+        return 0;
+    }
+    p->in_len += (size_t)k;
+    char *nl = memchr(p->in, '\n', p->in_len);
+    if (!nl) {
+        if (p->in_len >= sizeof(p->in) - 1) fo_close(p);
+        return 0;
+    }
+
+    char id[MAX_ID_LEN];
+    int eta, queued;
+    uint32_t job;
+    int ok = proto_parse_ack_job(p->in, (size_t)(nl - p->in), id, &eta, &queued, &job) == PROTO_OK;
+    if (p->cancelling) {
+        if (ok && job == p->res.job) f->cancelled++;
+        p->res.job = 0;
+        fo_close(p);
+        return 1;
+    }
+    p->res.ok = ok;
+    if (ok) {
+        memcpy(p->res.truck_id, id, MAX_ID_LEN);
+        p->res.eta_min = eta;
+        p->res.queued = queued;
+        p->res.job = job;
+        p->res.rtt_us = mono_us() - p->sent_us;
+        p->st = FO_DONE;
+    } else {
+        fo_close(p);
+    }
+    return 1;
+}
+
+/**
+ * @brief One poll round over every open peer, advancing each one's state.
+ * on_line, if set, is told about every reply line that was handled.
+ */
+static void fo_poll(FanOut *f, int timeout_ms, void (*on_line)(FanOut *, size_t, void *), void *ctx) {
+    struct pollfd *pfd = malloc(f->n * sizeof(*pfd));
+    size_t *idx = malloc(f->n * sizeof(*idx));
+    if (!pfd || !idx) {
+        free(pfd);
+        free(idx);
+        return;
+    }
+    nfds_t m = 0;
+    for (size_t i = 0; i < f->n; ++i) {
+        FoPeer *p = &f->p[i];
+        if (p->st == FO_CLOSED || p->st == FO_DONE) continue;
+        pfd[m].fd = p->fd;
+        pfd[m].events = p->st == FO_WAITING ? POLLIN : POLLOUT;
+        pfd[m].revents = 0;
+        idx[m++] = i;
+    }
+    if (m > 0 && poll(pfd, m, timeout_ms) > 0) {
+        for (nfds_t j = 0; j < m; ++j) {
+            if (!pfd[j].revents) continue;
+            size_t i = idx[j];
+            FoPeer *p = &f->p[i];
+            if (p->st == FO_CONNECTING) fo_connected(f, p);
+            if (p->st == FO_SENDING) fo_send(p);
+            else if (p->st == FO_WAITING && (pfd[j].revents & (POLLIN | POLLHUP | POLLERR))) {
+                if (fo_recv(f, p) && on_line) on_line(f, i, ctx);
+            }
+        }
+    }
+    free(pfd);
+    free(idx);
+}
+
+static int fo_busy(const FanOut *f) {
+    for (size_t i = 0; i < f->n; ++i) {
+        FoState st = f->p[i].st;
+        if (st == FO_CONNECTING || st == FO_SENDING || st == FO_WAITING) return 1;
+    }
+    return 0;
+}
+
+typedef struct {
+    int best;
+    int accept_eta;
+    int accepted;
+} FoRun;
+
+static void fo_on_ack(FanOut *f, size_t i, void *ctx) {
+    FoRun *r = ctx;
+    const PingResult *res = &f->p[i].res;
+    if (!res->ok) return;
+    if (r->best < 0 || res->eta_min < f->p[r->best].res.eta_min) r->best = (int)i;
+    if (r->accept_eta >= 0 && res->eta_min <= r->accept_eta) r->accepted = 1;
+}
+
+int fanout_run(FanOut *f, int accept_eta, int timeout_ms) {
+    FoRun r = { -1, accept_eta, 0 };
+    for (size_t i = 0; i < f->n; ++i)
+        if (f->p[i].res.ok) fo_on_ack(f, i, &r);
+    long deadline = mono_ms() + timeout_ms;
+    while (!r.accepted && fo_busy(f)) {
+        long left = deadline - mono_ms();
+        if (left <= 0) break;
+        fo_poll(f, (int)left, fo_on_ack, &r);
+    }
+    return r.best;
+}
+
+// A late ACK for a truck we no longer want: cancel its job right away
+static void fo_on_late_ack(FanOut *f, size_t i, void *ctx) {
+    (void)ctx;
+    FoPeer *p = &f->p[i];
+    if (p->cancelling || p->st != FO_DONE) return;
+    if (!p->res.ok || !p->res.job) {
+        fo_close(p);
+        return;
+    }
+    CancelMsg m;
+    memset(&m, 0, sizeof(m));
+    snprintf(m.truck_id, sizeof(m.truck_id), "%s", p->t.id);
+    snprintf(m.user_id, sizeof(m.user_id), "%s", f->tmpl.user_id);
+    m.job = p->res.job;
+    p->cancelling = 1;
+    fo_queue(p, format_cancel(p->out, sizeof(p->out), &m));
+}
+
+int fanout_cancel_rest(FanOut *f, int keep, int timeout_ms) {
+    f->cancelled = 0;
+    for (size_t i = 0; i < f->n; ++i) {
+        FoPeer *p = &f->p[i];
+        if ((int)i == keep) {
+            fo_close(p);
+            continue;
+        }
+        // A PING not fully written never reached the truck as a request
+        if (p->st == FO_CONNECTING || p->st == FO_SENDING) fo_close(p);
+        else if (p->st == FO_DONE) fo_on_late_ack(f, i, NULL);
+    }
+    long deadline = mono_ms() + timeout_ms;
+    while (fo_busy(f)) {
+        long left = deadline - mono_ms();
+        if (left <= 0) break;
+        fo_poll(f, (int)left, fo_on_late_ack, NULL);
+    }
+    return f->cancelled;
+}
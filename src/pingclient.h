@@ -0,0 +1,65 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <netinet/in.h>
+#include "common.h"
+
+/*
+ * Client side of the PING/ACK protocol over persistent connections.
+ *
+ * A ConnPool keeps idle keep-alive connections keyed by truck id and
+ * IP:port so repeated pings to the same truck skip the TCP handshake.
+ * ping_pipeline() sends several PINGs ahead of their ACKs on one connection;
+ * the truck answers in request order.
+ *
+ * A FanOut pings several trucks at once from one poll loop: every connect is
+ * started up front and each PING goes out as soon as its connection is up,
+ * so the wait is bounded by the slowest reply that matters instead of the
+ * sum of the connects. Orders from the trucks that lose are then cancelled.
+ */
+
+typedef struct {
+    int ok;                     // 1 when a well-formed ACK came back
+    char truck_id[MAX_ID_LEN];
+    int eta_min;
+    int queued;
+    uint32_t job;               // truck's order number, 0 if not queued
+    long rtt_us;                // PING sent -> ACK received
+} PingResult;
+
+typedef struct ConnPool ConnPool;
+
+ConnPool *connpool_create(int idle_ms);
+void connpool_destroy(ConnPool *pool);
+
+// Returns a pooled or freshly connected socket; *reused tells which
+int connpool_acquire(ConnPool *pool, const char *truck_id, struct in_addr ip,
+                     uint16_t port, int timeout_ms, int *reused);
+// Gives the socket back; it is closed instead when reusable is 0
+void connpool_release(ConnPool *pool, const char *truck_id, struct in_addr ip,
+                      uint16_t port, int fd, int reusable);
+
+// Sends msgs with up to depth PINGs in flight; returns ACK lines read or -1
+int ping_pipeline(int fd, const PingMsg *msgs, size_t n, int depth,
+                  PingResult *res, int timeout_ms);
+
+// Pipelines msgs to truck t over a pooled connection, reconnecting once if a
+// pooled connection turns out to be dead. Returns ACK lines read.
+int ping_via_pool(ConnPool *pool, const TruckInfo *t, const PingMsg *msgs, size_t n,
+                  int depth, PingResult *res, int timeout_ms);
+
+typedef struct FanOut FanOut;
+
+// Starts connecting to the n trucks; each gets tmpl with its own truck_id
+FanOut *fanout_start(const TruckInfo *trucks, size_t n, const PingMsg *tmpl);
+// Collects ACKs until one quotes eta <= accept_eta (accept_eta < 0: never),
+// every truck has answered or failed, or timeout_ms passes. Returns the
+// index of the lowest ETA received so far, or -1 if none.
+int fanout_run(FanOut *f, int accept_eta, int timeout_ms);
+// Truck i's ACK; ok is 0 when it has not answered (yet)
+const PingResult *fanout_result(const FanOut *f, size_t i);
+// Cancels every order except truck keep's (-1 = all). PINGs still waiting
+// for their ACK get up to timeout_ms to answer so their job can be
+// cancelled too. Returns the number of orders the trucks confirmed cancelled.
+int fanout_cancel_rest(FanOut *f, int keep, int timeout_ms);
+void fanout_destroy(FanOut *f);
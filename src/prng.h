@@ -0,0 +1,45 @@
+#pragma once
+#include <stdint.h>
+
+/*
+ * xoshiro256** PRNG with splitmix64 seeding. The state is a plain value, so
+ * every simulated truck (or thread) can own one: no locks, no shared state,
+ * and the same seed always gives the same sequence.
+ */
+
+typedef struct {
+    uint64_t s[4];
+} Prng;
+
+static inline uint64_t prng_splitmix64(uint64_t *x) {
+    uint64_t z = (*x += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+// Seeds r from seed and a stream number (e.g. the truck index)
+static inline void prng_seed(Prng *r, uint64_t seed, uint64_t stream) {
+    uint64_t x = seed ^ (stream * 0xD1B54A32D192ED03ull);
+    for (int i = 0; i < 4; ++i) r->s[i] = prng_splitmix64(&x);
+}
+
+static inline uint64_t prng_rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+
+static inline uint64_t prng_next(Prng *r) {
+    uint64_t *s = r->s;
+    uint64_t out = prng_rotl(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = prng_rotl(s[3], 45);
+    return out;
+}
+
+// Uniform in [0, 1)
+static inline double prng_double(Prng *r) {
+    return (double)(prng_next(r) >> 11) * (1.0 / 9007199254740992.0);
+}
@@ -1,17 +1,253 @@
+#define _POSIX_C_SOURCE 200809L   // strnlen
+
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
-#include <ctype.h>
+#include <stdint.h>
+#include <limits.h>
 #include <time.h>
+#include <arpa/inet.h>
 #include "protocol.h"
 
-static const char* skipsp(const char *s) {
-    while (*s == ' ' || *s == '\t') ++s;
-    return s;
+/* ------------------------------
+ * TOKENIZER
+ *
+ * A message is "<TYPE> key=value key=value ...". Values are either bare
+ * (up to the next blank) or double-quoted (may contain blanks). The line is
+ * walked once; each key is looked up in a small per-message table and its
+ * value is converted in place, without copies or sscanf.
+ * ------------------------------ */
+
+typedef struct {
+    const char *p;
+    const char *end;
+} Cursor;
+
+typedef struct {
+    const char *key;
+    size_t klen;
+    const char *val;
+    size_t vlen;
+} Token;
+
+enum {
+    F_UNKNOWN = -1,
+    F_TRUCK_ID, F_USER_ID, F_ADDR, F_NOTE, F_KA,
+    F_LAT, F_LON, F_TS, F_TCP,
+    F_ETA, F_QUEUED, F_JOB,
+    F_IP, F_COUNT,
+    F_VN, F_VE
+};
+
+typedef struct {
+    const char *name;
+    size_t len;
+    int field;
+} KeyDef;
+
+#define KEY(s, f) { s, sizeof(s) - 1, f }
+
+static const KeyDef HB_KEYS[] = {
+    KEY("truck_id", F_TRUCK_ID), KEY("lat", F_LAT), KEY("lon", F_LON),
+    KEY("ts", F_TS), KEY("tcp", F_TCP),
+    KEY("vn", F_VN), KEY("ve", F_VE), KEY("ka", F_KA),
+};
+
+static const KeyDef PING_KEYS[] = {
+    KEY("truck_id", F_TRUCK_ID), KEY("user_id", F_USER_ID),
+    KEY("addr", F_ADDR), KEY("note", F_NOTE), KEY("ka", F_KA),
+    KEY("lat", F_LAT), KEY("lon", F_LON),
+};
+
+static const KeyDef ACK_KEYS[] = {
+    KEY("truck_id", F_TRUCK_ID), KEY("eta_min", F_ETA), KEY("queued", F_QUEUED),
+    KEY("job", F_JOB),
+};
+
+static const KeyDef CANCEL_KEYS[] = {
+    KEY("truck_id", F_TRUCK_ID), KEY("user_id", F_USER_ID), KEY("job", F_JOB),
+    KEY("ka", F_KA),
+};
+
+static const KeyDef GW_KEYS[] = {
+    KEY("truck_id", F_TRUCK_ID), KEY("lat", F_LAT), KEY("lon", F_LON),
+    KEY("tcp", F_TCP), KEY("ip", F_IP), KEY("n", F_COUNT),
+};
+
+#define NKEYS(t) (sizeof(t) / sizeof((t)[0]))
+
+static int lookup_key(const KeyDef *tab, size_t n, const Token *t)
+{
+    for (size_t i = 0; i < n; ++i) {
+        if (tab[i].len == t->klen && memcmp(tab[i].name, t->key, t->klen) == 0)
+            return tab[i].field;
+    }
+    return F_UNKNOWN;
+}
+
+static int is_eol(char c)
+{
+    return c == '\n' || c == '\r' || c == '\0';
+}
+
+static int is_blank(char c)
+{
+    return c == ' ' || c == '\t';
+}
+
+/* Clips the cursor at the first '\n' or '\0' so later scans can trust end */
+static void cursor_init(Cursor *c, const char *line, size_t len)
+{
+    const char *nl = memchr(line, '\n', len);
+    if (nl) len = (size_t)(nl - line);
+    const char *nul = memchr(line, '\0', len);
+    if (nul) len = (size_t)(nul - line);
+    c->p = line;
+    c->end = line + len;
+}
+
+/* Consumes "<type> " at the start of the line */
+static int expect_type(Cursor *c, const char *type, size_t tlen)
+{
+    if ((size_t)(c->end - c->p) <= tlen || memcmp(c->p, type, tlen) != 0 || !is_blank(c->p[tlen]))
+        return PROTO_ERR_TYPE;
+    c->p += tlen + 1;
+    return PROTO_OK;
+}
+
+/* Returns 1 with a token, 0 at end of line, or a ProtoErr */
+static int next_token(Cursor *c, Token *t)
+{
+    const char *p = c->p, *end = c->end;
+    while (p < end && is_blank(*p)) ++p;
+    if (p == end || is_eol(*p)) { c->p = p; return 0; }
+
+    t->key = p;
+    while (p < end && *p != '=' && !is_blank(*p) && !is_eol(*p)) ++p;
+    if (p == end || *p != '=' || p == t->key) return PROTO_ERR_SYNTAX;
+    t->klen = (size_t)(p - t->key);
+    ++p;
+
+    if (p < end && *p == '"') {
+        ++p;
+        const char *q = memchr(p, '"', (size_t)(end - p));
+        if (!q) return PROTO_ERR_SYNTAX;
+        t->val = p;
+        t->vlen = (size_t)(q - p);
+        p = q + 1;
+    } else {
+        t->val = p;
+        while (p < end && !is_blank(*p) && !is_eol(*p)) ++p;
+        t->vlen = (size_t)(p - t->val);
+    }
+
+    c->p = p;
+    return 1;
+}
+
+/* ------------------------------
+ * VALUE CONVERSION
+ * ------------------------------ */
+
+/* Copies a string value, truncating to the destination (like %15s did) */
+static void copy_str(char *dst, size_t n, const Token *t)
+{
+    size_t k = t->vlen < n - 1 ? t->vlen : n - 1;
+    memcpy(dst, t->val, k);
+    dst[k] = '\0';
+}
+
+static int parse_long(const Token *t, long lo, long hi, long *out)
+{
+    const char *p = t->val, *end = t->val + t->vlen;
+    int neg = 0;
+    if (p < end && (*p == '-' || *p == '+')) neg = (*p++ == '-');
+    if (p == end) return PROTO_ERR_NUMBER;
+
+    unsigned long v = 0;
+    for (; p < end; ++p) {
+        unsigned d = (unsigned)(*p - '0');
+        if (d > 9) return PROTO_ERR_NUMBER;
+        if (v > ((unsigned long)LONG_MAX - d) / 10) return PROTO_ERR_RANGE;
+        v = v * 10 + d;
+    }
+
+    long s = neg ? -(long)v : (long)v;
+    if (s < lo || s > hi) return PROTO_ERR_RANGE;
+    *out = s;
+    return PROTO_OK;
 }
 
-static int starts(const char *s, const char *p) {
-    return strncmp(s, p, strlen(p)) == 0;
+static int parse_int(const Token *t, int lo, int hi, int *out)
+{
+    long v;
+    int r = parse_long(t, lo, hi, &v);
+    if (r == PROTO_OK) *out = (int)v;
+    return r;
+}
+
+static const double POW10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9,
+    1e10, 1e11, 1e12, 1e13, 1e14, 1e15
+};
+
+/*
+ * Fixed-point decimal ("-31.956000"). All digits are gathered into one
+ * integer and divided by a power of ten once, which gives the correctly
+ * rounded result for up to 15 significant digits - everything format_hb
+ * produces. Longer or exponent forms fall back to strtod.
+ */
+static int parse_double(const Token *t, double *out)
+{
+    const char *p = t->val, *end = t->val + t->vlen;
+    int neg = 0;
+    if (p < end && (*p == '-' || *p == '+')) neg = (*p++ == '-');
+
+    uint64_t mant = 0;
+    int digits = 0, frac = 0, seen_dot = 0, any = 0;
+    for (; p < end; ++p) {
+        if (*p == '.' && !seen_dot) { seen_dot = 1; continue; }
+        unsigned d = (unsigned)(*p - '0');
+        if (d > 9) break;
+        any = 1;
+        if (mant == 0 && d == 0 && !seen_dot) continue; // leading zeros
+        mant = mant * 10 + d;
+        ++digits;
+        if (seen_dot) ++frac;
+        if (digits > 15) break;
+    }
+    if (!any) return PROTO_ERR_NUMBER;
+
+    if (p != end) {
+        // Rare forms (exponent, >15 digits): let libc do the exact conversion
+        char tmp[64];
+        if (t->vlen >= sizeof(tmp)) return PROTO_ERR_NUMBER;
+        memcpy(tmp, t->val, t->vlen);
+        tmp[t->vlen] = '\0';
+        char *e;
+        double v = strtod(tmp, &e);
+        if (*e != '\0' || v != v || v - v != 0) return PROTO_ERR_NUMBER; // reject nan/inf
+        *out = v;
+        return PROTO_OK;
+    }
+
+    double v = (double)mant / POW10[frac];
+    *out = neg ? -v : v;
+    return PROTO_OK;
+}
+
+const char *proto_strerror(int err)
+{
+    switch (err) {
+    case PROTO_OK:          return "ok";
+    case PROTO_ERR_TYPE:    return "wrong message type";
+    case PROTO_ERR_SYNTAX:  return "malformed key=value token";
+    case PROTO_ERR_NUMBER:  return "invalid number";
+    case PROTO_ERR_MISSING: return "missing required field";
+    case PROTO_ERR_RANGE:   return "value out of range";
+    case PROTO_ERR_VERSION: return "unsupported binary version";
+    }
+    return "unknown error";
 }
 
 /* ------------------------------
@@ -21,182 +257,525 @@ int format_hb(char *out, size_t n,
               const char *truck_id, double lat, double lon,
               int tcp_port, time_t ts)
 {
+    return format_hb_motion(out, n, truck_id, lat, lon, tcp_port, ts, NULL);
+}
+
+int format_hb_motion(char *out, size_t n,
+                     const char *truck_id, double lat, double lon,
+                     int tcp_port, time_t ts, const HbMotion *m)
+{
+    if (!m)
+        return snprintf(out, n,
+                        "HB truck_id=%s lat=%.6f lon=%.6f ts=%ld tcp=%d\n",
+                        truck_id, lat, lon, (long)ts, tcp_port);
     return snprintf(out, n,
-                    "HB truck_id=%s lat=%.6f lon=%.6f ts=%ld tcp=%d\n",
-                    truck_id, lat, lon, (long)ts, tcp_port);
+                    "HB truck_id=%s lat=%.6f lon=%.6f ts=%ld tcp=%d vn=%.2f ve=%.2f ka=%d\n",
+                    truck_id, lat, lon, (long)ts, tcp_port, m->vn, m->ve, m->keepalive_s);
 }
 
-int parse_hb(const char *line, TruckInfo *out, time_t *ts)
+int proto_parse_hb(const char *line, size_t len, TruckInfo *out, time_t *ts)
 {
-    if (!starts(line, "HB "))
-        return 0;
-    line += 3;
+    Cursor c;
+    cursor_init(&c, line, len);
+    int r = expect_type(&c, "HB", 2);
+    if (r != PROTO_OK) return r;
 
     char id[MAX_ID_LEN] = {0};
-    double lat = 0, lon = 0;
+    double lat = 0, lon = 0, vn = 0, ve = 0;
     long t = 0;
-    int tcp = 0;
-
-    const char *s = line;
-    while (*s) {
-        s = skipsp(s);
-
-        if (starts(s, "truck_id=")) {
-            s += 9;
-            sscanf(s, "%15s", id);
-        } else if (starts(s, "lat=")) {
-            s += 4;
-            sscanf(s, "%lf", &lat);
-        } else if (starts(s, "lon=")) {
-            s += 4;
-            sscanf(s, "%lf", &lon);
-        } else if (starts(s, "ts=")) {
-            s += 3;
-            sscanf(s, "%ld", &t);
-        } else if (starts(s, "tcp=")) {
-            s += 4;
-            sscanf(s, "%d", &tcp);
-        }
+    int tcp = 0, ka = 0;
 
-        while (*s && *s != ' ' && *s != '\n')
-            ++s;
-        if (*s == '\n')
-            break;
+    Token tok;
+    while ((r = next_token(&c, &tok)) == 1) {
+        switch (lookup_key(HB_KEYS, NKEYS(HB_KEYS), &tok)) {
+        case F_TRUCK_ID: copy_str(id, sizeof(id), &tok); break;
+        case F_LAT:      r = parse_double(&tok, &lat); break;
+        case F_LON:      r = parse_double(&tok, &lon); break;
+        case F_TS:       r = parse_long(&tok, LONG_MIN, LONG_MAX, &t); break;
+        case F_TCP:      r = parse_int(&tok, 1, 65535, &tcp); break;
+        case F_VN:       r = parse_double(&tok, &vn); break;
+        case F_VE:       r = parse_double(&tok, &ve); break;
+        case F_KA:       r = parse_int(&tok, 0, 65535, &ka); break;
+        default:         break; // unknown keys are skipped for forward compatibility
+        }
+        if (r < 0) return r;
     }
+    if (r < 0) return r;
 
     if (!*id || tcp <= 0)
-        return 0;
+        return PROTO_ERR_MISSING;
 
-    strncpy(out->id, id, MAX_ID_LEN);
+    memcpy(out->id, id, MAX_ID_LEN);
     out->lat = lat;
     out->lon = lon;
     out->tcp_port = tcp;
+    out->seq = 0;
+    out->vn = (float)vn;
+    out->ve = (float)ve;
+    out->keepalive_s = ka;
     if (ts) *ts = (time_t)t;
 
-    return 1;
+    return PROTO_OK;
+}
+
+int parse_hb(const char *line, TruckInfo *out, time_t *ts)
+{
+    return proto_parse_hb(line, strlen(line), out, ts) == PROTO_OK;
 }
 
 /* ------------------------------
- * PING FORMAT + PARSE
+ * BINARY HEARTBEAT FORMAT + PARSE
  * ------------------------------ */
-int format_ping(char *out, size_t n, const PingMsg *p)
+
+/* FNV-1a: a stable 32-bit key receivers can index trucks by */
+uint32_t proto_id_key(const char *id)
 {
-    return snprintf(out, n,
-                    "PING truck_id=%s user_id=%s addr=\"%s\" note=\"%s\"\n",
-                    p->truck_id, p->user_id, p->addr, p->note);
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < MAX_ID_LEN && id[i]; ++i) {
+        h ^= (uint8_t)id[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void put_u16(uint8_t *p, uint16_t v) { p[0] = (uint8_t)(v >> 8); p[1] = (uint8_t)v; }
+static void put_u32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)(v >> 24); p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);  p[3] = (uint8_t)v;
+}
+static uint16_t get_u16(const uint8_t *p) { return (uint16_t)(p[0] << 8 | p[1]); }
+static uint32_t get_u32(const uint8_t *p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static int32_t deg_to_e7(double d)
+{
+    double v = d * 1e7;
+    return (int32_t)(v < 0 ? v - 0.5 : v + 0.5);
+}
+
+// Velocity in cm/s, saturated to the i16 field
+static uint16_t speed_cm(double mps)
+{
+    double v = mps * 100.0;
+    if (v > 32767.0) v = 32767.0;
+    if (v < -32767.0) v = -32767.0;
+    return (uint16_t)(int16_t)(v < 0 ? v - 0.5 : v + 0.5);
+}
+
+int format_hb_bin(uint8_t *out, size_t n,
+                  const char *truck_id, double lat, double lon,
+                  int tcp_port, time_t ts, uint32_t seq)
+{
+    return format_hb_bin_motion(out, n, truck_id, lat, lon, tcp_port, ts, seq, NULL);
 }
 
-static void scan_qstr(const char *s, char *dst, size_t n)
+int format_hb_bin_motion(uint8_t *out, size_t n,
+                         const char *truck_id, double lat, double lon,
+                         int tcp_port, time_t ts, uint32_t seq, const HbMotion *m)
 {
-    if (*s != '\"') {
-        *dst = '\0';
-        return;
+    size_t id_len = strnlen(truck_id, MAX_ID_LEN - 1);
+    size_t hdr = m ? HB_BIN_HDR_LEN_MOTION : HB_BIN_HDR_LEN;
+    if (n < hdr + id_len)
+        return -1;
+
+    out[0] = HB_BIN_MAGIC;
+    out[1] = m ? HB_BIN_VERSION_MOTION : HB_BIN_VERSION;
+    out[2] = (uint8_t)hdr;
+    out[3] = (uint8_t)id_len;
+    put_u32(out + 4, proto_id_key(truck_id));
+    put_u32(out + 8, seq);
+    put_u32(out + 12, (uint32_t)deg_to_e7(lat));
+    put_u32(out + 16, (uint32_t)deg_to_e7(lon));
+    put_u32(out + 20, (uint32_t)ts);
+    put_u16(out + 24, (uint16_t)tcp_port);
+    put_u16(out + 26, 0);
+    if (m) {
+        put_u16(out + 28, speed_cm(m->vn));
+        put_u16(out + 30, speed_cm(m->ve));
+        int ka = m->keepalive_s < 0 ? 0 : m->keepalive_s > 65535 ? 65535 : m->keepalive_s;
+        put_u16(out + 32, (uint16_t)ka);
     }
+    memcpy(out + hdr, truck_id, id_len);
+    return (int)(hdr + id_len);
+}
+
+int proto_parse_hb_bin(const uint8_t *buf, size_t len, TruckInfo *out, time_t *ts)
+{
+    if (len < 4 || buf[0] != HB_BIN_MAGIC)
+        return PROTO_ERR_TYPE;
+
+    size_t hdr = buf[2], id_len = buf[3];
+    if (buf[1] < 1 || hdr < HB_BIN_HDR_LEN)
+        return PROTO_ERR_VERSION;
+    if (len < hdr + id_len)
+        return PROTO_ERR_SYNTAX;
+    if (id_len == 0)
+        return PROTO_ERR_MISSING;
+    if (id_len >= MAX_ID_LEN)
+        return PROTO_ERR_RANGE;
 
-    s++;
-    size_t i = 0;
-    while (*s && *s != '\"' && i + 1 < n) {
-        dst[i++] = *s++;
+    int tcp = get_u16(buf + 24);
+    if (tcp == 0)
+        return PROTO_ERR_MISSING;
+
+    if (memchr(buf + hdr, '\0', id_len))
+        return PROTO_ERR_SYNTAX;
+
+    memset(out->id, 0, MAX_ID_LEN);
+    memcpy(out->id, buf + hdr, id_len);
+    out->seq = get_u32(buf + 8);
+    out->lat = (int32_t)get_u32(buf + 12) / 1e7;
+    out->lon = (int32_t)get_u32(buf + 16) / 1e7;
+    out->tcp_port = tcp;
+    out->vn = out->ve = 0;
+    out->keepalive_s = 0;
+    if (buf[1] >= HB_BIN_VERSION_MOTION && hdr >= HB_BIN_HDR_LEN_MOTION) {
+        out->vn = (int16_t)get_u16(buf + 28) / 100.0f;
+        out->ve = (int16_t)get_u16(buf + 30) / 100.0f;
+        out->keepalive_s = get_u16(buf + 32);
     }
-    dst[i] = '\0';
+    if (ts) *ts = (time_t)get_u32(buf + 20);
+
+    return PROTO_OK;
 }
 
-int parse_ping(const char *line, PingMsg *out)
+int proto_parse_hb_any(const void *buf, size_t len, TruckInfo *out, time_t *ts)
 {
-    if (!starts(line, "PING "))
-        return 0;
-    line += 5;
+    const uint8_t *b = (const uint8_t *)buf;
+    if (len > 0 && b[0] == HB_BIN_MAGIC)
+        return proto_parse_hb_bin(b, len, out, ts);
+    if (len > 0 && b[0] == HB_BATCH_MAGIC)
+        return PROTO_ERR_TYPE;
 
-    const char *s = line;
-    char id[MAX_ID_LEN] = {0};
-    char uid[MAX_ID_LEN] = {0};
-    char addr[128] = {0};
-    char note[64] = {0};
-
-    while (*s) {
-        s = skipsp(s);
-
-        if (starts(s, "truck_id=")) {
-            s += 9;
-            sscanf(s, "%15s", id);
-        } else if (starts(s, "user_id=")) {
-            s += 8;
-            sscanf(s, "%15s", uid);
-        } else if (starts(s, "addr=")) {
-            s += 5;
-            scan_qstr(s, addr, sizeof(addr));
-        } else if (starts(s, "note=")) {
-            s += 5;
-            scan_qstr(s, note, sizeof(note));
-        }
+    return proto_parse_hb((const char *)buf, len, out, ts);
+}
+
+/* ------------------------------
+ * BATCHED HEARTBEATS
+ * ------------------------------ */
+void hb_batch_reset(HbBatch *b)
+{
+    b->buf[0] = HB_BATCH_MAGIC;
+    b->buf[1] = HB_BATCH_VERSION;
+    b->buf[2] = HB_BATCH_HDR_LEN;
+    b->buf[3] = 0;
+    b->len = HB_BATCH_HDR_LEN;
+    b->count = 0;
+}
 
-        while (*s && *s != ' ' && *s != '\n')
-            ++s;
-        if (*s == '\n')
-            break;
+int hb_batch_add(HbBatch *b, const char *truck_id, double lat, double lon,
+                 int tcp_port, time_t ts, uint32_t seq, const HbMotion *m)
+{
+    if (b->count == 255)
+        return -1;
+    int n = format_hb_bin_motion(b->buf + b->len, sizeof(b->buf) - b->len,
+                                 truck_id, lat, lon, tcp_port, ts, seq, m);
+    if (n < 0)
+        return -1;
+    b->len += (size_t)n;
+    b->buf[3] = (uint8_t)++b->count;
+    return 0;
+}
+
+int proto_parse_hb_batch(const uint8_t *buf, size_t len, TruckInfo *out, size_t max)
+{
+    if (len < HB_BATCH_HDR_LEN || buf[0] != HB_BATCH_MAGIC)
+        return PROTO_ERR_TYPE;
+    if (buf[1] < 1 || buf[2] < HB_BATCH_HDR_LEN)
+        return PROTO_ERR_VERSION;
+    if (len < buf[2])
+        return PROTO_ERR_SYNTAX;
+
+    size_t count = buf[3], off = buf[2];
+    if (count > max)
+        return PROTO_ERR_RANGE;
+    for (size_t i = 0; i < count; ++i) {
+        // Record length from its own header, checked before the full parse
+        if (len - off < 4)
+            return PROTO_ERR_SYNTAX;
+        size_t rec = (size_t)buf[off + 2] + buf[off + 3];
+        if (rec > len - off)
+            return PROTO_ERR_SYNTAX;
+        memset(&out[i], 0, sizeof(out[i]));
+        int r = proto_parse_hb_bin(buf + off, rec, &out[i], NULL);
+        if (r != PROTO_OK)
+            return r;
+        off += rec;
     }
+    return off == len ? (int)count : PROTO_ERR_SYNTAX;
+}
 
-    if (!*id || !*uid)
-        return 0;
+int proto_parse_hb_datagram(const void *buf, size_t len, TruckInfo *out, size_t max)
+{
+    const uint8_t *b = (const uint8_t *)buf;
+    if (len > 0 && b[0] == HB_BATCH_MAGIC)
+        return proto_parse_hb_batch(b, len, out, max);
+    if (max == 0)
+        return PROTO_ERR_RANGE;
 
-    strncpy(out->truck_id, id, MAX_ID_LEN);
-    strncpy(out->user_id, uid, MAX_ID_LEN);
-    strncpy(out->addr, addr, sizeof(out->addr));
-    strncpy(out->note, note, sizeof(out->note));
+    memset(out, 0, sizeof(*out));
+    int r = proto_parse_hb_any(buf, len, out, NULL);
+    return r == PROTO_OK ? 1 : r;
+}
 
-    return 1;
+/* ------------------------------
+ * PING FORMAT + PARSE
+ * ------------------------------ */
+int format_ping(char *out, size_t n, const PingMsg *p)
+{
+    if (p->has_loc)
+        return snprintf(out, n,
+                        "PING truck_id=%s user_id=%s addr=\"%s\" note=\"%s\" lat=%.6f lon=%.6f%s\n",
+                        p->truck_id, p->user_id, p->addr, p->note, p->lat, p->lon,
+                        p->keepalive ? " ka=1" : "");
+    return snprintf(out, n,
+                    "PING truck_id=%s user_id=%s addr=\"%s\" note=\"%s\"%s\n",
+                    p->truck_id, p->user_id, p->addr, p->note,
+                    p->keepalive ? " ka=1" : "");
+}
+
+int proto_parse_ping(const char *line, size_t len, PingMsg *out)
+{
+    Cursor c;
+    cursor_init(&c, line, len);
+    int r = expect_type(&c, "PING", 4);
+    if (r != PROTO_OK) return r;
+
+    PingMsg m;
+    memset(&m, 0, sizeof(m));
+    int has_lat = 0, has_lon = 0;
+
+    Token tok;
+    while ((r = next_token(&c, &tok)) == 1) {
+        switch (lookup_key(PING_KEYS, NKEYS(PING_KEYS), &tok)) {
+        case F_TRUCK_ID: copy_str(m.truck_id, sizeof(m.truck_id), &tok); break;
+        case F_USER_ID:  copy_str(m.user_id, sizeof(m.user_id), &tok); break;
+        case F_ADDR:     copy_str(m.addr, sizeof(m.addr), &tok); break;
+        case F_NOTE:     copy_str(m.note, sizeof(m.note), &tok); break;
+        case F_KA:       r = parse_int(&tok, INT_MIN, INT_MAX, &m.keepalive); break;
+        case F_LAT:      r = parse_double(&tok, &m.lat); has_lat = 1; break;
+        case F_LON:      r = parse_double(&tok, &m.lon); has_lon = 1; break;
+        default:         break;
+        }
+        if (r < 0) return r;
+    }
+    if (r < 0) return r;
+
+    if (!*m.truck_id || !*m.user_id)
+        return PROTO_ERR_MISSING;
+
+    /* The location is optional, but only as a pair */
+    if (has_lat != has_lon)
+        return PROTO_ERR_MISSING;
+    if (has_lat && (m.lat < -90.0 || m.lat > 90.0 || m.lon < -180.0 || m.lon > 180.0))
+        return PROTO_ERR_RANGE;
+    m.has_loc = has_lat;
+
+    m.keepalive = m.keepalive != 0;
+    *out = m;
+    return PROTO_OK;
+}
+
+int parse_ping(const char *line, PingMsg *out)
+{
+    return proto_parse_ping(line, strlen(line), out) == PROTO_OK;
 }
 
 /* ------------------------------
- * ACK FORMAT
+ * ACK FORMAT + PARSE
  * ------------------------------ */
 int format_ack(char *out, size_t n,
                const char *truck_id, int eta_min, int queued)
 {
+    return format_ack_job(out, n, truck_id, eta_min, queued, 0);
+}
+
+int format_ack_job(char *out, size_t n, const char *truck_id,
+                   int eta_min, int queued, uint32_t job)
+{
+    if (job)
+        return snprintf(out, n,
+                        "ACK truck_id=%s eta_min=%d queued=%d job=%u\n",
+                        truck_id, eta_min, queued, job);
     return snprintf(out, n,
                     "ACK truck_id=%s eta_min=%d queued=%d\n",
                     truck_id, eta_min, queued);
 }
 
-/* ------------------------------
- * ACK PARSE  (THIS WAS MISSING)
- * ------------------------------ */
-int parse_ack(const char *line, char *id, int *eta_min, int *queued)
+int proto_parse_ack(const char *line, size_t len, char *id, int *eta_min, int *queued)
 {
-    if (!starts(line, "ACK "))
-        return 0;
-    line += 4;
+    return proto_parse_ack_job(line, len, id, eta_min, queued, NULL);
+}
+
+int proto_parse_ack_job(const char *line, size_t len, char *id, int *eta_min,
+                        int *queued, uint32_t *job)
+{
+    Cursor c;
+    cursor_init(&c, line, len);
+    int r = expect_type(&c, "ACK", 3);
+    if (r != PROTO_OK) return r;
 
     char tid[MAX_ID_LEN] = {0};
     int eta = 0;
     int q = 0;
+    long j = 0;
 
-    const char *s = line;
-    while (*s) {
-        s = skipsp(s);
-
-        if (starts(s, "truck_id=")) {
-            s += 9;
-            sscanf(s, "%15s", tid);
-        } else if (starts(s, "eta_min=")) {
-            s += 8;
-            sscanf(s, "%d", &eta);
-        } else if (starts(s, "queued=")) {
-            s += 7;
-            sscanf(s, "%d", &q);
+    Token tok;
+    while ((r = next_token(&c, &tok)) == 1) {
+        switch (lookup_key(ACK_KEYS, NKEYS(ACK_KEYS), &tok)) {
+        case F_TRUCK_ID: copy_str(tid, sizeof(tid), &tok); break;
+        case F_ETA:      r = parse_int(&tok, INT_MIN, INT_MAX, &eta); break;
+        case F_QUEUED:   r = parse_int(&tok, INT_MIN, INT_MAX, &q); break;
+        case F_JOB:      r = parse_long(&tok, 0, UINT32_MAX, &j); break;
+        default:         break;
         }
-
-        while (*s && *s != ' ' && *s != '\n')
-            ++s;
-        if (*s == '\n')
-            break;
+        if (r < 0) return r;
     }
+    if (r < 0) return r;
 
     if (!*tid)
-        return 0;
+        return PROTO_ERR_MISSING;
 
-    strncpy(id, tid, MAX_ID_LEN);
+    memcpy(id, tid, MAX_ID_LEN);
     *eta_min = eta;
     *queued = q;
-    return 1;
+    if (job) *job = (uint32_t)j;
+    return PROTO_OK;
+}
+
+int parse_ack(const char *line, char *id, int *eta_min, int *queued)
+{
+    return proto_parse_ack(line, strlen(line), id, eta_min, queued) == PROTO_OK;
+}
+
+/* ------------------------------
+ * CANCEL FORMAT + PARSE
+ * ------------------------------ */
+int format_cancel(char *out, size_t n, const CancelMsg *m)
+{
+    return snprintf(out, n, "CANCEL truck_id=%s user_id=%s job=%u%s\n",
+                    m->truck_id, m->user_id, m->job, m->keepalive ? " ka=1" : "");
+}
+
+int proto_parse_cancel(const char *line, size_t len, CancelMsg *out)
+{
+    Cursor c;
+    cursor_init(&c, line, len);
+    int r = expect_type(&c, "CANCEL", 6);
+    if (r != PROTO_OK) return r;
+
+    CancelMsg m;
+    memset(&m, 0, sizeof(m));
+    long job = 0;
+
+    Token tok;
+    while ((r = next_token(&c, &tok)) == 1) {
+        switch (lookup_key(CANCEL_KEYS, NKEYS(CANCEL_KEYS), &tok)) {
+        case F_TRUCK_ID: copy_str(m.truck_id, sizeof(m.truck_id), &tok); break;
+        case F_USER_ID:  copy_str(m.user_id, sizeof(m.user_id), &tok); break;
+        case F_JOB:      r = parse_long(&tok, 1, UINT32_MAX, &job); break;
+        case F_KA:       r = parse_int(&tok, INT_MIN, INT_MAX, &m.keepalive); break;
+        default:         break;
+        }
+        if (r < 0) return r;
+    }
+    if (r < 0) return r;
+
+    if (!*m.truck_id || !*m.user_id || !job)
+        return PROTO_ERR_MISSING;
+    m.job = (uint32_t)job;
+    m.keepalive = m.keepalive != 0;
+    *out = m;
+    return PROTO_OK;
+}
+
+/* ------------------------------
+ * GATEWAY STREAM FORMAT + PARSE
+ * ------------------------------ */
+int format_gw_snap(char *out, size_t n, size_t count)
+{
+    return snprintf(out, n, "SNAP n=%zu\n", count);
+}
+
+int format_gw_add(char *out, size_t n, const TruckInfo *t)
+{
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &t->last_ip, ip, sizeof(ip));
+    return snprintf(out, n, "ADD truck_id=%s lat=%.6f lon=%.6f tcp=%d ip=%s\n",
+                    t->id, t->lat, t->lon, t->tcp_port, ip);
+}
+
+int format_gw_mov(char *out, size_t n, const TruckInfo *t)
+{
+    return snprintf(out, n, "MOV truck_id=%s lat=%.6f lon=%.6f\n", t->id, t->lat, t->lon);
+}
+
+int format_gw_del(char *out, size_t n, const char *truck_id)
+{
+    return snprintf(out, n, "DEL truck_id=%s\n", truck_id);
+}
+
+static int parse_ipv4(const Token *t, struct in_addr *out)
+{
+    char buf[INET_ADDRSTRLEN];
+    if (t->vlen >= sizeof(buf)) return PROTO_ERR_SYNTAX;
+    memcpy(buf, t->val, t->vlen);
+    buf[t->vlen] = '\0';
+    return inet_pton(AF_INET, buf, out) == 1 ? PROTO_OK : PROTO_ERR_SYNTAX;
+}
+
+int proto_parse_gw(const char *line, size_t len, GwMsg *out)
+{
+    Cursor c;
+    cursor_init(&c, line, len);
+
+    int op;
+    if (expect_type(&c, "ADD", 3) == PROTO_OK) op = GW_ADD;
+    else if (expect_type(&c, "MOV", 3) == PROTO_OK) op = GW_MOV;
+    else if (expect_type(&c, "DEL", 3) == PROTO_OK) op = GW_DEL;
+    else if (expect_type(&c, "SNAP", 4) == PROTO_OK) op = GW_SNAP;
+    else return PROTO_ERR_TYPE;
+
+    GwMsg m;
+    memset(&m, 0, sizeof(m));
+    m.op = op;
+    int has_lat = 0, has_lon = 0, has_count = 0;
+    long count = 0;
+
+    int r;
+    Token tok;
+    while ((r = next_token(&c, &tok)) == 1) {
+        switch (lookup_key(GW_KEYS, NKEYS(GW_KEYS), &tok)) {
+        case F_TRUCK_ID: copy_str(m.t.id, sizeof(m.t.id), &tok); break;
+        case F_LAT:      r = parse_double(&tok, &m.t.lat); has_lat = 1; break;
+        case F_LON:      r = parse_double(&tok, &m.t.lon); has_lon = 1; break;
+        case F_TCP:      r = parse_int(&tok, 1, 65535, &m.t.tcp_port); break;
+        case F_IP:       r = parse_ipv4(&tok, &m.t.last_ip); break;
+        case F_COUNT:    r = parse_long(&tok, 0, LONG_MAX, &count); has_count = 1; break;
+        default:         break;
+        }
+        if (r < 0) return r;
+    }
+    if (r < 0) return r;
+
+    switch (op) {
+    case GW_SNAP:
+        if (!has_count) return PROTO_ERR_MISSING;
+        m.count = (size_t)count;
+        break;
+    case GW_ADD:
+        if (!*m.t.id || !has_lat || !has_lon || m.t.tcp_port <= 0) return PROTO_ERR_MISSING;
+        break;
+    case GW_MOV:
+        if (!*m.t.id || !has_lat || !has_lon) return PROTO_ERR_MISSING;
+        break;
+    case GW_DEL:
+        if (!*m.t.id) return PROTO_ERR_MISSING;
+        break;
+    }
+    *out = m;
+    return PROTO_OK;
 }
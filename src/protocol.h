@@ -6,10 +6,43 @@
 
 #define MAX_MSG_LEN 256
 
+/* Result of the proto_parse_* functions */
+typedef enum {
+    PROTO_OK          =  0,
+    PROTO_ERR_TYPE    = -1,  /* line is not this message type */
+    PROTO_ERR_SYNTAX  = -2,  /* token is not key=value, or unterminated quote */
+    PROTO_ERR_NUMBER  = -3,  /* numeric field is not a valid number */
+    PROTO_ERR_MISSING = -4,  /* a required field is absent */
+    PROTO_ERR_RANGE   = -5,  /* numeric field out of range */
+    PROTO_ERR_VERSION = -6   /* binary message version/header not understood */
+} ProtoErr;
+
+const char *proto_strerror(int err);
+
 int format_hb(char *out, size_t n,
               const char *truck_id, double lat, double lon,
               int tcp_port, time_t ts);
 
+/* -------------------------
+ * Adaptive heartbeats carry the truck's velocity and the longest gap the
+ * truck leaves between heartbeats. Receivers extrapolate the position from
+ * the last one (geo_dead_reckon) and treat the truck as alive for
+ * keepalive_s past the usual drop age. In text form:
+ *
+ *   HB truck_id=<id> lat= lon= ts= tcp= vn=<m/s> ve=<m/s> ka=<seconds>
+ *
+ * Receivers that do not know the keys skip them.
+ * ------------------------- */
+typedef struct {
+    double vn, ve;       /* m/s north / east */
+    int keepalive_s;
+} HbMotion;
+
+/* format_hb with the motion keys; m == NULL formats a plain heartbeat */
+int format_hb_motion(char *out, size_t n,
+                     const char *truck_id, double lat, double lon,
+                     int tcp_port, time_t ts, const HbMotion *m);
+
 int parse_hb(const char *line, TruckInfo *out, time_t *ts);
 
 int format_ping(char *out, size_t n, const PingMsg *p);
@@ -19,7 +52,148 @@ int parse_ping(const char *line, PingMsg *out);
 int format_ack(char *out, size_t n, const char *truck_id,
                int eta_min, int queued);
 
+int parse_ack(const char *line, char *id, int *eta_min, int *queued);
+
+/* ACK carrying the truck's order number (job=, omitted when 0) */
+int format_ack_job(char *out, size_t n, const char *truck_id,
+                   int eta_min, int queued, uint32_t job);
+
 /* -------------------------
- * ADD THIS: missing prototype
+ * Order cancellation (client -> truck):
+ *
+ *   CANCEL truck_id=<id> user_id=<id> job=<n> [ka=1]
+ *
+ * The truck answers with an ACK whose job= is the cancelled job, or no job=
+ * when that job was not pending for this user; queued= is what is left.
  * ------------------------- */
-int parse_ack(const char *line, char *id, int *eta_min, int *queued);
+typedef struct {
+    char truck_id[MAX_ID_LEN];
+    char user_id[MAX_ID_LEN];
+    uint32_t job;
+    int keepalive;
+} CancelMsg;
+
+int format_cancel(char *out, size_t n, const CancelMsg *m);
+
+/* -------------------------
+ * Fleet gateway stream (gateway -> subscriber), one message per line:
+ *
+ *   SNAP n=<count>                             the next count ADD lines are
+ *                                              the whole fleet; forget the rest
+ *   ADD truck_id=<id> lat= lon= tcp= ip=<a.b.c.d>  new truck, or its port or
+ *                                              address changed
+ *   MOV truck_id=<id> lat= lon=                truck moved
+ *   DEL truck_id=<id>                          truck expired
+ * ------------------------- */
+typedef enum { GW_SNAP = 1, GW_ADD, GW_MOV, GW_DEL } GwOp;
+
+typedef struct {
+    int op;         /* GwOp */
+    size_t count;   /* SNAP */
+    TruckInfo t;    /* ADD fills id/lat/lon/tcp_port/last_ip, MOV id/lat/lon, DEL id */
+} GwMsg;
+
+int format_gw_snap(char *out, size_t n, size_t count);
+int format_gw_add(char *out, size_t n, const TruckInfo *t);
+int format_gw_mov(char *out, size_t n, const TruckInfo *t);
+int format_gw_del(char *out, size_t n, const char *truck_id);
+
+/* -------------------------
+ * Length-aware parsers returning a ProtoErr. The line does not need to be
+ * NUL-terminated; parsing stops at len, '\n' or '\0'. The parse_* functions
+ * above are wrappers returning 1 on PROTO_OK and 0 otherwise.
+ * ------------------------- */
+int proto_parse_hb(const char *line, size_t len, TruckInfo *out, time_t *ts);
+int proto_parse_ping(const char *line, size_t len, PingMsg *out);
+int proto_parse_ack(const char *line, size_t len, char *id, int *eta_min, int *queued);
+int proto_parse_ack_job(const char *line, size_t len, char *id, int *eta_min,
+                        int *queued, uint32_t *job);
+int proto_parse_gw(const char *line, size_t len, GwMsg *out);
+int proto_parse_cancel(const char *line, size_t len, CancelMsg *out);
+
+/* -------------------------
+ * Binary heartbeat (network byte order):
+ *
+ *   0  u8   magic 0xB7 (never the first byte of a text message)
+ *   1  u8   version
+ *   2  u8   header length = offset of the id bytes
+ *   3  u8   id length
+ *   4  u32  id key (proto_id_key of the id)
+ *   8  u32  sequence number
+ *  12  i32  lat * 1e7
+ *  16  i32  lon * 1e7
+ *  20  u32  ts (seconds since the Epoch)
+ *  24  u16  tcp port
+ *  26  u16  flags (0)
+ *  28  ...  id bytes, not NUL-terminated
+ *
+ * Version 2 (adaptive heartbeats) appends, with the id moving to 34:
+ *
+ *  28  i16  velocity north, cm/s
+ *  30  i16  velocity east, cm/s
+ *  32  u16  keepalive, seconds
+ *
+ * Later versions may only append fields before the id and grow the header
+ * length, so a receiver reads the fields it knows and skips the rest.
+ * ------------------------- */
+#define HB_BIN_MAGIC    0xB7
+#define HB_BIN_VERSION  1
+#define HB_BIN_HDR_LEN  28
+#define HB_BIN_VERSION_MOTION  2
+#define HB_BIN_HDR_LEN_MOTION  34
+#define HB_BIN_MAX_LEN  (HB_BIN_HDR_LEN_MOTION + MAX_ID_LEN - 1)
+
+uint32_t proto_id_key(const char *id);
+
+int format_hb_bin(uint8_t *out, size_t n,
+                  const char *truck_id, double lat, double lon,
+                  int tcp_port, time_t ts, uint32_t seq);
+
+/* Version 2 with m, version 1 (same as format_hb_bin) with m == NULL */
+int format_hb_bin_motion(uint8_t *out, size_t n,
+                         const char *truck_id, double lat, double lon,
+                         int tcp_port, time_t ts, uint32_t seq, const HbMotion *m);
+
+int proto_parse_hb_bin(const uint8_t *buf, size_t len, TruckInfo *out, time_t *ts);
+
+/* Accepts either heartbeat encoding, chosen by the first byte; a batch
+ * (below) is PROTO_ERR_TYPE */
+int proto_parse_hb_any(const void *buf, size_t len, TruckInfo *out, time_t *ts);
+
+/* -------------------------
+ * Batched heartbeats: one datagram for many trucks, from senders that
+ * speak for several of them (fleet_sim, a depot relay). Receivers pay per
+ * datagram, so packing ~40 trucks into one cuts their packet rate by as much.
+ *
+ *   0  u8   magic (0xB8)
+ *   1  u8   version (1)
+ *   2  u8   header length (4)
+ *   3  u8   record count
+ *   4  ...  records, each a complete binary heartbeat as above (any
+ *           version; its own header length + id length give its size)
+ *
+ * A batch fits a 1500-byte Ethernet frame. Every truck in it is reached at
+ * the datagram's source address.
+ * ------------------------- */
+#define HB_BATCH_MAGIC    0xB8
+#define HB_BATCH_VERSION  1
+#define HB_BATCH_HDR_LEN  4
+#define HB_BATCH_MAX_LEN  1472   /* 1500 - IPv4 - UDP headers */
+#define HB_BATCH_MAX_RECORDS ((HB_BATCH_MAX_LEN - HB_BATCH_HDR_LEN) / (HB_BIN_HDR_LEN + 1))
+
+typedef struct {
+    uint8_t buf[HB_BATCH_MAX_LEN];
+    size_t len;
+    int count;
+} HbBatch;
+
+void hb_batch_reset(HbBatch *b);
+/* Appends one truck; -1 when it does not fit (send, reset and add again) */
+int hb_batch_add(HbBatch *b, const char *truck_id, double lat, double lon,
+                 int tcp_port, time_t ts, uint32_t seq, const HbMotion *m);
+/* Decodes the records into out (room for max); returns the count or a
+ * PROTO_ERR_* code. A datagram with any bad record is rejected whole. */
+int proto_parse_hb_batch(const uint8_t *buf, size_t len, TruckInfo *out, size_t max);
+/* Any heartbeat datagram (text, binary or batch): the trucks it carries,
+ * at most max, or a PROTO_ERR_* code */
+int proto_parse_hb_datagram(const void *buf, size_t len, TruckInfo *out, size_t max);
@@ -0,0 +1,482 @@
+#define _DEFAULT_SOURCE  // M_PI
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "protocol.h"
+#include "util.h"
+#include "geo.h"
+#include "registry.h"
+
+#define REG_MIN_CAP 16
+#define REG_CELL_DEG 0.01     // grid cell side, about 1.1 km north-south
+#define KM_PER_DEG 111.19     // along a meridian (Earth radius 6371 km)
+#define REG_WHEEL 256         // expiry wheel buckets, one per second; power of two
+
+typedef struct {
+    TruckInfo info;
+    uint32_t key;            // proto_id_key(info.id)
+    int32_t tprev, tnext;    // expiry wheel bucket list; 'tnext' doubles as free-list link
+    uint32_t tbucket;        // wheel bucket the entry is linked into
+    int32_t cx, cy;          // grid cell of info.lon / info.lat
+    int32_t cell_prev, cell_next; // grid bucket list
+    uint8_t used;
+} RegEntry;
+
+struct Registry {
+    RegEntry *slots;
+    size_t nslots, cap;      // slots in use so far / allocated
+    int32_t free_head;
+
+    int32_t *index;          // slot + 1 per bucket, 0 = empty
+    size_t index_mask;
+
+    int32_t *grid;           // first slot per grid bucket, -1 = empty
+    size_t grid_mask;        // grid buckets = hash index buckets
+
+    int32_t wheel[REG_WHEEL]; // first slot per second of last_seen, -1 = empty
+    time_t wheel_at;         // seconds before this have been expired
+    size_t count;
+};
+
+// --- Hash Index (linear probing, backward-shift deletion) ---
+
+static size_t bucket_of(const Registry *r, uint32_t key) {
+    // Spread the FNV bits before masking
+    uint32_t h = key * 2654435761u;
+    return (size_t)(h ^ (h >> 16)) & r->index_mask;
+}
+
+static int index_rebuild(Registry *r, size_t nbuckets) {
+    int32_t *idx = calloc(nbuckets, sizeof(*idx));
+    if (!idx) return -1;
+    free(r->index);
+    r->index = idx;
+    r->index_mask = nbuckets - 1;
+
+    for (size_t s = 0; s < r->nslots; ++s) {
+        if (!r->slots[s].used) continue;
+        size_t b = bucket_of(r, r->slots[s].key);
+        while (r->index[b]) b = (b + 1) & r->index_mask;
+        r->index[b] = (int32_t)s + 1;
+    }
+    return 0;
+}
+
+// Bucket holding id, or the empty bucket where it would go
+static size_t index_probe(const Registry *r, const char *id, uint32_t key) {
+    size_t b = bucket_of(r, key);
+    for (;;) {
+        int32_t v = r->index[b];
+        if (!v) return b;
+        const RegEntry *e = &r->slots[v - 1];
+        if (e->key == key && strncmp(e->info.id, id, MAX_ID_LEN) == 0) return b;
+        b = (b + 1) & r->index_mask;
+    }
+}
+
+static void index_remove(Registry *r, size_t b) {
+    r->index[b] = 0;
+    size_t j = b;
+    for (;;) {
+        j = (j + 1) & r->index_mask;
+        int32_t v = r->index[j];
+        if (!v) return;
+        // Move the entry back if its home bucket is not in (b, j]
+        size_t home = bucket_of(r, r->slots[v - 1].key);
+        if (((j - home) & r->index_mask) >= ((j - b) & r->index_mask)) {
+            r->index[b] = v;
+            r->index[j] = 0;
+            b = j;
+        }
+    }
+}
+
+// --- Spatial Grid ---
+//
+// Trucks are binned into REG_CELL_DEG x REG_CELL_DEG cells and the cells are
+// hashed into as many buckets as the hash index has. A bucket may mix cells,
+// so walks compare (cx, cy). Longitude wrap-around at +-180 is not handled;
+// the client only cares about a single city.
+
+static int32_t cell_coord(double deg) { return (int32_t)floor(deg / REG_CELL_DEG); }
+
+static size_t grid_bucket(const Registry *r, int32_t cx, int32_t cy) {
+    uint32_t h = (uint32_t)cx * 73856093u ^ (uint32_t)cy * 19349663u;
+    return (size_t)(h ^ (h >> 15)) & r->grid_mask;
+}
+
+static void grid_link(Registry *r, int32_t s) {
+    RegEntry *e = &r->slots[s];
+    e->cx = cell_coord(e->info.lon);
+    e->cy = cell_coord(e->info.lat);
+    size_t b = grid_bucket(r, e->cx, e->cy);
+    e->cell_prev = -1;
+    e->cell_next = r->grid[b];
+    if (e->cell_next >= 0) r->slots[e->cell_next].cell_prev = s;
+    r->grid[b] = s;
+}
+
+static void grid_unlink(Registry *r, int32_t s) {
+    RegEntry *e = &r->slots[s];
+    if (e->cell_prev >= 0) r->slots[e->cell_prev].cell_next = e->cell_next;
+    else r->grid[grid_bucket(r, e->cx, e->cy)] = e->cell_next;
+    if (e->cell_next >= 0) r->slots[e->cell_next].cell_prev = e->cell_prev;
+}
+
+static int grid_rebuild(Registry *r, size_t nbuckets) {
+    int32_t *g = malloc(nbuckets * sizeof(*g));
+    if (!g) return -1;
+    for (size_t i = 0; i < nbuckets; ++i) g[i] = -1;
+    free(r->grid);
+    r->grid = g;
+    r->grid_mask = nbuckets - 1;
+    for (size_t s = 0; s < r->nslots; ++s) {
+        if (r->slots[s].used) grid_link(r, (int32_t)s);
+    }
+    return 0;
+}
+
+// --- Expiry Wheel ---
+//
+// A hashed timing wheel with one bucket per second of due time: last_seen
+// plus the keepalive an adaptive truck announced, so a truck that is
+// deliberately quiet is not dropped between its heartbeats. Expiry
+// drains only the buckets between the previous cutoff and the new one, so it
+// touches the trucks that are due plus the rare one more than REG_WHEEL
+// seconds ahead that shares a bucket. Trucks arriving with a last_seen that
+// is already behind the cutoff (cache preloads, clock steps) go into the
+// cutoff's bucket and are looked at on the next call.
+
+static time_t entry_due(const TruckInfo *ti) {
+    return ti->last_seen + (ti->keepalive_s > 0 ? ti->keepalive_s : 0);
+}
+
+static uint32_t wheel_bucket(const Registry *r, time_t due) {
+    time_t t = due > r->wheel_at ? due : r->wheel_at;
+    return (uint32_t)((uint64_t)t & (REG_WHEEL - 1));
+}
+
+static void wheel_unlink(Registry *r, int32_t s) {
+    RegEntry *e = &r->slots[s];
+    if (e->tprev >= 0) r->slots[e->tprev].tnext = e->tnext; else r->wheel[e->tbucket] = e->tnext;
+    if (e->tnext >= 0) r->slots[e->tnext].tprev = e->tprev;
+    e->tprev = e->tnext = -1;
+}
+
+static void wheel_link(Registry *r, int32_t s) {
+    RegEntry *e = &r->slots[s];
+    e->tbucket = wheel_bucket(r, entry_due(&e->info));
+    e->tprev = -1;
+    e->tnext = r->wheel[e->tbucket];
+    if (e->tnext >= 0) r->slots[e->tnext].tprev = s;
+    r->wheel[e->tbucket] = s;
+}
+
+// --- Construction ---
+
+Registry *registry_create(size_t cap_hint) {
+    Registry *r = calloc(1, sizeof(*r));
+    if (!r) return NULL;
+
+    size_t cap = cap_hint > REG_MIN_CAP ? cap_hint : REG_MIN_CAP;
+    size_t nb = REG_MIN_CAP * 2;
+    while (nb < cap * 2) nb <<= 1;
+
+    r->slots = malloc(cap * sizeof(*r->slots));
+    r->cap = cap;
+    r->free_head = -1;
+    for (size_t i = 0; i < REG_WHEEL; ++i) r->wheel[i] = -1;
+    if (!r->slots || index_rebuild(r, nb) < 0 || grid_rebuild(r, nb) < 0) {
+        registry_destroy(r);
+        return NULL;
+    }
+    return r;
+}
+
+void registry_destroy(Registry *r) {
+    if (!r) return;
+    free(r->slots);
+    free(r->index);
+    free(r->grid);
+    free(r);
+}
+
+static int32_t slot_alloc(Registry *r) {
+    if (r->free_head >= 0) {
+        int32_t s = r->free_head;
+        r->free_head = r->slots[s].tnext;
+        return s;
+    }
+    if (r->nslots == r->cap) {
+        size_t new_cap = r->cap * 2;
+        RegEntry *tmp = realloc(r->slots, new_cap * sizeof(*tmp));
+        if (!tmp) return -1;
+        r->slots = tmp;
+        r->cap = new_cap;
+    }
+    return (int32_t)r->nslots++;
+}
+
+static void slot_free(Registry *r, int32_t s) {
+    r->slots[s].used = 0;
+    r->slots[s].tnext = r->free_head;
+    r->free_head = s;
+}
+
+// --- Operations ---
+
+/**
+ * @brief Inserts or replaces a truck and files it under its due second
+ * for expiry.
+ */
+int registry_upsert(Registry *r, const TruckInfo *ti) {
+    uint32_t key = proto_id_key(ti->id);
+    size_t b = index_probe(r, ti->id, key);
+
+    if (r->index[b]) {
+        int32_t s = r->index[b] - 1;
+        RegEntry *e = &r->slots[s];
+        e->info = *ti;
+        e->info.id[MAX_ID_LEN - 1] = '\0';
+        if (cell_coord(ti->lon) != e->cx || cell_coord(ti->lat) != e->cy) {
+            grid_unlink(r, s);
+            grid_link(r, s);
+        }
+        if (wheel_bucket(r, entry_due(ti)) != e->tbucket) {
+            wheel_unlink(r, s);
+            wheel_link(r, s);
+        }
+        return s;
+    }
+
+    // Keep the load factor at or below 1/2
+    if ((r->count + 1) * 2 > r->index_mask + 1) {
+        size_t nb = (r->index_mask + 1) * 2;
+        if (index_rebuild(r, nb) < 0 || grid_rebuild(r, nb) < 0) return -1;
+        b = index_probe(r, ti->id, key);
+    }
+
+    int32_t s = slot_alloc(r);
+    if (s < 0) return -1;
+
+    RegEntry *e = &r->slots[s];
+    e->info = *ti;
+    e->info.id[MAX_ID_LEN - 1] = '\0';
+    e->key = key;
+    e->used = 1;
+    r->index[b] = s + 1;
+    grid_link(r, s);
+    wheel_link(r, s);
+    r->count++;
+    return s;
+}
+
+int registry_find(const Registry *r, const char *id) {
+    size_t b = index_probe(r, id, proto_id_key(id));
+    return r->index[b] ? r->index[b] - 1 : -1;
+}
+
+// Unlinks slot s from the index, grid and expiry wheel and frees it
+static void entry_remove(Registry *r, int32_t s) {
+    RegEntry *e = &r->slots[s];
+    index_remove(r, index_probe(r, e->info.id, e->key));
+    grid_unlink(r, s);
+    wheel_unlink(r, s);
+    slot_free(r, s);
+    r->count--;
+}
+
+int registry_remove(Registry *r, const char *id) {
+    int s = registry_find(r, id);
+    if (s < 0) return -1;
+    entry_remove(r, s);
+    return 0;
+}
+
+/**
+ * @brief Drops trucks not updated within max_age seconds, plus the
+ * keepalive of those that announced one. Only the wheel
+ * buckets for the seconds that became stale since the previous call are
+ * visited, so max_age may change from call to call. on_expire, if given, sees
+ * each truck just before its slot is freed.
+ */
+size_t registry_expire_fn(Registry *r, time_t now, int max_age,
+                          void (*on_expire)(void *ctx, int slot, const TruckInfo *ti), void *ctx) {
+    time_t cutoff = now - max_age - 1;   // due at or before this is stale
+    if (cutoff < r->wheel_at) return 0;
+
+    // After a long pause every bucket is due; one lap covers them all
+    time_t from = r->wheel_at;
+    if (cutoff - from >= REG_WHEEL) from = cutoff - REG_WHEEL + 1;
+
+    size_t n = 0;
+    for (time_t t = from; t <= cutoff; ++t) {
+        int32_t s = r->wheel[(uint64_t)t & (REG_WHEEL - 1)];
+        while (s >= 0) {
+            int32_t next = r->slots[s].tnext;
+            if (entry_due(&r->slots[s].info) <= cutoff) {
+                if (on_expire) on_expire(ctx, s, &r->slots[s].info);
+                entry_remove(r, s);
+                n++;
+            }
+            s = next;
+        }
+    }
+    r->wheel_at = cutoff + 1;
+    return n;
+}
+
+size_t registry_expire(Registry *r, time_t now, int max_age) {
+    return registry_expire_fn(r, now, max_age, NULL, NULL);
+}
+
+size_t registry_count(const Registry *r) { return r->count; }
+
+size_t registry_slots(const Registry *r) { return r->nslots; }
+
+const TruckInfo *registry_get(const Registry *r, int slot) {
+    if (slot < 0 || (size_t)slot >= r->nslots || !r->slots[slot].used) return NULL;
+    return &r->slots[slot].info;
+}
+
+// --- Spatial Queries ---
+
+// Loops s_ over the slots of the trucks in cell (cx_, cy_)
+#define FOR_CELL(r, cx_, cy_, s_)                                                   \
+    for (int32_t s_ = (r)->grid[grid_bucket((r), (cx_), (cy_))]; s_ >= 0;          \
+         s_ = (r)->slots[s_].cell_next)                                             \
+        if ((r)->slots[s_].cx == (cx_) && (r)->slots[s_].cy == (cy_))
+
+// Max-heap on km holding the k best hits so far
+static void heap_offer(RegHit *h, size_t *n, size_t k, int slot, double km) {
+    size_t i;
+    if (*n < k) {
+        i = (*n)++;
+        while (i > 0 && h[(i - 1) / 2].km < km) { h[i] = h[(i - 1) / 2]; i = (i - 1) / 2; }
+    } else if (km < h[0].km) {
+        i = 0;
+        for (;;) {
+            size_t c = 2 * i + 1;
+            if (c >= k) break;
+            if (c + 1 < k && h[c + 1].km > h[c].km) c++;
+            if (h[c].km <= km) break;
+            h[i] = h[c];
+            i = c;
+        }
+    } else {
+        return;
+    }
+    h[i].slot = slot;
+    h[i].km = km;
+}
+
+static int cmp_hit(const void *a, const void *b) {
+    double da = ((const RegHit *)a)->km, db = ((const RegHit *)b)->km;
+    return (da > db) - (da < db);
+}
+
+/**
+ * @brief Finds the k trucks closest to (lat, lon) by searching grid cells in
+ * growing square rings around the query cell. A ring is the last one needed
+ * once the k-th best distance is no larger than the distance any truck in
+ * the next ring could have.
+ * @return Number of hits written to out, sorted nearest first.
+ */
+size_t registry_nearest_k(const Registry *r, double lat, double lon, size_t k, RegHit *out) {
+    if (k == 0 || r->count == 0) return 0;
+    if (k > r->count) k = r->count;
+
+    int32_t qx = cell_coord(lon), qy = cell_coord(lat);
+    size_t n = 0, seen = 0, cells = 0;
+    for (int32_t ring = 0;; ++ring) {
+        for (int32_t dy = -ring; dy <= ring; ++dy) {
+            // Interior rows only need the two edge cells
+            int32_t step = (dy == -ring || dy == ring || ring == 0) ? 1 : 2 * ring;
+            for (int32_t dx = -ring; dx <= ring; dx += step) {
+                cells++;
+                FOR_CELL(r, qx + dx, qy + dy, s) {
+                    const TruckInfo *t = &r->slots[s].info;
+                    heap_offer(out, &n, k, s, haversine_km(lat, lon, t->lat, t->lon));
+                    seen++;
+                }
+            }
+        }
+        if (seen == r->count) break;
+
+        // Anything outside this ring is at least `ring` cells away. Cells
+        // narrow toward the poles, so use the width at the ring's far edge
+        // and keep a 1% margin for great-circle vs. grid distance.
+        double far_lat = fabs(lat) + (ring + 1) * REG_CELL_DEG;
+        double cell_km = REG_CELL_DEG * KM_PER_DEG * (far_lat < 90.0 ? cos(far_lat * M_PI / 180.0) : 0.0);
+        if (n == k && out[0].km <= 0.99 * ring * cell_km) break;
+
+        // Sparse or far-flung fleet: stop walking mostly empty cells
+        if (cells > 4 * r->count + 64) {
+            n = 0;
+            for (size_t s = 0; s < r->nslots; ++s) {
+                const RegEntry *e = &r->slots[s];
+                if (e->used) heap_offer(out, &n, k, (int)s, haversine_km(lat, lon, e->info.lat, e->info.lon));
+            }
+            break;
+        }
+    }
+    qsort(out, n, sizeof(*out), cmp_hit);
+    return n;
+}
+
+/**
+ * @brief Collects trucks within km of (lat, lon), visiting only the cells
+ * that overlap the circle's bounding box and skipping the haversine for
+ * trucks the equirectangular estimate already places outside.
+ * @return Number of trucks in range; the nearest max of them are written
+ * to out, sorted nearest first.
+ */
+size_t registry_within_radius(const Registry *r, double lat, double lon, double km,
+                              RegHit *out, size_t max) {
+    if (r->count == 0 || km < 0) return 0;
+    double dlat = km / KM_PER_DEG;
+    double coslat = cos((fabs(lat) + dlat) * M_PI / 180.0);
+    double dlon = coslat > 1e-6 ? dlat / coslat : 360.0;
+
+    int32_t x0 = cell_coord(lon - dlon), x1 = cell_coord(lon + dlon);
+    int32_t y0 = cell_coord(lat - dlat), y1 = cell_coord(lat + dlat);
+
+    // Cheap rejection of the bounding box corners before the exact formula
+    GeoOrigin o;
+    geo_origin_init(&o, lat, lon);
+    int prefilter = km <= GEO_EQUIRECT_MAX_KM && fabs(lat) <= 70.0;
+    double reject_km = km * (1.0 + GEO_EQUIRECT_ERR);
+
+    size_t n = 0, kept = 0;
+    double ncells = ((double)x1 - x0 + 1) * ((double)y1 - y0 + 1);
+    if (ncells > (double)r->count) {
+        // Huge radius: a plain scan is cheaper than walking empty cells
+        for (size_t s = 0; s < r->nslots; ++s) {
+            const RegEntry *e = &r->slots[s];
+            if (!e->used) continue;
+            if (prefilter && geo_equirect_km(&o, e->info.lat, e->info.lon) > reject_km) continue;
+            double d = haversine_km(lat, lon, e->info.lat, e->info.lon);
+            if (d > km) continue;
+            if (max > 0) heap_offer(out, &kept, max, (int)s, d);
+            n++;
+        }
+    } else {
+        for (int32_t cy = y0; cy <= y1; ++cy) {
+            for (int32_t cx = x0; cx <= x1; ++cx) {
+                FOR_CELL(r, cx, cy, s) {
+                    const TruckInfo *t = &r->slots[s].info;
+                    if (prefilter && geo_equirect_km(&o, t->lat, t->lon) > reject_km) continue;
+                    double d = haversine_km(lat, lon, t->lat, t->lon);
+                    if (d > km) continue;
+                    if (max > 0) heap_offer(out, &kept, max, s, d);
+                    n++;
+                }
+            }
+        }
+    }
+    qsort(out, kept, sizeof(*out), cmp_hit);
+    return n;
+}
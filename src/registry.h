@@ -0,0 +1,50 @@
+#pragma once
+#include <stddef.h>
+#include <time.h>
+#include "common.h"
+
+/*
+ * Truck registry keyed on truck id.
+ *
+ * Entries live in slots whose index stays the same for as long as the truck
+ * is present. An open-addressing hash index gives O(1) lookup/upsert, and a
+ * timing wheel keyed on last_seen (+ keepalive_s) gives amortized O(1) expiry whatever order
+ * the updates arrive in. A uniform lat/lon grid answers nearest/radius
+ * queries by looking only at cells around the query point. Not thread-safe:
+ * callers hold their own lock.
+ */
+
+typedef struct Registry Registry;
+
+typedef struct {
+    int slot;
+    double km;   // haversine distance from the query point
+} RegHit;
+
+Registry *registry_create(size_t cap_hint);
+void registry_destroy(Registry *r);
+
+// Inserts or replaces the truck with ti->id; returns its slot or -1
+int registry_upsert(Registry *r, const TruckInfo *ti);
+// Slot of the truck with this id, or -1
+int registry_find(const Registry *r, const char *id);
+// Removes trucks whose last_seen is more than max_age seconds before now,
+// counting from the end of their keepalive_s if they set one; max_age may
+// differ between calls
+size_t registry_expire(Registry *r, time_t now, int max_age);
+// Same, calling on_expire for each truck before it is removed
+size_t registry_expire_fn(Registry *r, time_t now, int max_age,
+                          void (*on_expire)(void *ctx, int slot, const TruckInfo *ti), void *ctx);
+// Removes the truck with this id; -1 if it is not present
+int registry_remove(Registry *r, const char *id);
+
+size_t registry_count(const Registry *r);
+// Upper bound for slot indices; registry_get returns NULL for empty slots
+size_t registry_slots(const Registry *r);
+const TruckInfo *registry_get(const Registry *r, int slot);
+
+// The k trucks nearest to (lat, lon), nearest first; out holds k entries
+size_t registry_nearest_k(const Registry *r, double lat, double lon, size_t k, RegHit *out);
+// Trucks within km of (lat, lon): returns how many, stores up to max, nearest first
+size_t registry_within_radius(const Registry *r, double lat, double lon, double km,
+                              RegHit *out, size_t max);
@@ -0,0 +1,325 @@
+#define _GNU_SOURCE               // timerfd, eventfd
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+#include "histo.h"
+#include "prng.h"
+#include "scheduler.h"
+
+#define SCHED_NAME 24
+
+typedef struct {
+    int id;
+    char name[SCHED_NAME];
+    SchedFn fn;
+    void *arg;
+    int64_t nominal_ns;       // next run before jitter
+    int64_t due_ns;           // next run, jitter applied
+    int64_t period_ns;        // 0 = one-shot
+    int64_t jitter_ns;
+    size_t heap_idx;          // SIZE_MAX while off the heap
+    int cancelled;            // cancelled while running; freed when it returns
+    uint64_t runs, missed;
+    Histo late_us;
+} Task;
+
+struct Sched {
+    pthread_mutex_t mu;
+    Task **task;              // by id, NULL = free id
+    size_t ntask;
+    Task **heap;              // min-heap on due_ns
+    size_t nheap, heap_cap;
+    Task *current;            // running now, with mu released
+    Prng rng;
+    int tfd;                  // timerfd armed for heap[0]
+    int efd;                  // eventfd: new task or stop
+    _Atomic int stop;
+    pthread_t th;
+    int started;
+};
+
+static int64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void wake(Sched *s) {
+    uint64_t one = 1;
+    ssize_t k = write(s->efd, &one, sizeof(one));
+    (void)k; // EAGAIN only when the counter is saturated, i.e. already awake
+}
+
+// --- Heap ---
+
+static void heap_set(Sched *s, size_t i, Task *t) {
+    s->heap[i] = t;
+    t->heap_idx = i;
+}
+
+static void heap_up(Sched *s, size_t i) {
+    Task *t = s->heap[i];
+    while (i > 0) {
+        size_t p = (i - 1) / 2;
+        if (s->heap[p]->due_ns <= t->due_ns) break;
+        heap_set(s, i, s->heap[p]);
+        i = p;
+    }
+    heap_set(s, i, t);
+}
+
+static void heap_down(Sched *s, size_t i) {
+    Task *t = s->heap[i];
+    for (;;) {
+        size_t c = 2 * i + 1;
+        if (c >= s->nheap) break;
+        if (c + 1 < s->nheap && s->heap[c + 1]->due_ns < s->heap[c]->due_ns) c++;
+        if (t->due_ns <= s->heap[c]->due_ns) break;
+        heap_set(s, i, s->heap[c]);
+        i = c;
+    }
+    heap_set(s, i, t);
+}
+
+static void heap_remove(Sched *s, Task *t) {
+    size_t i = t->heap_idx;
+    Task *last = s->heap[--s->nheap];
+    t->heap_idx = SIZE_MAX;
+    if (last == t) return;
+    heap_set(s, i, last);
+    heap_up(s, i);
+    heap_down(s, last->heap_idx);
+}
+
+// --- Tasks ---
+
+static void set_due(Sched *s, Task *t) {
+    int64_t off = 0;
+    if (t->jitter_ns > 0)
+        off = (int64_t)(prng_double(&s->rng) * (double)(2 * t->jitter_ns + 1)) - t->jitter_ns;
+    t->due_ns = t->nominal_ns + off;
+}
+
+/**
+ * @brief Moves a periodic task to its next slot. Slots whose whole period
+ * has already passed are skipped rather than run late one after another.
+ */
+static void advance(Sched *s, Task *t, int64_t now) {
+    t->nominal_ns += t->period_ns;
+    if (now >= t->nominal_ns + t->period_ns) {
+        int64_t k = (now - t->nominal_ns) / t->period_ns;
+        t->nominal_ns += k * t->period_ns;
+        t->missed += (uint64_t)k;
+    }
+    set_due(s, t);
+}
+
+// Takes t off the id table and the heap; it runs no more
+static void forget(Sched *s, Task *t) {
+    s->task[t->id] = NULL;
+    if (t->heap_idx != SIZE_MAX) heap_remove(s, t);
+}
+
+static void fill_stats(const Task *t, SchedStats *out) {
+    out->runs = t->runs;
+    out->missed = t->missed;
+    out->late_p50_us = histo_quantile(&t->late_us, 0.50);
+    out->late_p99_us = histo_quantile(&t->late_us, 0.99);
+    out->late_max_us = t->late_us.total ? t->late_us.max : 0;
+    out->late_mean_us = histo_mean(&t->late_us);
+}
+
+Sched *sched_create(uint64_t seed) {
+    Sched *s = calloc(1, sizeof(*s));
+    if (!s) return NULL;
+    pthread_mutex_init(&s->mu, NULL);
+    prng_seed(&s->rng, seed, 0);
+    s->tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    s->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (s->tfd < 0 || s->efd < 0) {
+        sched_destroy(s);
+        return NULL;
+    }
+    return s;
+}
+
+void sched_destroy(Sched *s) {
+    if (!s) return;
+    if (s->started) {
+        sched_stop(s);
+        pthread_join(s->th, NULL);
+    }
+    for (size_t i = 0; i < s->ntask; ++i) free(s->task[i]);
+    free(s->task);
+    free(s->heap);
+    if (s->tfd >= 0) close(s->tfd);
+    if (s->efd >= 0) close(s->efd);
+    pthread_mutex_destroy(&s->mu);
+    free(s);
+}
+
+int sched_add(Sched *s, const char *name, long delay_ms, long period_ms, long jitter_ms,
+              SchedFn fn, void *arg) {
+    if (!fn || delay_ms < 0 || period_ms < 0 || jitter_ms < 0) return -1;
+    Task *t = calloc(1, sizeof(*t));
+    if (!t) return -1;
+    snprintf(t->name, sizeof(t->name), "%s", name ? name : "task");
+    t->fn = fn;
+    t->arg = arg;
+    t->period_ns = (int64_t)period_ms * 1000000;
+    t->jitter_ns = (int64_t)jitter_ms * 1000000;
+    if (t->period_ns > 0 && t->jitter_ns > t->period_ns / 2) t->jitter_ns = t->period_ns / 2;
+    histo_reset(&t->late_us);
+
+    pthread_mutex_lock(&s->mu);
+    size_t id = 0;
+    while (id < s->ntask && s->task[id]) id++;
+    if (id == s->ntask) {
+        Task **nt = realloc(s->task, (s->ntask + 1) * sizeof(*nt));
+        if (!nt) goto fail;
+        s->task = nt;
+        s->task[s->ntask++] = NULL;
+    }
+    if (s->nheap == s->heap_cap) {
+        size_t cap = s->heap_cap ? 2 * s->heap_cap : 8;
+        Task **nh = realloc(s->heap, cap * sizeof(*nh));
+        if (!nh) goto fail;
+        s->heap = nh;
+        s->heap_cap = cap;
+    }
+    t->id = (int)id;
+    t->nominal_ns = now_ns() + (int64_t)delay_ms * 1000000;
+    set_due(s, t);
+    s->task[id] = t;
+    s->heap[s->nheap++] = t;
+    heap_up(s, s->nheap - 1);
+    pthread_mutex_unlock(&s->mu);
+    wake(s);
+    return (int)id;
+
+fail:
+    pthread_mutex_unlock(&s->mu);
+    free(t);
+    return -1;
+}
+
+int sched_cancel(Sched *s, int id) {
+    pthread_mutex_lock(&s->mu);
+    Task *t = id >= 0 && (size_t)id < s->ntask ? s->task[id] : NULL;
+    if (t) {
+        forget(s, t);
+        if (t == s->current) t->cancelled = 1;
+        else free(t);
+    }
+    pthread_mutex_unlock(&s->mu);
+    return t ? 0 : -1;
+}
+
+int sched_stats(Sched *s, int id, SchedStats *out) {
+    pthread_mutex_lock(&s->mu);
+    Task *t = id >= 0 && (size_t)id < s->ntask ? s->task[id] : NULL;
+    if (t) fill_stats(t, out);
+    pthread_mutex_unlock(&s->mu);
+    return t ? 0 : -1;
+}
+
+void sched_report(Sched *s, FILE *out) {
+    pthread_mutex_lock(&s->mu);
+    for (size_t i = 0; i < s->ntask; ++i) {
+        const Task *t = s->task[i];
+        if (!t || t->period_ns == 0) continue;
+        SchedStats st;
+        fill_stats(t, &st);
+        fprintf(out, "sched %s: %llu runs, %llu missed, late p50 %llu us, p99 %llu us, max %llu us\n",
+                t->name, (unsigned long long)st.runs, (unsigned long long)st.missed,
+                (unsigned long long)st.late_p50_us, (unsigned long long)st.late_p99_us,
+                (unsigned long long)st.late_max_us);
+    }
+    pthread_mutex_unlock(&s->mu);
+}
+
+// --- Loop ---
+
+// Arms the timerfd for the earliest task, or disarms it
+static void arm(Sched *s) {
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    if (s->nheap > 0) {
+        int64_t due = s->heap[0]->due_ns;
+        if (due < 1) due = 1;   // zero would disarm
+        its.it_value.tv_sec = due / 1000000000;
+        its.it_value.tv_nsec = due % 1000000000;
+    }
+    timerfd_settime(s->tfd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+int sched_run(Sched *s) {
+    int rc = 0;
+    pthread_mutex_lock(&s->mu);
+    while (!atomic_load(&s->stop)) {
+        int64_t now = now_ns();
+        if (s->nheap > 0 && s->heap[0]->due_ns <= now) {
+            Task *t = s->heap[0];
+            histo_record(&t->late_us, (uint64_t)(now - t->due_ns) / 1000);
+            t->runs++;
+            s->current = t;
+            if (t->period_ns > 0) {
+                advance(s, t, now);
+                heap_down(s, 0);
+            } else {
+                forget(s, t);
+            }
+
+            pthread_mutex_unlock(&s->mu);
+            t->fn(t->arg);
+            pthread_mutex_lock(&s->mu);
+
+            s->current = NULL;
+            if (t->cancelled || t->period_ns == 0) free(t);
+            continue;
+        }
+
+        arm(s);
+        pthread_mutex_unlock(&s->mu);
+        struct pollfd pfd[2] = { { .fd = s->tfd, .events = POLLIN }, { .fd = s->efd, .events = POLLIN } };
+        int k = poll(pfd, 2, -1);
+        uint64_t v;
+        if (k > 0 && (pfd[0].revents & POLLIN)) (void)!read(s->tfd, &v, sizeof(v));
+        if (k > 0 && (pfd[1].revents & POLLIN)) (void)!read(s->efd, &v, sizeof(v));
+        pthread_mutex_lock(&s->mu);
+        if (k < 0 && errno != EINTR) {
+            rc = -1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&s->mu);
+    return rc;
+}
+
+static void *th_sched(void *arg) {
+    sched_run((Sched *)arg);
+    return NULL;
+}
+
+int sched_start(Sched *s) {
+    if (s->started) return -1;
+    if (pthread_create(&s->th, NULL, th_sched, s) != 0) return -1;
+    s->started = 1;
+    return 0;
+}
+
+void sched_stop(Sched *s) {
+    atomic_store(&s->stop, 1);
+    wake(s);
+}
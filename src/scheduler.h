@@ -0,0 +1,56 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Periodic and one-shot tasks run from a single thread.
+ *
+ * Due times are absolute CLOCK_MONOTONIC instants kept in a min-heap; the
+ * loop sleeps on a timerfd armed (TFD_TIMER_ABSTIME) for the earliest one, so
+ * the time a task takes never stretches its period. A periodic task's nominal
+ * run times are first + k * period. If it falls behind by a whole period the
+ * slots it overran are skipped and counted as missed rather than run back to
+ * back. A jitter of J moves each run to a random point within +-J of its
+ * nominal time; the offsets do not accumulate.
+ *
+ * sched_stop() wakes the loop at once through an eventfd and is safe to call
+ * from any thread or a signal handler. Tasks may add or cancel tasks. A task
+ * runs without the scheduler's lock held, so it must not block for long: it
+ * delays every task behind it (the delay shows up as lateness in the stats).
+ */
+
+typedef struct Sched Sched;
+typedef void (*SchedFn)(void *arg);
+
+typedef struct {
+    uint64_t runs;
+    uint64_t missed;             // periods skipped because the task fell behind
+    // Start time minus due time, in microseconds
+    uint64_t late_p50_us, late_p99_us, late_max_us;
+    double late_mean_us;
+} SchedStats;
+
+// seed drives the jitter; the same seed gives the same offsets
+Sched *sched_create(uint64_t seed);
+// Stops the loop (joining its thread if sched_start() made one) and frees everything
+void sched_destroy(Sched *s);
+
+/*
+ * Schedules fn(arg) delay_ms from now, then every period_ms (0 = once),
+ * each run jittered by up to +-jitter_ms (capped at half the period).
+ * Returns the task id, or -1. One-shot tasks are forgotten once they ran.
+ */
+int sched_add(Sched *s, const char *name, long delay_ms, long period_ms, long jitter_ms,
+              SchedFn fn, void *arg);
+// The task will not run again; -1 if there is no such task
+int sched_cancel(Sched *s, int id);
+int sched_stats(Sched *s, int id, SchedStats *out);
+// Prints one line of stats per periodic task
+void sched_report(Sched *s, FILE *out);
+
+// Runs tasks in the calling thread until sched_stop()
+int sched_run(Sched *s);
+// Runs tasks in a new thread until sched_stop() / sched_destroy()
+int sched_start(Sched *s);
+void sched_stop(Sched *s);
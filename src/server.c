@@ -0,0 +1,1065 @@
+#define _GNU_SOURCE               // accept4, EPOLLEXCLUSIVE
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <netinet/in.h>
+#include <linux/time_types.h>
+#include <linux/io_uring.h>
+
+#include "common.h"
+#include "util.h"
+#include "net.h"
+#include "server.h"
+#include "metrics.h"
+
+#define SERVER_IO_TIMEOUT_MS 2000
+#define SERVER_IDLE_TIMEOUT_MS 5000
+#define CONN_IN_BUF (4 * MAX_LINE)
+#define CONN_OUT_BUF (8 * MAX_LINE)
+#define SERVER_MAX_LISTENERS_INIT 4
+#define SERVER_EPOLL_EVENTS 64
+
+// Tags so one epoll data pointer can refer to a listener or a connection
+enum { TAG_LISTENER = 1, TAG_CONN = 2 };
+
+typedef struct {
+    int tag;
+    int fd;
+    void *ctx;
+} Listener;
+
+struct Server {
+    ServerBackend backend;
+    int nworkers;
+    server_line_fn fn;
+    int idle_ms;
+    Listener **listeners;
+    size_t nlisteners, cap;
+    volatile int *running;
+};
+
+// --- Utility Time Function ---
+
+static long mono_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void strip_eol(char *line) {
+    size_t n = strlen(line);
+    while (n > 0 && (line[n - 1] == '\n' || line[n - 1] == '\r')) line[--n] = '\0';
+}
+
+// --- Construction ---
+
+Server *server_create(ServerBackend backend, int nworkers, server_line_fn fn) {
+    Server *srv = calloc(1, sizeof(*srv));
+    if (!srv) return NULL;
+
+    if (nworkers <= 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        nworkers = cores > 0 ? (int)cores : 1;
+    }
+    srv->backend = backend;
+    srv->nworkers = nworkers;
+    srv->fn = fn;
+    srv->idle_ms = SERVER_IDLE_TIMEOUT_MS;
+    return srv;
+}
+
+/**
+ * @brief Sets how long a kept-alive connection may sit between requests.
+ */
+void server_set_idle_timeout(Server *srv, int idle_ms) {
+    if (idle_ms > 0) srv->idle_ms = idle_ms;
+}
+
+/**
+ * @brief Registers a listening socket; ctx is handed to the line handler for
+ * every request arriving on it.
+ */
+int server_add_listener(Server *srv, int listen_fd, void *ctx) {
+    if (srv->nlisteners == srv->cap) {
+        size_t new_cap = srv->cap ? srv->cap * 2 : SERVER_MAX_LISTENERS_INIT;
+        Listener **tmp = realloc(srv->listeners, new_cap * sizeof(*tmp));
+        if (!tmp) return -1;
+        srv->listeners = tmp;
+        srv->cap = new_cap;
+    }
+
+    Listener *l = malloc(sizeof(*l));
+    if (!l) return -1;
+    l->tag = TAG_LISTENER;
+    l->fd = listen_fd;
+    l->ctx = ctx;
+
+    // Listeners are polled in both backends so shutdown is never stuck in accept()
+    if (set_nonblocking(listen_fd) < 0) { free(l); return -1; }
+
+    srv->listeners[srv->nlisteners++] = l;
+    return 0;
+}
+
+void server_destroy(Server *srv) {
+    if (!srv) return;
+    for (size_t i = 0; i < srv->nlisteners; ++i) free(srv->listeners[i]);
+    free(srv->listeners);
+    free(srv);
+}
+
+int server_backend_parse(const char *name, ServerBackend *out) {
+    if (!strcmp(name, "thread")) { *out = SERVER_THREAD; return 0; }
+    if (!strcmp(name, "epoll"))  { *out = SERVER_EPOLL;  return 0; }
+    if (!strcmp(name, "uring"))  { *out = SERVER_URING;  return 0; }
+    return -1;
+}
+
+const char *server_backend_name(ServerBackend b) {
+    switch (b) {
+    case SERVER_THREAD: return "thread";
+    case SERVER_EPOLL:  return "epoll";
+    case SERVER_URING:  return "uring";
+    }
+    return "?";
+}
+
+// =======================================================
+// Thread-per-connection backend
+// =======================================================
+
+struct WorkerArg {
+    Server *srv;
+    int sock;
+    void *ctx;
+};
+
+// --- PING WORKER THREAD (Handles one TCP connection) ---
+static void *th_worker(void *arg) {
+    struct WorkerArg wa = *(struct WorkerArg *)arg;
+    free(arg);
+
+    char buf[CONN_IN_BUF];
+    char out[MAX_LINE];
+    LineReader rd;
+    linereader_init(&rd, wa.sock, buf, sizeof(buf));
+    int keepalive = 1;
+
+    for (int first = 1; keepalive && *wa.srv->running; first = 0) {
+        // The first request gets the I/O timeout, later ones the idle timeout
+        int timeout = first ? SERVER_IO_TIMEOUT_MS : wa.srv->idle_ms;
+        const char *line;
+        size_t line_len;
+        ssize_t n = linereader_next(&rd, &line, &line_len, timeout);
+        if (n <= 0) {
+            // EOF after a kept-alive exchange is the normal way to finish
+            if (n < 0 && first) perror("Worker: linereader_next error");
+            break;
+        }
+
+        keepalive = 0;
+        int k = wa.srv->fn(wa.ctx, line, out, sizeof(out), &keepalive);
+        if (k <= 0) break;
+        metrics_inc(MC_REPLIES);
+
+        size_t len = strnlen(out, sizeof(out));
+        uint64_t t0 = metrics_now_ns();
+        if (send_all_timeout(wa.sock, out, len, SERVER_IO_TIMEOUT_MS) != (ssize_t)len) {
+            metrics_inc(MC_SEND_ERRORS);
+            break;
+        }
+        metrics_observe_ns(MH_SEND, metrics_now_ns() - t0);
+    }
+
+    close(wa.sock);
+    return NULL;
+}
+
+static int run_thread(Server *srv) {
+    struct pollfd *pfds = calloc(srv->nlisteners, sizeof(*pfds));
+    if (!pfds) return -1;
+    for (size_t i = 0; i < srv->nlisteners; ++i) {
+        pfds[i].fd = srv->listeners[i]->fd;
+        pfds[i].events = POLLIN;
+    }
+
+    while (*srv->running) {
+        int r = poll(pfds, srv->nlisteners, 500);
+        if (r <= 0) continue;
+
+        for (size_t i = 0; i < srv->nlisteners; ++i) {
+            if (!(pfds[i].revents & POLLIN)) continue;
+
+            uint64_t t0 = metrics_now_ns();
+            int s = accept(pfds[i].fd, NULL, NULL);
+            if (s < 0) continue;
+            metrics_observe_ns(MH_ACCEPT, metrics_now_ns() - t0);
+            metrics_inc(MC_ACCEPTS);
+            tcp_set_nodelay(s);
+
+            struct WorkerArg *wa = malloc(sizeof(*wa));
+            if (!wa) {
+                fprintf(stderr, "Failed to allocate memory for thread argument. Closing client socket.\n");
+                close(s);
+                continue;
+            }
+            wa->srv = srv;
+            wa->sock = s;
+            wa->ctx = srv->listeners[i]->ctx;
+
+            // One detached thread per connection; it cleans up its own resources
+            pthread_t tw;
+            if (pthread_create(&tw, NULL, th_worker, wa) != 0) {
+                free(wa);
+                close(s);
+                continue;
+            }
+            pthread_detach(tw);
+        }
+    }
+
+    free(pfds);
+    return 0;
+}
+
+// =======================================================
+// Epoll backend
+// =======================================================
+
+// Deadline lists: waiting on a request/reply in progress, or idle between requests
+enum { DL_IO = 0, DL_IDLE = 1 };
+
+typedef struct Conn {
+    int tag;
+    int fd;
+    void *ctx;
+    int closing;                // no more requests; close once output drains
+    uint32_t events;            // current epoll interest set
+    int dl;                     // DL_IO or DL_IDLE
+    long deadline_ms;
+    struct Conn *prev, *next;   // deadline list, oldest first
+
+    size_t in_off, in_len;
+    size_t out_off, out_len;
+    char in[CONN_IN_BUF];
+    char out[CONN_OUT_BUF];
+} Conn;
+
+typedef struct {
+    Server *srv;
+    int epfd;
+    // Each list has a single timeout, so appending keeps it sorted by deadline
+    Conn *head[2], *tail[2];
+} EpollWorker;
+
+static void dl_unlink(EpollWorker *w, Conn *c) {
+    int d = c->dl;
+    if (c->prev) c->prev->next = c->next; else w->head[d] = c->next;
+    if (c->next) c->next->prev = c->prev; else w->tail[d] = c->prev;
+    c->prev = c->next = NULL;
+}
+
+static void dl_append(EpollWorker *w, Conn *c, int d) {
+    int timeout = d == DL_IDLE ? w->srv->idle_ms : SERVER_IO_TIMEOUT_MS;
+    c->dl = d;
+    c->deadline_ms = mono_ms() + timeout;
+    c->prev = w->tail[d];
+    c->next = NULL;
+    if (w->tail[d]) w->tail[d]->next = c; else w->head[d] = c;
+    w->tail[d] = c;
+}
+
+static void dl_touch(EpollWorker *w, Conn *c, int d) {
+    dl_unlink(w, c);
+    dl_append(w, c, d);
+}
+
+static void conn_close(EpollWorker *w, Conn *c) {
+    dl_unlink(w, c);
+    epoll_ctl(w->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    free(c);
+}
+
+/**
+ * @brief Flushes pending output. Returns 1 when everything was sent, 0 if the
+ * socket is full, -1 on error.
+ */
+static int conn_flush(Conn *c) {
+    if (c->out_off == c->out_len) {
+        c->out_off = c->out_len = 0;
+        return 1;
+    }
+    uint64_t t0 = metrics_now_ns();
+    int rc = 1;
+    while (c->out_off < c->out_len) {
+        ssize_t k = send(c->fd, c->out + c->out_off, c->out_len - c->out_off, MSG_NOSIGNAL);
+        if (k < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) { rc = 0; break; }
+            metrics_inc(MC_SEND_ERRORS);
+            return -1;
+        }
+        c->out_off += (size_t)k;
+    }
+    metrics_observe_ns(MH_SEND, metrics_now_ns() - t0);
+    if (rc == 1) c->out_off = c->out_len = 0;
+    return rc;
+}
+
+/**
+ * @brief Runs the handler on every complete line in the input buffer, in
+ * order, appending the replies to the output buffer. Stops early when the
+ * output buffer cannot take another reply (backpressure on pipelining).
+ */
+static void conn_process(EpollWorker *w, Conn *c) {
+    while (!c->closing) {
+        char *line = c->in + c->in_off;
+        size_t avail = c->in_len - c->in_off;
+        char *nl = memchr(line, '\n', avail);
+        size_t used;
+        if (nl) {
+            used = (size_t)(nl - line) + 1;
+        } else if (c->in_off == 0 && c->in_len == sizeof(c->in) - 1) {
+            used = avail; // Over-long line: handle what fits, like recv_line_timeout does
+        } else {
+            break;
+        }
+
+        if (sizeof(c->out) - c->out_len < MAX_LINE) {
+            if (c->out_off > 0) {
+                memmove(c->out, c->out + c->out_off, c->out_len - c->out_off);
+                c->out_len -= c->out_off;
+                c->out_off = 0;
+            }
+            if (sizeof(c->out) - c->out_len < MAX_LINE) break;
+        }
+
+        char saved = line[used];
+        line[used] = '\0';
+        strip_eol(line);
+
+        int keepalive = 0;
+        size_t room = sizeof(c->out) - c->out_len;
+        int k = w->srv->fn(c->ctx, line, c->out + c->out_len, room, &keepalive);
+        line[used] = saved;
+        c->in_off += used;
+
+        if (k <= 0) {
+            // Bad request: send what is already queued, then hang up
+            c->closing = 1;
+            break;
+        }
+        c->out_len += (size_t)k < room ? (size_t)k : room - 1;
+        metrics_inc(MC_REPLIES);
+        if (!keepalive) c->closing = 1;
+    }
+
+    // Compact the unread tail to the front of the input buffer
+    if (c->in_off > 0) {
+        memmove(c->in, c->in + c->in_off, c->in_len - c->in_off);
+        c->in_len -= c->in_off;
+        c->in_off = 0;
+    }
+}
+
+/**
+ * @brief Flushes output and updates the epoll interest set and deadline list
+ * after the connection made progress. May close the connection.
+ */
+static void conn_settle(EpollWorker *w, Conn *c) {
+    int r = conn_flush(c);
+    if (r < 0 || (r == 1 && c->closing)) { conn_close(w, c); return; }
+
+    uint32_t ev = 0;
+    if (r == 0) ev |= EPOLLOUT;
+    // Stop reading while replies are backed up or once the connection is done
+    if (!c->closing && r == 1) ev |= EPOLLIN | EPOLLRDHUP;
+
+    if (ev != c->events) {
+        struct epoll_event e = { .events = ev, .data.ptr = c };
+        if (epoll_ctl(w->epfd, EPOLL_CTL_MOD, c->fd, &e) < 0) { conn_close(w, c); return; }
+        c->events = ev;
+    }
+
+    // Idle only when nothing is half-read or waiting to be sent
+    int d = (r == 1 && c->in_len == 0 && !c->closing) ? DL_IDLE : DL_IO;
+    dl_touch(w, c, d);
+}
+
+static void conn_on_readable(EpollWorker *w, Conn *c) {
+    for (;;) {
+        size_t room = sizeof(c->in) - 1 - c->in_len;
+        if (room == 0) break;
+        ssize_t k = recv(c->fd, c->in + c->in_len, room, 0);
+        if (k < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            conn_close(w, c);
+            return;
+        }
+        if (k == 0) {
+            // Peer finished sending: answer the complete lines it left, then close
+            conn_process(w, c);
+            c->closing = 1;
+            conn_settle(w, c);
+            return;
+        }
+        c->in_len += (size_t)k;
+        if ((size_t)k < room) break;
+    }
+
+    conn_process(w, c);
+    conn_settle(w, c);
+}
+
+static void accept_all(EpollWorker *w, Listener *l) {
+    for (;;) {
+        uint64_t t0 = metrics_now_ns();
+        int s = accept4(l->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (s < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            return; // EAGAIN, or another worker won the race
+        }
+        metrics_observe_ns(MH_ACCEPT, metrics_now_ns() - t0);
+        metrics_inc(MC_ACCEPTS);
+
+        tcp_set_nodelay(s);
+        Conn *c = malloc(sizeof(*c));
+        if (!c) { close(s); continue; }
+        c->tag = TAG_CONN;
+        c->fd = s;
+        c->ctx = l->ctx;
+        c->closing = 0;
+        c->events = EPOLLIN | EPOLLRDHUP;
+        c->in_off = c->in_len = 0;
+        c->out_off = c->out_len = 0;
+        c->prev = c->next = NULL;
+        dl_append(w, c, DL_IO);
+
+        struct epoll_event ev = { .events = c->events, .data.ptr = c };
+        if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, s, &ev) < 0) { conn_close(w, c); continue; }
+    }
+}
+
+static void conn_on_writable(EpollWorker *w, Conn *c) {
+    if (conn_flush(c) < 0) { conn_close(w, c); return; }
+    // Output drained: pick up pipelined lines that were held back
+    conn_process(w, c);
+    conn_settle(w, c);
+}
+
+static long next_deadline(EpollWorker *w) {
+    long d = -1;
+    for (int i = 0; i < 2; ++i)
+        if (w->head[i] && (d < 0 || w->head[i]->deadline_ms < d)) d = w->head[i]->deadline_ms;
+    return d;
+}
+
+static void expire_conns(EpollWorker *w) {
+    long now = mono_ms();
+    for (int i = 0; i < 2; ++i)
+        while (w->head[i] && w->head[i]->deadline_ms <= now) conn_close(w, w->head[i]);
+}
+
+static void *th_epoll(void *arg) {
+    EpollWorker *w = (EpollWorker *)arg;
+    Server *srv = w->srv;
+    struct epoll_event evs[SERVER_EPOLL_EVENTS];
+
+    while (*srv->running) {
+        int timeout = 500;
+        long dl = next_deadline(w);
+        if (dl >= 0) {
+            long left = dl - mono_ms();
+            if (left < timeout) timeout = left > 0 ? (int)left : 0;
+        }
+
+        int n = epoll_wait(w->epfd, evs, SERVER_EPOLL_EVENTS, timeout);
+        for (int i = 0; i < n; ++i) {
+            int tag = *(int *)evs[i].data.ptr;
+            if (tag == TAG_LISTENER) {
+                accept_all(w, (Listener *)evs[i].data.ptr);
+                continue;
+            }
+
+            Conn *c = (Conn *)evs[i].data.ptr;
+            uint32_t e = evs[i].events;
+            if (e & EPOLLERR) conn_close(w, c);
+            else if (e & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) conn_on_readable(w, c);
+            else if (e & EPOLLOUT) conn_on_writable(w, c);
+        }
+        expire_conns(w);
+    }
+
+    for (int i = 0; i < 2; ++i)
+        while (w->head[i]) conn_close(w, w->head[i]);
+    return NULL;
+}
+
+static int run_epoll(Server *srv) {
+    int nw = srv->nworkers;
+    EpollWorker *workers = calloc((size_t)nw, sizeof(*workers));
+    pthread_t *tids = calloc((size_t)nw, sizeof(*tids));
+    if (!workers || !tids) { free(workers); free(tids); return -1; }
+
+    int started = 0, rc = 0;
+    for (int i = 0; i < nw; ++i) {
+        EpollWorker *w = &workers[i];
+        w->srv = srv;
+        w->epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (w->epfd < 0) { rc = -1; break; }
+
+        // Every worker watches every listener; EPOLLEXCLUSIVE avoids thundering herds
+        for (size_t j = 0; j < srv->nlisteners; ++j) {
+            struct epoll_event ev = { .events = EPOLLIN | EPOLLEXCLUSIVE, .data.ptr = srv->listeners[j] };
+            if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, srv->listeners[j]->fd, &ev) < 0) rc = -1;
+        }
+        if (rc < 0) { close(w->epfd); break; }
+
+        if (pthread_create(&tids[i], NULL, th_epoll, w) != 0) { close(w->epfd); rc = -1; break; }
+        ++started;
+    }
+
+    if (rc < 0) *srv->running = 0;
+    for (int i = 0; i < started; ++i) {
+        pthread_join(tids[i], NULL);
+        close(workers[i].epfd);
+    }
+
+    free(workers);
+    free(tids);
+    return rc;
+}
+
+// =======================================================
+// io_uring backend
+// =======================================================
+//
+// One ring per worker thread, driven through the raw syscalls. Every worker
+// keeps a multishot accept armed on each listener. A connection has at most
+// one recv or send in flight: recvs pick a buffer from the worker's provided
+// buffer ring, the bytes are copied into the connection's line buffer and the
+// buffer goes straight back, so a few hundred buffers serve any number of
+// idle connections. The reply that ends a connection is sent linked to its
+// close. Line handling, pipelining and the deadline lists are shared with the
+// epoll backend.
+
+#define URING_ENTRIES 1024
+#define URING_BUFS 256            // provided recv buffers per worker, power of two
+#define URING_BUF_SIZE 2048
+#define URING_BGID 1
+#define URING_DRAIN_MS 1000       // shutdown: wait this long for cancelled ops
+#define URING_STARVE_MS 10        // recvs parked on -ENOBUFS retry at least this often
+
+// Low bits of user_data; the rest is a UConn pointer or a listener index.
+// user_data 0 is a request whose completion needs no handling.
+enum { OP_ACCEPT = 1, OP_RECV = 2, OP_SEND = 3, OP_CLOSE = 4, OP_CANCEL = 5 };
+#define OP_BITS 3
+#define OP_MASK ((1ull << OP_BITS) - 1)
+
+typedef struct {
+    int fd;
+    unsigned *sq_head, *sq_tail, *sq_array, sq_mask, sq_entries;
+    unsigned sq_local, sq_submitted;   // SQEs filled / handed to the kernel
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head, *cq_tail, cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_map, *cq_map;
+    size_t sq_map_len, cq_map_len, sqes_len;
+
+    struct io_uring_buf_ring *br;      // provided recv buffers
+    char *bufs;
+    unsigned br_tail;
+} Uring;
+
+typedef struct UConn {
+    Conn c;                     // first, so the deadline lists can hold it
+    int op;                     // OP_RECV / OP_SEND in flight, or 0
+    int inflight;               // requests not completed yet, including cancels and closes
+    int shut;                   // the fd is closed or a close is queued
+    int dead;                   // freed once inflight drops to 0
+    int starved;                // on the starved list, waiting for a recv buffer
+    uint64_t send_t0;           // when the send in flight was queued
+    struct UConn *next_starved;
+} UConn;
+
+typedef struct {
+    EpollWorker w;              // server and deadline lists; epfd is unused
+    Uring r;
+    char *accepting;            // per listener: multishot accept armed
+    size_t pending;             // requests in flight on the ring
+    UConn *starved;             // recvs that got -ENOBUFS, re-armed once buffers return
+    long starved_ms;            // when the list became non-empty
+    int failed;
+} UringWorker;
+
+static int uring_sys_setup(unsigned entries, struct io_uring_params *p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uring_sys_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags,
+                           void *arg, size_t argsz) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static int uring_sys_register(int fd, unsigned op, void *arg, unsigned nargs) {
+    return (int)syscall(__NR_io_uring_register, fd, op, arg, nargs);
+}
+
+static void uring_exit(Uring *r) {
+    if (r->sqes) munmap(r->sqes, r->sqes_len);
+    if (r->cq_map && r->cq_map != r->sq_map) munmap(r->cq_map, r->cq_map_len);
+    if (r->sq_map) munmap(r->sq_map, r->sq_map_len);
+    if (r->fd >= 0) close(r->fd);
+    if (r->br) munmap(r->br, URING_BUFS * sizeof(struct io_uring_buf));
+    free(r->bufs);
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+}
+
+static void buf_put(Uring *r, unsigned bid) {
+    struct io_uring_buf *b = &r->br->bufs[r->br_tail & (URING_BUFS - 1)];
+    b->addr = (uint64_t)(uintptr_t)(r->bufs + (size_t)bid * URING_BUF_SIZE);
+    b->len = URING_BUF_SIZE;
+    b->bid = (uint16_t)bid;
+    r->br_tail++;
+    __atomic_store_n(&r->br->tail, (uint16_t)r->br_tail, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Sets up a ring and its provided buffer ring. Fails (errno set) on
+ * kernels without io_uring or without the features this backend needs
+ * (extended enter arguments, buffer rings: Linux 5.19 or later).
+ */
+static int uring_init(Uring *r) {
+    memset(r, 0, sizeof(*r));
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+    r->fd = uring_sys_setup(URING_ENTRIES, &p);
+    if (r->fd < 0 && errno == EINVAL) {
+        memset(&p, 0, sizeof(p));   // older kernel: no optional flags
+        r->fd = uring_sys_setup(URING_ENTRIES, &p);
+    }
+    if (r->fd < 0) return -1;
+    if (!(p.features & IORING_FEAT_EXT_ARG)) {
+        errno = ENOSYS;
+        goto fail;
+    }
+
+    r->sq_map_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_map_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cq_map_len > r->sq_map_len) r->sq_map_len = r->cq_map_len;
+        r->cq_map_len = r->sq_map_len;
+    }
+    r->sq_map = mmap(NULL, r->sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_map == MAP_FAILED) { r->sq_map = NULL; goto fail; }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        r->cq_map = r->sq_map;
+    } else {
+        r->cq_map = mmap(NULL, r->cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         r->fd, IORING_OFF_CQ_RING);
+        if (r->cq_map == MAP_FAILED) { r->cq_map = NULL; goto fail; }
+    }
+    r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) { r->sqes = NULL; goto fail; }
+
+    char *sq = r->sq_map, *cq = r->cq_map;
+    r->sq_head = (unsigned *)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = *(unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_entries = *(unsigned *)(sq + p.sq_off.ring_entries);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    r->sq_local = r->sq_submitted = *r->sq_tail;
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = *(unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    // The buffer ring must be page aligned; the kernel reads it directly
+    r->br = mmap(NULL, URING_BUFS * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (r->br == MAP_FAILED) { r->br = NULL; goto fail; }
+    r->bufs = malloc((size_t)URING_BUFS * URING_BUF_SIZE);
+    if (!r->bufs) goto fail;
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)r->br;
+    reg.ring_entries = URING_BUFS;
+    reg.bgid = URING_BGID;
+    if (uring_sys_register(r->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) goto fail;
+    for (unsigned i = 0; i < URING_BUFS; ++i) buf_put(r, i);
+    return 0;
+
+fail:;
+    int saved = errno;
+    uring_exit(r);
+    errno = saved;
+    return -1;
+}
+
+/**
+ * @brief Hands queued SQEs to the kernel and, if wait_ms >= 0, waits up to
+ * wait_ms for at least one completion.
+ */
+static int uring_submit(Uring *r, int wait_ms) {
+    __atomic_store_n(r->sq_tail, r->sq_local, __ATOMIC_RELEASE);
+    unsigned to_submit = r->sq_local - r->sq_submitted;
+    struct __kernel_timespec ts = { .tv_sec = wait_ms / 1000, .tv_nsec = (long)(wait_ms % 1000) * 1000000L };
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.ts = (uint64_t)(uintptr_t)&ts;
+    unsigned flags = wait_ms >= 0 ? IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG : 0;
+
+    int k = uring_sys_enter(r->fd, to_submit, wait_ms >= 0 ? 1 : 0, flags,
+                            wait_ms >= 0 ? &arg : NULL, sizeof(arg));
+    if (k < 0) return errno == ETIME || errno == EINTR || errno == EBUSY || errno == EAGAIN ? 0 : -1;
+    r->sq_submitted += (unsigned)k;
+    return 0;
+}
+
+// Next free SQE, zeroed; submits queued ones first if the ring is full
+static struct io_uring_sqe *sqe_get(UringWorker *uw) {
+    Uring *r = &uw->r;
+    while (r->sq_local - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) >= r->sq_entries) {
+        if (uring_submit(r, -1) < 0) {
+            uw->failed = 1;
+            return NULL;
+        }
+    }
+    unsigned idx = r->sq_local & r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    r->sq_array[idx] = idx;
+    r->sq_local++;
+    uw->pending++;
+    return sqe;
+}
+
+static void arm_accept(UringWorker *uw, size_t i) {
+    struct io_uring_sqe *sqe = sqe_get(uw);
+    if (!sqe) return;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = uw->w.srv->listeners[i]->fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = (uint64_t)i << OP_BITS | OP_ACCEPT;
+    uw->accepting[i] = 1;
+}
+
+static struct io_uring_sqe *conn_sqe(UringWorker *uw, UConn *u, int op, uint8_t opcode) {
+    struct io_uring_sqe *sqe = sqe_get(uw);
+    if (!sqe) return NULL;
+    sqe->opcode = opcode;
+    sqe->fd = u->c.fd;
+    sqe->user_data = (uint64_t)(uintptr_t)u | (uint64_t)op;
+    u->inflight++;
+    return sqe;
+}
+
+/**
+ * @brief Ends the connection now: cancels whatever is in flight on it and
+ * closes the socket. The UConn is freed when the last completion arrives.
+ */
+static void uconn_kill(UringWorker *uw, UConn *u) {
+    if (u->dead) return;
+    u->dead = 1;
+    dl_unlink(&uw->w, &u->c);
+    if (u->shut) {
+        // The last reply is stuck with the close linked behind it: cancel the
+        // send, the close then fails with -ECANCELED and is done by hand
+        if (u->op == OP_SEND) {
+            struct io_uring_sqe *sqe = conn_sqe(uw, u, OP_CANCEL, IORING_OP_ASYNC_CANCEL);
+            if (sqe) sqe->cancel_flags = IORING_ASYNC_CANCEL_FD;
+        }
+        return;
+    }
+    u->shut = 1;
+    if (u->op) {
+        // Hard link: the close runs even when there was nothing left to cancel
+        struct io_uring_sqe *sqe = conn_sqe(uw, u, OP_CANCEL, IORING_OP_ASYNC_CANCEL);
+        if (!sqe) return;
+        sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+        sqe->flags = IOSQE_IO_HARDLINK;
+    }
+    conn_sqe(uw, u, OP_CLOSE, IORING_OP_CLOSE);
+}
+
+/**
+ * @brief Queues the connection's next step: the pending replies, the close
+ * once it is finished, or another recv. Deadlines follow conn_settle().
+ */
+static void uconn_settle(UringWorker *uw, UConn *u) {
+    Conn *c = &u->c;
+    if (u->dead || u->op) return;
+
+    struct io_uring_sqe *sqe;
+    if (c->out_len > c->out_off) {
+        if (!(sqe = conn_sqe(uw, u, OP_SEND, IORING_OP_SEND))) return;
+        sqe->addr = (uint64_t)(uintptr_t)(c->out + c->out_off);
+        sqe->len = (unsigned)(c->out_len - c->out_off);
+        sqe->msg_flags = MSG_NOSIGNAL;
+        u->op = OP_SEND;
+        u->send_t0 = metrics_now_ns();
+        if (c->closing) {
+            // Last reply: close right behind it (a failed send cancels the close)
+            sqe->msg_flags |= MSG_WAITALL;
+            sqe->flags = IOSQE_IO_LINK;
+            conn_sqe(uw, u, OP_CLOSE, IORING_OP_CLOSE);
+            u->shut = 1;
+        }
+    } else if (c->closing) {
+        uconn_kill(uw, u);
+        return;
+    } else {
+        size_t room = sizeof(c->in) - 1 - c->in_len;
+        if (!(sqe = conn_sqe(uw, u, OP_RECV, IORING_OP_RECV))) return;
+        sqe->len = (unsigned)(room < URING_BUF_SIZE ? room : URING_BUF_SIZE);
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = URING_BGID;
+        u->op = OP_RECV;
+    }
+
+    int d = (c->out_len == 0 && c->in_len == 0 && !c->closing) ? DL_IDLE : DL_IO;
+    dl_touch(&uw->w, c, d);
+}
+
+static void on_accept(UringWorker *uw, size_t i, const struct io_uring_cqe *cqe) {
+    if (!(cqe->flags & IORING_CQE_F_MORE)) uw->accepting[i] = 0;   // re-armed by the loop
+    if (cqe->res < 0) return;
+
+    // The kernel accepts on its own here, so there is no accept time for MH_ACCEPT
+    metrics_inc(MC_ACCEPTS);
+    int s = cqe->res;
+    tcp_set_nodelay(s);
+    UConn *u = calloc(1, sizeof(*u));
+    if (!u) { close(s); return; }
+    u->c.tag = TAG_CONN;
+    u->c.fd = s;
+    u->c.ctx = uw->w.srv->listeners[i]->ctx;
+    dl_append(&uw->w, &u->c, DL_IO);
+    uconn_settle(uw, u);
+}
+
+static void on_conn_cqe(UringWorker *uw, UConn *u, int op, const struct io_uring_cqe *cqe) {
+    Conn *c = &u->c;
+    int res = cqe->res;
+    u->inflight--;
+    if (op == OP_RECV || op == OP_SEND) u->op = 0;
+
+    switch (op) {
+    case OP_RECV:
+        if (res > 0) {
+            unsigned bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+            memcpy(c->in + c->in_len, uw->r.bufs + (size_t)bid * URING_BUF_SIZE, (size_t)res);
+            c->in_len += (size_t)res;
+            buf_put(&uw->r, bid);
+        } else if (res == 0) {
+            // Peer finished sending: answer the complete lines it left, then close
+            if (!u->dead) {
+                conn_process(&uw->w, c);
+                c->closing = 1;
+            }
+        } else if (res == -ENOBUFS) {
+            // All buffers are busy: wait for one to come back rather than spin
+            if (!u->dead) {
+                if (!uw->starved) uw->starved_ms = mono_ms();
+                u->starved = 1;
+                u->next_starved = uw->starved;
+                uw->starved = u;
+            }
+            break;
+        } else {
+            uconn_kill(uw, u);
+        }
+        if (!u->dead) {
+            conn_process(&uw->w, c);
+            uconn_settle(uw, u);
+        }
+        break;
+    case OP_SEND:
+        if (res < 0) {
+            metrics_inc(MC_SEND_ERRORS);
+            uconn_kill(uw, u);
+        } else {
+            // Queued to completed, so time spent waiting for socket space counts
+            metrics_observe_ns(MH_SEND, metrics_now_ns() - u->send_t0);
+            c->out_off += (size_t)res;
+            if (c->out_off == c->out_len) c->out_off = c->out_len = 0;
+        }
+        if (u->shut) {
+            uconn_kill(uw, u);   // the linked close is on its way
+        } else if (!u->dead) {
+            // Output drained: pick up pipelined lines that were held back
+            conn_process(&uw->w, c);
+            uconn_settle(uw, u);
+        }
+        break;
+    case OP_CLOSE:
+        if (res == -ECANCELED) close(c->fd);   // its linked send failed
+        break;
+    }
+    if (u->dead && u->inflight == 0 && !u->starved) free(u);
+}
+
+// Re-arms the recvs parked on -ENOBUFS, freeing the ones killed meanwhile
+static void rearm_starved(UringWorker *uw) {
+    UConn *u = uw->starved;
+    uw->starved = NULL;
+    while (u) {
+        UConn *next = u->next_starved;
+        u->starved = 0;
+        if (!u->dead) uconn_settle(uw, u);
+        else if (u->inflight == 0) free(u);
+        u = next;
+    }
+}
+
+static void reap(UringWorker *uw) {
+    Uring *r = &uw->r;
+    unsigned head = *r->cq_head;
+    unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+        struct io_uring_cqe cqe = r->cqes[head & r->cq_mask];
+        if (!(cqe.flags & IORING_CQE_F_MORE)) uw->pending--;
+        int op = (int)(cqe.user_data & OP_MASK);
+        if (op == OP_ACCEPT) on_accept(uw, (size_t)(cqe.user_data >> OP_BITS), &cqe);
+        else if (op) on_conn_cqe(uw, (UConn *)(uintptr_t)(cqe.user_data & ~OP_MASK), op, &cqe);
+    }
+    __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+}
+
+static void *th_uring(void *arg) {
+    UringWorker *uw = (UringWorker *)arg;
+    EpollWorker *w = &uw->w;
+    Server *srv = w->srv;
+
+    while (*srv->running && !uw->failed) {
+        for (size_t i = 0; i < srv->nlisteners; ++i)
+            if (!uw->accepting[i]) arm_accept(uw, i);
+
+        int timeout = 500;
+        long dl = next_deadline(w);
+        if (dl >= 0) {
+            long left = dl - mono_ms();
+            if (left < timeout) timeout = left > 0 ? (int)left : 0;
+        }
+        if (uw->starved && timeout > URING_STARVE_MS) timeout = URING_STARVE_MS;
+        if (uring_submit(&uw->r, timeout) < 0) {
+            perror("io_uring_enter");
+            break;
+        }
+        unsigned br_tail = uw->r.br_tail;
+        reap(uw);
+        // Buffers came back in this batch (possibly before the -ENOBUFS itself
+        // was reaped), or the back-off ran out
+        if (uw->starved && (uw->r.br_tail != br_tail || mono_ms() - uw->starved_ms >= URING_STARVE_MS))
+            rearm_starved(uw);
+
+        long now = mono_ms();
+        for (int i = 0; i < 2; ++i)
+            while (w->head[i] && w->head[i]->deadline_ms <= now) uconn_kill(uw, (UConn *)w->head[i]);
+    }
+
+    // Close every connection and stop accepting, then wait for the kernel to
+    // finish with our buffers before they are freed
+    for (int i = 0; i < 2; ++i)
+        while (w->head[i]) uconn_kill(uw, (UConn *)w->head[i]);
+    for (size_t i = 0; i < srv->nlisteners; ++i) {
+        if (!uw->accepting[i]) continue;
+        struct io_uring_sqe *sqe = sqe_get(uw);
+        if (!sqe) break;
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = (uint64_t)i << OP_BITS | OP_ACCEPT;
+        sqe->user_data = 0;   // its res is not an fd: reap() only counts it
+    }
+    long give_up = mono_ms() + URING_DRAIN_MS;
+    while (uw->pending > 0 && !uw->failed && mono_ms() < give_up) {
+        if (uring_submit(&uw->r, 50) < 0) break;
+        reap(uw);
+    }
+    rearm_starved(uw);   // parked connections were killed above
+    return NULL;
+}
+
+static int run_uring(Server *srv) {
+    int nw = srv->nworkers;
+    UringWorker *workers = calloc((size_t)nw, sizeof(*workers));
+    pthread_t *tids = calloc((size_t)nw, sizeof(*tids));
+    if (!workers || !tids) { free(workers); free(tids); return -1; }
+
+    int ready = 0, rc = 0;
+    for (; ready < nw; ++ready) {
+        UringWorker *uw = &workers[ready];
+        uw->w.srv = srv;
+        uw->w.epfd = -1;
+        uw->accepting = calloc(srv->nlisteners, 1);
+        if (!uw->accepting || uring_init(&uw->r) < 0) {
+            free(uw->accepting);
+            break;
+        }
+    }
+    if (ready < nw) {
+        // Not supported here (old kernel, seccomp, io_uring_disabled)
+        int err = errno;
+        for (int i = 0; i < ready; ++i) {
+            uring_exit(&workers[i].r);
+            free(workers[i].accepting);
+        }
+        free(workers);
+        free(tids);
+        fprintf(stderr, "io_uring backend unavailable (%s); using epoll\n", strerror(err));
+        return run_epoll(srv);
+    }
+
+    int started = 0;
+    for (; started < nw; ++started) {
+        if (pthread_create(&tids[started], NULL, th_uring, &workers[started]) != 0) {
+            *srv->running = 0;
+            rc = -1;
+            break;
+        }
+    }
+    for (int i = 0; i < started; ++i) pthread_join(tids[i], NULL);
+    for (int i = 0; i < nw; ++i) {
+        // Leak rather than free buffers the kernel may still write to
+        if (workers[i].pending == 0) uring_exit(&workers[i].r);
+        else close(workers[i].r.fd);
+        free(workers[i].accepting);
+    }
+
+    free(workers);
+    free(tids);
+    return rc;
+}
+
+/**
+ * @brief Serves all registered listeners until *running becomes 0.
+ */
+int server_run(Server *srv, volatile int *running) {
+    srv->running = running;
+    if (srv->nlisteners == 0) return -1;
+
+    switch (srv->backend) {
+    case SERVER_THREAD: return run_thread(srv);
+    case SERVER_EPOLL:  return run_epoll(srv);
+    case SERVER_URING:  return run_uring(srv);
+    }
+    return -1;
+}
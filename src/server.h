@@ -0,0 +1,44 @@
+#pragma once
+#include <stddef.h>
+
+/*
+ * Request/response TCP server used by the truck.
+ *
+ * Each request is a newline-terminated line and gets one reply line back.
+ * By default the server closes the connection after the reply; a handler can
+ * keep it open so further (possibly pipelined) requests reuse it. Replies are
+ * always sent in request order, and kept-alive connections are closed after
+ * the idle timeout. Three backends are available:
+ *   SERVER_THREAD - polls the listeners (500 ms, to notice shutdown) and
+ *                   starts one detached thread per accepted connection
+ *   SERVER_EPOLL  - non-blocking sockets, one epoll loop per worker thread
+ *   SERVER_URING  - one io_uring per worker thread (multishot accept, provided
+ *                   buffer ring, send linked to close); falls back to epoll
+ *                   when the kernel lacks io_uring or Linux 5.19 features
+ */
+
+typedef enum {
+    SERVER_THREAD = 0,
+    SERVER_EPOLL  = 1,
+    SERVER_URING  = 2
+} ServerBackend;
+
+/*
+ * Handles one request line ('\n' stripped, NUL-terminated).
+ * Writes the reply into out and returns its length, or -1 to drop the
+ * connection without replying. Setting *keepalive to 1 keeps the connection
+ * open for the next request (it starts at 0 for every line).
+ */
+typedef int (*server_line_fn)(void *ctx, const char *line, char *out, size_t out_n,
+                              int *keepalive);
+
+typedef struct Server Server;
+
+Server *server_create(ServerBackend backend, int nworkers, server_line_fn fn);
+int server_add_listener(Server *srv, int listen_fd, void *ctx);
+void server_set_idle_timeout(Server *srv, int idle_ms);
+int server_run(Server *srv, volatile int *running);
+void server_destroy(Server *srv);
+
+int server_backend_parse(const char *name, ServerBackend *out);
+const char *server_backend_name(ServerBackend b);
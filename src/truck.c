@@ -1,18 +1,29 @@
+#define _DEFAULT_SOURCE
 #define _POSIX_C_SOURCE 200809L
 
 #include <stdio.h>
+#include <math.h>
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <signal.h>
 #include <time.h>
 #include <pthread.h>
+#include <poll.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include "protocol.h" 
 #include "util.h"    
 #include "net.h"   
 #include "logger.h" 
+#include "gps.h"
+#include "server.h"
+#include "orders.h"
+#include "metrics.h"
+#include "prng.h"
+#include "scheduler.h"
+#include "geo.h"
+#include "mcregion.h"
 #ifndef MAX_LINE
 #define MAX_LINE 256
 #endif
@@ -31,13 +42,35 @@
 static volatile int running = 1;
 
 // Truck Status
-static double g_lat = 31.956, g_lon = 35.945;
-static volatile int g_queue_len = 0; // MUST be volatile for atomic operations
+static double g_lat = 31.956, g_lon = 35.945; // start position; live position is in g_gps
+static GpsCtx *g_gps = NULL;
+static uint64_t g_seed = 0;          // --seed; 0 = from the clock
+static const char *g_route_path = NULL;   // --gps-route: waypoints to drive between
+static const char *g_replay_path = NULL;  // --gps-replay: recorded track, one point per tick
+static OrderQueue *g_orders = NULL;
+static double g_speed_kmh = 30.0;   // average driving speed for ETAs and the simulation
+static double g_service_min = 5.0;  // time spent at each stop
+static int g_max_orders = 4096;
 static char g_truck_id[MAX_ID_LEN] = "TRK01"; 
 static int g_tcp_port = 6012;
+static ServerBackend g_backend = SERVER_EPOLL;
+static int g_workers = 0; // 0 = one per online core
+static int g_idle_ms = 5000; // keep-alive connections close after this much silence
+static int g_hb_binary = 0;  // --hb-format binary: compact fixed-layout heartbeats
+static int g_log_async = 1;  // --log-mode sync: write each event in the caller
+static int g_log_flush_ms = 200;
+static LogDurability g_log_durability = LOG_FLUSH_INTERVAL;
+static JournalOpts g_log_journal = { .max_bytes = 64u << 20, .max_secs = 3600 };
+static int g_metrics_port = 0;  // --metrics-port: Prometheus text on 127.0.0.1; 0 = off
+static int g_hb_jitter_ms = HB_INTERVAL_MS / 10;  // --hb-jitter-ms: each heartbeat moves by up to +-this
+static Sched *g_sched = NULL;   // runs the GPS, heartbeat and metrics ticks
+static int g_hb_adaptive = 0;        // --hb-mode adaptive: send on divergence from dead reckoning
+static double g_hb_threshold_m = 25.0;  // --hb-threshold-m: allowed receiver-side position error
+static int g_hb_keepalive_s = 10;    // --hb-keepalive-s: longest silence in adaptive mode
+static double g_mc_tile_km = 0;      // --mc-tile-km: send to the current map tile's group; 0 = MC_GROUP
 
 // Network File Descriptors and Address
-static int mc_fd = -1, listen_fd = -1; 
+static int mc_fd = -1, listen_fd = -1, metrics_fd = -1; 
 static struct sockaddr_in mc_addr;
 
 
@@ -49,81 +82,216 @@ static void on_sig(int s) {
 }
 
 
-// --- GPS SIMULATION THREAD ---
-static void* th_gps(void* _) { 
-    (void)_; 
-    while (running) { 
-        // Assumed to be in util.c
-        gps_step(&g_lat, &g_lon); 
-        usleep(300 * 1000); // Update every 300ms
-    } 
-    return NULL; 
+// --- GPS SIMULATION TASK ---
+#define GPS_TICK_MS 300
+
+static uint32_t gps_serving = 0;  // job being served at its stop, 0 = none
+static int gps_service_ticks = 0;
+static double g_vn = 0, g_ve = 0; // m/s over the last tick; read by the heartbeat task on the same thread
+
+static void gps_tick(void *arg) {
+    (void)arg;
+    double lat0, lon0;
+    gps_position(g_gps, &lat0, &lon0);
+
+    Order head;
+    int parked = 0;
+    if (orders_head(g_orders, &head) < 0) {
+        // No orders: wander, follow the route or replay the track
+        gps_advance(g_gps, GPS_TICK_MS / 1000.0);
+        gps_serving = 0;
+        parked = gps_mode(g_gps) == GPS_WALK;   // GPS noise around a parked truck, not movement
+    } else if (gps_serving == head.job) {
+        if (--gps_service_ticks <= 0) {
+            orders_complete(g_orders, head.job);
+            gps_serving = 0;
+        }
+    } else if (gps_drive_toward(g_gps, head.lat, head.lon, g_speed_kmh * GPS_TICK_MS / 3600000.0)) {
+        gps_serving = head.job;
+        gps_service_ticks = (int)(g_service_min * 60000.0 / GPS_TICK_MS);
+    }
+
+    double lat, lon;
+    gps_position(g_gps, &lat, &lon);
+    double m_per_deg = GEO_EARTH_KM * 1000.0 * M_PI / 180.0;
+    g_vn = parked ? 0 : (lat - lat0) * m_per_deg / (GPS_TICK_MS / 1000.0);
+    g_ve = parked ? 0 : (lon - lon0) * m_per_deg * cos(lat * M_PI / 180.0) / (GPS_TICK_MS / 1000.0);
 }
 
 
-// --- HEARTBEAT BROADCAST THREAD ---
-static void* th_hb(void* _) { 
-    (void)_; 
+// --- HEARTBEAT BROADCAST TASK ---
+#define HB_CHECK_MS 100   // adaptive mode: how often the position is compared with the receivers' estimate
+
+// Sends one heartbeat; m carries the motion fields in adaptive mode
+static void hb_send(double lat, double lon, const HbMotion *m) {
+    static uint32_t seq = 0;
     char line[MAX_LINE];
-    while (running) {
-        // 1. Format the Heartbeat message (HB)
-        format_hb(line, sizeof(line), g_truck_id, g_lat, g_lon, g_tcp_port, time(NULL));
-        
-        // 2. Send the message via UDP Multicast (mc_fd is set up in main)
-        sendto(mc_fd, line, strlen(line), 0, (struct sockaddr*)&mc_addr, sizeof(mc_addr));
-        
-        // 3. Wait for the interval
-        usleep(HB_INTERVAL_MS * 1000);
-    } 
-    return NULL; 
+
+    // 1. Format the Heartbeat message (HB), text or binary
+    int len;
+    if (g_hb_binary)
+        len = format_hb_bin_motion((uint8_t *)line, sizeof(line), g_truck_id, lat, lon, g_tcp_port,
+                                   time(NULL), ++seq, m);
+    else
+        len = format_hb_motion(line, sizeof(line), g_truck_id, lat, lon, g_tcp_port, time(NULL), m);
+
+    // 2. Send the message via UDP Multicast (mc_fd is set up in main), to
+    //    the group of the tile the truck is in when the map is sharded
+    if (g_mc_tile_km > 0) mc_addr.sin_addr = mcregion_group(g_mc_tile_km, lat, lon);
+    if (len > 0 && sendto(mc_fd, line, (size_t)len, 0, (struct sockaddr*)&mc_addr, sizeof(mc_addr)) == len) {
+        metrics_inc(MC_HB_SENT);
+    } else {
+        // Report the first failure; the metrics endpoint keeps the count
+        if (metrics_counter(MC_HB_SEND_ERRORS) == 0) perror("heartbeat sendto");
+        metrics_inc(MC_HB_SEND_ERRORS);
+    }
 }
 
+static void hb_tick(void *arg) {
+    (void)arg;
+    double lat, lon;
+    gps_position(g_gps, &lat, &lon);
+    hb_send(lat, lon, NULL);
+}
 
-// --- PING WORKER THREAD (Handles one TCP connection) ---
-static void* th_worker(void *arg) { 
-    // FIX: Safely retrieve socket FD and free the allocated memory
-    int *sock_ptr = (int *)arg;
-    int sock = *sock_ptr;
-    free(sock_ptr); 
+static double mono_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ts.tv_nsec / 1e9;
+}
 
-    char buf[MAX_LINE];
-    
-    // Attempt to read the PING message from the client with a 2-second timeout
-    ssize_t n = recv_line_timeout(sock, buf, sizeof(buf), 2000);
-
-    if (n > 0) { 
-        PingMsg p = {0}; 
-        if (parse_ping(buf, &p)) {
-            
-            // ATOMIC FIX: Safely calculate the ETA based on the current queue length
-            // 1. Increment queue length and read the *new* length (N+1) atomically
-            int current_queue = __sync_add_and_fetch(&g_queue_len, 1);
-            
-            // 2. Calculate ETA (5 mins base + position in queue)
-            // If current_queue is 1 (first person), eta = 5 + 0.
-            int eta = 5 + (current_queue - 1); 
-
-            // 3. Log the ping
-            logger_log_ping(time(NULL), &p, g_lat, g_lon);
-            
-            // 4. Send the ACK back to the client
-            char out[MAX_LINE]; 
-            format_ack(out, sizeof(out), g_truck_id, eta, current_queue);
-            send_all_timeout(sock, out, strlen(out), 2000);
-            
-            // 5. Decrement queue length atomically
-            __sync_sub_and_fetch(&g_queue_len, 1);
-        } else {
-            fprintf(stderr, "Worker: Failed to parse PING message: %s\n", buf);
-        }
-    } else if (n == 0) {
-        // fprintf(stderr, "Worker: Client disconnected before sending data.\n");
-    } else {
-        perror("Worker: recv_line_timeout error");
+/**
+ * @brief Adaptive heartbeats: receivers extrapolate from the last one sent,
+ * so a new one goes out only when that estimate is more than
+ * g_hb_threshold_m off or g_hb_keepalive_s has passed. A parked truck then
+ * sends once per keepalive and one on a straight road only when it turns or
+ * changes speed.
+ */
+static void hb_check(void *arg) {
+    (void)arg;
+    static int sent = 0;
+    static double s_lat, s_lon, s_vn, s_ve, s_at;
+
+    double lat, lon, now = mono_s();
+    gps_position(g_gps, &lat, &lon);
+    if (sent && now - s_at < g_hb_keepalive_s) {
+        double elat, elon;
+        geo_dead_reckon(s_lat, s_lon, s_vn, s_ve, now - s_at, &elat, &elon);
+        if (haversine_km(lat, lon, elat, elon) * 1000.0 <= g_hb_threshold_m) return;
     }
-    
-    close(sock); 
-    return NULL; 
+
+    HbMotion m = { .vn = g_vn, .ve = g_ve, .keepalive_s = g_hb_keepalive_s };
+    hb_send(lat, lon, &m);
+    sent = 1;
+    s_lat = lat; s_lon = lon; s_vn = g_vn; s_ve = g_ve; s_at = now;
+}
+
+// Seeds the heartbeat jitter so that trucks sharing --seed still drift apart
+static uint64_t hb_seed(void) {
+    uint64_t h = 1469598103934665603ull;
+    for (const char *p = g_truck_id; *p; ++p) h = (h ^ (unsigned char)*p) * 1099511628211ull;
+    return g_seed ^ h;
+}
+
+
+// --- PING HANDLER (Runs on a server worker for each request line) ---
+// A customer withdrawing an order, e.g. one that another truck will serve
+static int handle_cancel(const char *line, char *out, size_t out_n, int *keepalive) {
+    CancelMsg m;
+    int err = proto_parse_cancel(line, strlen(line), &m);
+    if (err != PROTO_OK) {
+        metrics_inc(MC_PARSE_ERRORS);
+        fprintf(stderr, "Worker: Failed to parse CANCEL message (%s): %s\n", proto_strerror(err), line);
+        return -1;
+    }
+    *keepalive = m.keepalive;
+    uint32_t job = orders_cancel(g_orders, m.job, m.user_id) == 0 ? m.job : 0;
+    return format_ack_job(out, out_n, g_truck_id, 0, (int)orders_count(g_orders), job);
+}
+
+static int handle_ping(void *ctx, const char *line, char *out, size_t out_n, int *keepalive) {
+    (void)ctx;
+    PingMsg p = {0};
+    uint64_t t0 = metrics_now_ns();
+    int err = proto_parse_ping(line, strlen(line), &p);
+    metrics_observe_ns(MH_PARSE, metrics_now_ns() - t0);
+    if (err == PROTO_ERR_TYPE && !strncmp(line, "CANCEL", 6)) return handle_cancel(line, out, out_n, keepalive);
+    if (err != PROTO_OK) {
+        metrics_inc(MC_PARSE_ERRORS);
+        fprintf(stderr, "Worker: Failed to parse PING message (%s): %s\n", proto_strerror(err), line);
+        return -1;
+    }
+    // Clients that send ka=1 reuse the connection for their next PINGs
+    *keepalive = p.keepalive;
+
+    // 1. Queue the order. Customers that send no location are taken to be
+    //    where the truck is now.
+    double lat, lon;
+    gps_position(g_gps, &lat, &lon);
+    double c_lat = p.has_loc ? p.lat : lat, c_lon = p.has_loc ? p.lon : lon;
+    OrderQuote q;
+    if (orders_place(g_orders, p.user_id, c_lat, c_lon, lat, lon, time(NULL), &q) < 0) {
+        fprintf(stderr, "Worker: out of memory queueing order for %s\n", p.user_id);
+        return -1;
+    }
+
+    // 2. Log the ping
+    t0 = metrics_now_ns();
+    logger_log_ping(time(NULL), &p, lat, lon);
+    metrics_observe_ns(MH_LOG, metrics_now_ns() - t0);
+    metrics_inc(MC_PINGS);
+
+    // 3. Format the ACK; the server sends it back to the client
+    return format_ack_job(out, out_n, g_truck_id, (int)ceil(q.eta_min), q.queued, q.job);
+}
+
+
+// --- METRICS ENDPOINT THREAD ---
+#define METRICS_BUF (16 * 1024)
+
+static void sample_gauges(void) {
+    metrics_gauge_set(MG_ORDERS_QUEUED, (int64_t)orders_count(g_orders));
+    metrics_gauge_set(MG_LOG_BACKLOG, (int64_t)logger_backlog());
+    metrics_gauge_set(MG_LOG_DROPPED, (int64_t)logger_dropped());
+}
+
+// Answers any HTTP request with the current metrics, then closes
+static void serve_metrics(int s, char *body) {
+    char req[1024];
+    struct pollfd pfd = { .fd = s, .events = POLLIN };
+    if (poll(&pfd, 1, 500) > 0) (void)recv(s, req, sizeof(req), 0);
+
+    sample_gauges();
+    size_t len = metrics_render(body, METRICS_BUF);
+    char hdr[160];
+    int h = snprintf(hdr, sizeof(hdr),
+                     "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                     "Content-Length: %zu\r\nConnection: close\r\n\r\n", len);
+    if (send_all_timeout(s, hdr, (size_t)h, 1000) == h) send_all_timeout(s, body, len, 1000);
+    close(s);
+}
+
+// Scheduled every second: PINGs handled during the last full second
+static void pps_tick(void *arg) {
+    static uint64_t last_pings = 0;
+    (void)arg;
+    uint64_t pings = metrics_counter(MC_PINGS);
+    metrics_gauge_set(MG_PINGS_PER_SEC, (int64_t)(pings - last_pings));
+    last_pings = pings;
+}
+
+static void* th_metrics(void* _) {
+    (void)_;
+    char *body = malloc(METRICS_BUF);
+    if (!body) return NULL;
+    while (running) {
+        struct pollfd pfd = { .fd = metrics_fd, .events = POLLIN };
+        if (poll(&pfd, 1, 500) <= 0) continue;
+        int s = accept(metrics_fd, NULL, NULL);
+        if (s >= 0) serve_metrics(s, body);
+    }
+    free(body);
+    return NULL;
 }
 
 
@@ -135,6 +303,53 @@ int main(int argc, char **argv) {
         else if (!strcmp(argv[i], "--tcp") && i + 1 < argc) g_tcp_port = atoi(argv[++i]);
         else if (!strcmp(argv[i], "--start-lat") && i + 1 < argc) g_lat = atof(argv[++i]);
         else if (!strcmp(argv[i], "--start-lon") && i + 1 < argc) g_lon = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--workers") && i + 1 < argc) g_workers = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--idle-ms") && i + 1 < argc) g_idle_ms = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--hb-format") && i + 1 < argc) {
+            const char *f = argv[++i];
+            if (!strcmp(f, "binary")) g_hb_binary = 1;
+            else if (!strcmp(f, "text")) g_hb_binary = 0;
+            else { fprintf(stderr, "unknown --hb-format '%s' (use text|binary)\n", f); return 1; }
+        }
+        else if (!strcmp(argv[i], "--server") && i + 1 < argc) {
+            if (server_backend_parse(argv[++i], &g_backend) < 0) {
+                fprintf(stderr, "unknown --server backend '%s' (use thread|epoll|uring)\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--log-mode") && i + 1 < argc) {
+            const char *m = argv[++i];
+            if (!strcmp(m, "async")) g_log_async = 1;
+            else if (!strcmp(m, "sync")) g_log_async = 0;
+            else { fprintf(stderr, "unknown --log-mode '%s' (use sync|async)\n", m); return 1; }
+        }
+        else if (!strcmp(argv[i], "--log-flush-ms") && i + 1 < argc) g_log_flush_ms = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--log-rotate-mb") && i + 1 < argc) g_log_journal.max_bytes = strtoul(argv[++i], NULL, 0) << 20;
+        else if (!strcmp(argv[i], "--log-rotate-sec") && i + 1 < argc) g_log_journal.max_secs = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--log-compress")) g_log_journal.compress = 1;
+        else if (!strcmp(argv[i], "--speed-kmh") && i + 1 < argc) g_speed_kmh = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--service-min") && i + 1 < argc) g_service_min = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--max-orders") && i + 1 < argc) g_max_orders = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--metrics-port") && i + 1 < argc) g_metrics_port = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--seed") && i + 1 < argc) g_seed = strtoull(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "--hb-jitter-ms") && i + 1 < argc) g_hb_jitter_ms = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--hb-mode") && i + 1 < argc) {
+            const char *m = argv[++i];
+            if (!strcmp(m, "adaptive")) g_hb_adaptive = 1;
+            else if (!strcmp(m, "fixed")) g_hb_adaptive = 0;
+            else { fprintf(stderr, "unknown --hb-mode '%s' (use fixed|adaptive)\n", m); return 1; }
+        }
+        else if (!strcmp(argv[i], "--hb-threshold-m") && i + 1 < argc) g_hb_threshold_m = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--hb-keepalive-s") && i + 1 < argc) g_hb_keepalive_s = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--mc-tile-km") && i + 1 < argc) g_mc_tile_km = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--gps-route") && i + 1 < argc) g_route_path = argv[++i];
+        else if (!strcmp(argv[i], "--gps-replay") && i + 1 < argc) g_replay_path = argv[++i];
+        else if (!strcmp(argv[i], "--log-durability") && i + 1 < argc) {
+            if (logger_durability_parse(argv[++i], &g_log_durability) < 0) {
+                fprintf(stderr, "unknown --log-durability '%s' (use interval|batch|fsync)\n", argv[i]);
+                return 1;
+            }
+        }
     }
     g_truck_id[MAX_ID_LEN - 1] = '\0'; // Ensure termination safety
 
@@ -143,7 +358,24 @@ int main(int argc, char **argv) {
     signal(SIGTERM, on_sig);
 
     // 3. Initialize GPS and Networking
-    gps_init(g_lat, g_lon, 4.0);
+    if (g_seed == 0) g_seed = (uint64_t)time(NULL);
+    g_gps = gps_create(g_lat, g_lon, 4.0, g_seed);
+    if (!g_gps) {
+        perror("gps_create");
+        return 1;
+    }
+    if (g_route_path || g_replay_path) {
+        const char *path = g_route_path ? g_route_path : g_replay_path;
+        GpsPoint *pts;
+        size_t n;
+        if (gps_load_points(path, &pts, &n) < 0) {
+            fprintf(stderr, "cannot read GPS points from %s (one \"lat,lon\" per line)\n", path);
+            return 1;
+        }
+        if (g_route_path) gps_set_route(g_gps, pts, n, g_speed_kmh);
+        else gps_set_replay(g_gps, pts, n);
+        free(pts);
+    }
     
     // Setup Multicast Sender for Heartbeats (HB)
     if (udp_mc_sender(MC_GROUP, MC_PORT, &mc_fd, &mc_addr) < 0) { 
@@ -151,68 +383,89 @@ int main(int argc, char **argv) {
         return 1; 
     }
     // Setup TCP Listener for Ping Requests (PING)
-    if (tcp_listen(g_tcp_port, 64, &listen_fd) < 0) { 
+    if (tcp_listen(g_tcp_port, 1024, &listen_fd) < 0) { 
         perror("tcp_listen failed"); 
         return 1; 
     }
     
     // 4. Setup Logging
     system("mkdir -p logs"); 
-    if (logger_open("logs/pings.csv") < 0) { 
-        perror("logger_open failed"); 
+    logger_set_journal(&g_log_journal);
+    int log_ok = g_log_async
+        ? logger_open_async("logs/pings", 0, g_log_flush_ms, g_log_durability)
+        : logger_open("logs/pings");
+    if (!log_ok) {
+        fprintf(stderr, "logger_open failed; pings will not be logged\n");
     }
 
-    // 5. Start Background Threads
-    pthread_t tg, th; 
-    pthread_create(&tg, NULL, th_gps, NULL); 
-    pthread_create(&th, NULL, th_hb, NULL);
-
-    fprintf(stderr, "🚚 Truck %s running: TCP port=%d, Multicast=%s:%d\n", 
-            g_truck_id, g_tcp_port, MC_GROUP, MC_PORT);
+    g_orders = orders_create(g_speed_kmh, g_service_min, g_max_orders > 0 ? (size_t)g_max_orders : 0);
+    if (!g_orders) {
+        perror("orders_create");
+        return 1;
+    }
 
-    // 6. Main TCP Listener Loop
-    while (running) {
-        struct sockaddr_in ca; 
-        socklen_t cl = sizeof(ca);
-        
-        // This call blocks until a client connects
-        int s = accept(listen_fd, (struct sockaddr*)&ca, &cl);
-        
-        if (s < 0) { 
-            // If accept fails (e.g., interrupted by signal), wait briefly and continue
-            if (running) { // Only print error if server is meant to be running
-                // perror("accept");
-                usleep(20 * 1000); 
-            }
-            continue; 
+    // 5. Start the periodic tasks, all on one scheduler thread. The first
+    //    heartbeat goes out at a random point in the interval so trucks
+    //    started together do not send in step. In adaptive mode the
+    //    heartbeat task only checks the position and sends when it must.
+    if (g_hb_keepalive_s < 1) g_hb_keepalive_s = 1;
+    g_sched = sched_create(hb_seed());
+    Prng phase;
+    prng_seed(&phase, hb_seed(), 1);
+    long hb_phase = (long)(prng_next(&phase) % HB_INTERVAL_MS);
+    if (!g_sched ||
+        sched_add(g_sched, "gps", 0, GPS_TICK_MS, 0, gps_tick, NULL) < 0 ||
+        (g_hb_adaptive
+         ? sched_add(g_sched, "hb", hb_phase, HB_CHECK_MS, 0, hb_check, NULL)
+         : sched_add(g_sched, "hb", hb_phase, HB_INTERVAL_MS,
+                     g_hb_jitter_ms > 0 ? g_hb_jitter_ms : 0, hb_tick, NULL)) < 0 ||
+        (g_metrics_port > 0 && sched_add(g_sched, "pps", 1000, 1000, 0, pps_tick, NULL) < 0) ||
+        sched_start(g_sched) < 0) {
+        perror("scheduler");
+        return 1;
+    }
+    if (g_metrics_port > 0) {
+        pthread_t tmx;
+        if (tcp_listen_local((uint16_t)g_metrics_port, 16, &metrics_fd) < 0 ||
+            pthread_create(&tmx, NULL, th_metrics, NULL) != 0) {
+            perror("metrics endpoint");
+            return 1;
         }
+        pthread_detach(tmx);
+        fprintf(stderr, "Metrics on http://127.0.0.1:%d/metrics\n", g_metrics_port);
+    }
 
-        // FIX: Allocate memory for the socket FD to pass to the new thread
-        int *sock_ptr = malloc(sizeof(int));
-        if (!sock_ptr) {
-            fprintf(stderr, "Failed to allocate memory for thread argument. Closing client socket.\n");
-            close(s);
-            continue;
-        }
-        *sock_ptr = s;
-        
-        // Create a new worker thread to handle the ping
-        pthread_t tw; 
-        pthread_create(&tw, NULL, th_worker, sock_ptr); 
-        pthread_detach(tw); // The thread cleans up its own resources when finished
+    fprintf(stderr, "🚚 Truck %s running: TCP port=%d (%s server), Multicast=%s:%d, GPS seed=%llu\n", 
+            g_truck_id, g_tcp_port, server_backend_name(g_backend), MC_GROUP, MC_PORT,
+            (unsigned long long)g_seed);
+    if (g_mc_tile_km > 0)
+        fprintf(stderr, "Heartbeats go to the group of the current %.1f km map tile on port %d\n",
+                g_mc_tile_km, MC_PORT);
+
+    // 6. Serve PING requests until a signal clears 'running'
+    Server *srv = server_create(g_backend, g_workers, handle_ping);
+    if (!srv || server_add_listener(srv, listen_fd, NULL) < 0) {
+        fprintf(stderr, "failed to start %s server\n", server_backend_name(g_backend));
+        return 1;
     }
+    server_set_idle_timeout(srv, g_idle_ms);
+    server_run(srv, &running);
+    server_destroy(srv);
 
 
     // 7. Cleanup and Exit
     fprintf(stderr, "Shutting down threads and resources...\n");
     
-    // Threads will exit gracefully because 'running' is false
+    // Stops and joins the scheduler thread; the metrics thread exits on its own
+    sched_report(g_sched, stderr);
+    sched_destroy(g_sched);
 
+    if (logger_dropped() > 0) {
+        fprintf(stderr, "log ring overflowed: %llu records dropped\n", (unsigned long long)logger_dropped());
+    }
     logger_close(); 
     close(listen_fd); 
     close(mc_fd);
-    
-    // Note: It's good practice to pthread_join tg and th here, but we rely on a quick exit for simplicity.
 
     return 0;
 }
@@ -0,0 +1,241 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "truckcache.h"
+
+#define CACHE_MAGIC 0x4a475443u   // "JGTC"
+#define CACHE_VERSION 1u
+#define CACHE_PROBE 16            // records searched per id
+#define CACHE_SPIN 1024           // seqlock retries before giving up on a record
+
+// What one record stores, packed into words for the seqlock copy
+typedef struct {
+    char id[MAX_ID_LEN];
+    double lat, lon;
+    int64_t last_seen;
+    int32_t tcp_port;
+    uint32_t ip;                  // network byte order
+} Payload;
+
+#define PAYLOAD_WORDS (sizeof(Payload) / sizeof(uint64_t))
+_Static_assert(sizeof(Payload) % sizeof(uint64_t) == 0, "payload must be whole words");
+
+typedef struct {
+    _Atomic uint32_t seq;         // odd while a writer is updating the record
+    uint32_t pad;
+    _Atomic uint64_t w[PAYLOAD_WORDS];
+} Record;
+
+typedef struct {
+    uint32_t magic, version;
+    uint64_t nrecords;            // power of two
+    uint64_t record_size;
+} Header;
+
+struct TruckCache {
+    int fd;
+    void *map;
+    size_t map_len;
+    Record *rec;
+    size_t mask;
+};
+
+// --- File ---
+
+static size_t file_size(size_t nrec) {
+    return sizeof(Header) + nrec * sizeof(Record);
+}
+
+static int header_ok(const Header *h, size_t nrec) {
+    return h->magic == CACHE_MAGIC && h->version == CACHE_VERSION &&
+           h->nrecords == nrec && h->record_size == sizeof(Record);
+}
+
+TruckCache *truckcache_open(const char *path, size_t nrecords) {
+    size_t nrec = 64;
+    while (nrec < nrecords) nrec <<= 1;
+    size_t len = file_size(nrec);
+
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) return NULL;
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return NULL;
+    }
+
+    // A new file, or one written with another layout, starts out empty
+    Header h = { 0 };
+    int fresh = (size_t)st.st_size != len ||
+                pread(fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h) || !header_ok(&h, nrec);
+    if (fresh && (ftruncate(fd, 0) < 0 || ftruncate(fd, (off_t)len) < 0)) {
+        close(fd);
+        return NULL;
+    }
+
+    void *map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    TruckCache *c = map != MAP_FAILED ? calloc(1, sizeof(*c)) : NULL;
+    if (!c) {
+        if (map != MAP_FAILED) munmap(map, len);
+        close(fd);
+        return NULL;
+    }
+    if (fresh) {
+        Header *hp = map;
+        hp->version = CACHE_VERSION;
+        hp->nrecords = nrec;
+        hp->record_size = sizeof(Record);
+        hp->magic = CACHE_MAGIC;
+    }
+    c->fd = fd;
+    c->map = map;
+    c->map_len = len;
+    c->rec = (Record *)((char *)map + sizeof(Header));
+    c->mask = nrec - 1;
+    return c;
+}
+
+void truckcache_close(TruckCache *c) {
+    if (!c) return;
+    munmap(c->map, c->map_len);
+    close(c->fd);
+    free(c);
+}
+
+void truckcache_default_path(char *out, size_t n) {
+    const char *home = getenv("HOME");
+    if (home && *home) snprintf(out, n, "%s/.jarat_trucks.cache", home);
+    else snprintf(out, n, "/tmp/jarat_trucks.%ld.cache", (long)getuid());
+}
+
+// --- Records (seqlock) ---
+
+// Stable copy of record r; -1 if a writer held it for too long
+static int rec_read(const Record *r, Payload *out) {
+    uint64_t w[PAYLOAD_WORDS];
+    for (int spin = 0; spin < CACHE_SPIN; ++spin) {
+        uint32_t s0 = atomic_load_explicit(&r->seq, memory_order_acquire);
+        if (s0 & 1) continue;
+        for (size_t i = 0; i < PAYLOAD_WORDS; ++i)
+            w[i] = atomic_load_explicit(&r->w[i], memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&r->seq, memory_order_relaxed) == s0) {
+            memcpy(out, w, sizeof(*out));
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static void rec_write(Record *r, const Payload *p) {
+    uint64_t w[PAYLOAD_WORDS];
+    memcpy(w, p, sizeof(w));
+
+    // Take the record by making seq odd. A writer that died mid-update would
+    // leave it odd forever, so after a while we take it over anyway.
+    uint32_t s = atomic_load_explicit(&r->seq, memory_order_relaxed);
+    for (int spin = 0; spin < CACHE_SPIN; ++spin) {
+        if (!(s & 1) && atomic_compare_exchange_weak_explicit(&r->seq, &s, s + 1,
+                                                              memory_order_relaxed,
+                                                              memory_order_relaxed))
+            break;
+        s = atomic_load_explicit(&r->seq, memory_order_relaxed);
+    }
+    if (!(s & 1)) s++;
+    else atomic_store_explicit(&r->seq, s, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    for (size_t i = 0; i < PAYLOAD_WORDS; ++i)
+        atomic_store_explicit(&r->w[i], w[i], memory_order_relaxed);
+    atomic_store_explicit(&r->seq, s + 1, memory_order_release);
+}
+
+static size_t id_hash(const char *id) {
+    uint64_t h = 1469598103934665603ull;   // FNV-1a
+    for (size_t i = 0; i < MAX_ID_LEN && id[i]; ++i) {
+        h ^= (unsigned char)id[i];
+        h *= 1099511628211ull;
+    }
+    return (size_t)h;
+}
+
+// --- Lookup / Update ---
+
+int truckcache_put(TruckCache *c, const TruckInfo *ti) {
+    if (!ti->id[0]) return -1;
+    Payload p;
+    memset(&p, 0, sizeof(p));
+    memcpy(p.id, ti->id, strnlen(ti->id, MAX_ID_LEN - 1));
+    p.lat = ti->lat;
+    p.lon = ti->lon;
+    p.last_seen = (int64_t)ti->last_seen;
+    p.tcp_port = ti->tcp_port;
+    p.ip = ti->last_ip.s_addr;
+
+    // The record with this id, else the first empty one, else the oldest
+    size_t h = id_hash(p.id);
+    Record *target = NULL, *oldest = NULL;
+    int64_t oldest_seen = INT64_MAX;
+    for (size_t k = 0; k < CACHE_PROBE; ++k) {
+        Record *r = &c->rec[(h + k) & c->mask];
+        Payload cur;
+        if (rec_read(r, &cur) < 0) continue;
+        if (!cur.id[0]) {
+            if (!target) target = r;
+            continue;
+        }
+        if (!strncmp(cur.id, p.id, MAX_ID_LEN)) {
+            target = r;
+            break;
+        }
+        if (cur.last_seen < oldest_seen) {
+            oldest_seen = cur.last_seen;
+            oldest = r;
+        }
+    }
+    if (!target) target = oldest;
+    if (!target) return -1;
+    rec_write(target, &p);
+    return 0;
+}
+
+static void to_info(const Payload *p, TruckInfo *out) {
+    memset(out, 0, sizeof(*out));
+    memcpy(out->id, p->id, MAX_ID_LEN);
+    out->id[MAX_ID_LEN - 1] = '\0';
+    out->lat = p->lat;
+    out->lon = p->lon;
+    out->last_seen = (time_t)p->last_seen;
+    out->tcp_port = p->tcp_port;
+    out->last_ip.s_addr = p->ip;
+}
+
+int truckcache_get(TruckCache *c, const char *id, TruckInfo *out) {
+    size_t h = id_hash(id);
+    for (size_t k = 0; k < CACHE_PROBE; ++k) {
+        Payload cur;
+        if (rec_read(&c->rec[(h + k) & c->mask], &cur) < 0) continue;
+        if (!cur.id[0] || strncmp(cur.id, id, MAX_ID_LEN)) continue;
+        to_info(&cur, out);
+        return 0;
+    }
+    return -1;
+}
+
+size_t truckcache_list(TruckCache *c, time_t min_seen, TruckInfo *out, size_t max) {
+    size_t k = 0;
+    for (size_t i = 0; i <= c->mask && k < max; ++i) {
+        Payload cur;
+        if (rec_read(&c->rec[i], &cur) < 0 || !cur.id[0] || cur.last_seen < (int64_t)min_seen) continue;
+        to_info(&cur, &out[k++]);
+    }
+    return k;
+}
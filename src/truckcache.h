@@ -0,0 +1,37 @@
+#pragma once
+#include <stddef.h>
+#include <time.h>
+#include "common.h"
+
+/*
+ * Last-known trucks, persisted in a small memory-mapped file.
+ *
+ * Every client that hears heartbeats (list mode, ping mode, gateway mode)
+ * writes what it learns here, so a later ping can connect straight away
+ * instead of first waiting for the truck's next heartbeat. The file holds a
+ * fixed number of records in an open-addressing table keyed by truck id; when
+ * the probe window is full the entry seen longest ago is replaced.
+ *
+ * Several processes may map the file at once. Each record is a seqlock:
+ * writers mark it odd while they update it and readers retry until they see
+ * a stable copy, so a reader never gets a torn entry. Writers are expected to
+ * be rare enough (one heartbeat listener per process) that two processes
+ * racing to add the same new id, leaving a duplicate, does not matter: both
+ * copies describe the same truck.
+ */
+
+typedef struct TruckCache TruckCache;
+
+// Opens or creates the cache file; a file with another layout is reset
+TruckCache *truckcache_open(const char *path, size_t nrecords);
+void truckcache_close(TruckCache *c);
+
+// Records ti (id, lat/lon, tcp_port, last_ip, last_seen)
+int truckcache_put(TruckCache *c, const TruckInfo *ti);
+// Fills *out with the cached truck; -1 if it is not cached
+int truckcache_get(TruckCache *c, const char *id, TruckInfo *out);
+// Copies up to max cached trucks seen at or after min_seen; returns how many
+size_t truckcache_list(TruckCache *c, time_t min_seen, TruckInfo *out, size_t max);
+
+// $HOME/.jarat_trucks.cache, or a per-user file in /tmp without HOME
+void truckcache_default_path(char *out, size_t n);
@@ -6,8 +6,9 @@
 #include <time.h>
 #include <unistd.h>
 #include <fcntl.h>
-#include <sys/select.h>
+#include <poll.h>
 #include <sys/socket.h>
+#include <sys/resource.h>
 #include <errno.h>
 #include <string.h>
 #include <stdlib.h>
@@ -77,13 +78,10 @@ ssize_t recv_line_timeout(int fd, char *buf, size_t n, int timeout_ms){
         remaining_ms = timeout_ms - (now_ms() - start_time);
         if (remaining_ms <= 0) break; // Timeout reached
 
-        fd_set rf; FD_ZERO(&rf); FD_SET(fd, &rf);
-        struct timeval tv = { 
-            .tv_sec = remaining_ms / 1000, 
-            .tv_usec = (remaining_ms % 1000) * 1000 
-        };
-        
-        int r = select(fd + 1, &rf, NULL, NULL, &tv);
+        // poll, not select: fds past FD_SETSIZE are normal on a busy server
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        int r = poll(&pfd, 1, (int)remaining_ms);
+        if (r < 0 && errno == EINTR) continue;
         if (r <= 0) return r == 0 ? 0 : -1; // 0 on timeout, -1 on error
 
         char c; 
@@ -117,14 +115,10 @@ ssize_t send_all_timeout(int fd, const char *buf, size_t n, int timeout_ms){
         remaining_ms = timeout_ms - (now_ms() - start_time);
         if (remaining_ms <= 0) break; // Total timeout reached
         
-        fd_set wf; FD_ZERO(&wf); FD_SET(fd, &wf);
-        struct timeval tv = { 
-            .tv_sec = remaining_ms / 1000, 
-            .tv_usec = (remaining_ms % 1000) * 1000 
-        };
-        
-        int r = select(fd + 1, NULL, &wf, NULL, &tv);
-        if (r <= 0) return -1; // 0 on select timeout (shouldn't happen with correct remaining_ms check), or -1 on error
+        struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+        int r = poll(&pfd, 1, (int)remaining_ms);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return -1; // 0 on poll timeout, or -1 on error
 
         ssize_t k = send(fd, buf + sent, n - sent, 0);
         
@@ -139,6 +133,97 @@ ssize_t send_all_timeout(int fd, const char *buf, size_t n, int timeout_ms){
     return (ssize_t)sent;
 }
 
+// --- Buffered Line Reader ---
+
+/**
+ * @brief Attaches a reader to fd using buf (cap bytes) as its buffer.
+ */
+void linereader_init(LineReader *r, int fd, char *buf, size_t cap){
+    r->fd = fd;
+    r->buf = buf;
+    r->cap = cap;
+    r->start = r->end = 0;
+    r->scanned = 0;
+    r->nsyscalls = 0;
+}
+
+/**
+ * @brief Returns the next '\n' terminated line, waiting at most timeout_ms
+ * in total for it.
+ *
+ * *line points into the reader's buffer and is NUL-terminated in place with
+ * the "\r\n"/"\n" removed; *len is its length. The pointer stays valid until
+ * the next call. A line longer than the buffer is returned in pieces of
+ * cap - 1 bytes, like recv_line_timeout().
+ * @return >0 bytes consumed (including the '\n'), 0 on timeout, -1 on error or EOF.
+ */
+ssize_t linereader_next(LineReader *r, const char **line, size_t *len, int timeout_ms){
+    long start_time = now_ms();
+
+    for (;;) {
+        // 1. Look for a newline in the bytes not scanned yet
+        char *base = r->buf + r->start;
+        size_t avail = r->end - r->start;
+        char *nl = memchr(base + r->scanned, '\n', avail - r->scanned);
+        size_t used = 0, n = 0;
+        if (nl) {
+            n = (size_t)(nl - base);
+            used = n + 1;
+        } else if (avail >= r->cap - 1) {
+            n = used = avail; // Buffer full without a newline: hand out what we have
+        }
+
+        if (used > 0) {
+            base[n] = '\0';
+            if (n > 0 && base[n - 1] == '\r') base[--n] = '\0';
+            r->start += used;
+            r->scanned = 0;
+            if (r->start == r->end) r->start = r->end = 0;
+            *line = base;
+            *len = n;
+            return (ssize_t)used;
+        }
+        r->scanned = avail;
+
+        // 2. Make room at the end of the buffer (one byte is kept for the NUL)
+        if (r->start > 0 && r->end + 1 >= r->cap) {
+            memmove(r->buf, base, avail);
+            r->start = 0;
+            r->end = avail;
+        }
+
+        // 3. Read whatever is already there; only wait when nothing is
+        ssize_t k = recv(r->fd, r->buf + r->end, r->cap - 1 - r->end, MSG_DONTWAIT);
+        r->nsyscalls++;
+        if (k > 0) { r->end += (size_t)k; continue; }
+        if (k == 0) return -1; // EOF
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) return -1;
+
+        long remaining_ms = timeout_ms - (now_ms() - start_time);
+        if (remaining_ms <= 0) return 0;
+
+        struct pollfd pfd = { .fd = r->fd, .events = POLLIN };
+        int pr = poll(&pfd, 1, (int)remaining_ms);
+        r->nsyscalls++;
+        if (pr == 0) return 0;
+        if (pr < 0 && errno != EINTR) return -1;
+    }
+}
+
+/**
+ * @brief Raises the soft RLIMIT_NOFILE to at least need descriptors (capped
+ * at the hard limit). Returns -1 if the limit stays below need.
+ */
+int raise_fd_limit(size_t need) {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) < 0) return -1;
+    if (rl.rlim_cur >= need) return 0;
+    rl.rlim_cur = need < rl.rlim_max ? need : rl.rlim_max;
+    if (setrlimit(RLIMIT_NOFILE, &rl) < 0) return -1;
+    return rl.rlim_cur >= need ? 0 : -1;
+}
+
 /*
 void gps_init(double lat, double lon, double max_dist_km);
 void gps_step(double *lat, double *lon);
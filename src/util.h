@@ -8,4 +8,23 @@ double haversine_km(double lat1, double lon1, double lat2, double lon2);
 long now_sec(void);
 int set_nonblocking(int fd);
 ssize_t recv_line_timeout(int fd, char *buf, size_t n, int timeout_ms);
-ssize_t send_all_timeout(int fd, const char *buf, size_t n, int timeout_ms);
\ No newline at end of file
+ssize_t send_all_timeout(int fd, const char *buf, size_t n, int timeout_ms);
+int raise_fd_limit(size_t need);
+
+
+/*
+ * Buffered line reader for one socket. Reads in large chunks and hands out
+ * complete lines in place; bytes past the returned line stay buffered for
+ * the next call.
+ */
+typedef struct {
+    int fd;
+    char *buf;
+    size_t cap;
+    size_t start, end;       // unread bytes are buf[start, end)
+    size_t scanned;          // buf[start, start + scanned) holds no '\n'
+    unsigned long nsyscalls; // recv/poll calls made so far
+} LineReader;
+
+void linereader_init(LineReader *r, int fd, char *buf, size_t cap);
+ssize_t linereader_next(LineReader *r, const char **line, size_t *len, int timeout_ms);
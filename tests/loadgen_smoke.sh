@@ -0,0 +1,27 @@
+#!/bin/sh
+# Usage: loadgen_smoke.sh TRUCK LOADGEN [BACKEND]
+# Starts a truck on a loopback port (with the given --server backend), runs a
+# short open-loop load against it and fails if loadgen reports errors or a
+# runaway p99.
+TRUCK=$1
+LOADGEN=$2
+BACKEND=${3:-epoll}
+PORT=${SMOKE_PORT:-16012}
+
+"$TRUCK" --id SMOKE --tcp "$PORT" --seed 1 --server "$BACKEND" >truck_smoke_$BACKEND.log 2>&1 &
+TRUCK_PID=$!
+trap 'kill $TRUCK_PID 2>/dev/null; wait $TRUCK_PID 2>/dev/null' EXIT
+
+# Wait for the listener (up to ~2 s)
+i=0
+until "$LOADGEN" --port "$PORT" --truck SMOKE --conns 1 --requests 1 >/dev/null 2>&1; do
+    i=$((i + 1))
+    if [ $i -ge 20 ] || ! kill -0 $TRUCK_PID 2>/dev/null; then
+        echo "truck did not come up on port $PORT"
+        cat truck_smoke_$BACKEND.log
+        exit 1
+    fi
+    sleep 0.1
+done
+
+"$LOADGEN" --port "$PORT" --truck SMOKE --conns 4 --rate 2000 --duration 2 --max-p99-ms 250
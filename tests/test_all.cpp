@@ -1,10 +1,43 @@
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <glob.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
 extern "C" {
 #include "common.h"
 #include "util.h"
 #include "gps.h"
 #include "protocol.h"
+#include "registry.h"
+#include "mcrecv.h"
+#include "geo.h"
+#include "logger.h"
+#include "orders.h"
+#include "prng.h"
+#include "histo.h"
+#include "metrics.h"
+#include "gateway.h"
+#include "truckcache.h"
+#include "net.h"
+#include "pingclient.h"
+#include "journal.h"
+#include "scheduler.h"
+#include "mcregion.h"
+#include "server.h"
 }
 
 TEST(DistanceTest, ZeroDistance) {
@@ -17,6 +50,35 @@ TEST(DistanceTest, PositiveDistance) {
     EXPECT_GT(d, 0.0);
 }
 
+TEST(LineReaderTest, SplitsChunksAndKeepsLeftovers) {
+    int sv[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+
+    char buf[64];
+    LineReader rd;
+    linereader_init(&rd, sv[1], buf, sizeof(buf));
+    const char *line;
+    size_t len;
+
+    // Two lines and the start of a third arrive in one chunk
+    ASSERT_EQ(write(sv[0], "ACK a\nACK b\r\nAC", 15), 15);
+    ASSERT_EQ(linereader_next(&rd, &line, &len, 100), 6);
+    EXPECT_STREQ(line, "ACK a");
+    ASSERT_GT(linereader_next(&rd, &line, &len, 100), 0);
+    EXPECT_STREQ(line, "ACK b");
+    EXPECT_EQ(len, 5u);
+
+    // Incomplete line: times out, then completes once the rest arrives
+    EXPECT_EQ(linereader_next(&rd, &line, &len, 20), 0);
+    ASSERT_EQ(write(sv[0], "K c\n", 4), 4);
+    ASSERT_GT(linereader_next(&rd, &line, &len, 100), 0);
+    EXPECT_STREQ(line, "ACK c");
+
+    close(sv[0]);
+    EXPECT_EQ(linereader_next(&rd, &line, &len, 100), -1);
+    close(sv[1]);
+}
+
 TEST(ProtocolTest, HeartbeatRoundTrip) {
     char buf[256];
     TruckInfo t;
@@ -51,6 +113,1297 @@ TEST(ProtocolTest, PingRoundTrip) {
     EXPECT_STREQ(p2.note, "2 cyl");
 }
 
+TEST(ProtocolTest, PingKeepAliveFlag) {
+    char buf[256];
+    PingMsg p{};
+    strcpy(p.truck_id, "TRK12");
+    strcpy(p.user_id, "USR1");
+    p.keepalive = 1;
+
+    ASSERT_GT(format_ping(buf, sizeof(buf), &p), 0);
+    PingMsg p2{};
+    ASSERT_TRUE(parse_ping(buf, &p2));
+    EXPECT_EQ(p2.keepalive, 1);
+
+    // Old clients never send ka=, which means one request per connection
+    ASSERT_TRUE(parse_ping("PING truck_id=TRK12 user_id=USR1 addr=\"\" note=\"\"\n", &p2));
+    EXPECT_EQ(p2.keepalive, 0);
+}
+
+TEST(ProtocolTest, PingLocationAndAckJob) {
+    char buf[256];
+    PingMsg p{};
+    strcpy(p.truck_id, "TRK12");
+    strcpy(p.user_id, "USR1");
+    p.has_loc = 1;
+    p.lat = 31.95612;
+    p.lon = -35.5;
+    ASSERT_GT(format_ping(buf, sizeof(buf), &p), 0);
+    PingMsg p2{};
+    ASSERT_EQ(proto_parse_ping(buf, strlen(buf), &p2), PROTO_OK) << buf;
+    EXPECT_EQ(p2.has_loc, 1);
+    EXPECT_NEAR(p2.lat, 31.95612, 1e-9);
+    EXPECT_NEAR(p2.lon, -35.5, 1e-9);
+
+    const char *half = "PING truck_id=T user_id=U lat=31.9\n";
+    EXPECT_EQ(proto_parse_ping(half, strlen(half), &p2), PROTO_ERR_MISSING);
+    const char *bad = "PING truck_id=T user_id=U lat=91 lon=0\n";
+    EXPECT_EQ(proto_parse_ping(bad, strlen(bad), &p2), PROTO_ERR_RANGE);
+
+    char id[MAX_ID_LEN];
+    int eta, q;
+    uint32_t job = 0;
+    int n = format_ack_job(buf, sizeof(buf), "TRK12", 7, 3, 4000000000u);
+    ASSERT_EQ(proto_parse_ack_job(buf, (size_t)n, id, &eta, &q, &job), PROTO_OK) << buf;
+    EXPECT_EQ(job, 4000000000u);
+    EXPECT_EQ(eta, 7);
+    // Old-style ACKs carry no job
+    n = format_ack(buf, sizeof(buf), "TRK12", 7, 3);
+    ASSERT_EQ(proto_parse_ack_job(buf, (size_t)n, id, &eta, &q, &job), PROTO_OK);
+    EXPECT_EQ(job, 0u);
+}
+
+TEST(ProtocolTest, ParseErrorCodes) {
+    TruckInfo t{};
+    time_t ts;
+    const char hb[] = "HB truck_id=T1 lat=31.5 lon=35.25 ts=7 tcp=6012";
+    EXPECT_EQ(proto_parse_hb(hb, sizeof(hb) - 1, &t, &ts), PROTO_OK);
+    EXPECT_DOUBLE_EQ(t.lat, 31.5);
+    EXPECT_EQ(ts, 7);
+
+    EXPECT_EQ(proto_parse_hb("PING truck_id=T1", 16, &t, &ts), PROTO_ERR_TYPE);
+    EXPECT_EQ(proto_parse_hb("HB truck_id=T1 lat=3x1 tcp=1", 28, &t, &ts), PROTO_ERR_NUMBER);
+    EXPECT_EQ(proto_parse_hb("HB truck_id=T1 tcp=70000", 24, &t, &ts), PROTO_ERR_RANGE);
+    EXPECT_EQ(proto_parse_hb("HB lat=1 tcp=1", 14, &t, &ts), PROTO_ERR_MISSING);
+
+    PingMsg p{};
+    EXPECT_EQ(proto_parse_ping("PING truck_id=T1 addr=\"open", 27, &p), PROTO_ERR_SYNTAX);
+}
+
+TEST(ProtocolTest, GatewayStreamRoundTrip) {
+    char buf[256];
+    TruckInfo t{};
+    strcpy(t.id, "TRK12");
+    t.lat = 31.956123;
+    t.lon = -35.5;
+    t.tcp_port = 6012;
+    inet_pton(AF_INET, "10.0.0.7", &t.last_ip);
+
+    GwMsg m{};
+    int n = format_gw_add(buf, sizeof(buf), &t);
+    ASSERT_EQ(proto_parse_gw(buf, (size_t)n, &m), PROTO_OK) << buf;
+    EXPECT_EQ(m.op, GW_ADD);
+    EXPECT_STREQ(m.t.id, "TRK12");
+    EXPECT_NEAR(m.t.lat, 31.956123, 1e-9);
+    EXPECT_EQ(m.t.tcp_port, 6012);
+    EXPECT_EQ(m.t.last_ip.s_addr, t.last_ip.s_addr);
+
+    n = format_gw_mov(buf, sizeof(buf), &t);
+    ASSERT_EQ(proto_parse_gw(buf, (size_t)n, &m), PROTO_OK) << buf;
+    EXPECT_EQ(m.op, GW_MOV);
+    EXPECT_NEAR(m.t.lon, -35.5, 1e-9);
+    n = format_gw_del(buf, sizeof(buf), "TRK12");
+    ASSERT_EQ(proto_parse_gw(buf, (size_t)n, &m), PROTO_OK) << buf;
+    EXPECT_EQ(m.op, GW_DEL);
+    n = format_gw_snap(buf, sizeof(buf), 1234);
+    ASSERT_EQ(proto_parse_gw(buf, (size_t)n, &m), PROTO_OK) << buf;
+    EXPECT_EQ(m.op, GW_SNAP);
+    EXPECT_EQ(m.count, 1234u);
+
+    EXPECT_EQ(proto_parse_gw("MOV truck_id=T lat=1", 20, &m), PROTO_ERR_MISSING);
+    EXPECT_EQ(proto_parse_gw("ADD truck_id=T lat=1 lon=2 tcp=1 ip=1.2.3", 41, &m), PROTO_ERR_SYNTAX);
+    EXPECT_EQ(proto_parse_gw("HB truck_id=T", 13, &m), PROTO_ERR_TYPE);
+}
+
+TEST(ProtocolTest, BinaryHeartbeatRoundTrip) {
+    uint8_t buf[HB_BIN_MAX_LEN];
+    int n = format_hb_bin(buf, sizeof(buf), "TRK12", 31.9561234, -35.945, 6012, 123, 42);
+    ASSERT_EQ(n, HB_BIN_HDR_LEN + 5);
+
+    TruckInfo t{};
+    time_t ts = 0;
+    ASSERT_EQ(proto_parse_hb_any(buf, (size_t)n, &t, &ts), PROTO_OK);
+    EXPECT_STREQ(t.id, "TRK12");
+    EXPECT_NEAR(t.lat, 31.9561234, 1e-7);
+    EXPECT_NEAR(t.lon, -35.945, 1e-7);
+    EXPECT_EQ(t.tcp_port, 6012);
+    EXPECT_EQ(t.seq, 42u);
+    EXPECT_EQ(ts, 123);
+
+    // Text heartbeats still go through the same entry point
+    char line[MAX_LINE];
+    n = format_hb(line, sizeof(line), "TRK13", 1.0, 2.0, 7000, 5);
+    ASSERT_EQ(proto_parse_hb_any(line, (size_t)n, &t, &ts), PROTO_OK);
+    EXPECT_STREQ(t.id, "TRK13");
+    EXPECT_EQ(t.seq, 0u);
+}
+
+TEST(ProtocolTest, BinaryHeartbeatVersions) {
+    uint8_t buf[64] = {0};
+    int n = format_hb_bin(buf, sizeof(buf), "TRK12", 31.0, 35.0, 6012, 1, 1);
+    TruckInfo t{};
+    time_t ts;
+
+    EXPECT_EQ(proto_parse_hb_bin(buf, (size_t)n - 1, &t, &ts), PROTO_ERR_SYNTAX);
+
+    // A future version with 4 extra header bytes: known fields still decode
+    uint8_t v2[64] = {0};
+    memcpy(v2, buf, HB_BIN_HDR_LEN);
+    v2[1] = 2;
+    v2[2] = HB_BIN_HDR_LEN + 4;
+    memcpy(v2 + HB_BIN_HDR_LEN + 4, "TRK12", 5);
+    ASSERT_EQ(proto_parse_hb_bin(v2, HB_BIN_HDR_LEN + 4 + 5, &t, &ts), PROTO_OK);
+    EXPECT_STREQ(t.id, "TRK12");
+    EXPECT_EQ(t.tcp_port, 6012);
+
+    buf[2] = 8; // header shorter than version 1 defines
+    EXPECT_EQ(proto_parse_hb_bin(buf, (size_t)n, &t, &ts), PROTO_ERR_VERSION);
+}
+
+TEST(ProtocolTest, AdaptiveHeartbeatCarriesMotion) {
+    HbMotion m = { 8.33, -2.5, 10 };
+    TruckInfo t{};
+    time_t ts = 0;
+
+    char line[MAX_LINE];
+    int n = format_hb_motion(line, sizeof(line), "TRK12", 31.0, 35.0, 6012, 7, &m);
+    ASSERT_EQ(proto_parse_hb_any(line, (size_t)n, &t, &ts), PROTO_OK);
+    EXPECT_NEAR(t.vn, 8.33, 1e-6);
+    EXPECT_NEAR(t.ve, -2.5, 1e-6);
+    EXPECT_EQ(t.keepalive_s, 10);
+
+    uint8_t buf[HB_BIN_MAX_LEN];
+    n = format_hb_bin_motion(buf, sizeof(buf), "TRK12", 31.0, 35.0, 6012, 7, 3, &m);
+    ASSERT_EQ(n, HB_BIN_HDR_LEN_MOTION + 5);
+    ASSERT_EQ(proto_parse_hb_any(buf, (size_t)n, &t, &ts), PROTO_OK);
+    EXPECT_STREQ(t.id, "TRK12");
+    EXPECT_EQ(t.seq, 3u);
+    EXPECT_NEAR(t.vn, 8.33, 0.005);
+    EXPECT_NEAR(t.ve, -2.5, 0.005);
+    EXPECT_EQ(t.keepalive_s, 10);
+
+    // Plain heartbeats reset the fields rather than leaving old values
+    n = format_hb_bin(buf, sizeof(buf), "TRK12", 31.0, 35.0, 6012, 8, 4);
+    ASSERT_EQ(proto_parse_hb_any(buf, (size_t)n, &t, &ts), PROTO_OK);
+    EXPECT_EQ(t.vn, 0.0f);
+    EXPECT_EQ(t.keepalive_s, 0);
+
+    // 10 s at the advertised velocity moves the estimate ~87 m
+    double lat, lon;
+    geo_dead_reckon(31.0, 35.0, m.vn, m.ve, 10.0, &lat, &lon);
+    EXPECT_NEAR(haversine_km(31.0, 35.0, lat, lon) * 1000.0, std::hypot(83.3, 25.0), 0.1);
+    EXPECT_GT(lat, 31.0);
+    EXPECT_LT(lon, 35.0);
+}
+
+TEST(ProtocolTest, BatchHeartbeatRoundTrip) {
+    HbBatch b;
+    hb_batch_reset(&b);
+    HbMotion m = { 1.5, 0, 10 };
+    int n = 0;
+    char id[MAX_ID_LEN];
+    for (;; ++n) {
+        snprintf(id, sizeof(id), "SIM%05d", n);
+        if (hb_batch_add(&b, id, 31.0 + n * 1e-4, 35.0, 7000 + n, 9, (uint32_t)n, n % 2 ? &m : NULL) < 0) break;
+    }
+    ASSERT_GE(n, 35);    // ~36-42 byte records in a 1472-byte datagram
+    ASSERT_LE(b.len, (size_t)HB_BATCH_MAX_LEN);
+    EXPECT_EQ(b.count, n);
+
+    std::vector<TruckInfo> out(HB_BATCH_MAX_RECORDS);
+    ASSERT_EQ(proto_parse_hb_datagram(b.buf, b.len, out.data(), out.size()), n);
+    for (int i = 0; i < n; ++i) {
+        snprintf(id, sizeof(id), "SIM%05d", i);
+        EXPECT_STREQ(out[i].id, id);
+        EXPECT_EQ(out[i].tcp_port, 7000 + i);
+        EXPECT_NEAR(out[i].lat, 31.0 + i * 1e-4, 1e-7);
+        EXPECT_EQ(out[i].keepalive_s, i % 2 ? 10 : 0);
+    }
+
+    // Truncated, trailing garbage, or more records than the caller has room for
+    EXPECT_EQ(proto_parse_hb_batch(b.buf, b.len - 1, out.data(), out.size()), PROTO_ERR_SYNTAX);
+    b.buf[b.len] = 0;
+    EXPECT_EQ(proto_parse_hb_batch(b.buf, b.len + 1, out.data(), out.size()), PROTO_ERR_SYNTAX);
+    EXPECT_EQ(proto_parse_hb_batch(b.buf, b.len, out.data(), 3), PROTO_ERR_RANGE);
+    TruckInfo t{};
+    time_t ts;
+    EXPECT_EQ(proto_parse_hb_any(b.buf, b.len, &t, &ts), PROTO_ERR_TYPE);
+
+    // Single heartbeats come through the same entry point as one record
+    char line[MAX_LINE];
+    int len = format_hb(line, sizeof(line), "TRK13", 1.0, 2.0, 7000, 5);
+    ASSERT_EQ(proto_parse_hb_datagram(line, (size_t)len, out.data(), 1), 1);
+    EXPECT_STREQ(out[0].id, "TRK13");
+}
+
+static std::string random_id(std::mt19937 &rng) {
+    static const char alnum[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789_-";
+    std::string id;
+    int len = 1 + (int)(rng() % (MAX_ID_LEN - 1));
+    for (int i = 0; i < len; ++i) id += alnum[rng() % (sizeof(alnum) - 1)];
+    return id;
+}
+
+TEST(ProtocolFuzz, RandomRoundTrips) {
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<double> ulat(-90.0, 90.0), ulon(-180.0, 180.0);
+    char buf[MAX_LINE];
+
+    for (int i = 0; i < 5000; ++i) {
+        std::string id = random_id(rng);
+        double lat = ulat(rng), lon = ulon(rng);
+        int port = 1 + (int)(rng() % 65535);
+        time_t when = (time_t)(rng() % 4000000000u);
+
+        int n = format_hb(buf, sizeof(buf), id.c_str(), lat, lon, port, when);
+        TruckInfo t{};
+        time_t ts = 0;
+        ASSERT_EQ(proto_parse_hb(buf, (size_t)n, &t, &ts), PROTO_OK) << buf;
+        EXPECT_EQ(id, t.id);
+        EXPECT_NEAR(t.lat, lat, 5e-7);
+        EXPECT_NEAR(t.lon, lon, 5e-7);
+        EXPECT_EQ(t.tcp_port, port);
+        EXPECT_EQ(ts, when);
+
+        int eta = (int)(rng() % 1000), q = (int)(rng() % 1000);
+        n = format_ack(buf, sizeof(buf), id.c_str(), eta, q);
+        char aid[MAX_ID_LEN];
+        int eta2, q2;
+        ASSERT_EQ(proto_parse_ack(buf, (size_t)n, aid, &eta2, &q2), PROTO_OK) << buf;
+        EXPECT_EQ(id, aid);
+        EXPECT_EQ(eta2, eta);
+        EXPECT_EQ(q2, q);
+    }
+}
+
+TEST(ProtocolFuzz, MutatedInputsNeverMisparse) {
+    std::mt19937 rng(99);
+    const std::string seeds[] = {
+        "HB truck_id=TRK01 lat=31.956000 lon=35.945000 ts=1700000000 tcp=6012\n",
+        "PING truck_id=TRK01 user_id=USR1 addr=\"12 St\" note=\"2 cyl\" ka=1\n",
+        "ACK truck_id=TRK01 eta_min=5 queued=1\n",
+    };
+    const char noise[] = " =\"\n\t.-+0123456789eHBPINGACKtruck_idlatontcp";
+
+    for (int i = 0; i < 20000; ++i) {
+        std::string m = seeds[rng() % 3];
+        int edits = 1 + (int)(rng() % 4);
+        for (int e = 0; e < edits && !m.empty(); ++e) {
+            size_t pos = rng() % m.size();
+            switch (rng() % 3) {
+            case 0: m[pos] = noise[rng() % (sizeof(noise) - 1)]; break;
+            case 1: m.erase(pos, 1); break;
+            default: m.insert(pos, 1, noise[rng() % (sizeof(noise) - 1)]); break;
+            }
+        }
+
+        // Parse from a heap copy without a terminator so overreads trip ASan
+        std::vector<char> raw(m.begin(), m.end());
+        TruckInfo t{};
+        time_t ts;
+        int r = proto_parse_hb(raw.data(), raw.size(), &t, &ts);
+        EXPECT_LE(r, PROTO_OK);
+        EXPECT_GE(r, PROTO_ERR_RANGE);
+        if (r == PROTO_OK) {
+            EXPECT_GT(t.tcp_port, 0);
+            EXPECT_LE(t.tcp_port, 65535);
+            EXPECT_NE(t.id[0], '\0');
+            EXPECT_LT(strlen(t.id), (size_t)MAX_ID_LEN);
+        }
+
+        PingMsg p{};
+        r = proto_parse_ping(raw.data(), raw.size(), &p);
+        EXPECT_GE(r, PROTO_ERR_RANGE);
+        if (r == PROTO_OK) {
+            EXPECT_NE(p.truck_id[0], '\0');
+            EXPECT_NE(p.user_id[0], '\0');
+        }
+
+        char id[MAX_ID_LEN];
+        int eta, q;
+        r = proto_parse_ack(raw.data(), raw.size(), id, &eta, &q);
+        EXPECT_GE(r, PROTO_ERR_RANGE);
+    }
+}
+
+TEST(RegistryTest, UpsertFindExpire) {
+    Registry *reg = registry_create(0);
+    ASSERT_NE(reg, nullptr);
+
+    // Enough trucks to force several index rebuilds and slab growth
+    const int n = 1000;
+    for (int i = 0; i < n; ++i) {
+        TruckInfo ti{};
+        snprintf(ti.id, sizeof(ti.id), "T%d", i);
+        ti.tcp_port = 6000 + i;
+        ti.last_seen = i < n / 2 ? 100 : 200;
+        ASSERT_GE(registry_upsert(reg, &ti), 0);
+    }
+    EXPECT_EQ(registry_count(reg), (size_t)n);
+
+    // Re-upserting keeps the slot and replaces the data
+    int slot = registry_find(reg, "T7");
+    ASSERT_GE(slot, 0);
+    TruckInfo upd{};
+    strcpy(upd.id, "T7");
+    upd.tcp_port = 1;
+    upd.last_seen = 200;
+    EXPECT_EQ(registry_upsert(reg, &upd), slot);
+    EXPECT_EQ(registry_get(reg, slot)->tcp_port, 1);
+    EXPECT_EQ(registry_count(reg), (size_t)n);
+
+    // Only the first half (minus the refreshed T7) is stale at t=205
+    EXPECT_EQ(registry_expire(reg, 205, 10), (size_t)(n / 2 - 1));
+    EXPECT_EQ(registry_count(reg), (size_t)(n / 2 + 1));
+    EXPECT_EQ(registry_find(reg, "T3"), -1);
+    EXPECT_EQ(registry_find(reg, "T7"), slot);
+    for (int i = n / 2; i < n; ++i) {
+        char id[MAX_ID_LEN];
+        snprintf(id, sizeof(id), "T%d", i);
+        int s = registry_find(reg, id);
+        ASSERT_GE(s, 0) << id;
+        EXPECT_EQ(registry_get(reg, s)->tcp_port, 6000 + i);
+    }
+
+    // Freed slots are reused
+    TruckInfo fresh{};
+    strcpy(fresh.id, "NEW");
+    fresh.last_seen = 300;
+    EXPECT_LT(registry_upsert(reg, &fresh), n);
+
+    EXPECT_EQ(registry_expire(reg, 1000, 10), (size_t)(n / 2 + 2));
+    EXPECT_EQ(registry_count(reg), 0u);
+    registry_destroy(reg);
+}
+
+// Expiry follows last_seen, not the order updates arrive in
+TEST(RegistryTest, ExpiryIgnoresUpdateOrder) {
+    Registry *reg = registry_create(0);
+    auto put = [&](const char *id, time_t seen) {
+        TruckInfo ti{};
+        snprintf(ti.id, sizeof(ti.id), "%s", id);
+        ti.last_seen = seen;
+        ASSERT_GE(registry_upsert(reg, &ti), 0);
+    };
+    std::vector<std::string> gone;
+    auto expire = [&](time_t now, int age) {
+        gone.clear();
+        return registry_expire_fn(reg, now, age, [](void *ctx, int, const TruckInfo *ti) {
+            static_cast<std::vector<std::string> *>(ctx)->push_back(ti->id);
+        }, &gone);
+    };
+
+    put("NEW", 1000);
+    put("OLD", 900);      // e.g. preloaded from the cache after NEW's heartbeat
+    put("AHEAD", 1600);   // more than a wheel lap ahead, shares a bucket
+    EXPECT_EQ(expire(1005, 10), 1u);
+    EXPECT_EQ(gone, std::vector<std::string>{"OLD"});
+
+    // A stale update behind the last cutoff is caught on the next call
+    put("LATE", 950);
+    EXPECT_EQ(expire(1006, 10), 1u);
+    EXPECT_EQ(gone, std::vector<std::string>{"LATE"});
+
+    // The drop age can change between calls
+    EXPECT_EQ(expire(1006, 60), 0u);
+    EXPECT_EQ(expire(1012, 3), 1u);
+    EXPECT_EQ(gone, std::vector<std::string>{"NEW"});
+
+    // A refresh moves the truck forward; a long pause sweeps every bucket
+    put("AHEAD", 5000);
+    EXPECT_EQ(expire(4000, 3), 0u);
+    EXPECT_EQ(expire(9000, 3), 1u);
+    EXPECT_EQ(registry_count(reg), 0u);
+    registry_destroy(reg);
+}
+
+// An adaptive truck is only stale max_age after its announced keepalive
+TEST(RegistryTest, KeepaliveDelaysExpiry) {
+    Registry *reg = registry_create(0);
+    TruckInfo ti{};
+    strcpy(ti.id, "FIXED");
+    ti.last_seen = 1000;
+    ASSERT_GE(registry_upsert(reg, &ti), 0);
+    strcpy(ti.id, "QUIET");
+    ti.keepalive_s = 30;
+    ASSERT_GE(registry_upsert(reg, &ti), 0);
+
+    EXPECT_EQ(registry_expire(reg, 1011, 10), 1u);
+    EXPECT_EQ(registry_find(reg, "FIXED"), -1);
+    EXPECT_EQ(registry_expire(reg, 1040, 10), 0u);
+    EXPECT_EQ(registry_expire(reg, 1041, 10), 1u);
+    EXPECT_EQ(registry_count(reg), 0u);
+    registry_destroy(reg);
+}
+
+TEST(RegistryTest, SpatialQueriesMatchBruteForce) {
+    Registry *reg = registry_create(0);
+    std::mt19937 rng(42);
+    // Dense city core plus a few trucks far away to exercise the fallbacks
+    std::uniform_real_distribution<double> dlat(31.90, 32.00), dlon(35.85, 35.95);
+    const int n = 2000;
+    for (int i = 0; i < n; ++i) {
+        TruckInfo ti{};
+        snprintf(ti.id, sizeof(ti.id), "T%d", i);
+        ti.lat = i % 100 == 0 ? 40.0 + i * 0.01 : dlat(rng);
+        ti.lon = i % 100 == 0 ? -70.0 : dlon(rng);
+        ASSERT_GE(registry_upsert(reg, &ti), 0);
+    }
+    // Move some trucks across cells
+    for (int i = 1; i < n; i += 7) {
+        TruckInfo ti{};
+        snprintf(ti.id, sizeof(ti.id), "T%d", i);
+        ti.lat = dlat(rng);
+        ti.lon = dlon(rng);
+        registry_upsert(reg, &ti);
+    }
+
+    const double qs[][2] = {{31.956, 35.945}, {31.90, 35.85}, {32.5, 36.5}, {45.0, -70.0}};
+    for (auto &q : qs) {
+        std::vector<double> all;
+        for (size_t s = 0; s < registry_slots(reg); ++s) {
+            const TruckInfo *t = registry_get(reg, (int)s);
+            if (t) all.push_back(haversine_km(q[0], q[1], t->lat, t->lon));
+        }
+        std::sort(all.begin(), all.end());
+
+        for (size_t k : {1u, 10u, 100u, (unsigned)n + 5}) {
+            std::vector<RegHit> hits(k);
+            size_t got = registry_nearest_k(reg, q[0], q[1], k, hits.data());
+            ASSERT_EQ(got, std::min(k, all.size()));
+            for (size_t i = 0; i < got; ++i) EXPECT_DOUBLE_EQ(hits[i].km, all[i]) << "k=" << k << " i=" << i;
+        }
+
+        for (double km : {0.5, 3.0, 50.0, 5000.0}) {
+            size_t want = (size_t)(std::upper_bound(all.begin(), all.end(), km) - all.begin());
+            std::vector<RegHit> hits(n);
+            ASSERT_EQ(registry_within_radius(reg, q[0], q[1], km, hits.data(), hits.size()), want) << km;
+            for (size_t i = 0; i < want; ++i) EXPECT_DOUBLE_EQ(hits[i].km, all[i]);
+        }
+    }
+    registry_destroy(reg);
+}
+
+TEST(RegistryTest, WithinRadiusKeepsNearestWhenTruncated) {
+    Registry *reg = registry_create(0);
+    // Far trucks sit in the cell south-west of the query, which is walked first
+    for (int i = 0; i < 20; ++i) {
+        TruckInfo ti{};
+        snprintf(ti.id, sizeof(ti.id), "FAR%d", i);
+        ti.lat = 31.989;
+        ti.lon = 35.989 + i * 0.00001;
+        ASSERT_GE(registry_upsert(reg, &ti), 0);
+    }
+    for (int i = 0; i < 3; ++i) {
+        TruckInfo ti{};
+        snprintf(ti.id, sizeof(ti.id), "NEAR%d", i);
+        ti.lat = 31.995;
+        ti.lon = 35.995 + i * 0.00001;
+        ASSERT_GE(registry_upsert(reg, &ti), 0);
+    }
+    // 1.5 km walks the grid cells, 30 km falls back to the plain scan
+    for (double km : {1.5, 30.0}) {
+        RegHit hits[3];
+        ASSERT_EQ(registry_within_radius(reg, 31.995, 35.995, km, hits, 3), 23u) << km;
+        for (int i = 0; i < 3; ++i) {
+            EXPECT_EQ(strncmp(registry_get(reg, hits[i].slot)->id, "NEAR", 4), 0) << km << " " << i;
+            if (i) { EXPECT_LE(hits[i - 1].km, hits[i].km); }
+        }
+        EXPECT_EQ(registry_within_radius(reg, 31.995, 35.995, km, hits, 0), 23u);
+    }
+    registry_destroy(reg);
+}
+
+namespace {
+
+// Everything the gateway has written to the subscriber end so far
+std::string drain(int fd) {
+    std::string out;
+    char buf[65536];
+    ssize_t k;
+    while ((k = recv(fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0) out.append(buf, (size_t)k);
+    return out;
+}
+
+TruckInfo gw_truck(const char *id, double lat, time_t seen) {
+    TruckInfo t{};
+    strcpy(t.id, id);
+    t.lat = lat;
+    t.lon = 35.9;
+    t.tcp_port = 6000;
+    t.last_seen = seen;
+    return t;
+}
+
+}  // namespace
+
+TEST(GatewayTest, SnapshotThenCoalescedDeltas) {
+    Gateway *g = gw_create(0, 0);
+    ASSERT_NE(g, nullptr);
+    TruckInfo a = gw_truck("A", 31.0, 100), b = gw_truck("B", 32.0, 100);
+    gw_heartbeat(g, &a);
+    gw_publish(g);
+
+    int sv[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+    ASSERT_EQ(gw_subscribe(g, sv[0]), 0);
+    std::string got = drain(sv[1]);
+    EXPECT_EQ(got.rfind("SNAP n=1\nADD truck_id=A lat=31.000000", 0), 0u) << got;
+
+    // Three reports from A between publishes make one MOV; a repeat makes none
+    for (double lat : {31.1, 31.2, 31.3}) {
+        a.lat = lat;
+        gw_heartbeat(g, &a);
+    }
+    gw_heartbeat(g, &b);
+    EXPECT_GT(gw_publish(g), 0u);
+    got = drain(sv[1]);
+    EXPECT_EQ(got, "MOV truck_id=A lat=31.300000 lon=35.900000\n"
+                   "ADD truck_id=B lat=32.000000 lon=35.900000 tcp=6000 ip=0.0.0.0\n");
+    gw_heartbeat(g, &b);
+    EXPECT_EQ(gw_publish(g), 0u);
+
+    // A stops reporting and expires
+    b.last_seen = 110;
+    gw_heartbeat(g, &b);
+    EXPECT_EQ(gw_expire(g, 110, 3), 1u);
+    gw_publish(g);
+    EXPECT_EQ(drain(sv[1]), "DEL truck_id=A\n");
+
+    GwStats st;
+    gw_stats(g, &st);
+    EXPECT_EQ(st.trucks, 1u);
+    EXPECT_EQ(st.subscribers, 1u);
+    EXPECT_EQ(st.resyncs, 0u);
+
+    close(sv[1]);
+    gw_service(g);
+    gw_stats(g, &st);
+    EXPECT_EQ(st.subscribers, 0u);
+    EXPECT_EQ(st.disconnects, 1u);
+    gw_destroy(g);
+}
+
+TEST(GatewayTest, SlowSubscriberIsResyncedWithoutStallingOthers) {
+    Gateway *g = gw_create(0, 4096);
+    int slow[2], fast[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, slow), 0);
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fast), 0);
+    int small = 4096;
+    setsockopt(slow[0], SOL_SOCKET, SO_SNDBUF, &small, sizeof(small));
+    ASSERT_EQ(gw_subscribe(g, slow[0]), 0);
+    ASSERT_EQ(gw_subscribe(g, fast[0]), 0);
+    drain(slow[1]);
+
+    // The slow viewer stops reading while the whole fleet moves many times
+    std::string fast_got = drain(fast[1]);
+    for (int round = 0; round < 50; ++round) {
+        for (int i = 0; i < 40; ++i) {
+            char id[MAX_ID_LEN];
+            snprintf(id, sizeof(id), "T%d", i);
+            TruckInfo t = gw_truck(id, 31.0 + round * 0.001, 100);
+            gw_heartbeat(g, &t);
+        }
+        gw_publish(g);
+        fast_got += drain(fast[1]);
+    }
+    GwStats st;
+    gw_stats(g, &st);
+    EXPECT_GE(st.resyncs, 1u);
+    // The fast viewer got every update: 40 ADDs then 49 rounds of 40 MOVs
+    EXPECT_EQ(std::count(fast_got.begin(), fast_got.end(), '\n'), 1 + 40 * 50);
+
+    // Once the slow viewer reads again, it catches up through a fresh SNAP
+    std::string slow_got;
+    for (int i = 0; i < 100; ++i) {
+        slow_got += drain(slow[1]);
+        gw_service(g);
+    }
+    size_t snap = slow_got.rfind("SNAP n=40\n");
+    ASSERT_NE(snap, std::string::npos);
+    EXPECT_NE(slow_got.find("ADD truck_id=T0 lat=31.049000", snap), std::string::npos);
+    EXPECT_EQ(slow_got.back(), '\n');
+
+    close(slow[1]);
+    close(fast[1]);
+    gw_destroy(g);
+}
+
+TEST(TruckCacheTest, PersistsAcrossOpensAndEvictsOldest) {
+    char path[] = "/tmp/jarat_cache_test_XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(write(fd, "junk", 4), 4);   // not a cache file: reset on open
+    close(fd);
+
+    TruckCache *c = truckcache_open(path, 64);
+    ASSERT_NE(c, nullptr);
+    TruckInfo t{}, out{};
+    strcpy(t.id, "TRK12");
+    t.lat = 31.95;
+    t.lon = 35.94;
+    t.tcp_port = 6012;
+    t.last_seen = 1000;
+    inet_pton(AF_INET, "10.1.2.3", &t.last_ip);
+    EXPECT_EQ(truckcache_get(c, "TRK12", &out), -1);
+    ASSERT_EQ(truckcache_put(c, &t), 0);
+    t.tcp_port = 6013;   // same id overwrites in place
+    ASSERT_EQ(truckcache_put(c, &t), 0);
+    truckcache_close(c);
+
+    c = truckcache_open(path, 64);
+    ASSERT_NE(c, nullptr);
+    ASSERT_EQ(truckcache_get(c, "TRK12", &out), 0);
+    EXPECT_EQ(out.tcp_port, 6013);
+    EXPECT_EQ(out.last_seen, 1000);
+    EXPECT_DOUBLE_EQ(out.lat, 31.95);
+    EXPECT_EQ(out.last_ip.s_addr, t.last_ip.s_addr);
+
+    // Far more trucks than records: the newest always fits, the total never
+    // exceeds the table size
+    for (int i = 0; i < 500; ++i) {
+        TruckInfo u{};
+        snprintf(u.id, sizeof(u.id), "T%d", i);
+        u.tcp_port = 7000 + i;
+        u.last_seen = 2000 + i;
+        ASSERT_EQ(truckcache_put(c, &u), 0);
+        ASSERT_EQ(truckcache_get(c, u.id, &out), 0) << u.id;
+        EXPECT_EQ(out.tcp_port, 7000 + i);
+    }
+    int found = 0;
+    for (int i = 0; i < 500; ++i) {
+        char id[MAX_ID_LEN];
+        snprintf(id, sizeof(id), "T%d", i);
+        found += truckcache_get(c, id, &out) == 0;
+    }
+    EXPECT_LE(found, 64);
+    EXPECT_GT(found, 32);
+    truckcache_close(c);
+
+    // Another table size is another layout: starts empty
+    c = truckcache_open(path, 128);
+    ASSERT_NE(c, nullptr);
+    EXPECT_EQ(truckcache_get(c, "T499", &out), -1);
+    truckcache_close(c);
+    unlink(path);
+}
+
+namespace {
+
+// A truck that serves one connection: ACKs PINGs with a fixed ETA after a
+// delay (job = 100 + eta) and counts CANCELs of that job
+struct FakeTruck {
+    int listen_fd = -1;
+    uint16_t port = 0;
+    int eta = 0, delay_ms = 0;
+    std::atomic<int> cancels{0};
+    std::thread th;
+
+    void start(int eta_min, int delay) {
+        eta = eta_min;
+        delay_ms = delay;
+        ASSERT_EQ(tcp_listen_local(0, 8, &listen_fd), 0);
+        sockaddr_in a{};
+        socklen_t len = sizeof(a);
+        getsockname(listen_fd, (sockaddr *)&a, &len);
+        port = ntohs(a.sin_port);
+        th = std::thread([this] { serve(); });
+    }
+
+    void serve() {
+        int fd = accept(listen_fd, nullptr, nullptr);
+        if (fd < 0) return;
+        char buf[1024], out[MAX_LINE];
+        LineReader rd;
+        linereader_init(&rd, fd, buf, sizeof(buf));
+        const char *line;
+        size_t len;
+        while (linereader_next(&rd, &line, &len, 2000) > 0) {
+            PingMsg p;
+            CancelMsg c;
+            int n = -1;
+            if (proto_parse_ping(line, len, &p) == PROTO_OK) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(delay_ms));
+                n = format_ack_job(out, sizeof(out), p.truck_id, eta, 1, 100 + (uint32_t)eta);
+            } else if (proto_parse_cancel(line, len, &c) == PROTO_OK) {
+                bool mine = c.job == 100 + (uint32_t)eta;
+                cancels += mine;
+                n = format_ack_job(out, sizeof(out), c.truck_id, 0, 0, mine ? c.job : 0);
+            }
+            if (n <= 0 || write(fd, out, (size_t)n) != n) break;
+        }
+        close(fd);
+    }
+
+    void stop() {
+        shutdown(listen_fd, SHUT_RDWR);
+        if (th.joinable()) th.join();
+        close(listen_fd);
+    }
+
+    TruckInfo info(const char *id) const {
+        TruckInfo t{};
+        strcpy(t.id, id);
+        t.tcp_port = port;
+        inet_pton(AF_INET, "127.0.0.1", &t.last_ip);
+        return t;
+    }
+};
+
+}  // namespace
+
+TEST(FanOutTest, KeepsLowestEtaAndCancelsTheRest) {
+    FakeTruck f9, f3, f6, slow1;
+    f9.start(9, 0);
+    f3.start(3, 0);
+    f6.start(6, 0);
+    slow1.start(1, 400);
+    TruckInfo trucks[5] = { f9.info("A"), f3.info("B"), f6.info("C"), slow1.info("D"), f9.info("DEAD") };
+    trucks[4].tcp_port = 1;   // nothing listens there
+
+    PingMsg tmpl{};
+    strcpy(tmpl.user_id, "USR1");
+    FanOut *fo = fanout_start(trucks, 5, &tmpl);
+    ASSERT_NE(fo, nullptr);
+
+    // The slow truck misses the deadline; the best of the rest wins
+    auto t0 = std::chrono::steady_clock::now();
+    int best = fanout_run(fo, -1, 200);
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count();
+    ASSERT_EQ(best, 1);
+    EXPECT_EQ(fanout_result(fo, 1)->eta_min, 3);
+    EXPECT_EQ(fanout_result(fo, 1)->job, 103u);
+    EXPECT_FALSE(fanout_result(fo, 3)->ok);
+    EXPECT_FALSE(fanout_result(fo, 4)->ok);
+    EXPECT_LT(ms, 400);
+
+    // Losers are cancelled, including the slow one once its ACK arrives
+    EXPECT_EQ(fanout_cancel_rest(fo, best, 2000), 3);
+    fanout_destroy(fo);
+    for (FakeTruck *f : { &f9, &f3, &f6, &slow1 }) f->stop();
+    EXPECT_EQ(f9.cancels, 1);
+    EXPECT_EQ(f3.cancels, 0);
+    EXPECT_EQ(f6.cancels, 1);
+    EXPECT_EQ(slow1.cancels, 1);
+}
+
+TEST(FanOutTest, StopsAtFirstAcceptableEta) {
+    FakeTruck fast, slow;
+    fast.start(4, 0);
+    slow.start(1, 1000);
+    TruckInfo trucks[2] = { slow.info("S"), fast.info("F") };
+    PingMsg tmpl{};
+    strcpy(tmpl.user_id, "USR1");
+    FanOut *fo = fanout_start(trucks, 2, &tmpl);
+
+    auto t0 = std::chrono::steady_clock::now();
+    EXPECT_EQ(fanout_run(fo, 5, 3000), 1);
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count();
+    EXPECT_LT(ms, 800);
+    fanout_destroy(fo);
+    fast.stop();
+    slow.stop();
+}
+
+TEST(GeoTest, BatchHaversineMatchesScalar) {
+    std::mt19937 rng(3);
+    std::uniform_real_distribution<double> ulat(-89.9, 89.9), ulon(-180.0, 180.0), small(-0.05, 0.05);
+    const size_t n = 4099;  // not a multiple of the vector width
+    std::vector<double> lat(n), lon(n), fast(n), ref(n);
+
+    for (int round = 0; round < 20; ++round) {
+        double olat = ulat(rng), olon = ulon(rng);
+        for (size_t i = 0; i < n; ++i) {
+            // Half the points near the origin, half anywhere (incl. antipodes)
+            lat[i] = i % 2 ? std::max(-90.0, std::min(90.0, olat + small(rng))) : ulat(rng);
+            lon[i] = i % 2 ? olon + small(rng) : ulon(rng);
+        }
+        GeoOrigin o;
+        geo_origin_init(&o, olat, olon);
+        geo_haversine_batch(&o, lat.data(), lon.data(), n, fast.data());
+        geo_haversine_batch_scalar(&o, lat.data(), lon.data(), n, ref.data());
+        for (size_t i = 0; i < n; ++i) {
+            double want = haversine_km(olat, olon, lat[i], lon[i]);
+            ASSERT_NEAR(ref[i], want, 1e-9 + 1e-12 * want) << geo_kernel_name() << " i=" << i;
+            ASSERT_NEAR(fast[i], want, 1e-9 + 1e-12 * want) << geo_kernel_name() << " i=" << i;
+        }
+    }
+}
+
+TEST(GeoTest, EquirectErrorBoundAndRadius) {
+    std::mt19937 rng(5);
+    std::uniform_real_distribution<double> ulat(-70.0, 70.0), ulon(-180.0, 180.0), off(-4.5, 4.5);
+    for (int i = 0; i < 100000; ++i) {
+        double olat = ulat(rng), olon = ulon(rng);
+        double lat = olat + off(rng), lon = olon + off(rng) / std::cos(olat * M_PI / 180.0);
+        double exact = haversine_km(olat, olon, lat, lon);
+        if (exact > GEO_EQUIRECT_MAX_KM || exact < 1e-6) continue;
+        GeoOrigin o;
+        geo_origin_init(&o, olat, olon);
+        ASSERT_LE(std::fabs(geo_equirect_km(&o, lat, lon) - exact), GEO_EQUIRECT_ERR * exact);
+    }
+
+    // Radius query with the prefilter agrees with brute force, across the dateline too
+    const size_t n = 5000;
+    std::vector<double> lat(n), lon(n);
+    std::uniform_real_distribution<double> near(-1.0, 1.0);
+    for (size_t i = 0; i < n; ++i) {
+        lat[i] = 60.0 + near(rng);
+        lon[i] = 179.5 + 2 * near(rng);
+        if (lon[i] > 180.0) lon[i] -= 360.0;
+    }
+    GeoOrigin o;
+    geo_origin_init(&o, 60.0, 179.9);
+    for (double km : {5.0, 50.0, 120.0}) {
+        std::vector<uint32_t> idx(n);
+        std::vector<double> dist(n);
+        size_t got = geo_within_radius(&o, lat.data(), lon.data(), n, km, idx.data(), dist.data());
+        size_t want = 0;
+        for (size_t i = 0; i < n; ++i) {
+            if (haversine_km(60.0, 179.9, lat[i], lon[i]) <= km) {
+                ASSERT_LT(want, got);
+                EXPECT_EQ(idx[want], i);
+                want++;
+            }
+        }
+        EXPECT_EQ(got, want) << km;
+    }
+}
+
+// Journal segments written under prefix, oldest first
+static std::vector<std::string> journal_segments(const std::string &prefix) {
+    std::vector<std::string> out;
+    glob_t g;
+    if (glob((prefix + "-*.jrnl").c_str(), 0, nullptr, &g) == 0) {
+        for (size_t i = 0; i < g.gl_pathc; ++i) out.push_back(g.gl_pathv[i]);
+    }
+    globfree(&g);
+    return out;
+}
+
+// Every record of one segment in file order; blocks, if given, gets the headers
+static std::vector<JournalRec> read_segment(const std::string &path, int use_mmap,
+                                            std::vector<JournalBlock> *blocks = nullptr) {
+    std::vector<JournalRec> out;
+    JournalReader *r = journal_reader_open(path.c_str(), use_mmap);
+    EXPECT_NE(r, nullptr) << path;
+    if (!r) return out;
+    JournalBlock b;
+    int rc;
+    while ((rc = journal_next_block(r, &b)) > 0) {
+        std::vector<JournalRec> rows(b.nrec);
+        EXPECT_EQ(journal_read_block(r, rows.data()), 0) << path << " @" << b.offset;
+        out.insert(out.end(), rows.begin(), rows.end());
+        if (blocks) blocks->push_back(b);
+    }
+    EXPECT_EQ(rc, 0) << path;
+    journal_reader_close(r);
+    return out;
+}
+
+static void remove_journal(const std::string &dir, const std::string &prefix) {
+    for (auto &seg : journal_segments(prefix)) unlink(seg.c_str());
+    rmdir(dir.c_str());
+}
+
+TEST(LoggerTest, AsyncWritesOrDropsEveryRecord) {
+    char dir[] = "/tmp/jarat_log_XXXXXX";
+    ASSERT_NE(mkdtemp(dir), nullptr);
+    std::string prefix = std::string(dir) + "/pings";
+
+    // Small ring and several producers so some records may overflow
+    ASSERT_EQ(logger_open_async(prefix.c_str(), 64, 10, LOG_FLUSH_BATCH), 1);
+    const int nthreads = 4, per_thread = 2000;
+    std::vector<std::thread> producers;
+    for (int t = 0; t < nthreads; ++t) {
+        producers.emplace_back([t] {
+            PingMsg p{};
+            snprintf(p.truck_id, sizeof(p.truck_id), "TRK%d", t);
+            strcpy(p.user_id, "U");
+            for (int i = 0; i < per_thread; ++i) {
+                snprintf(p.note, sizeof(p.note), "%d", i);
+                logger_log_ping(1700000000, &p, 31.9, 35.9);
+            }
+        });
+    }
+    for (auto &th : producers) th.join();
+    uint64_t dropped = logger_dropped();
+    logger_close();
+
+    // Every record is either in the journal, whole and in per-producer order, or counted
+    size_t records = 0;
+    std::vector<int> last(nthreads, -1);
+    for (auto &seg : journal_segments(prefix)) {
+        for (auto &r : read_segment(seg, 0)) {
+            int t;
+            ASSERT_EQ(r.type, JREC_PING);
+            ASSERT_EQ(sscanf(r.truck_id, "TRK%d", &t), 1) << r.truck_id;
+            ASSERT_LT(t, nthreads);
+            EXPECT_STREQ(r.user_id, "U");
+            EXPECT_EQ(r.ts, 1700000000);
+            int i = atoi(r.note);
+            EXPECT_GT(i, last[t]);
+            last[t] = i;
+            records++;
+        }
+    }
+    EXPECT_EQ(records + dropped, (size_t)(nthreads * per_thread));
+    remove_journal(dir, prefix);
+}
+
+static JournalRec make_event(std::mt19937 &rng, int i) {
+    JournalRec r{};
+    r.type = (uint8_t)(rng() % JREC_TYPES);
+    r.ts = 1700000000 + i / 50;
+    snprintf(r.truck_id, sizeof(r.truck_id), "TRK%02u", (unsigned)(rng() % 20));
+    switch (r.type) {
+    case JREC_PING:
+        r.lat = 31.9 + (double)(rng() % 1000) * 1e-4;
+        r.lon = 35.9 + (double)(rng() % 1000) * 1e-4;
+        snprintf(r.user_id, sizeof(r.user_id), "U%u", (unsigned)(rng() % 100));
+        snprintf(r.note, sizeof(r.note), "call, \"gate\" %d", i);
+        break;
+    case JREC_HB:
+        r.lat = 31.9 + (double)(rng() % 1000) * 1e-4;
+        r.lon = 35.9;
+        r.ip = htonl(0x7f000001);
+        break;
+    default:
+        r.eta_min = (int32_t)(rng() % 60);
+        r.queued = (int32_t)(rng() % 10);
+        break;
+    }
+    return r;
+}
+
+static bool same_event(const JournalRec &a, const JournalRec &b) {
+    return a.type == b.type && a.ts == b.ts && a.lat == b.lat && a.lon == b.lon && a.ip == b.ip &&
+           a.eta_min == b.eta_min && a.queued == b.queued && !strcmp(a.truck_id, b.truck_id) &&
+           !strcmp(a.user_id, b.user_id) && !strcmp(a.note, b.note);
+}
+
+TEST(JournalTest, RoundTripsAcrossRotationAndCompression) {
+    char dir[] = "/tmp/jarat_jrnl_XXXXXX";
+    ASSERT_NE(mkdtemp(dir), nullptr);
+    std::string prefix = std::string(dir) + "/ev";
+
+    JournalOpts o{};
+    o.max_bytes = 16384;
+    o.compress = 1;
+    o.block_records = 64;
+    Journal *j = journal_open(prefix.c_str(), &o);
+    ASSERT_NE(j, nullptr);
+    std::mt19937 rng(20);
+    std::vector<JournalRec> want[JREC_TYPES];
+    for (int i = 0; i < 3000; ++i) {
+        JournalRec r = make_event(rng, i);
+        ASSERT_EQ(journal_append(j, &r), 0);
+        want[r.type].push_back(r);
+    }
+    journal_close(j);
+
+    std::vector<std::string> segs = journal_segments(prefix);
+    EXPECT_GT(segs.size(), 1u);
+    for (int use_mmap = 0; use_mmap < 2; ++use_mmap) {
+        std::vector<JournalRec> got[JREC_TYPES];
+        size_t compressed = 0;
+        for (auto &seg : segs) {
+            std::vector<JournalBlock> blocks;
+            std::vector<JournalRec> rows = read_segment(seg, use_mmap, &blocks);
+            std::ifstream f(seg, std::ios::binary | std::ios::ate);
+            EXPECT_LE((size_t)f.tellg(), o.max_bytes) << seg;
+
+            // Block headers bound the records they hold
+            size_t k = 0;
+            for (auto &b : blocks) {
+                compressed += b.compressed;
+                if (b.compressed) {
+                    EXPECT_LT(b.stored_len, b.raw_len);
+                }
+                for (uint32_t i = 0; i < b.nrec; ++i, ++k) {
+                    EXPECT_EQ(rows[k].type, b.type);
+                    EXPECT_GE(rows[k].ts, b.ts_min);
+                    EXPECT_LE(rows[k].ts, b.ts_max);
+                }
+            }
+            for (auto &r : rows) got[r.type].push_back(r);
+        }
+        EXPECT_GT(compressed, 0u);
+        for (int t = 0; t < JREC_TYPES; ++t) {
+            ASSERT_EQ(got[t].size(), want[t].size()) << t;
+            for (size_t i = 0; i < got[t].size(); ++i) {
+                ASSERT_TRUE(same_event(got[t][i], want[t][i])) << "type " << t << " record " << i;
+            }
+        }
+    }
+    remove_journal(dir, prefix);
+}
+
+TEST(JournalTest, ReaderStopsAtTornOrCorruptBlock) {
+    char dir[] = "/tmp/jarat_jrnl_XXXXXX";
+    ASSERT_NE(mkdtemp(dir), nullptr);
+    std::string prefix = std::string(dir) + "/ev";
+
+    JournalOpts o{};
+    o.block_records = 4;
+    Journal *j = journal_open(prefix.c_str(), &o);
+    ASSERT_NE(j, nullptr);
+    std::string path = journal_path(j);
+    for (int i = 0; i < 8; ++i) {
+        JournalRec r{};
+        r.type = JREC_HB;
+        r.ts = 1700000000 + i;
+        strcpy(r.truck_id, "T1");
+        ASSERT_EQ(journal_append(j, &r), 0);
+    }
+    journal_close(j);
+
+    // A crash in the middle of the second block's write
+    struct stat st;
+    ASSERT_EQ(stat(path.c_str(), &st), 0);
+    ASSERT_EQ(truncate(path.c_str(), st.st_size - 10), 0);
+    JournalReader *r = journal_reader_open(path.c_str(), 1);
+    ASSERT_NE(r, nullptr);
+    JournalBlock b;
+    JournalRec rows[4];
+    ASSERT_EQ(journal_next_block(r, &b), 1);
+    EXPECT_EQ(b.ts_min, 1700000000);
+    EXPECT_EQ(b.ts_max, 1700000003);
+    EXPECT_EQ(journal_read_block(r, rows), 0);
+    EXPECT_EQ(journal_next_block(r, &b), -1);
+    journal_reader_close(r);
+
+    // A flipped bit in the first block's columns fails its checksum
+    int fd = open(path.c_str(), O_RDWR);
+    ASSERT_GE(fd, 0);
+    char c;
+    off_t at = 16 + 40 + 3;   // file header, block header, into the ts column
+    ASSERT_EQ(pread(fd, &c, 1, at), 1);
+    c ^= 1;
+    ASSERT_EQ(pwrite(fd, &c, 1, at), 1);
+    close(fd);
+    r = journal_reader_open(path.c_str(), 0);
+    ASSERT_NE(r, nullptr);
+    ASSERT_EQ(journal_next_block(r, &b), 1);
+    EXPECT_EQ(journal_read_block(r, rows), -1);
+    journal_reader_close(r);
+    remove_journal(dir, prefix);
+}
+
+TEST(OrdersTest, EtaFollowsRouteAfterInsertsAndRemovals) {
+    const double speed = 30.0, service = 5.0;
+    OrderQueue *q = orders_create(speed, service, 0);
+    ASSERT_NE(q, nullptr);
+    std::mt19937 rng(9);
+    std::uniform_real_distribution<double> dlat(31.90, 32.00), dlon(35.85, 35.95);
+    const double tlat = 31.95, tlon = 35.90;
+
+    struct Stop { uint32_t job; double lat, lon; };
+    std::vector<Stop> route;  // reference model
+    int next_user = 0;
+
+    for (int step = 0; step < 600; ++step) {
+        if (route.empty() || rng() % 3 != 0) {
+            char user[MAX_ID_LEN];
+            snprintf(user, sizeof(user), "U%d", next_user++);
+            double lat = dlat(rng), lon = dlon(rng);
+            OrderQuote oq;
+            ASSERT_EQ(orders_place(q, user, lat, lon, tlat, tlon, 0, &oq), 0);
+            ASSERT_NE(oq.job, 0u);
+            EXPECT_EQ(oq.position, (int)route.size() + 1);
+            route.push_back({oq.job, lat, lon});
+
+            // Asking again returns the same pending order
+            OrderQuote again;
+            orders_place(q, user, 0, 0, tlat, tlon, 0, &again);
+            EXPECT_EQ(again.job, oq.job);
+            EXPECT_EQ(again.existing, 1);
+        } else {
+            size_t victim = rng() % route.size();
+            ASSERT_EQ(orders_complete(q, route[victim].job), 0);
+            EXPECT_EQ(orders_complete(q, route[victim].job), -1);
+            route.erase(route.begin() + (long)victim);
+        }
+
+        // Spot-check a few quotes against a walk along the reference route
+        ASSERT_EQ(orders_count(q), route.size());
+        for (size_t k = 0; k < route.size(); k += 1 + route.size() / 5) {
+            double km = haversine_km(tlat, tlon, route[0].lat, route[0].lon);
+            for (size_t i = 1; i <= k; ++i)
+                km += haversine_km(route[i - 1].lat, route[i - 1].lon, route[i].lat, route[i].lon);
+            OrderQuote oq;
+            ASSERT_EQ(orders_quote(q, route[k].job, tlat, tlon, &oq), 0);
+            EXPECT_EQ(oq.position, (int)k + 1);
+            EXPECT_NEAR(oq.eta_min, km / speed * 60.0 + service * (double)k, 1e-6);
+        }
+        if (!route.empty()) {
+            Order head;
+            ASSERT_EQ(orders_head(q, &head), 0);
+            EXPECT_EQ(head.job, route[0].job);
+        }
+    }
+    orders_destroy(q);
+}
+
+TEST(OrdersTest, FullQueueQuotesWithoutQueueing) {
+    OrderQueue *q = orders_create(30.0, 5.0, 2);
+    OrderQuote oq;
+    orders_place(q, "A", 31.9, 35.9, 31.9, 35.9, 0, &oq);
+    orders_place(q, "B", 31.9, 35.9, 31.9, 35.9, 0, &oq);
+    orders_place(q, "C", 31.9, 35.9, 31.9, 35.9, 0, &oq);
+    EXPECT_EQ(oq.job, 0u);
+    EXPECT_EQ(oq.position, 3);
+    EXPECT_NEAR(oq.eta_min, 10.0, 1e-9);
+    EXPECT_EQ(orders_count(q), 2u);
+    orders_destroy(q);
+}
+
+TEST(OrdersTest, CancelOnlyByTheCustomer) {
+    OrderQueue *q = orders_create(30.0, 5.0, 0);
+    OrderQuote oq;
+    orders_place(q, "A", 31.9, 35.9, 31.9, 35.9, 0, &oq);
+    uint32_t job = oq.job;
+    EXPECT_EQ(orders_cancel(q, job, "B"), -1);
+    EXPECT_EQ(orders_count(q), 1u);
+
+    char buf[MAX_LINE];
+    CancelMsg m{}, back{};
+    strcpy(m.truck_id, "T1");
+    strcpy(m.user_id, "A");
+    m.job = job;
+    int n = format_cancel(buf, sizeof(buf), &m);
+    ASSERT_EQ(proto_parse_cancel(buf, (size_t)n, &back), PROTO_OK) << buf;
+    EXPECT_EQ(orders_cancel(q, back.job, back.user_id), 0);
+    EXPECT_EQ(orders_count(q), 0u);
+    EXPECT_EQ(orders_cancel(q, job, "A"), -1);
+    EXPECT_EQ(proto_parse_cancel("CANCEL truck_id=T1 user_id=A", 28, &back), PROTO_ERR_MISSING);
+    orders_destroy(q);
+}
+
+TEST(McRecvTest, ReceivesBurstInBatches) {
+    int rx = socket(AF_INET, SOCK_DGRAM, 0);
+    int tx = socket(AF_INET, SOCK_DGRAM, 0);
+    ASSERT_GE(rx, 0);
+    ASSERT_GE(tx, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ASSERT_EQ(bind(rx, (sockaddr *)&addr, sizeof(addr)), 0);
+    socklen_t alen = sizeof(addr);
+    getsockname(rx, (sockaddr *)&addr, &alen);
+    mcbatch_watch_drops(rx);
+
+    // 10 heartbeats queued before the first receive, batches of 4
+    for (int i = 0; i < 10; ++i) {
+        char id[MAX_ID_LEN], line[MAX_LINE];
+        snprintf(id, sizeof(id), "T%d", i);
+        int n = format_hb(line, sizeof(line), id, 1.0, 2.0, 6000, 0);
+        ASSERT_EQ(sendto(tx, line, (size_t)n, 0, (sockaddr *)&addr, sizeof(addr)), n);
+    }
+
+    McBatch *mb = mcbatch_create(4);
+    ASSERT_NE(mb, nullptr);
+    int seen = 0;
+    while (seen < 10) {
+        int n = mcbatch_recv(mb, rx);
+        ASSERT_GT(n, 0);
+        ASSERT_LE(n, 4);
+        for (int i = 0; i < n; ++i) {
+            size_t len;
+            sockaddr_in src;
+            const char *d = mcbatch_data(mb, i, &len, &src);
+            TruckInfo ti{};
+            time_t ts;
+            ASSERT_EQ(proto_parse_hb_any(d, len, &ti, &ts), PROTO_OK);
+            char want[MAX_ID_LEN];
+            snprintf(want, sizeof(want), "T%d", seen + i);
+            EXPECT_STREQ(ti.id, want);
+            EXPECT_EQ(src.sin_addr.s_addr, htonl(INADDR_LOOPBACK));
+        }
+        seen += n;
+    }
+    EXPECT_EQ(mcbatch_stats(mb)->datagrams, 10u);
+    EXPECT_EQ(mcbatch_stats(mb)->batches, 3u);
+    EXPECT_EQ(mcbatch_stats(mb)->drops, 0u);
+
+    mcbatch_destroy(mb);
+    close(rx);
+    close(tx);
+}
+
+TEST(McRegionTest, AreaCoverHoldsEveryTruckInside) {
+    in_addr single = mcregion_group(0, 31.9, 35.9), g;
+    inet_aton(MC_GROUP, &g);
+    EXPECT_EQ(single.s_addr, g.s_addr);
+
+    // Neighbouring tiles get different groups, the same point the same one
+    double td = 2.0 / 111.32;
+    in_addr a = mcregion_group(2.0, 31.9, 35.9);
+    EXPECT_EQ(a.s_addr, mcregion_group(2.0, 31.9, 35.9).s_addr);
+    EXPECT_NE(a.s_addr, mcregion_group(2.0, 31.9 + td, 35.9).s_addr);
+    EXPECT_NE(a.s_addr, mcregion_group(2.0, 31.9, 35.9 - td).s_addr);
+    EXPECT_EQ(ntohl(a.s_addr) & 0xFFFFFF00u, MC_REGION_BASE);
+
+    std::mt19937 rng(11);
+    std::uniform_real_distribution<double> u(0.0, 1.0);
+    for (int k = 0; k < 200; ++k) {
+        double lat = -50 + 100 * u(rng), lon = -180 + 360 * u(rng), km = 0.5 + 2 * u(rng);
+        in_addr cover[MC_REGION_MAX_JOIN];
+        int n = mcregion_cover(3.0, lat, lon, km, cover, MC_REGION_MAX_JOIN);
+        ASSERT_GT(n, 0);
+        for (int i = 0; i < 50; ++i) {
+            double r = km * std::sqrt(u(rng)) * 0.999, t = 2 * M_PI * u(rng);
+            double plat = lat + r * std::sin(t) / 111.32;
+            double plon = lon + r * std::cos(t) / (111.32 * std::cos(lat * M_PI / 180.0));
+            in_addr pg = mcregion_group(3.0, plat, plon);
+            ASSERT_TRUE(std::any_of(cover, cover + n, [&](in_addr c) { return c.s_addr == pg.s_addr; }))
+                << lat << "," << lon << " r=" << km;
+        }
+    }
+
+    // An area needing more groups than a socket may join is refused
+    in_addr cover[MC_REGION_MAX_JOIN];
+    EXPECT_EQ(mcregion_cover(1.0, 31.9, 35.9, 5.0, cover, MC_REGION_MAX_JOIN), -1);
+}
+
+// Memberships follow the area: only the current tiles' heartbeats arrive
+TEST(McRegionTest, FollowJoinsAndLeavesOverLoopback) {
+    const uint16_t port = 15997;
+    int tx, rx;
+    sockaddr_in dst;
+    ASSERT_EQ(udp_mc_sender(MC_GROUP, port, &tx, &dst), 0);
+    ASSERT_EQ(udp_mc_bind(port, &rx), 0);
+    set_nonblocking(rx);
+    McRegionSub sub;
+    mcregion_sub_init(&sub, rx, 2.0);
+
+    const double lat = 31.9, lon = 35.9, far_lat = 31.9 + 10 * 2.0 / 111.32;
+    auto heard = [&](double plat) {
+        char line[MAX_LINE];
+        int n = format_hb(line, sizeof(line), "T1", plat, lon, 7000, 0);
+        dst.sin_addr = mcregion_group(2.0, plat, lon);
+        sendto(tx, line, (size_t)n, 0, (sockaddr *)&dst, sizeof(dst));
+        usleep(20 * 1000);
+        int got = 0;
+        while (recv(rx, line, sizeof(line), 0) > 0) got++;
+        return got;
+    };
+
+    ASSERT_GT(mcregion_follow(&sub, lat, lon, 1.0), 0);
+    EXPECT_EQ(heard(lat), 1);
+    EXPECT_EQ(heard(far_lat), 0);
+
+    // Same area again changes nothing; then the area moves 20 km north
+    int n = sub.n;
+    EXPECT_EQ(mcregion_follow(&sub, lat, lon, 1.0), n);
+    ASSERT_GT(mcregion_follow(&sub, far_lat, lon, 1.0), 0);
+    EXPECT_EQ(heard(far_lat), 1);
+    EXPECT_EQ(heard(lat), 0);
+
+    close(tx);
+    close(rx);
+}
+
 TEST(GpsTest, MovesOverTime) {
     double lat = 31.956;
     double lon = 35.945;
@@ -64,6 +1417,320 @@ TEST(GpsTest, MovesOverTime) {
     EXPECT_FALSE(lat == lat0 && lon == lon0);
 }
 
+TEST(GpsTest, SameSeedSameTrack) {
+    GpsCtx *a = gps_create(31.956, 35.945, 5.0, 1234);
+    GpsCtx *b = gps_create(31.956, 35.945, 5.0, 1234);
+    GpsCtx *c = gps_create(31.956, 35.945, 5.0, 1235);
+    ASSERT_TRUE(a && b && c);
+    for (int i = 0; i < 100; ++i) {
+        gps_advance(a, 0.3);
+        gps_advance(b, 0.3);
+        gps_advance(c, 0.3);
+    }
+    double la, loa, lb, lob, lc, loc;
+    gps_position(a, &la, &loa);
+    gps_position(b, &lb, &lob);
+    gps_position(c, &lc, &loc);
+    EXPECT_EQ(la, lb);
+    EXPECT_EQ(loa, lob);
+    EXPECT_FALSE(la == lc && loa == loc);
+    gps_destroy(a);
+    gps_destroy(b);
+    gps_destroy(c);
+}
+
+TEST(GpsTest, RouteAndReplayModes) {
+    // Two waypoints 1.11 km apart on a meridian; 36 km/h covers 10 m per second
+    GpsPoint route[] = { {31.95, 35.90}, {31.96, 35.90} };
+    GpsCtx *g = gps_create(31.95, 35.90, 3.0, 1);
+    ASSERT_TRUE(g);
+    ASSERT_EQ(gps_set_route(g, route, 2, 36.0), 0);
+    EXPECT_EQ(gps_mode(g), GPS_ROUTE);
+    double lat, lon;
+    gps_advance(g, 60.0);   // at waypoint 0 already, then 600 m toward waypoint 1
+    gps_position(g, &lat, &lon);
+    EXPECT_NEAR(haversine_km(31.95, 35.90, lat, lon), 0.6, 0.005);
+    gps_advance(g, 100.0);  // 1 km more: past waypoint 1 and ~0.49 km back toward 0
+    gps_position(g, &lat, &lon);
+    EXPECT_NEAR(haversine_km(31.96, 35.90, lat, lon), 0.49, 0.01);
+    EXPECT_DOUBLE_EQ(lon, 35.90);
+
+    GpsPoint track[] = { {1, 2}, {3, 4}, {5, 6} };
+    ASSERT_EQ(gps_set_replay(g, track, 3), 0);
+    for (int i = 0; i < 4; ++i) {
+        gps_advance(g, 0.3);
+        gps_position(g, &lat, &lon);
+        EXPECT_EQ(lat, track[i % 3].lat);
+        EXPECT_EQ(lon, track[i % 3].lon);
+    }
+    gps_destroy(g);
+}
+
+TEST(GpsTest, LoadsPointsFile) {
+    char path[] = "/tmp/jarat_gps_XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+    const char *text = "# route\n31.95,35.90\n\n  31.96 35.91\n";
+    ASSERT_EQ(write(fd, text, strlen(text)), (ssize_t)strlen(text));
+    close(fd);
+    GpsPoint *pts = NULL;
+    size_t n = 0;
+    ASSERT_EQ(gps_load_points(path, &pts, &n), 0);
+    ASSERT_EQ(n, 2u);
+    EXPECT_DOUBLE_EQ(pts[1].lat, 31.96);
+    EXPECT_DOUBLE_EQ(pts[1].lon, 35.91);
+    free(pts);
+
+    FILE *f = fopen(path, "w");
+    fputs("31.95,200\n", f);
+    fclose(f);
+    EXPECT_EQ(gps_load_points(path, &pts, &n), -1);
+    unlink(path);
+}
+
+TEST(GpsTest, ReadersNeverSeeTornPositions) {
+    GpsCtx *g = gps_create(0, 0, 3.0, 1);
+    ASSERT_TRUE(g);
+    std::atomic<bool> done{false};
+    std::thread writer([&] {
+        for (int i = 1; i <= 200000; ++i) gps_set_position(g, i * 1e-4, -i * 1e-4);
+        done = true;
+    });
+    long torn = 0, reads = 0;
+    // At least one read even if the writer finishes first (single core)
+    do {
+        double lat, lon;
+        gps_position(g, &lat, &lon);
+        torn += lat != -lon;
+        reads++;
+    } while (!done);
+    writer.join();
+    EXPECT_EQ(torn, 0);
+    EXPECT_GT(reads, 0);
+    gps_destroy(g);
+}
+
+TEST(HistoTest, QuantilesWithinBucketPrecision) {
+    static Histo a, b;
+    histo_reset(&a);
+    histo_reset(&b);
+    // 1..100000 split over two histograms, as per-thread histograms would be
+    for (uint64_t v = 1; v <= 100000; ++v) histo_record(v % 2 ? &a : &b, v);
+    histo_merge(&a, &b);
+    EXPECT_EQ(a.total, 100000u);
+    EXPECT_EQ(a.min, 1u);
+    EXPECT_EQ(a.max, 100000u);
+    EXPECT_NEAR(histo_mean(&a), 50000.5, 1e-6);
+    const double qs[] = {0.5, 0.9, 0.99, 0.999};
+    for (double q : qs) {
+        double exact = q * 100000;
+        uint64_t got = histo_quantile(&a, q);
+        EXPECT_GE((double)got, exact) << q;
+        EXPECT_LE((double)got, exact * (1.0 + 1.0 / 64)) << q;
+    }
+    EXPECT_EQ(histo_quantile(&a, 1.0), 100000u);
+
+    // Small values are exact
+    histo_reset(&b);
+    for (int i = 0; i < 99; ++i) histo_record(&b, 10);
+    histo_record(&b, 100);
+    EXPECT_EQ(histo_quantile(&b, 0.5), 10u);
+    EXPECT_EQ(histo_quantile(&b, 0.995), 100u);
+}
+
+// ------------------------------------------------------------
+// Scheduler
+// ------------------------------------------------------------
+
+struct SchedProbe {
+    std::vector<int64_t> at_us;    // run start times
+    int work_ms = 0;               // time each run takes
+    static void tick(void *arg) {
+        SchedProbe *p = static_cast<SchedProbe *>(arg);
+        p->at_us.push_back(std::chrono::duration_cast<std::chrono::microseconds>(
+                               std::chrono::steady_clock::now().time_since_epoch()).count());
+        if (p->work_ms) std::this_thread::sleep_for(std::chrono::milliseconds(p->work_ms));
+    }
+};
+
+TEST(SchedulerTest, PeriodsDoNotDriftByTheWorkTime) {
+    Sched *s = sched_create(1);
+    ASSERT_NE(s, nullptr);
+    SchedProbe periodic, once, cancelled;
+    periodic.work_ms = 8;   // a sleep-after-work loop would fall 40% behind
+    int id = sched_add(s, "p", 0, 20, 0, SchedProbe::tick, &periodic);
+    ASSERT_GE(id, 0);
+    ASSERT_GE(sched_add(s, "once", 50, 0, 0, SchedProbe::tick, &once), 0);
+    int gone = sched_add(s, "gone", 100, 10, 0, SchedProbe::tick, &cancelled);
+    ASSERT_EQ(sched_cancel(s, gone), 0);
+    EXPECT_EQ(sched_cancel(s, gone), -1);
+
+    ASSERT_EQ(sched_start(s), 0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1010));
+    sched_stop(s);
+    SchedStats st;
+    ASSERT_EQ(sched_stats(s, id, &st), 0);
+    sched_destroy(s);
+
+    ASSERT_GE(periodic.at_us.size(), 45u);
+    EXPECT_LE(periodic.at_us.size(), 52u);
+    EXPECT_EQ(st.runs, periodic.at_us.size());
+    // Run k starts near k * period after the first, not k * (period + work)
+    int64_t span = periodic.at_us.back() - periodic.at_us.front();
+    EXPECT_NEAR((double)span, (periodic.at_us.size() - 1) * 20000.0, 15000.0);
+    EXPECT_EQ(once.at_us.size(), 1u);
+    EXPECT_TRUE(cancelled.at_us.empty());
+}
+
+TEST(SchedulerTest, JitterStaysInBoundsAndStopIsImmediate) {
+    Sched *s = sched_create(7);
+    ASSERT_NE(s, nullptr);
+    SchedProbe p, idle;
+    ASSERT_GE(sched_add(s, "j", 0, 40, 10, SchedProbe::tick, &p), 0);
+    ASSERT_GE(sched_add(s, "idle", 60000, 60000, 0, SchedProbe::tick, &idle), 0);
+
+    std::thread loop([s] { sched_run(s); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+    auto t0 = std::chrono::steady_clock::now();
+    sched_stop(s);
+    loop.join();
+    auto stop_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                       std::chrono::steady_clock::now() - t0).count();
+    EXPECT_LT(stop_ms, 100);
+
+    ASSERT_GE(p.at_us.size(), 20u);
+    // Each run is within +-10 ms of first + k * 40 ms, and the offsets vary
+    std::vector<int64_t> off;
+    for (size_t k = 0; k < p.at_us.size(); ++k)
+        off.push_back(p.at_us[k] - p.at_us[0] - (int64_t)k * 40000);
+    int64_t lo = *std::min_element(off.begin(), off.end());
+    int64_t hi = *std::max_element(off.begin(), off.end());
+    EXPECT_LE(hi - lo, 20000 + 5000);
+    EXPECT_GT(hi - lo, 2000);
+    EXPECT_TRUE(idle.at_us.empty());
+    sched_destroy(s);
+}
+
+TEST(MetricsTest, PerThreadCountersSumAndRender) {
+    uint64_t before = metrics_counter(MC_PINGS);
+    // Two rounds of threads: the second round reuses the first round's shards
+    for (int round = 0; round < 2; ++round) {
+        std::vector<std::thread> ts;
+        for (int t = 0; t < 4; ++t)
+            ts.emplace_back([] {
+                for (int i = 0; i < 1000; ++i) {
+                    metrics_inc(MC_PINGS);
+                    metrics_observe_ns(MH_PARSE, 500);
+                }
+            });
+        for (auto &t : ts) t.join();
+    }
+    EXPECT_EQ(metrics_counter(MC_PINGS) - before, 8000u);
+
+    metrics_gauge_set(MG_ORDERS_QUEUED, 7);
+    std::vector<char> buf(16384);
+    size_t len = metrics_render(buf.data(), buf.size());
+    std::string text(buf.data(), len);
+    EXPECT_NE(text.find("# TYPE jarat_pings_total counter\n"), std::string::npos);
+    EXPECT_NE(text.find("jarat_pings_total " + std::to_string(metrics_counter(MC_PINGS)) + "\n"),
+              std::string::npos);
+    EXPECT_NE(text.find("jarat_orders_queued 7\n"), std::string::npos);
+    // Every sample is 500 ns: the bucket bound is capped at the recorded max
+    EXPECT_NE(text.find("jarat_parse_seconds{quantile=\"0.5\"} 0.000000500\n"), std::string::npos);
+
+    // Truncated output stays NUL-terminated
+    char small[64];
+    EXPECT_EQ(metrics_render(small, sizeof(small)), sizeof(small) - 1);
+    EXPECT_EQ(strlen(small), sizeof(small) - 1);
+}
+
+TEST(PrngTest, StreamsAreReproducibleAndIndependent) {
+    Prng a, b, c;
+    prng_seed(&a, 42, 7);
+    prng_seed(&b, 42, 7);
+    prng_seed(&c, 42, 8);
+    int same_as_c = 0;
+    for (int i = 0; i < 1000; ++i) {
+        uint64_t x = prng_next(&a);
+        EXPECT_EQ(x, prng_next(&b));
+        same_as_c += x == prng_next(&c);
+    }
+    EXPECT_EQ(same_as_c, 0);
+
+    double sum = 0.0;
+    for (int i = 0; i < 100000; ++i) {
+        double u = prng_double(&a);
+        ASSERT_GE(u, 0.0);
+        ASSERT_LT(u, 1.0);
+        sum += u;
+    }
+    EXPECT_NEAR(sum / 100000, 0.5, 0.01);
+}
+
+namespace {
+
+// Fills the whole reply buffer and ends the connection
+int fill_reply(void *, const char *, char *out, size_t n, int *) {
+    memset(out, 'x', n - 1);
+    out[n - 2] = '\n';
+    return (int)n - 1;
+}
+
+int open_fds() {
+    glob_t g;
+    if (glob("/proc/self/fd/*", 0, NULL, &g) != 0) return -1;
+    int n = (int)g.gl_pathc;
+    globfree(&g);
+    return n;
+}
+
+}  // namespace
+
+TEST(ServerTest, DeadlineClosesPeerThatStopsReading) {
+    const ServerBackend backends[] = {SERVER_EPOLL, SERVER_URING};
+    for (ServerBackend b : backends) {
+        SCOPED_TRACE(server_backend_name(b));
+        // Smallest buffers on both ends, so the one reply cannot be delivered
+        int small = 1;
+        int lfd;
+        ASSERT_EQ(tcp_listen_local(0, 16, &lfd), 0);
+        setsockopt(lfd, SOL_SOCKET, SO_SNDBUF, &small, sizeof(small));
+        struct sockaddr_in addr;
+        socklen_t alen = sizeof(addr);
+        ASSERT_EQ(getsockname(lfd, (struct sockaddr *)&addr, &alen), 0);
+
+        Server *srv = server_create(b, 1, fill_reply);
+        ASSERT_NE(srv, nullptr);
+        ASSERT_EQ(server_add_listener(srv, lfd, nullptr), 0);
+        volatile int running = 1;
+        std::thread th([&] { server_run(srv, &running); });
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));   // epoll fd or ring is open
+        int base = open_fds();
+
+        int s = socket(AF_INET, SOCK_STREAM, 0);
+        setsockopt(s, SOL_SOCKET, SO_RCVBUF, &small, sizeof(small));
+        ASSERT_EQ(connect(s, (struct sockaddr *)&addr, sizeof(addr)), 0);
+        ASSERT_EQ(send(s, "GO\n", 3, 0), 3);
+
+        // The reply that ends the connection is stuck until the IO deadline
+        auto t0 = std::chrono::steady_clock::now();
+        while (open_fds() < base + 2 && std::chrono::steady_clock::now() - t0 < std::chrono::seconds(1))
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        std::this_thread::sleep_for(std::chrono::milliseconds(300));
+        EXPECT_EQ(open_fds(), base + 2);
+        t0 = std::chrono::steady_clock::now();
+        while (open_fds() > base + 1 && std::chrono::steady_clock::now() - t0 < std::chrono::seconds(4))
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        EXPECT_EQ(open_fds(), base + 1);
+
+        running = 0;
+        th.join();
+        close(s);
+        close(lfd);
+        server_destroy(srv);
+    }
+}
+
 int main(int argc, char **argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
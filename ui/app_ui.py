@@ -1,3 +1,4 @@
+import argparse
 import socket
 import struct
 import threading
@@ -12,6 +13,18 @@ MC_PORT = 5000
 DROP_AGE_SEC = 3        # same as in common.h
 HB_INTERVAL_MS = 1000
 
+# Binary heartbeat layout from protocol.h (network byte order)
+HB_BIN_MAGIC = 0xB7
+HB_BIN_HDR = struct.Struct(">BBBBIIiiIHH")   # 28 bytes, id bytes follow
+HB_BIN_MOTION = struct.Struct(">hhH")         # version 2: vn, ve (cm/s), keepalive (s)
+HB_BATCH_MAGIC = 0xB8                         # batch: magic, version, header length, count, records
+
+# Region-sharded groups from mcregion.h
+MC_REGION_BASE = 0xEFFF0100   # 239.255.1.0
+MC_REGION_SIDE = 16           # tiles per torus side; 256 groups
+MC_REGION_MAX_JOIN = 20       # Linux default net.ipv4.igmp_max_memberships
+KM_PER_DEG = 111.32
+
 # Default user location (you can tweak in the UI)
 DEFAULT_USER_LAT = 31.956
 DEFAULT_USER_LON = 35.945
@@ -36,20 +49,80 @@ class TruckInfo:
         self.lon = lon
         self.tcp_port = tcp_port
         self.ip = ip
+        self.keepalive_s = 0    # adaptive trucks: longest gap between heartbeats
         self.last_seen = time.time()
 
     def age_sec(self):
         return time.time() - self.last_seen
 
 
+# ---- Region groups (same math as mcregion.c) ----
+def mc_region_cover(tile_km, lat, lon, radius_km):
+    """Groups covering radius_km around (lat, lon), or None if more than
+    MC_REGION_MAX_JOIN are needed. tile_km <= 0 means the single MC_GROUP."""
+    if tile_km <= 0:
+        return [MC_GROUP]
+    td = tile_km / KM_PER_DEG
+    dlat = radius_km / KM_PER_DEG
+    dlon = radius_km / (KM_PER_DEG * max(math.cos(math.radians(lat)), 0.01))
+    x0, x1 = math.floor((lon - dlon) / td), math.floor((lon + dlon) / td)
+    y0, y1 = math.floor((lat - dlat) / td), math.floor((lat + dlat) / td)
+    x1 = min(x1, x0 + MC_REGION_SIDE - 1)
+    y1 = min(y1, y0 + MC_REGION_SIDE - 1)
+    if (x1 - x0 + 1) * (y1 - y0 + 1) > MC_REGION_MAX_JOIN:
+        return None
+    groups = []
+    for y in range(y0, y1 + 1):
+        for x in range(x0, x1 + 1):
+            idx = (x % MC_REGION_SIDE) + MC_REGION_SIDE * (y % MC_REGION_SIDE)
+            groups.append(socket.inet_ntoa(struct.pack(">I", MC_REGION_BASE + idx)))
+    return groups
+
+
 # ---- Multicast listener thread (HB parsing) ----
 class TruckListener(threading.Thread):
-    def __init__(self, trucks, lock):
+    def __init__(self, trucks, lock, tile_km=0.0, radius_km=5.0, lat=DEFAULT_USER_LAT, lon=DEFAULT_USER_LON):
         super().__init__(daemon=True)
         self.trucks = trucks
         self.lock = lock
         self.running = True
         self.seen_any = False  # for debug/status
+        self.tile_km = tile_km
+        self.radius_km = radius_km
+        self.area = (lat, lon)
+        self.sock = None
+        self.joined = []       # groups currently joined
+        self.join_lock = threading.Lock()
+
+    def describe(self):
+        if self.tile_km <= 0:
+            return f"{MC_GROUP}:{MC_PORT}"
+        return f"{len(self.joined)} tile group(s) within {self.radius_km:g} km, port {MC_PORT}"
+
+    def follow(self, lat, lon):
+        """Moves the memberships to the area around (lat, lon), leaving the
+        groups that dropped out before joining new ones (as mcregion_follow
+        does). Returns False if the area needs too many groups."""
+        with self.join_lock:
+            self.area = (lat, lon)
+            if self.sock is None:
+                return True     # run() joins once the socket is bound
+            want = mc_region_cover(self.tile_km, lat, lon, self.radius_km)
+            if want is None:
+                return False
+            for g in [g for g in self.joined if g not in want]:
+                self._membership(socket.IP_DROP_MEMBERSHIP, g)
+                self.joined.remove(g)
+            for g in want:
+                if g not in self.joined:
+                    self._membership(socket.IP_ADD_MEMBERSHIP, g)
+                    self.joined.append(g)
+            return True
+
+    def _membership(self, opt, group):
+        # More portable membership struct: group + interface
+        mreq = struct.pack("=4s4s", socket.inet_aton(group), socket.inet_aton("0.0.0.0"))
+        self.sock.setsockopt(socket.IPPROTO_IP, opt, mreq)
 
     def run(self):
         # Create UDP socket and join multicast
@@ -63,16 +136,15 @@ class TruckListener(threading.Thread):
             print(f"[UI] ERROR: could not bind UDP socket on port {MC_PORT}: {e}")
             return
 
+        self.sock = sock
         try:
-            # More portable membership struct: group + interface
-            mreq = struct.pack(
-                "=4s4s",
-                socket.inet_aton(MC_GROUP),
-                socket.inet_aton("0.0.0.0"),
-            )
-            sock.setsockopt(socket.IPPROTO_IP, socket.IP_ADD_MEMBERSHIP, mreq)
+            if not self.follow(*self.area):
+                print(f"[UI] ERROR: {self.radius_km:g} km around the user needs more than "
+                      f"{MC_REGION_MAX_JOIN} groups with {self.tile_km:g} km tiles; try a larger --mc-tile-km")
+                sock.close()
+                return
         except OSError as e:
-            print(f"[UI] ERROR: could not join multicast group {MC_GROUP}: {e}")
+            print(f"[UI] ERROR: could not join the heartbeat multicast group(s): {e}")
             sock.close()
             return
 
@@ -83,49 +155,93 @@ class TruckListener(threading.Thread):
             pass  # not fatal
 
         sock.settimeout(1.0)
-        print(f"[UI] Listening for heartbeats on {MC_GROUP}:{MC_PORT} ...")
+        print(f"[UI] Listening for heartbeats on {self.describe()} ...")
 
         while self.running:
             try:
-                data, addr = sock.recvfrom(1024)
+                data, addr = sock.recvfrom(2048)  # room for a heartbeat batch
             except socket.timeout:
                 continue
             except OSError:
                 break
 
-            line = data.decode("utf-8", errors="ignore").strip()
-            if not line.startswith("HB "):
-                continue
-
-            parsed = self.parse_hb(line)
-            if parsed is None:
-                continue
-
-            truck_id, lat, lon, tcp_port = parsed
             ip = addr[0]
-            self.seen_any = True
-            print(f"[UI] HB from {truck_id} @ {ip}:{tcp_port}  lat={lat} lon={lon}")
-
-            with self.lock:
-                t = self.trucks.get(truck_id)
-                if t is None:
-                    self.trucks[truck_id] = TruckInfo(truck_id, lat, lon, tcp_port, ip)
-                else:
-                    t.lat = lat
-                    t.lon = lon
-                    t.tcp_port = tcp_port
-                    t.ip = ip
-                    t.last_seen = time.time()
+            for truck_id, lat, lon, tcp_port, keepalive_s in self.parse_datagram(data):
+                self.seen_any = True
+                print(f"[UI] HB from {truck_id} @ {ip}:{tcp_port}  lat={lat} lon={lon}")
+                self.update(truck_id, lat, lon, tcp_port, keepalive_s, ip)
 
         sock.close()
 
-    def parse_hb(self, line):
+    def update(self, truck_id, lat, lon, tcp_port, keepalive_s, ip):
+        with self.lock:
+            t = self.trucks.get(truck_id)
+            if t is None:
+                t = self.trucks[truck_id] = TruckInfo(truck_id, lat, lon, tcp_port, ip)
+            else:
+                t.lat = lat
+                t.lon = lon
+                t.tcp_port = tcp_port
+                t.ip = ip
+                t.last_seen = time.time()
+            t.keepalive_s = keepalive_s
+
+    def parse_datagram(self, data):
+        # A batch carries many binary heartbeats; anything else carries one
+        if data[:1] != bytes([HB_BATCH_MAGIC]):
+            parsed = self.parse_hb(data)
+            return [parsed] if parsed else []
+        if len(data) < 4:
+            return []
+        _magic, version, hdr_len, count = data[0], data[1], data[2], data[3]
+        if version < 1 or hdr_len < 4:
+            return []
+        out, off = [], hdr_len
+        for _ in range(count):
+            if off + 4 > len(data):
+                return []
+            rec = data[off + 2] + data[off + 3]
+            parsed = self.parse_hb_bin(data[off:off + rec])
+            if parsed is None:
+                return []
+            out.append(parsed)
+            off += rec
+        return out
+
+    def parse_hb(self, data):
+        # Trucks may send text or binary heartbeats; the first byte tells which
+        if data[:1] == bytes([HB_BIN_MAGIC]):
+            return self.parse_hb_bin(data)
+
+        line = data.decode("utf-8", errors="ignore").strip()
+        if not line.startswith("HB "):
+            return None
+        return self.parse_hb_text(line)
+
+    def parse_hb_bin(self, data):
+        if len(data) < HB_BIN_HDR.size:
+            return None
+        (_magic, version, hdr_len, id_len, _id_key, _seq,
+         lat_e7, lon_e7, _ts, tcp, _flags) = HB_BIN_HDR.unpack_from(data)
+        # Newer versions only grow the header; skip fields we do not know
+        if version < 1 or hdr_len < HB_BIN_HDR.size or len(data) < hdr_len + id_len:
+            return None
+        truck_id = data[hdr_len:hdr_len + id_len].decode("utf-8", errors="ignore")
+        if not truck_id or tcp == 0:
+            return None
+        keepalive_s = 0
+        if version >= 2 and hdr_len >= HB_BIN_HDR.size + HB_BIN_MOTION.size:
+            _vn, _ve, keepalive_s = HB_BIN_MOTION.unpack_from(data, HB_BIN_HDR.size)
+        return truck_id, lat_e7 / 1e7, lon_e7 / 1e7, tcp, keepalive_s
+
+    def parse_hb_text(self, line):
         # Expected HB line: HB truck_id=TRK01 lat=.. lon=.. ts=.. tcp=..
         parts = line.split()
         if len(parts) < 5:
             return None
         truck_id = None
         lat = lon = tcp = None
+        keepalive_s = 0
         for p in parts[1:]:
             if p.startswith("truck_id="):
                 truck_id = p[len("truck_id="):]
@@ -135,9 +251,11 @@ class TruckListener(threading.Thread):
                 lon = float(p[len("lon="):])
             elif p.startswith("tcp="):
                 tcp = int(p[len("tcp="):])
+            elif p.startswith("ka="):
+                keepalive_s = int(p[len("ka="):])
         if not truck_id or lat is None or lon is None or tcp is None:
             return None
-        return truck_id, lat, lon, tcp
+        return truck_id, lat, lon, tcp, keepalive_s
 
     def stop(self):
         self.running = False
@@ -194,7 +312,7 @@ def send_ping(truck, user_id, addr, note, timeout_sec=2.0):
 
 # ---- Modern minimal Tkinter UI ----
 class App:
-    def __init__(self, root):
+    def __init__(self, root, tile_km=0.0, radius_km=5.0):
         self.root = root
         self.root.title("Truck Dispatcher")
         self.root.geometry("780x520")
@@ -337,7 +455,7 @@ class App:
         self.status.pack(fill="x", pady=(8, 0))
 
         # Start multicast listener
-        self.listener = TruckListener(self.trucks, self.trucks_lock)
+        self.listener = TruckListener(self.trucks, self.trucks_lock, tile_km, radius_km)
         self.listener.start()
 
         # Periodic refresh
@@ -461,7 +579,8 @@ class App:
         # prune stale trucks
         with self.trucks_lock:
             to_delete = [
-                tid for tid, t in self.trucks.items() if now - t.last_seen > DROP_AGE_SEC
+                tid for tid, t in self.trucks.items()
+                if now - t.last_seen > DROP_AGE_SEC + t.keepalive_s
             ]
             for tid in to_delete:
                 del self.trucks[tid]
@@ -471,7 +590,7 @@ class App:
         # Update status if no heartbeats at all yet
         if not self.listener.seen_any:
             self.status.configure(
-                text=f"Waiting for heartbeats on {MC_GROUP}:{MC_PORT}… "
+                text=f"Waiting for heartbeats on {self.listener.describe()}… "
                      f"(is the truck binary running in the same environment?)"
             )
 
@@ -481,6 +600,13 @@ class App:
         lat, lon = self.get_user_coords()
         if lat is None:
             return
+        # Sharded groups: only the tiles around the user location are heard
+        follow_error = None
+        try:
+            if not self.listener.follow(lat, lon):
+                follow_error = "Too many tile groups around this location; use a larger --mc-tile-km."
+        except OSError as e:
+            follow_error = f"Could not join the tile groups: {e}"
 
         # 🔹 Remember selection before refreshing
         selected = self.tree.selection()
@@ -519,7 +645,9 @@ class App:
             self.tree.selection_set(selected_id)
             self.tree.focus(selected_id)
 
-        if items:
+        if follow_error:
+            self.status.configure(text=follow_error)
+        elif items:
             self.status.configure(
                 text=f"{len(items)} truck(s) online · updated just now"
             )
@@ -585,6 +713,13 @@ class App:
 
 
 # No __name__ guard to avoid your earlier "__name__ is not defined" issue
+ap = argparse.ArgumentParser(description="Truck Dispatcher UI")
+ap.add_argument("--mc-tile-km", type=float, default=0.0,
+                help="join only the map tile groups around the user (same as the client); 0 = " + MC_GROUP)
+ap.add_argument("--mc-radius-km", type=float, default=5.0,
+                help="area of interest around the user location with --mc-tile-km")
+args = ap.parse_args()
+
 root = tk.Tk()
-app = App(root)
+app = App(root, args.mc_tile_km, args.mc_radius_km)
 root.mainloop()